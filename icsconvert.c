@@ -0,0 +1,577 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright (C) 2000-2013, 2016 Cris Luengo and others
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : icsconvert.c
+ *
+ * Command-line tool that rewrites ICS files with a different version,
+ * compression method or temporal delta coding:
+ *
+ *   icsconvert [options] input.ics output.ics
+ *   icsconvert [options] -d outdir input.ics [input.ics ...]
+ *
+ * All metadata (including history and sensor parameters) is copied with
+ * IcsCopyMetadata(). The image data is streamed from the input to the output
+ * through IcsSetDataSource(), so that uncompressed and gzip-compressed output
+ * is written without holding the image in memory.
+ *
+ * Many files are converted concurrently. Each worker thread has its own queue
+ * of files, and takes work from the other queues when its own is empty. The
+ * memory cap (-m) limits the sum of the estimated memory use of the files
+ * being converted at any one time; a file that needs more than the cap is
+ * converted when nothing else is running.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "libics_ll.h"
+#include "libics_conf.h"
+
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
+
+
+/* Estimated memory needed to stream a file: zlib state and block buffers. */
+#define ICSCONVERT_STREAM_COST (1024 * 1024)
+
+
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+typedef CRITICAL_SECTION   Ics_Mutex;
+typedef CONDITION_VARIABLE Ics_Cond;
+#define icsMutexInit(m)    InitializeCriticalSection(m)
+#define icsMutexDestroy(m) DeleteCriticalSection(m)
+#define icsLock(m)         EnterCriticalSection(m)
+#define icsUnlock(m)       LeaveCriticalSection(m)
+#define icsCondInit(c)     InitializeConditionVariable(c)
+#define icsCondDestroy(c)
+#define icsCondWait(c, m)  SleepConditionVariableCS(c, m, INFINITE)
+#define icsCondWakeAll(c)  WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t    Ics_Mutex;
+typedef pthread_cond_t     Ics_Cond;
+#define icsMutexInit(m)    pthread_mutex_init(m, NULL)
+#define icsMutexDestroy(m) pthread_mutex_destroy(m)
+#define icsLock(m)         pthread_mutex_lock(m)
+#define icsUnlock(m)       pthread_mutex_unlock(m)
+#define icsCondInit(c)     pthread_cond_init(c, NULL)
+#define icsCondDestroy(c)  pthread_cond_destroy(c)
+#define icsCondWait(c, m)  pthread_cond_wait(c, m)
+#define icsCondWakeAll(c)  pthread_cond_broadcast(c)
+#endif
+#else
+typedef int Ics_Mutex;
+typedef int Ics_Cond;
+#define icsMutexInit(m)
+#define icsMutexDestroy(m)
+#define icsLock(m)
+#define icsUnlock(m)
+#define icsCondInit(c)
+#define icsCondDestroy(c)
+#define icsCondWait(c, m)
+#define icsCondWakeAll(c)
+#endif
+
+
+/* Conversion options. */
+typedef struct {
+    int              version;     /* 1 or 2 */
+    int              compression; /* Ics_Compression, or -1 to keep */
+    int              level;
+    long             keyInterval; /* temporal delta coding, -1 to keep off */
+    int              nThreads;
+    size_t           memoryCap;   /* in bytes, 0 for no limit */
+    int              quiet;
+} Ics_ConvertOptions;
+
+/* One file to convert. */
+typedef struct {
+    const char      *input;
+    char             output[ICS_MAXPATHLEN];
+} Ics_ConvertJob;
+
+/* A worker's queue of job indices; the owner takes from the back, other
+   workers steal from the front. */
+typedef struct {
+    size_t          *jobs;
+    size_t           front;
+    size_t           back;
+    Ics_Mutex        lock;
+} Ics_ConvertQueue;
+
+/* State shared by all workers. */
+typedef struct {
+    const Ics_ConvertOptions *opt;
+    Ics_ConvertJob           *jobs;
+    Ics_ConvertQueue         *queues;
+    int                       nQueues;
+    size_t                    memoryUsed;
+    Ics_Mutex                 memoryLock;
+    Ics_Cond                  memoryFreed;
+    Ics_Mutex                 outputLock;
+    int                       nFailed;
+} Ics_ConvertPool;
+
+typedef struct {
+    Ics_ConvertPool *pool;
+    int              id;
+} Ics_ConvertWorker;
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: icsconvert [options] input.ics output.ics\n"
+            "       icsconvert [options] -d outdir input.ics ...\n"
+            "Options:\n"
+            "  -v 1|2      ICS version of the output (default 2)\n"
+            "  -c method   compression: none, gzip, loco or fpred\n"
+            "              (default: that of the input)\n"
+            "  -l level    compression level (default 6)\n"
+            "  -t n        delta code along time, keyframe every n frames\n"
+            "  -j n        number of files converted concurrently\n"
+            "              (default: number of processors)\n"
+            "  -m MB       memory cap for all concurrent conversions\n"
+            "  -q          do not report each file\n");
+    exit(2);
+}
+
+
+static int numProcessors(void)
+{
+#ifdef ICS_THREADS
+    int n;
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    n = (int)info.dwNumberOfProcessors;
+#else
+    n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return n > 0 ? n : 1;
+#else
+    return 1;
+#endif
+}
+
+
+/* Data source for the output file: the next block of the input file. */
+static Ics_Error readInputBlock(void   *userData,
+                                void   *dest,
+                                size_t  n)
+{
+    return IcsGetDataBlock((ICS*)userData, dest, n);
+}
+
+
+/* Memory a conversion is expected to need. */
+static size_t estimateMemory(const ICS                *in,
+                             Ics_Compression           compression,
+                             const Ics_ConvertOptions *opt)
+{
+    if (opt->keyInterval < 0 &&
+        (compression == IcsCompr_uncompressed ||
+         compression == IcsCompr_gzip || compression == IcsCompr_compress)) {
+        return ICSCONVERT_STREAM_COST;
+    }
+        /* The image, and the coded output */
+    return 2 * IcsGetDataSize(in) + ICSCONVERT_STREAM_COST;
+}
+
+
+static void acquireMemory(Ics_ConvertPool *pool,
+                          size_t           cost)
+{
+    if (pool->opt->memoryCap == 0) return;
+    icsLock(&pool->memoryLock);
+    while (pool->memoryUsed > 0 &&
+           pool->memoryUsed + cost > pool->opt->memoryCap) {
+        icsCondWait(&pool->memoryFreed, &pool->memoryLock);
+    }
+    pool->memoryUsed += cost;
+    icsUnlock(&pool->memoryLock);
+}
+
+
+static void releaseMemory(Ics_ConvertPool *pool,
+                          size_t           cost)
+{
+    if (pool->opt->memoryCap == 0) return;
+    icsLock(&pool->memoryLock);
+    pool->memoryUsed -= cost;
+    icsCondWakeAll(&pool->memoryFreed);
+    icsUnlock(&pool->memoryLock);
+}
+
+
+static void removeOutput(const char *name,
+                         int         version)
+{
+    char idsName[ICS_MAXPATHLEN];
+
+
+    remove(name);
+    if (version == 1) {
+        IcsGetIdsName(idsName, name);
+        remove(idsName);
+    }
+}
+
+
+/* Convert one file. Returns the first error; *stage says what failed. */
+static Ics_Error convertFile(Ics_ConvertPool      *pool,
+                             const Ics_ConvertJob *job,
+                             const char          **stage)
+{
+    const Ics_ConvertOptions *opt = pool->opt;
+    Ics_Error                 error;
+    Ics_Compression           compression;
+    ICS                      *in, *out;
+    size_t                    cost;
+
+
+    *stage = "opening input";
+    error = IcsOpen(&in, job->input, "r");
+    if (error) return error;
+    compression = opt->compression < 0 ? in->compression
+                                       : (Ics_Compression)opt->compression;
+    cost = estimateMemory(in, compression, opt);
+    acquireMemory(pool, cost);
+
+    *stage = "opening output";
+    error = IcsOpen(&out, job->output, opt->version == 1 ? "w1" : "w2");
+    if (!error) {
+        *stage = "copying metadata";
+        error = IcsCopyMetadata(out, in);
+        if (!error) {
+            *stage = "setting options";
+            error = IcsSetCompression(out, compression, opt->level);
+        }
+        if (!error && opt->keyInterval >= 0) {
+            error = IcsSetTemporalDelta(out, (size_t)opt->keyInterval);
+        }
+        if (!error) error = IcsSetDataSource(out, readInputBlock, in);
+        if (error) {
+            IcsClose(out);
+        } else {
+            *stage = "writing output";
+            error = IcsClose(out);
+        }
+        if (error && error != IcsErr_FSizeConflict) {
+                /* Don't leave a broken file behind */
+            removeOutput(job->output, opt->version);
+        }
+    }
+    releaseMemory(pool, cost);
+    if (error) {
+        IcsClose(in);
+    } else {
+        *stage = "closing input";
+        error = IcsClose(in);
+    }
+    return error;
+}
+
+
+/* Take the next job: from the back of our own queue, or from the front of
+   another worker's queue. Returns 0 when there is no work left. */
+static int nextJob(Ics_ConvertPool *pool,
+                   int              id,
+                   size_t          *job)
+{
+    Ics_ConvertQueue *q;
+    int               i, found = 0;
+
+
+    q = pool->queues + id;
+    icsLock(&q->lock);
+    if (q->back > q->front) {
+        *job = q->jobs[--q->back];
+        found = 1;
+    }
+    icsUnlock(&q->lock);
+    for (i = 1; !found && i < pool->nQueues; i++) {
+        q = pool->queues + (id + i) % pool->nQueues;
+        icsLock(&q->lock);
+        if (q->back > q->front) {
+            *job = q->jobs[q->front++];
+            found = 1;
+        }
+        icsUnlock(&q->lock);
+    }
+    return found;
+}
+
+
+static void runWorker(Ics_ConvertWorker *worker)
+{
+    Ics_ConvertPool *pool = worker->pool;
+    Ics_Error        error;
+    const char      *stage;
+    size_t           i;
+
+
+    while (nextJob(pool, worker->id, &i)) {
+        error = convertFile(pool, pool->jobs + i, &stage);
+        icsLock(&pool->outputLock);
+        if (error != IcsErr_Ok && error != IcsErr_FSizeConflict) {
+            fprintf(stderr, "icsconvert: %s: %s while %s\n",
+                    pool->jobs[i].input, IcsGetErrorText(error), stage);
+            pool->nFailed++;
+        } else if (!pool->opt->quiet) {
+            printf("%s -> %s\n", pool->jobs[i].input, pool->jobs[i].output);
+        }
+        icsUnlock(&pool->outputLock);
+    }
+}
+
+
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+static unsigned __stdcall workerMain(void *arg)
+{
+    runWorker((Ics_ConvertWorker*)arg);
+    return 0;
+}
+#else
+static void *workerMain(void *arg)
+{
+    runWorker((Ics_ConvertWorker*)arg);
+    return NULL;
+}
+#endif
+#endif
+
+
+/* Run all jobs on nThreads workers (this thread is one of them). */
+static int runPool(const Ics_ConvertOptions *opt,
+                   Ics_ConvertJob           *jobs,
+                   size_t                    nJobs)
+{
+    Ics_ConvertPool    pool;
+    Ics_ConvertWorker *workers;
+    size_t            *order;
+    size_t             i;
+    int                w, nWorkers = opt->nThreads;
+#ifdef ICS_THREADS
+    int                started = 0;
+#if defined(_WIN32)
+    HANDLE            *threads;
+#else
+    pthread_t         *threads;
+#endif
+#endif
+
+
+#ifndef ICS_THREADS
+    nWorkers = 1;
+#endif
+    if ((size_t)nWorkers > nJobs) nWorkers = (int)nJobs;
+    if (nWorkers < 1) nWorkers = 1;
+    pool.opt = opt;
+    pool.jobs = jobs;
+    pool.nQueues = nWorkers;
+    pool.memoryUsed = 0;
+    pool.nFailed = 0;
+    pool.queues = malloc((size_t)nWorkers * sizeof(Ics_ConvertQueue));
+    workers = malloc((size_t)nWorkers * sizeof(Ics_ConvertWorker));
+    order = malloc(nJobs * sizeof(size_t));
+    if (pool.queues == NULL || workers == NULL || order == NULL) {
+        fprintf(stderr, "icsconvert: %s\n", IcsGetErrorText(IcsErr_Alloc));
+        exit(1);
+    }
+    icsMutexInit(&pool.memoryLock);
+    icsCondInit(&pool.memoryFreed);
+    icsMutexInit(&pool.outputLock);
+
+        /* Each worker starts with a contiguous share of the jobs */
+    for (i = 0; i < nJobs; i++) order[i] = i;
+    for (w = 0; w < nWorkers; w++) {
+        pool.queues[w].jobs = order;
+        pool.queues[w].front = nJobs * (size_t)w / (size_t)nWorkers;
+        pool.queues[w].back = nJobs * (size_t)(w + 1) / (size_t)nWorkers;
+        icsMutexInit(&pool.queues[w].lock);
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+
+#ifdef ICS_THREADS
+    threads = malloc((size_t)nWorkers * sizeof(*threads));
+    if (threads != NULL) {
+        for (w = 1; w < nWorkers; w++) {
+#if defined(_WIN32)
+            threads[started] = (HANDLE)_beginthreadex(NULL, 0, workerMain,
+                                                      workers + w, 0, NULL);
+            if (threads[started] != 0) started++;
+#else
+            if (pthread_create(threads + started, NULL, workerMain,
+                               workers + w) == 0) {
+                started++;
+            }
+#endif
+        }
+    }
+#endif
+        /* Work stealing makes sure the jobs of workers that could not be
+           started are done by the others */
+    runWorker(workers);
+#ifdef ICS_THREADS
+    for (w = 0; w < started; w++) {
+#if defined(_WIN32)
+        WaitForSingleObject(threads[w], INFINITE);
+        CloseHandle(threads[w]);
+#else
+        pthread_join(threads[w], NULL);
+#endif
+    }
+    free(threads);
+#endif
+
+    for (w = 0; w < nWorkers; w++) {
+        icsMutexDestroy(&pool.queues[w].lock);
+    }
+    icsMutexDestroy(&pool.outputLock);
+    icsCondDestroy(&pool.memoryFreed);
+    icsMutexDestroy(&pool.memoryLock);
+    free(order);
+    free(workers);
+    free(pool.queues);
+    return pool.nFailed;
+}
+
+
+/* outdir + the file name part of input. */
+static void makeOutputName(char       *dest,
+                           const char *outDir,
+                           const char *input)
+{
+    const char *name = input, *p;
+    size_t      len;
+
+
+    for (p = input; *p; p++) {
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    len = strlen(outDir);
+    if (len > 0 && (outDir[len - 1] == '/' || outDir[len - 1] == '\\')) {
+        len--;
+    }
+    if (len + strlen(name) + 2 > ICS_MAXPATHLEN) {
+        fprintf(stderr, "icsconvert: %s: %s\n", input,
+                IcsGetErrorText(IcsErr_LineOverflow));
+        exit(2);
+    }
+    sprintf(dest, "%.*s/%s", (int)len, outDir, name);
+}
+
+
+int main(int         argc,
+         const char *argv[])
+{
+    Ics_ConvertOptions  opt;
+    Ics_ConvertJob     *jobs;
+    const char         *outDir = NULL;
+    size_t              nJobs, i;
+    int                 a, nFailed;
+
+
+    opt.version = 2;
+    opt.compression = -1;
+    opt.level = 6;
+    opt.keyInterval = -1;
+    opt.nThreads = numProcessors();
+    opt.memoryCap = 0;
+    opt.quiet = 0;
+
+    for (a = 1; a < argc && argv[a][0] == '-' && argv[a][1] != '\0'; a++) {
+        const char *arg = argv[a];
+        if (!strcmp(arg, "-q")) {
+            opt.quiet = 1;
+            continue;
+        }
+        if (a + 1 >= argc) usage();
+        if (!strcmp(arg, "-v")) {
+            opt.version = atoi(argv[++a]);
+            if (opt.version != 1 && opt.version != 2) usage();
+        } else if (!strcmp(arg, "-c")) {
+            const char *m = argv[++a];
+            if (!strcmp(m, "none")) opt.compression = IcsCompr_uncompressed;
+            else if (!strcmp(m, "gzip")) opt.compression = IcsCompr_gzip;
+            else if (!strcmp(m, "loco")) opt.compression = IcsCompr_loco;
+            else if (!strcmp(m, "fpred")) opt.compression = IcsCompr_fpred;
+            else usage();
+        } else if (!strcmp(arg, "-l")) {
+            opt.level = atoi(argv[++a]);
+        } else if (!strcmp(arg, "-t")) {
+            opt.keyInterval = atol(argv[++a]);
+            if (opt.keyInterval < 0) usage();
+        } else if (!strcmp(arg, "-j")) {
+            opt.nThreads = atoi(argv[++a]);
+            if (opt.nThreads < 1) usage();
+        } else if (!strcmp(arg, "-m")) {
+            opt.memoryCap = (size_t)atol(argv[++a]) * 1024 * 1024;
+        } else if (!strcmp(arg, "-d")) {
+            outDir = argv[++a];
+        } else {
+            usage();
+        }
+    }
+
+    if (outDir == NULL) {
+        if (argc - a != 2) usage();
+        nJobs = 1;
+    } else {
+        if (argc - a < 1) usage();
+        nJobs = (size_t)(argc - a);
+    }
+    jobs = malloc(nJobs * sizeof(Ics_ConvertJob));
+    if (jobs == NULL) {
+        fprintf(stderr, "icsconvert: %s\n", IcsGetErrorText(IcsErr_Alloc));
+        return 1;
+    }
+    for (i = 0; i < nJobs; i++) {
+        jobs[i].input = argv[a + (int)i];
+        if (outDir == NULL) {
+            if (strlen(argv[a + 1]) >= ICS_MAXPATHLEN) usage();
+            strcpy(jobs[i].output, argv[a + 1]);
+        } else {
+            makeOutputName(jobs[i].output, outDir, jobs[i].input);
+        }
+        if (!strcmp(jobs[i].input, jobs[i].output)) {
+            fprintf(stderr, "icsconvert: %s: cannot convert a file onto "
+                    "itself\n", jobs[i].input);
+            return 2;
+        }
+    }
+
+    nFailed = runPool(&opt, jobs, nJobs);
+    free(jobs);
+    return nFailed ? 1 : 0;
+}
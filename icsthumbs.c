@@ -0,0 +1,253 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright (C) 2000-2013, 2016 Cris Luengo and others
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : icsthumbs.c
+ *
+ * Command-line tool that makes fixed-size 8-bit thumbnails of many ICS files:
+ *
+ *   icsthumbs [options] -o thumbs.pgm input.ics [input.ics ...]
+ *   icsthumbs [options] -o thumbs.pgm -f list.txt
+ *
+ * The thumbnails are made with IcsLoadThumbnails(), which processes the files
+ * concurrently, and are packed into a single binary PGM image, one below the
+ * other in the order of the input list: thumbnail i starts at byte
+ * header + i * width * height. Thumbnails of files that could not be read are
+ * left black.
+ *
+ * The files are handed to IcsLoadThumbnails() in batches of ICS_THUMB_BATCH.
+ * The thumbnails of a batch arrive out of order and are collected in a
+ * buffer, which is written when the batch is done. The output is thus written
+ * sequentially and can be a pipe, and the memory used does not grow with the
+ * number of files.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+
+
+/* Number of files handed to IcsLoadThumbnails() at once. */
+#define ICS_THUMB_BATCH 256
+
+
+/* State shared by the callbacks. Each thumbnail of a batch has its own slot,
+   so that the callbacks need no lock. */
+typedef struct {
+    size_t             thumbSize;  /* width * height */
+    unsigned char     *thumbs;     /* the thumbnails of the batch */
+    Ics_Error         *errors;     /* the error of each file of the batch */
+    char              *failed;     /* set if there is no thumbnail */
+} Ics_ThumbWriter;
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: icsthumbs [options] -o output.pgm input.ics ...\n"
+            "       icsthumbs [options] -o output.pgm -f list\n"
+            "Options:\n"
+            "  -o file     packed output image (PGM), - for stdout\n"
+            "  -f list     read the input names from a file, one per line,\n"
+            "              - for stdin\n"
+            "  -s WxH      thumbnail size (default 128x128)\n"
+            "  -p n        plane to show (default 0)\n"
+            "  -q          do not report each file\n");
+    exit(2);
+}
+
+
+/* Read file names from a list, one per line. */
+static char **readList(const char *listName,
+                       size_t     *n)
+{
+    FILE   *fp;
+    char    line[ICS_MAXPATHLEN];
+    char  **names = NULL;
+    char  **tmp;
+    size_t  len, capacity = 0;
+
+
+    *n = 0;
+    fp = strcmp(listName, "-") ? fopen(listName, "r") : stdin;
+    if (fp == NULL) {
+        fprintf(stderr, "icsthumbs: %s: cannot open list\n", listName);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len == 0) continue;
+        if (*n == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            tmp = realloc(names, capacity * sizeof(char*));
+            if (tmp == NULL) break;
+            names = tmp;
+        }
+        names[*n] = malloc(len + 1);
+        if (names[*n] == NULL) break;
+        memcpy(names[*n], line, len + 1);
+        (*n)++;
+    }
+    if (!feof(fp)) {
+        fprintf(stderr, "icsthumbs: %s\n", IcsGetErrorText(IcsErr_Alloc));
+        exit(1);
+    }
+    if (fp != stdin) fclose(fp);
+    return names;
+}
+
+
+/* Receive a thumbnail into its slot; files that could not be read are left
+   black. */
+static Ics_Error storeThumbnail(void                *userData,
+                                size_t               index,
+                                Ics_Error            error,
+                                const unsigned char *thumbnail)
+{
+    Ics_ThumbWriter *w = (Ics_ThumbWriter*)userData;
+    unsigned char   *dest = w->thumbs + index * w->thumbSize;
+
+
+    if (thumbnail != NULL) {
+        memcpy(dest, thumbnail, w->thumbSize);
+    } else {
+        memset(dest, 0, w->thumbSize);
+    }
+    w->errors[index] = error;
+    w->failed[index] = thumbnail == NULL;
+    return IcsErr_Ok;
+}
+
+
+int main(int         argc,
+         const char *argv[])
+{
+    Ics_ThumbWriter     w;
+    const char *const  *inputs;
+    size_t              nInputs;
+    const char         *outName = NULL;
+    const char         *listName = NULL;
+    char              **list = NULL;
+    FILE               *out;
+    size_t              width = 128, height = 128, plane = 0, first, n, i;
+    Ics_Error           error = IcsErr_Ok;
+    int                 a, quiet = 0, nFailed = 0;
+
+
+    for (a = 1; a < argc && argv[a][0] == '-' && argv[a][1] != '\0'; a++) {
+        const char *arg = argv[a];
+        if (!strcmp(arg, "-q")) {
+            quiet = 1;
+            continue;
+        }
+        if (a + 1 >= argc) usage();
+        if (!strcmp(arg, "-o")) {
+            outName = argv[++a];
+        } else if (!strcmp(arg, "-f")) {
+            listName = argv[++a];
+        } else if (!strcmp(arg, "-s")) {
+            unsigned long sw, sh;
+            if (sscanf(argv[++a], "%lux%lu", &sw, &sh) != 2 || sw == 0 ||
+                sh == 0) {
+                usage();
+            }
+            width = sw;
+            height = sh;
+        } else if (!strcmp(arg, "-p")) {
+            plane = (size_t)atol(argv[++a]);
+        } else {
+            usage();
+        }
+    }
+    if (outName == NULL) usage();
+    if (listName != NULL) {
+        if (a != argc) usage();
+        list = readList(listName, &nInputs);
+        inputs = (const char *const *)list;
+    } else {
+        if (a == argc) usage();
+        nInputs = (size_t)(argc - a);
+        inputs = argv + a;
+    }
+    if (nInputs == 0) return 0;
+
+    w.thumbSize = width * height;
+    n = nInputs < ICS_THUMB_BATCH ? nInputs : ICS_THUMB_BATCH;
+    w.thumbs = malloc(n * w.thumbSize);
+    w.errors = malloc(n * sizeof(Ics_Error));
+    w.failed = malloc(n);
+    if (w.thumbs == NULL || w.errors == NULL || w.failed == NULL) {
+        fprintf(stderr, "icsthumbs: %s\n", IcsGetErrorText(IcsErr_Alloc));
+        return 1;
+    }
+    out = strcmp(outName, "-") ? fopen(outName, "wb") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "icsthumbs: %s: cannot open output\n", outName);
+        return 1;
+    }
+
+    fprintf(out, "P5\n%lu %lu\n255\n", (unsigned long)width,
+            (unsigned long)(height * nInputs));
+    for (first = 0; first < nInputs && !error; first += n) {
+        n = nInputs - first < ICS_THUMB_BATCH ? nInputs - first
+                                              : ICS_THUMB_BATCH;
+        error = IcsLoadThumbnails(inputs + first, n, plane, width, height,
+                                  storeThumbnail, &w);
+        if (error) break;
+        for (i = 0; i < n; i++) {
+            if (w.errors[i] != IcsErr_Ok) {
+                fprintf(stderr, "icsthumbs: %s: %s\n", inputs[first + i],
+                        IcsGetErrorText(w.errors[i]));
+                if (w.failed[i]) nFailed++;
+            } else if (!quiet) {
+                fprintf(out == stdout ? stderr : stdout, "%s\n",
+                        inputs[first + i]);
+            }
+        }
+        if (fwrite(w.thumbs, w.thumbSize, n, out) != n) {
+            error = IcsErr_FWriteIds;
+        }
+    }
+    if (out != stdout) {
+        if (fclose(out) != 0 && !error) error = IcsErr_FWriteIds;
+    } else if (fflush(out) != 0 && !error) {
+        error = IcsErr_FWriteIds;
+    }
+    if (error) {
+        fprintf(stderr, "icsthumbs: %s: %s\n", outName,
+                IcsGetErrorText(error));
+    }
+
+    if (list != NULL) {
+        for (i = 0; i < nInputs; i++) {
+            free(list[i]);
+        }
+        free(list);
+    }
+    free(w.thumbs);
+    free(w.errors);
+    free(w.failed);
+    return (error || nFailed) ? 1 : 0;
+}
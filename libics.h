@@ -50,7 +50,7 @@ extern "C" {
 #endif
 
 /* Library versioning is in the form major, minor, patch: */
-#define ICSLIB_VERSION "1.6.2" /* also defined in configure.ac */
+#define ICSLIB_VERSION "1.7.0" /* also defined in configure.ac */
 
 #if defined(__WIN32__) && !defined(WIN32)
 #define WIN32
@@ -114,10 +114,20 @@ typedef enum {
 typedef enum {
     IcsCompr_uncompressed = 0, /* No compression                              */
     IcsCompr_compress,         /* Using 'compress' (writing converts to gzip) */
-    IcsCompr_gzip              /* Using zlib (ICS_ZLIB must be defined)       */
+    IcsCompr_gzip,             /* Using zlib (ICS_ZLIB must be defined)       */
+    IcsCompr_loco,             /* Lossless image codec, 8 and 16 bit integers */
+    IcsCompr_fpred             /* Lossless codec for floating-point data      */
 } Ics_Compression;
 
 
+/* How IcsGetBinnedROIData() reduces each bin of samples to one. */
+typedef enum {
+    IcsBin_mean = 0, /* Average, rounded for integer types */
+    IcsBin_max,      /* Largest value                      */
+    IcsBin_min       /* Smallest value                     */
+} Ics_BinMode;
+
+
 /* File modes. */
 typedef enum {
     IcsFileMode_write, /* write mode                                  */
@@ -126,6 +136,14 @@ typedef enum {
 } Ics_FileMode;
 
 
+/* How the files written are made durable, see IcsSetDurability(). */
+typedef enum {
+    IcsDurability_none = 0, /* Leave writing to disk to the operating system */
+    IcsDurability_sync,     /* Flush each file to disk when it is closed     */
+    IcsDurability_group     /* Flush the files closed together in batches    */
+} Ics_Durability;
+
+
 /* Structures that define the image representation. They are only used inside
    the ICS data structure. */
 typedef struct {
@@ -358,6 +376,47 @@ typedef struct _ICS {
 
         /* SCIL_Image compatibility parameter: */
     char                    scilType[ICS_STRLEN_TOKEN];
+
+        /* ICS2: Deduplicating chunk store directory: */
+    char                    dedupStore[ICS_MAXPATHLEN];
+        /* ICS2: Maximum chunk size in the chunk store (writing only): */
+    size_t                  dedupChunkSize;
+        /* ICS2: Directory holding the image data as one file per chunk: */
+    char                    chunkStore[ICS_MAXPATHLEN];
+        /* ICS2: Size of the chunks in the chunk directory: */
+    size_t                  chunkDims[ICS_MAXDIM];
+        /* Dimension along which frames are delta coded, -1 if none: */
+    int                     deltaDim;
+        /* Keyframe interval for the delta coding: */
+    size_t                  deltaKeyInterval;
+        /* Set to 1 to write a zone map with the data (writing only): */
+    int                     writeZoneMap;
+        /* Maximum size of the chunks in the zone map (writing only): */
+    size_t                  zoneChunkSize;
+        /* Set to 1 to write an index of the GZIP stream (writing only): */
+    int                     writeZipIndex;
+        /* Number of planes between the entries of that index: */
+    size_t                  zipIndexPlanes;
+        /* Callback providing the data to write, instead of data: */
+    void*                   dataSource;
+        /* Writable memory map holding the data, see IcsMapData(): */
+    void*                   dataMap;
+        /* Shared execution context, see IcsSetContext(): */
+    void*                   context;
+        /* Frame writer, see IcsStartFrameWriter(): */
+    void*                   frameWriter;
+        /* How the files are made durable (writing only): */
+    Ics_Durability          durability;
+        /* Memory of the internal buffers, see IcsGetMemoryUsage(): */
+    size_t                  memoryInUse;
+    size_t                  memoryPeak;
+        /* Most memory the internal buffers may use, 0 if not limited: */
+    size_t                  memoryLimit;
+        /* Handle also charged for the internal buffers, see
+           IcsSubmitROIRead(): */
+    void*                   memoryOwner;
+        /* Reader doing the asynchronous reads, see IcsSubmitROIRead(): */
+    void*                   asyncReads;
 } ICS;
 
 
@@ -488,6 +547,32 @@ typedef struct {
 ICSEXPORT const char* IcsGetLibVersion(void);
 
 
+/* Returns the name of the instruction set level ("generic", "sse4.2", "avx2",
+   "avx512" or "neon") used by the library's inner loops. It is detected at run
+   time and can be lowered with the ICS_CPU_LEVEL environment variable. */
+ICSEXPORT const char* IcsGetCpuLevel(void);
+
+
+/* Returns the number of NUMA nodes of the machine, 1 if not known. */
+ICSEXPORT int IcsGetNumaNodes(void);
+
+
+/* Set the durability policy of the files opened for writing from here on (see
+   IcsSetDurability()), and the window in milliseconds within which files
+   closed with IcsDurability_group are flushed together. Set window to 0 to use
+   the default of ICS_DURABLE_WINDOW milliseconds. */
+ICSEXPORT Ics_Error IcsSetDefaultDurability(Ics_Durability durability,
+                                            size_t         window);
+
+
+/* Wait until all files closed so far with IcsDurability_group are on disk and
+   visible under their final names. Returns the first error that occurred
+   while flushing files in the background since the previous call. Files still
+   waiting when the program exits normally are flushed by an exit handler,
+   which cannot report errors. */
+ICSEXPORT Ics_Error IcsFlushDurable(void);
+
+
 /* Returns 0 if it is not an ICS file, or the version number if it is.  If
   forcename is non-zero, no extension is appended. */
 ICSEXPORT int IcsVersion(const char *filename,
@@ -504,6 +589,30 @@ ICSEXPORT Ics_Error IcsLoadPreview(const char  *filename,
                                    size_t      *ysize);
 
 
+/* Function that receives the thumbnails made by IcsLoadThumbnails(). index is
+   the position of the file in the list. If the file could not be read, error
+   says why and thumbnail is NULL; a file that is shorter than its header says
+   gives IcsErr_FSizeConflict and a thumbnail. Returning an error stops the
+   batch. */
+typedef Ics_Error (*Ics_ThumbnailFunc)(void                *userData,
+                                       size_t               index,
+                                       Ics_Error            error,
+                                       const unsigned char *thumbnail);
+
+/* Make a thumbnail of width x height uint8 pixels of one plane of each of the
+   n files, as IcsGetThumbnailData() does, and pass it to func. Files are
+   processed concurrently if the library is built with thread support, so func
+   can be called from several threads at once, and not in the order of the
+   list. */
+ICSEXPORT Ics_Error IcsLoadThumbnails(const char *const *filenames,
+                                      size_t             n,
+                                      size_t             planeNumber,
+                                      size_t             width,
+                                      size_t             height,
+                                      Ics_ThumbnailFunc  func,
+                                      void              *userData);
+
+
 /* Open an ICS file for reading (mode = "r") or writing (mode = "w"). When
    writing, append a "2" to the mode string to create an ICS version 2.0
    file. Append an "f" to mode if, when reading, you want to force the file name
@@ -520,6 +629,70 @@ ICSEXPORT Ics_Error IcsOpen(ICS        **ics,
 ICSEXPORT Ics_Error IcsClose(ICS* ics);
 
 
+/* A shared execution context, see IcsNewContext(). */
+typedef struct _Ics_Context Ics_Context;
+
+/* Memory allocator used by a context, see IcsNewContextWithAllocator().
+   allocFunc returns NULL if out of memory. The library never calls them from
+   two threads at once. */
+typedef void* (*Ics_AllocFunc)(void   *userData,
+                               size_t  size);
+typedef void (*Ics_FreeFunc)(void *userData,
+                             void *ptr);
+
+/* Create an execution context that can be shared by several ICS handles, see
+   IcsSetContext(). Parallel loops and asynchronous reads of those handles use
+   at most nThreads threads in total (as many as there are processors if
+   nThreads <= 0), kept alive until the context is freed, and the scratch
+   buffers used for reading and (de)compression are reused instead of being
+   allocated for each call. */
+ICSEXPORT Ics_Error IcsNewContext(Ics_Context **context,
+                                  int           nThreads);
+
+/* As IcsNewContext(), but the memory of the context and its buffers is
+   obtained from allocFunc and freed with freeFunc. */
+ICSEXPORT Ics_Error IcsNewContextWithAllocator(Ics_Context   **context,
+                                               int             nThreads,
+                                               Ics_AllocFunc   allocFunc,
+                                               Ics_FreeFunc    freeFunc,
+                                               void           *userData);
+
+/* Stop the threads of a context and free its memory. All handles using the
+   context must have been closed, and their asynchronous reads finished. */
+ICSEXPORT Ics_Error IcsFreeContext(Ics_Context *context);
+
+/* Let an ICS handle use a context (or none, if context is NULL). The context
+   must remain valid until the handle is closed. Not valid while reading data
+   block by block, nor after reading asynchronously. */
+ICSEXPORT Ics_Error IcsSetContext(ICS         *ics,
+                                  Ics_Context *context);
+
+/* Limit the memory used by the internal buffers of an ICS handle to limit
+   bytes (no limit if 0). Where a smaller buffer will do, such as when
+   converting a plane in IcsGetPreviewData(), the library switches to it rather
+   than exceed the limit; otherwise the call fails with IcsErr_Alloc. */
+ICSEXPORT Ics_Error IcsSetMemoryLimit(ICS    *ics,
+                                      size_t  limit);
+
+/* Retrieve the memory currently used by the internal buffers of an ICS
+   handle, and the most they have used at once. */
+ICSEXPORT Ics_Error IcsGetMemoryUsage(const ICS *ics,
+                                      size_t    *inUse,
+                                      size_t    *peak);
+
+/* Limit the memory a context obtains from its allocator to limit bytes (no
+   limit if 0), as IcsSetMemoryLimit() does for a handle. Its free scratch
+   buffers are released. */
+ICSEXPORT Ics_Error IcsSetContextMemoryLimit(Ics_Context *context,
+                                             size_t       limit);
+
+/* Retrieve the memory a context currently holds, including its free scratch
+   buffers, and the most it has held at once. */
+ICSEXPORT Ics_Error IcsGetContextMemoryUsage(const Ics_Context *context,
+                                             size_t            *inUse,
+                                             size_t            *peak);
+
+
 /* Retrieve the layout of an ICS image. Only valid if reading. */
 ICSEXPORT Ics_Error IcsGetLayout(const ICS    *ics,
                                  Ics_DataType *dt,
@@ -557,6 +730,153 @@ ICSEXPORT Ics_Error IcsGetROIData(ICS          *ics,
                                   size_t        n);
 
 
+/* Read a square region of the image from an ICS file into a sub-block of a
+   memory block. The strides are given in samples for each dimension of the
+   (sub-sampled) region, and can be negative. To use the defaults in one of the
+   parameters, set the pointer to NULL. Only valid if reading. */
+ICSEXPORT Ics_Error IcsGetROIDataWithStrides(ICS             *ics,
+                                             const size_t    *offset,
+                                             const size_t    *size,
+                                             const size_t    *sampling,
+                                             void            *dest,
+                                             const ptrdiff_t *stride,
+                                             int              nDims);
+
+
+/* Read the image data from an ICS file, as IcsGetData() does, placing the
+   memory pages of dest on the NUMA nodes of the threads that will use them.
+   dest is split into nParts partitions of partSizes[i] bytes, the way the
+   caller's threads will divide it; set partSizes to NULL to split it evenly at
+   page boundaries, and nParts to 0 to use one partition per NUMA node. Each
+   partition is first touched, and if the data is uncompressed also read, by a
+   worker of its own (see IcsSetContext()). With bindNodes set, the worker for
+   partition i is bound to node i * nodes / nParts while filling it. Only valid
+   if reading. */
+ICSEXPORT Ics_Error IcsGetDataPartitioned(ICS          *ics,
+                                          void         *dest,
+                                          size_t        n,
+                                          const size_t *partSizes,
+                                          size_t        nParts,
+                                          int           bindNodes);
+
+
+/* Read a square region of the image from an ICS file, reduced by an integer
+   factor in each dimension: each bin of binning[0] x binning[1] x ... samples
+   becomes one sample, computed as given by mode. The output has
+   ceil(size[i]/binning[i]) samples along dimension i, of the same data type as
+   the image; bins at the end of a dimension can be smaller. The data are read
+   in one pass, and only one plane of bins is kept in memory. IcsBin_max and
+   IcsBin_min are not defined for complex data. To use the defaults in one of
+   the parameters, set the pointer to NULL. Only valid if reading. */
+ICSEXPORT Ics_Error IcsGetBinnedROIData(ICS          *ics,
+                                        const size_t *offset,
+                                        const size_t *size,
+                                        const size_t *binning,
+                                        Ics_BinMode   mode,
+                                        void         *dest,
+                                        size_t        n);
+
+
+/* Write a square region of the image to the chunk directory it is stored in
+   (see IcsSetChunkStore()). src holds the region as IcsGetROIData() would
+   return it. Only the chunk files that overlap the region are rewritten, such
+   that independent processes can each write their own chunks at the same
+   time. To use the defaults in one of the parameters, set the pointer to NULL.
+   Only valid if reading or updating a file whose data is in a chunk directory,
+   in the native byte order; the ICS file itself is not changed. */
+ICSEXPORT Ics_Error IcsPutROIData(ICS          *ics,
+                                  const size_t *offset,
+                                  const size_t *size,
+                                  const void   *src,
+                                  size_t        n);
+
+
+/* An asynchronous read, see IcsSubmitROIRead(). */
+typedef struct _Ics_ReadRequest Ics_ReadRequest;
+
+/* Function called when an asynchronous read has finished, with the result of
+   the read. It is called from a worker thread. */
+typedef void (*Ics_ReadCallback)(void      *userData,
+                                 Ics_Error  error);
+
+/* Start reading a square region of the image, as IcsGetROIData() does, and
+   return without waiting for the data. Give a callback, which is called when
+   the read has finished, and/or a pointer to a request handle, to be passed to
+   IcsPollRead() and IcsWaitRead(); a handle is done after its callback has
+   returned. Without handle, the request is freed after the callback. The reads
+   of one ics are done one after the other, in the order they were submitted,
+   so that they finish and call back in that order. The reads of different
+   handles are done in parallel by a pool of worker threads, with as many
+   threads as are used for the tile codecs. The reads use a copy of the ICS
+   structure made at the first one, so ics can be used or closed while reads
+   are in flight, but dest must remain valid until the read has finished.
+   Until ics is closed, the memory used by the reads is counted against its
+   limit (see IcsSetMemoryLimit()). Only valid if reading. */
+ICSEXPORT Ics_Error IcsSubmitROIRead(ICS               *ics,
+                                     const size_t      *offset,
+                                     const size_t      *size,
+                                     const size_t      *sampling,
+                                     void              *dest,
+                                     size_t             n,
+                                     Ics_ReadCallback   callback,
+                                     void              *userData,
+                                     Ics_ReadRequest  **request);
+
+
+/* Set done to 1 if the asynchronous read has finished, 0 otherwise. When done
+   is 1, the data is in dest. */
+ICSEXPORT Ics_Error IcsPollRead(Ics_ReadRequest *request,
+                                int             *done);
+
+
+/* Wait for an asynchronous read to finish, free the request handle and return
+   the result of the read. Must be called once for each handle. */
+ICSEXPORT Ics_Error IcsWaitRead(Ics_ReadRequest *request);
+
+
+/* Image data in a shared memory segment, see IcsPublishROIData() and
+   IcsAttachShared(). The data is stored contiguously, with strides given in
+   samples. */
+typedef struct {
+    Ics_DataType  dataType;              /* Data type of the samples */
+    int           dimensions;            /* Number of dimensions */
+    size_t        dims[ICS_MAXDIM];      /* Size of the data */
+    size_t        offset[ICS_MAXDIM];    /* Position of the data in the image */
+    ptrdiff_t     strides[ICS_MAXDIM];   /* Strides of the data, in samples */
+    const void   *data;                  /* The data, read-only */
+    size_t        dataSize;              /* Size of the data, in bytes */
+    void         *segment;               /* Internal: the mapped segment */
+} Ics_SharedData;
+
+/* Read a square region of the image, as IcsGetROIData() does, into a new
+   shared memory segment called name, so that other processes on the same
+   machine can use the data with IcsAttachShared() without reading the file
+   again. The segment starts with a descriptor of the layout, the data type and
+   the strides of the data. It exists until IcsDetachShared() is called on the
+   handle returned in shared. On POSIX systems name is a shm_open() name; a
+   slash is prepended if it has none, and only processes of the same user can
+   attach to the segment. To use the defaults in one of the parameters, set
+   the pointer to NULL. Only valid if reading. */
+ICSEXPORT Ics_Error IcsPublishROIData(ICS             *ics,
+                                      const size_t    *offset,
+                                      const size_t    *size,
+                                      const char      *name,
+                                      Ics_SharedData **shared);
+
+
+/* Map the data published under name by IcsPublishROIData(), read-only and
+   without copying it. Returns IcsErr_MissingData if the data is still being
+   written. */
+ICSEXPORT Ics_Error IcsAttachShared(const char      *name,
+                                    Ics_SharedData **shared);
+
+
+/* Unmap shared data and free the handle. If the data was published through
+   this handle, the segment is removed; processes that are attached to it keep
+   their view of the data. */
+ICSEXPORT Ics_Error IcsDetachShared(Ics_SharedData *shared);
+
+
 /* Read the image from an ICS file into a sub-block of a memory block. To use
    the defaults in one of the parameters, set the pointer to NULL. Only valid if
    reading. */
@@ -586,6 +906,66 @@ ICSEXPORT Ics_Error IcsGetPreviewData(ICS    *ics,
                                       size_t  planeNumber);
 
 
+/* Read every planeStep-th plane of the image data from an ICS file in a
+   single pass, and convert them to uint8 as IcsGetPreviewData() does. The
+   planes are put side by side in a montage of columns planes wide, filled row
+   by row; with columns set to 1 they simply follow each other. dest must hold
+   columns * dims[0] by ceil(nPlanes / columns) * dims[1] bytes, where nPlanes
+   is the number of planes read; unused cells are set to 0. Each plane is
+   scaled to its own range, unless globalScale is set, in which case all
+   planes are scaled to the range of all planes read. Only valid if
+   reading. */
+ICSEXPORT Ics_Error IcsGetPreviewPlanes(ICS    *ics,
+                                        void   *dest,
+                                        size_t  n,
+                                        size_t  planeStep,
+                                        size_t  columns,
+                                        int     globalScale);
+
+
+/* Read a plane of the image data from an ICS file, scaled down to fit in
+   width x height pixels and converted to uint8. The aspect ratio is kept; the
+   unused border of dest is set to 0. Only a subset of the image lines is read
+   for large images. dest must hold width * height bytes. Only valid if
+   reading. */
+ICSEXPORT Ics_Error IcsGetThumbnailData(ICS    *ics,
+                                        void   *dest,
+                                        size_t  width,
+                                        size_t  height,
+                                        size_t  planeNumber);
+
+
+/* Function that receives the chunks found by IcsForEachZone(). A chunk is a
+   region of the image given by offset and size; it is made of whole image
+   lines within one 2D plane. data holds the chunk, in the data type of the
+   image. Returning an error stops the iteration. */
+typedef Ics_Error (*Ics_ZoneFunc)(void         *userData,
+                                  const size_t *offset,
+                                  const size_t *size,
+                                  const void   *data);
+
+/* Read the chunks of the image data that have values in the range [low,
+   high], and pass them to func in the order of the file. Complex samples are
+   compared by magnitude. If the file has a zone map (see IcsSetZoneMap()),
+   other chunks are not read; otherwise all chunks are read and passed. Only
+   valid if reading. */
+ICSEXPORT Ics_Error IcsForEachZone(ICS          *ics,
+                                   double        low,
+                                   double        high,
+                                   Ics_ZoneFunc  func,
+                                   void         *userData);
+
+
+/* Find the smallest region of the image that contains all samples with a
+   value above threshold. offset and size must have as many elements as the
+   image has dimensions; size is set to all zeros if there are no such samples.
+   Uses the zone map as IcsForEachZone() does. Only valid if reading. */
+ICSEXPORT Ics_Error IcsGetBoundingBox(ICS    *ics,
+                                      double  threshold,
+                                      size_t *offset,
+                                      size_t *size);
+
+
 /* Set the image data for an ICS image. The pointer to this data must be
    accessible until IcsClose has been called. Only valid if writing. */
 ICSEXPORT Ics_Error IcsSetData(ICS        *ics,
@@ -601,6 +981,75 @@ ICSEXPORT Ics_Error IcsSetDataWithStrides(ICS             *ics,
                                           const ptrdiff_t *strides,
                                           int              nDims);
 
+/* Function that provides the image data while writing, see
+   IcsSetDataSource(). It must copy the next n bytes of the image into
+   dest. */
+typedef Ics_Error (*Ics_DataSourceFunc)(void   *userData,
+                                        void   *dest,
+                                        size_t  n);
+
+/* Set a function that provides the image data when the file is written in
+   IcsClose(), instead of a buffer. The data is requested in order, in blocks,
+   so that it can be streamed from another file without being held in memory
+   completely. Uncompressed and gzip-compressed data is written in a single
+   pass; for the other compression methods, for temporal delta coding and for
+   a chunk store, the data is first collected in memory. Only valid if
+   writing. */
+ICSEXPORT Ics_Error IcsSetDataSource(ICS                *ics,
+                                     Ics_DataSourceFunc  func,
+                                     void               *userData);
+
+/* Create the data file at its final size and return in data a writable
+   pointer to the image data in the file, so that the data can be computed in
+   place instead of being copied from a buffer. If strides is not NULL, it is
+   set to the strides of the data, as used by IcsSetDataWithStrides(); it must
+   have as many elements as the image has dimensions. The header is written
+   by this function, so set all metadata before calling it. The data is
+   written to disk and the pointer becomes invalid when IcsClose() is called.
+   Only valid if writing uncompressed data. */
+ICSEXPORT Ics_Error IcsMapData(ICS        *ics,
+                               void      **data,
+                               ptrdiff_t  *strides);
+
+/* An acquisition writer, see IcsStartFrameWriter(). */
+typedef struct _Ics_FrameWriter Ics_FrameWriter;
+
+/* Function called when the writer no longer needs a frame given to
+   IcsPushFrame(). It can be called from any thread. */
+typedef void (*Ics_FrameReleaseFunc)(void       *userData,
+                                     size_t      index,
+                                     const void *frame);
+
+/* Write the image frame by frame, as the frames are produced, possibly by
+   several threads at once. A frame is one sample along the last dimension.
+   The header is written by this function, so set all metadata before calling
+   it. Frames are compressed in parallel (gzip) and written in order by
+   worker threads, using the context of the handle if it has one. At most
+   queueDepth frames are held at a time. IcsClose() waits for the frames to be
+   written and finishes the file. Only valid if writing uncompressed or gzip
+   compressed data, with a library built with thread support. */
+ICSEXPORT Ics_Error IcsStartFrameWriter(ICS              *ics,
+                                        size_t            queueDepth,
+                                        Ics_FrameWriter **writer);
+
+/* Give frame number index to the writer. The frame must remain valid until
+   release(userData, index, frame) is called, after it has been written.
+   Does not wait for any I/O, but waits while the frame is queueDepth or more
+   frames ahead of the oldest frame not yet written. If an error is returned,
+   the frame was not taken. Can be called from several threads at once. */
+ICSEXPORT Ics_Error IcsPushFrame(Ics_FrameWriter      *writer,
+                                 size_t                index,
+                                 const void           *frame,
+                                 Ics_FrameReleaseFunc  release,
+                                 void                 *userData);
+
+/* Copy the layout, the position and labels of each dimension, the pixel
+   representation, the coordinate system, the sensor parameters and the
+   history from src to dest. Only valid if dest is opened for writing and src
+   for reading or updating. */
+ICSEXPORT Ics_Error IcsCopyMetadata(ICS       *dest,
+                                    const ICS *src);
+
 /* Set the image source parameter for an ICS version 2.0 file. Only valid if
    writing. */
 ICSEXPORT Ics_Error IcsSetSource(ICS        *ics,
@@ -608,6 +1057,30 @@ ICSEXPORT Ics_Error IcsSetSource(ICS        *ics,
                                  size_t      offset);
 
 
+/* Write the image data as chunks into a content-addressed store directory
+   instead of into the ICS file. Chunks with identical content, also those
+   written by other ICS files using the same store, are stored only once; the
+   ICS file holds only the list of chunks that make up the image. chunkSize is
+   the maximum size of a chunk in bytes, set it to 0 to use the default. Only
+   valid if writing an ICS version 2.0 file. */
+ICSEXPORT Ics_Error IcsSetDedupStore(ICS        *ics,
+                                     const char *storeDir,
+                                     size_t      chunkSize);
+
+
+/* Write the image data into a directory instead of into the ICS file, as
+   N-dimensional chunks of chunkDims[0] x chunkDims[1] x ... samples, each in
+   its own file named after its chunk coordinates. A chunk size of 0 means the
+   whole dimension; set chunkDims to NULL to use chunks of ICS_CHUNK_EDGE
+   samples along the first three dimensions and of one sample along the
+   others. If no data is given, only the directory is created; chunks that were
+   not written read as zeros, and can be written later with IcsPutROIData().
+   Only valid if writing an ICS version 2.0 file, after IcsSetLayout(). */
+ICSEXPORT Ics_Error IcsSetChunkStore(ICS          *ics,
+                                     const char   *storeDir,
+                                     const size_t *chunkDims);
+
+
 /* Set the compression method and compression parameter. Only valid if
    writing. */
 ICSEXPORT Ics_Error IcsSetCompression(ICS             *ics,
@@ -615,6 +1088,53 @@ ICSEXPORT Ics_Error IcsSetCompression(ICS             *ics,
                                       int              level);
 
 
+/* Store each frame along the time dimension (the dimension with order or
+   label "t" or "time") as the difference with the previous frame, which
+   compresses well if consecutive frames are similar. Every keyInterval-th
+   frame is stored as-is, such that reading a frame requires reading at most
+   keyInterval frames. Set keyInterval to 0 to store all frames as-is (the
+   default). Call after IcsSetLayout() and IcsSetOrder(). Only valid if
+   writing. */
+ICSEXPORT Ics_Error IcsSetTemporalDelta(ICS    *ics,
+                                        size_t  keyInterval);
+
+
+/* Write a zone map next to the ICS file (in a file with the extension
+   ".izm"), recording the smallest and largest value and the number of non-zero
+   samples of each chunk of the image data. IcsForEachZone() and
+   IcsGetBoundingBox() use it to skip chunks without interesting values.
+   chunkSize is the maximum size of a chunk in bytes; set it to 0 to use the
+   tiles of the compression method or the chunks of the chunk store, or a
+   default size otherwise. Only valid if writing. */
+ICSEXPORT Ics_Error IcsSetZoneMap(ICS    *ics,
+                                  size_t  chunkSize);
+
+
+/* Write an index next to the ICS file (in a file with the extension ".izx")
+   of points in the GZIP stream of the image data where decompression can
+   start, one every planes 2D planes (every plane if planes is 0). Reading a
+   plane, a region or a block far into the data then skips to the nearest
+   such point instead of decompressing all the data before it. The stream
+   stays an ordinary GZIP stream, slightly larger. Only used with gzip
+   compression, and not with a chunk store. Only valid if writing. */
+ICSEXPORT Ics_Error IcsSetZipIndex(ICS    *ics,
+                                   size_t  planes);
+
+
+/* Set how the files written are made durable, to survive a crash or power
+   loss. With IcsDurability_none (the default, see IcsSetDefaultDurability())
+   the files are left to the operating system. Otherwise the ICS file is
+   written under a temporary name, and only renamed to its final name after it
+   and the data files have been flushed to disk, so that a visible ICS file
+   always has its data on disk. With IcsDurability_sync this happens in
+   IcsClose(). With IcsDurability_group, IcsClose() returns without waiting,
+   and the files closed within a short window are flushed together by a
+   background thread, at the cost of one flush of the file system; see
+   IcsFlushDurable(). Only valid if writing, before the header is written. */
+ICSEXPORT Ics_Error IcsSetDurability(ICS            *ics,
+                                     Ics_Durability  durability);
+
+
 /* Get the position of the image in the real world: the origin of the first
    pixel, the distances between pixels and the units in which to measure.  If
    you are not interested in one of the parameters, set the pointer to NULL.
@@ -0,0 +1,613 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright (C) 2000-2013, 2016 Cris Luengo and others
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * FILE : libics.hpp
+ *
+ * Header-only C++17 interface on top of the top-level functions in libics.h.
+ *
+ *   ics::file       RAII handle around an ICS*, closed by the destructor.
+ *   ics::view<T>    Typed n-dimensional view over caller memory, with
+ *                   arbitrary (also negative) strides in samples.
+ *   ics::buffer<T>  Move-only owning buffer that hands out views.
+ *   ics::span<T>    Minimal pointer/length pair used for dimensions, ROI
+ *                   offsets, sampling and strides (std::span is C++20).
+ *   ics::dispatch   Switches once on an Ics_DataType and calls a generic
+ *                   callable with the matching C++ type; everything below
+ *                   that is templated and inlined, with no per-element
+ *                   switch.
+ *   ics::kernel     Conversion, preview scaling and reductions.
+ *
+ * Errors are reported by throwing ics::error. The non-fatal codes
+ * IcsErr_FSizeConflict and IcsErr_OutputNotFilled are not thrown.
+ */
+
+
+#ifndef LIBICS_HPP
+#define LIBICS_HPP
+
+#include "libics.h"
+
+#include <array>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+
+namespace ics {
+
+
+/* Errors */
+
+class error : public std::runtime_error {
+public:
+    explicit error(Ics_Error code)
+        : std::runtime_error(IcsGetErrorText(code)), code_(code) {}
+    Ics_Error code() const noexcept { return code_; }
+private:
+    Ics_Error code_;
+};
+
+inline void check(Ics_Error code)
+{
+    if (code != IcsErr_Ok && code != IcsErr_FSizeConflict &&
+        code != IcsErr_OutputNotFilled) {
+        throw error(code);
+    }
+}
+
+
+/* Mapping between C++ types and Ics_DataType */
+
+template <class T> struct data_type_of;
+template <> struct data_type_of<std::uint8_t>
+    : std::integral_constant<Ics_DataType, Ics_uint8> {};
+template <> struct data_type_of<std::int8_t>
+    : std::integral_constant<Ics_DataType, Ics_sint8> {};
+template <> struct data_type_of<std::uint16_t>
+    : std::integral_constant<Ics_DataType, Ics_uint16> {};
+template <> struct data_type_of<std::int16_t>
+    : std::integral_constant<Ics_DataType, Ics_sint16> {};
+template <> struct data_type_of<std::uint32_t>
+    : std::integral_constant<Ics_DataType, Ics_uint32> {};
+template <> struct data_type_of<std::int32_t>
+    : std::integral_constant<Ics_DataType, Ics_sint32> {};
+template <> struct data_type_of<float>
+    : std::integral_constant<Ics_DataType, Ics_real32> {};
+template <> struct data_type_of<double>
+    : std::integral_constant<Ics_DataType, Ics_real64> {};
+template <> struct data_type_of<std::complex<float>>
+    : std::integral_constant<Ics_DataType, Ics_complex32> {};
+template <> struct data_type_of<std::complex<double>>
+    : std::integral_constant<Ics_DataType, Ics_complex64> {};
+
+template <class T>
+inline constexpr Ics_DataType data_type_v =
+    data_type_of<std::remove_cv_t<T>>::value;
+
+template <class T> struct is_complex : std::false_type {};
+template <class T> struct is_complex<std::complex<T>> : std::true_type {};
+template <class T>
+inline constexpr bool is_complex_v = is_complex<std::remove_cv_t<T>>::value;
+
+template <class T> struct type_tag { using type = T; };
+
+/* Call f(type_tag<T>{}) with T the C++ type for dt. This is the only place
+   where the run-time type is looked at. */
+template <class F>
+decltype(auto) dispatch(Ics_DataType dt, F &&f)
+{
+    switch (dt) {
+        case Ics_uint8:     return f(type_tag<std::uint8_t>{});
+        case Ics_sint8:     return f(type_tag<std::int8_t>{});
+        case Ics_uint16:    return f(type_tag<std::uint16_t>{});
+        case Ics_sint16:    return f(type_tag<std::int16_t>{});
+        case Ics_uint32:    return f(type_tag<std::uint32_t>{});
+        case Ics_sint32:    return f(type_tag<std::int32_t>{});
+        case Ics_real32:    return f(type_tag<float>{});
+        case Ics_real64:    return f(type_tag<double>{});
+        case Ics_complex32: return f(type_tag<std::complex<float>>{});
+        case Ics_complex64: return f(type_tag<std::complex<double>>{});
+        default:            throw error(IcsErr_UnknownDataType);
+    }
+}
+
+
+/* span */
+
+template <class T>
+class span {
+public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+
+    constexpr span() noexcept : data_(nullptr), size_(0) {}
+    constexpr span(T *data, std::size_t size) noexcept
+        : data_(data), size_(size) {}
+    template <std::size_t N>
+    constexpr span(T (&array)[N]) noexcept : data_(array), size_(N) {}
+        /* Any contiguous container: std::vector, std::array, std::span... */
+    template <class C, class = std::enable_if_t<
+        !std::is_same_v<std::decay_t<C>, span> &&
+        std::is_convertible_v<decltype(std::declval<C &>().data()), T *>>>
+    constexpr span(C &c) noexcept : data_(c.data()), size_(c.size()) {}
+
+    constexpr T *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+    constexpr T *begin() const noexcept { return data_; }
+    constexpr T *end() const noexcept { return data_ + size_; }
+
+private:
+    T           *data_;
+    std::size_t  size_;
+};
+
+
+/* view */
+
+template <class T>
+class view {
+public:
+    using value_type = std::remove_cv_t<T>;
+
+    view() noexcept = default;
+        /* Contiguous view, first dimension changing fastest as in ICS. */
+    view(T *data, span<const std::size_t> dims) : data_(data)
+    {
+        set_dims(dims);
+        std::ptrdiff_t s = 1;
+        for (std::size_t i = 0; i < rank(); i++) {
+            strides_[i] = s;
+            s *= static_cast<std::ptrdiff_t>(dims_[i]);
+        }
+    }
+        /* Strided view; strides are in samples. */
+    view(T *data, span<const std::size_t> dims,
+         span<const std::ptrdiff_t> strides) : data_(data)
+    {
+        set_dims(dims);
+        if (strides.size() != dims.size()) throw error(IcsErr_IllParameter);
+        for (std::size_t i = 0; i < rank(); i++) strides_[i] = strides[i];
+    }
+        /* view<T> converts to view<const T>. */
+    template <class U, class = std::enable_if_t<
+        std::is_same_v<const U, T> && !std::is_same_v<U, T>>>
+    view(const view<U> &other) noexcept
+        : data_(other.data()), ndims_(other.ndims())
+    {
+        for (std::size_t i = 0; i < rank(); i++) {
+            dims_[i] = other.dim(i);
+            strides_[i] = other.stride(i);
+        }
+    }
+
+    T *data() const noexcept { return data_; }
+    int ndims() const noexcept { return ndims_; }
+    std::size_t dim(std::size_t i) const noexcept { return dims_[i]; }
+    std::ptrdiff_t stride(std::size_t i) const noexcept { return strides_[i]; }
+    span<const std::size_t> dims() const noexcept
+    {
+        return {dims_.data(), rank()};
+    }
+    span<const std::ptrdiff_t> strides() const noexcept
+    {
+        return {strides_.data(), rank()};
+    }
+    std::size_t size() const noexcept
+    {
+        std::size_t n = ndims_ > 0 ? 1 : 0;
+        for (std::size_t i = 0; i < rank(); i++) n *= dims_[i];
+        return n;
+    }
+    bool contiguous() const noexcept
+    {
+        std::ptrdiff_t s = 1;
+        for (std::size_t i = 0; i < rank(); i++) {
+            if (dims_[i] > 1 && strides_[i] != s) return false;
+            s *= static_cast<std::ptrdiff_t>(dims_[i]);
+        }
+        return true;
+    }
+    template <class... I>
+    T &operator()(I... index) const noexcept
+    {
+        static_assert(sizeof...(I) <= ICS_MAXDIM, "too many indices");
+        const std::size_t idx[] = {static_cast<std::size_t>(index)...};
+        std::ptrdiff_t off = 0;
+        for (std::size_t i = 0; i < sizeof...(I); i++) {
+            off += static_cast<std::ptrdiff_t>(idx[i]) * strides_[i];
+        }
+        return data_[off];
+    }
+
+private:
+    std::size_t rank() const noexcept
+    {
+        return static_cast<std::size_t>(ndims_);
+    }
+    void set_dims(span<const std::size_t> dims)
+    {
+        if (dims.size() > ICS_MAXDIM) throw error(IcsErr_TooManyDims);
+        ndims_ = static_cast<int>(dims.size());
+        for (std::size_t i = 0; i < rank(); i++) dims_[i] = dims[i];
+    }
+
+    T                                       *data_ = nullptr;
+    int                                      ndims_ = 0;
+    std::array<std::size_t, ICS_MAXDIM>      dims_{};
+    std::array<std::ptrdiff_t, ICS_MAXDIM>   strides_{};
+};
+
+
+/* buffer */
+
+template <class T>
+class buffer {
+public:
+    buffer() noexcept = default;
+    explicit buffer(span<const std::size_t> dims)
+    {
+        view<T> tmp(nullptr, dims);
+        data_.reset(new T[tmp.size()]);
+        view_ = view<T>(data_.get(), dims);
+    }
+    buffer(buffer &&) noexcept = default;
+    buffer &operator=(buffer &&) noexcept = default;
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    T *data() noexcept { return data_.get(); }
+    const T *data() const noexcept { return data_.get(); }
+    std::size_t size() const noexcept { return view_.size(); }
+    span<const std::size_t> dims() const noexcept { return view_.dims(); }
+    view<T> get_view() noexcept { return view_; }
+    view<const T> get_view() const noexcept { return view_; }
+
+private:
+    std::unique_ptr<T[]> data_;
+    view<T>              view_;
+};
+
+
+namespace detail {
+
+/* Calls f(a, b, n, strideA, strideB) for each line along the first
+   dimension of two views with identical sizes. */
+template <class A, class B, class F>
+inline void for_each_line(const view<A> &a, const view<B> &b, F &&f)
+{
+    if (a.ndims() != b.ndims()) throw error(IcsErr_IllParameter);
+    const std::size_t nd = a.dims().size();
+    for (std::size_t i = 0; i < nd; i++) {
+        if (a.dim(i) != b.dim(i)) throw error(IcsErr_IllParameter);
+    }
+    if (nd == 0 || a.size() == 0) return;
+    std::array<std::size_t, ICS_MAXDIM> pos{};
+    A *pa = a.data();
+    B *pb = b.data();
+    for (;;) {
+        f(pa, pb, a.dim(0), a.stride(0), b.stride(0));
+        std::size_t i = 1;
+        for (; i < nd; i++) {
+            pa += a.stride(i);
+            pb += b.stride(i);
+            if (++pos[i] < a.dim(i)) break;
+            pa -= a.stride(i) * static_cast<std::ptrdiff_t>(a.dim(i));
+            pb -= b.stride(i) * static_cast<std::ptrdiff_t>(b.dim(i));
+            pos[i] = 0;
+        }
+        if (i == nd) return;
+    }
+}
+
+template <class A, class F>
+inline void for_each_line(const view<A> &a, F &&f)
+{
+    for_each_line(a, a, [&f](A *p, A *, std::size_t n, std::ptrdiff_t s,
+                             std::ptrdiff_t) { f(p, n, s); });
+}
+
+template <class Out, class In>
+constexpr Out convert_value(const In &v) noexcept
+{
+    if constexpr (is_complex_v<In> && !is_complex_v<Out>) {
+        return static_cast<Out>(std::abs(v));
+    } else {
+        return static_cast<Out>(v);
+    }
+}
+
+} /* namespace detail */
+
+
+/* Kernels */
+
+namespace kernel {
+
+/* Element-wise conversion; complex values convert to real through their
+   magnitude. */
+template <class In, class Out>
+inline void convert(view<const In> in, view<Out> out)
+{
+    detail::for_each_line(in, out, [](const In *src, Out *dst, std::size_t n,
+                                      std::ptrdiff_t ss, std::ptrdiff_t ds) {
+        if (ss == 1 && ds == 1) {
+            for (std::size_t i = 0; i < n; i++) {
+                dst[i] = detail::convert_value<Out>(src[i]);
+            }
+        } else {
+            for (std::size_t i = 0; i < n; i++, src += ss, dst += ds) {
+                *dst = detail::convert_value<Out>(*src);
+            }
+        }
+    });
+}
+
+/* Minimum and maximum; complex data uses the magnitude. */
+template <class T>
+inline auto minmax(view<const T> in)
+{
+    using R = std::conditional_t<is_complex_v<T>, double, T>;
+    R lo = std::numeric_limits<R>::max();
+    R hi = std::numeric_limits<R>::lowest();
+    detail::for_each_line(in, [&](const T *p, std::size_t n,
+                                  std::ptrdiff_t s) {
+        R l = lo, h = hi;
+        for (std::size_t i = 0; i < n; i++, p += s) {
+            R v = detail::convert_value<R>(*p);
+            l = v < l ? v : l;
+            h = v > h ? v : h;
+        }
+        lo = l;
+        hi = h;
+    });
+    return std::pair<R, R>(lo, hi);
+}
+
+/* Sum of all samples, accumulated in double (or complex<double>). */
+template <class T>
+inline auto sum(view<const T> in)
+{
+    using R = std::conditional_t<is_complex_v<T>, std::complex<double>,
+                                 double>;
+    R total = 0;
+    detail::for_each_line(in, [&](const T *p, std::size_t n,
+                                  std::ptrdiff_t s) {
+        R acc = 0;
+        for (std::size_t i = 0; i < n; i++, p += s) acc += R(*p);
+        total += acc;
+    });
+    return total;
+}
+
+/* Stretch the input to the full uint8 range, as IcsGetPreviewData() does. */
+template <class T>
+inline void preview(view<const T> in, view<std::uint8_t> out)
+{
+    auto [lo, hi] = minmax(in);
+    const double offset = static_cast<double>(lo);
+    const double gain = hi > lo ? 255.0 / (static_cast<double>(hi) - offset)
+                                : 0.0;
+    detail::for_each_line(in, out, [=](const T *src, std::uint8_t *dst,
+                                       std::size_t n, std::ptrdiff_t ss,
+                                       std::ptrdiff_t ds) {
+        for (std::size_t i = 0; i < n; i++, src += ss, dst += ds) {
+            double v = detail::convert_value<double>(*src);
+            *dst = static_cast<std::uint8_t>((v - offset) * gain);
+        }
+    });
+}
+
+} /* namespace kernel */
+
+
+/* file */
+
+struct layout {
+    Ics_DataType                         type = Ics_unknown;
+    int                                  ndims = 0;
+    std::array<std::size_t, ICS_MAXDIM>  dims{};
+
+    span<const std::size_t> shape() const noexcept
+    {
+        return {dims.data(), static_cast<std::size_t>(ndims)};
+    }
+};
+
+class file {
+public:
+    file() noexcept = default;
+        /* mode as for IcsOpen(): "r", "w1", "w2", "rw", ... */
+    file(const char *name, const char *mode)
+    {
+        check(IcsOpen(&ics_, name, mode));
+    }
+    file(const std::string &name, const char *mode)
+        : file(name.c_str(), mode) {}
+    ~file()
+    {
+        if (ics_ != nullptr) IcsClose(ics_);
+    }
+    file(file &&other) noexcept : ics_(std::exchange(other.ics_, nullptr)) {}
+    file &operator=(file &&other) noexcept
+    {
+        if (this != &other) {
+            if (ics_ != nullptr) IcsClose(ics_);
+            ics_ = std::exchange(other.ics_, nullptr);
+        }
+        return *this;
+    }
+    file(const file &) = delete;
+    file &operator=(const file &) = delete;
+
+        /* Close explicitly to see write errors; the destructor ignores them. */
+    void close()
+    {
+        if (ics_ != nullptr) check(IcsClose(std::exchange(ics_, nullptr)));
+    }
+    ICS *get() const noexcept { return ics_; }
+    explicit operator bool() const noexcept { return ics_ != nullptr; }
+
+    ics::layout layout() const
+    {
+        ics::layout l;
+        check(IcsGetLayout(ics_, &l.type, &l.ndims, l.dims.data()));
+        return l;
+    }
+
+        /* Read the region of the image given by offset and sampling, with the
+           size of dest, into dest. T must match the file's data type. Empty
+           offset or sampling mean 0 or 1 in every dimension. */
+    template <class T>
+    void read_roi(view<T> dest, span<const std::size_t> offset = {},
+                  span<const std::size_t> sampling = {})
+    {
+        static_assert(!std::is_const_v<T>, "cannot read into a const view");
+        ics::layout l = layout();
+        if (l.type != data_type_v<T>) throw error(IcsErr_IllParameter);
+        if (dest.ndims() != l.ndims ||
+            (!offset.empty() && offset.size() != dest.dims().size()) ||
+            (!sampling.empty() && sampling.size() != dest.dims().size())) {
+            throw error(IcsErr_IllParameter);
+        }
+        std::array<std::size_t, ICS_MAXDIM> size{};
+        for (std::size_t i = 0; i < dest.dims().size(); i++) {
+            std::size_t s = sampling.empty() ? 1 : sampling[i];
+            size[i] = dest.dim(i) == 0 ? 0 : (dest.dim(i) - 1) * s + 1;
+        }
+        check(IcsGetROIDataWithStrides(ics_,
+                                       offset.empty() ? nullptr : offset.data(),
+                                       size.data(),
+                                       sampling.empty() ? nullptr
+                                                        : sampling.data(),
+                                       dest.data(), dest.strides().data(),
+                                       l.ndims));
+    }
+
+        /* Read the whole image into dest, which must have the image size. */
+    template <class T>
+    void read(view<T> dest)
+    {
+        ics::layout l = layout();
+        if (dest.ndims() != l.ndims) throw error(IcsErr_IllParameter);
+        for (std::size_t i = 0; i < dest.dims().size(); i++) {
+            if (dest.dim(i) != l.dims[i])
+                throw error(IcsErr_IllParameter);
+        }
+        read_roi(dest);
+    }
+
+        /* Read the whole image into a new buffer of the file's type. */
+    template <class T>
+    buffer<T> read()
+    {
+        buffer<T> out(layout().shape());
+        read(out.get_view());
+        return out;
+    }
+
+        /* Read the whole image, converting to T. */
+    template <class T>
+    buffer<T> read_as()
+    {
+        ics::layout l = layout();
+        buffer<T> out(l.shape());
+        if (l.type == data_type_v<T>) {
+            read(out.get_view());
+        } else {
+            dispatch(l.type, [&](auto tag) {
+                using In = typename decltype(tag)::type;
+                buffer<In> tmp(l.shape());
+                read(tmp.get_view());
+                kernel::convert<In, T>(std::as_const(tmp).get_view(),
+                                       out.get_view());
+            });
+        }
+        return out;
+    }
+
+        /* Plane planeNumber (counting over dimensions 2 and up) stretched to
+           uint8, as IcsGetPreviewData(). */
+    buffer<std::uint8_t> preview(std::size_t planeNumber = 0)
+    {
+        ics::layout l = layout();
+        if (l.ndims < 2) throw error(IcsErr_IllParameter);
+        std::array<std::size_t, ICS_MAXDIM> offset{};
+        std::size_t rest = planeNumber;
+        for (std::size_t i = 2; i < l.shape().size(); i++) {
+            offset[i] = rest % l.dims[i];
+            rest /= l.dims[i];
+        }
+        if (rest != 0) throw error(IcsErr_IllegalROI);
+        std::array<std::size_t, ICS_MAXDIM> size{};
+        size.fill(1);
+        size[0] = l.dims[0];
+        size[1] = l.dims[1];
+        span<const std::size_t> shape(size.data(),
+                                      static_cast<std::size_t>(l.ndims));
+        buffer<std::uint8_t> out(shape);
+        dispatch(l.type, [&](auto tag) {
+            using In = typename decltype(tag)::type;
+            buffer<In> plane(shape);
+            read_roi(plane.get_view(),
+                     span<const std::size_t>(offset.data(), shape.size()));
+            kernel::preview<In>(std::as_const(plane).get_view(),
+                                out.get_view());
+        });
+        return out;
+    }
+
+        /* Set the layout and the data to write. The memory must stay valid
+           until the file is closed. */
+    template <class T>
+    void write(view<const T> src,
+               Ics_Compression compression = IcsCompr_uncompressed,
+               int level = 0)
+    {
+        check(IcsSetLayout(ics_, data_type_v<T>, src.ndims(),
+                           src.dims().data()));
+        check(IcsSetDataWithStrides(ics_, src.data(), src.size() * sizeof(T),
+                                    src.strides().data(), src.ndims()));
+        check(IcsSetCompression(ics_, compression, level));
+    }
+    template <class T>
+    void write(view<T> src, Ics_Compression compression = IcsCompr_uncompressed,
+               int level = 0)
+    {
+        write(view<const T>(src), compression, level);
+    }
+
+private:
+    ICS *ics_ = nullptr;
+};
+
+
+} /* namespace ics */
+
+#endif /* LIBICS_HPP */
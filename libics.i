@@ -6,14 +6,403 @@
 #include "libics_sensor.h"
 #include "libics_ll.h"
 #include "libics_test.h"
+#ifdef HAVE_CONFIG_H
 #include "config.h"
+#endif
 #include "libics_conf.h"
 %}
 
+/* IcsOpen returns the new ICS structure: [error, ics] = IcsOpen(name, mode) */
+%typemap(in, numinputs=0) ICS **(ICS *temp = NULL) {
+    $1 = &temp;
+}
+%typemap(argout) ICS ** {
+    $result = SWIG_Python_AppendOutput($result,
+                                       SWIG_NewPointerObj(*$1, $descriptor(ICS *),
+                                                          0));
+}
+
+/* IcsClose is IcsPyClose, which also releases the buffers set with
+   IcsPySetData */
+%ignore IcsClose;
+%rename(IcsClose) IcsPyClose;
+
 %include "libics.h"
  //%include "libics_intern.h"
 %include "libics_sensor.h"
 %include "libics_ll.h"
 %include "libics_test.h"
+#ifdef HAVE_CONFIG_H
 %include "config.h"
+#endif
 %include "libics_conf.h"
+
+
+/*
+ * Data access through the buffer protocol. The image data is read into, and
+ * written from, any object that exports a buffer (such as a NumPy array)
+ * without intermediate copies, and the GIL is released while reading and
+ * writing. The buffer shape is the ICS dimensions in reverse order, so that a
+ * C-ordered array has the first ICS dimension (x) as its last index.
+ */
+%{
+/* Buffers set with IcsPySetData, held until the file is closed. */
+typedef struct IcsPyBuffer {
+    ICS                *ics;
+    Py_buffer           view;
+    ptrdiff_t           strides[ICS_MAXDIM];
+    struct IcsPyBuffer *next;
+} IcsPyBuffer;
+
+static IcsPyBuffer *icsPyBuffers = NULL;
+
+
+/* Find the data type of a buffer from its struct format and item size. */
+static Ics_DataType icsPyDataType(const Py_buffer *view)
+{
+    const char *format = view->format ? view->format : "B";
+    int         one = 1;
+    int         little = *(char*)&one;
+
+
+    switch (*format) {
+        case '@': case '=': case '|':
+            format++;
+            break;
+        case '<':
+            if (!little) return Ics_unknown;
+            format++;
+            break;
+        case '>': case '!':
+            if (little) return Ics_unknown;
+            format++;
+            break;
+    }
+    if (*format == '\0') return Ics_unknown;
+    if (strchr("BHILQN", *format) && format[1] == '\0') {
+        switch (view->itemsize) {
+            case 1: return Ics_uint8;
+            case 2: return Ics_uint16;
+            case 4: return Ics_uint32;
+        }
+    } else if (strchr("bhilqn", *format) && format[1] == '\0') {
+        switch (view->itemsize) {
+            case 1: return Ics_sint8;
+            case 2: return Ics_sint16;
+            case 4: return Ics_sint32;
+        }
+    } else if (strcmp(format, "f") == 0) {
+        return Ics_real32;
+    } else if (strcmp(format, "d") == 0) {
+        return Ics_real64;
+    } else if (strcmp(format, "Zf") == 0) {
+        return Ics_complex32;
+    } else if (strcmp(format, "Zd") == 0) {
+        return Ics_complex64;
+    }
+    return Ics_unknown;
+}
+
+
+/* Convert the byte strides of a buffer to ICS strides in samples, in ICS
+   dimension order. */
+static Ics_Error icsPyStrides(const Py_buffer *view,
+                              ptrdiff_t       *strides)
+{
+    int i;
+
+
+    for (i = 0; i < view->ndim; i++) {
+        if (view->strides[i] % view->itemsize != 0) return IcsErr_IllParameter;
+        strides[view->ndim - 1 - i] = view->strides[i] / view->itemsize;
+    }
+    return IcsErr_Ok;
+}
+
+
+/* Check that a buffer matches the layout of the image. */
+static Ics_Error icsPyCheckLayout(ICS             *ics,
+                                  const Py_buffer *view)
+{
+    int i;
+
+
+    if (icsPyDataType(view) == Ics_unknown
+        || icsPyDataType(view) != ics->imel.dataType)
+        return IcsErr_IllParameter;
+    if (view->ndim != ics->dimensions) return IcsErr_IllParameter;
+    for (i = 0; i < view->ndim; i++) {
+        if ((size_t)view->shape[i] != ics->dim[view->ndim - 1 - i].size)
+            return IcsErr_IllParameter;
+    }
+    return IcsErr_Ok;
+}
+
+
+/* Read a sequence of sizes into an array. */
+static int icsPySizes(PyObject *seq,
+                      int       n,
+                      size_t   *dest)
+{
+    PyObject *fast;
+    int       i;
+
+
+    fast = PySequence_Fast(seq, "expected a sequence of integers");
+    if (fast == NULL) return -1;
+    if (PySequence_Fast_GET_SIZE(fast) != n) {
+        Py_DECREF(fast);
+        PyErr_SetString(PyExc_ValueError, "wrong number of dimensions");
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        dest[i] = PyLong_AsSize_t(PySequence_Fast_GET_ITEM(fast, i));
+        if (PyErr_Occurred()) {
+            Py_DECREF(fast);
+            return -1;
+        }
+    }
+    Py_DECREF(fast);
+    return 0;
+}
+%}
+
+%inline %{
+/* Returns (data type, dimensions) of an image, dimensions in ICS order. */
+PyObject *IcsPyGetLayout(ICS *ics)
+{
+    PyObject *dims;
+    int       i;
+
+
+    if (ics == NULL) {
+        PyErr_SetString(PyExc_ValueError, "no ICS structure");
+        return NULL;
+    }
+    dims = PyTuple_New(ics->dimensions);
+    if (dims == NULL) return NULL;
+    for (i = 0; i < ics->dimensions; i++) {
+        PyTuple_SET_ITEM(dims, i, PyLong_FromSize_t(ics->dim[i].size));
+    }
+    return Py_BuildValue("(iN)", (int)ics->imel.dataType, dims);
+}
+
+
+/* Read the image data into a writable buffer, which can be strided. */
+Ics_Error IcsPyGetData(ICS      *ics,
+                       PyObject *array)
+{
+    Ics_Error error;
+    Py_buffer view;
+    ptrdiff_t strides[ICS_MAXDIM];
+
+
+    if (ics == NULL) return IcsErr_NotValidAction;
+    if (PyObject_GetBuffer(array, &view, PyBUF_WRITABLE | PyBUF_STRIDES
+                           | PyBUF_FORMAT) != 0) {
+        PyErr_Clear();
+        return IcsErr_IllParameter;
+    }
+    error = icsPyCheckLayout(ics, &view);
+    if (!error) {
+        if (PyBuffer_IsContiguous(&view, 'C')) {
+            Py_BEGIN_ALLOW_THREADS
+            error = IcsGetData(ics, view.buf, (size_t)view.len);
+            Py_END_ALLOW_THREADS
+        } else {
+            error = icsPyStrides(&view, strides);
+            if (!error) {
+                Py_BEGIN_ALLOW_THREADS
+                error = IcsGetDataWithStrides(ics, view.buf, 0, strides,
+                                              view.ndim);
+                Py_END_ALLOW_THREADS
+            }
+        }
+    }
+    PyBuffer_Release(&view);
+    return error;
+}
+
+
+/* Read a region of the image data into a C-contiguous writable buffer.
+   offset, size and sampling are sequences in ICS dimension order, or None for
+   the defaults. */
+Ics_Error IcsPyGetROIData(ICS      *ics,
+                          PyObject *offset,
+                          PyObject *size,
+                          PyObject *sampling,
+                          PyObject *array)
+{
+    Ics_Error error;
+    Py_buffer view;
+    size_t    o[ICS_MAXDIM], s[ICS_MAXDIM], d[ICS_MAXDIM];
+
+
+    if (ics == NULL) return IcsErr_NotValidAction;
+    if ((offset != Py_None && icsPySizes(offset, ics->dimensions, o) != 0)
+        || (size != Py_None && icsPySizes(size, ics->dimensions, s) != 0)
+        || (sampling != Py_None
+            && icsPySizes(sampling, ics->dimensions, d) != 0)) {
+        PyErr_Clear();
+        return IcsErr_IllParameter;
+    }
+    if (PyObject_GetBuffer(array, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS
+                           | PyBUF_FORMAT) != 0) {
+        PyErr_Clear();
+        return IcsErr_IllParameter;
+    }
+    if (icsPyDataType(&view) != ics->imel.dataType) {
+        error = IcsErr_IllParameter;
+    } else {
+        Py_BEGIN_ALLOW_THREADS
+        error = IcsGetROIData(ics, offset == Py_None ? NULL : o,
+                              size == Py_None ? NULL : s,
+                              sampling == Py_None ? NULL : d,
+                              view.buf, (size_t)view.len);
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&view);
+    return error;
+}
+
+
+/* Use a buffer, which can be strided, as the image data to write. If no layout
+   was set, it is taken from the buffer. The buffer is held until the file is
+   closed. */
+Ics_Error IcsPySetData(ICS      *ics,
+                       PyObject *array)
+{
+    Ics_Error    error = IcsErr_Ok;
+    IcsPyBuffer *buffer;
+    size_t       dims[ICS_MAXDIM];
+    int          i;
+
+
+    if (ics == NULL) return IcsErr_NotValidAction;
+    buffer = (IcsPyBuffer*)malloc(sizeof(IcsPyBuffer));
+    if (buffer == NULL) return IcsErr_Alloc;
+    if (PyObject_GetBuffer(array, &buffer->view, PyBUF_STRIDES
+                           | PyBUF_FORMAT) != 0) {
+        PyErr_Clear();
+        free(buffer);
+        return IcsErr_IllParameter;
+    }
+    if (buffer->view.ndim < 1 || buffer->view.ndim > ICS_MAXDIM)
+        error = IcsErr_TooManyDims;
+    if (!error && ics->dimensions == 0) {
+        for (i = 0; i < buffer->view.ndim; i++) {
+            dims[buffer->view.ndim - 1 - i] = (size_t)buffer->view.shape[i];
+        }
+        error = IcsSetLayout(ics, icsPyDataType(&buffer->view),
+                             buffer->view.ndim, dims);
+    }
+    if (!error) error = icsPyCheckLayout(ics, &buffer->view);
+    if (!error) error = icsPyStrides(&buffer->view, buffer->strides);
+    if (!error) {
+        error = IcsSetDataWithStrides(ics, buffer->view.buf,
+                                      (size_t)buffer->view.len,
+                                      buffer->strides, buffer->view.ndim);
+    }
+    if (error) {
+        PyBuffer_Release(&buffer->view);
+        free(buffer);
+        return error;
+    }
+    buffer->ics = ics;
+    buffer->next = icsPyBuffers;
+    icsPyBuffers = buffer;
+    return error;
+}
+
+
+/* Close the file, writing it if opened for writing, and release the buffers
+   set with IcsPySetData. Called as IcsClose from Python. */
+Ics_Error IcsPyClose(ICS *ics)
+{
+    Ics_Error     error;
+    IcsPyBuffer **link = &icsPyBuffers, *buffer;
+
+
+    Py_BEGIN_ALLOW_THREADS
+    error = IcsClose(ics);
+    Py_END_ALLOW_THREADS
+    while (*link != NULL) {
+        buffer = *link;
+        if (buffer->ics == ics) {
+            *link = buffer->next;
+            PyBuffer_Release(&buffer->view);
+            free(buffer);
+        } else {
+            link = &buffer->next;
+        }
+    }
+    return error;
+}
+%}
+
+
+%pythoncode %{
+try:
+    import numpy as _numpy
+except ImportError:
+    _numpy = None
+
+_dtypes = {Ics_uint8: 'u1', Ics_sint8: 'i1', Ics_uint16: 'u2',
+           Ics_sint16: 'i2', Ics_uint32: 'u4', Ics_sint32: 'i4',
+           Ics_real32: 'f4', Ics_real64: 'f8', Ics_complex32: 'c8',
+           Ics_complex64: 'c16'}
+
+
+class IcsError(Exception):
+    """An error returned by libics; `code` is the Ics_Error value."""
+    def __init__(self, code):
+        Exception.__init__(self, IcsGetErrorText(code))
+        self.code = code
+
+
+def _check(error):
+    if error != IcsErr_Ok:
+        raise IcsError(error)
+
+
+def get_data(ics, out=None):
+    """Read the image data into a NumPy array. The array shape is the ICS
+    dimensions in reverse order (e.g. [z, y, x]). If `out` is given, it is
+    filled in place; it can be a strided view into a larger array."""
+    dt, dims = IcsPyGetLayout(ics)
+    if out is None:
+        out = _numpy.empty(dims[::-1], dtype=_dtypes[dt])
+    _check(IcsPyGetData(ics, out))
+    return out
+
+
+def get_roi_data(ics, offset=None, size=None, sampling=None, out=None):
+    """Read a region of the image data into a NumPy array. offset, size and
+    sampling are given in ICS dimension order (x first); the array shape is
+    the region size in reverse order."""
+    dt, dims = IcsPyGetLayout(ics)
+    if out is None:
+        if offset is None:
+            offset = [0] * len(dims)
+        if size is None:
+            size = [d - o for d, o in zip(dims, offset)]
+        if sampling is None:
+            sampling = [1] * len(dims)
+        shape = [(s + d - 1) // d for s, d in zip(size, sampling)]
+        out = _numpy.empty(shape[::-1], dtype=_dtypes[dt])
+    _check(IcsPyGetROIData(ics, offset, size, sampling, out))
+    return out
+
+
+def set_data(ics, array):
+    """Use a NumPy array, contiguous or strided, as the image data to write.
+    If no layout was set, it is taken from the array, with the dimensions in
+    reverse order. The array is not copied, and must not be modified until
+    the file is closed with close()."""
+    _check(IcsPySetData(ics, array))
+
+
+def close(ics):
+    """Close an ICS file, writing it if it was opened for writing."""
+    _check(IcsClose(ics))
+%}
@@ -0,0 +1,372 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_async.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsSubmitROIRead()
+ *   IcsPollRead()
+ *   IcsWaitRead()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsDetachReads()
+ *
+ * Asynchronous reads. A handle that reads asynchronously gets a reader, which
+ * holds a copy of the ICS structure made at its first read, so that it can
+ * read independently of the caller. The reads of a handle wait in the queue of
+ * its reader, and a job in the worker pool of libics_thread.c does them one by
+ * one, in the order they were submitted. The reads of one handle thus finish,
+ * and call back, in order, while the reads of different handles run in
+ * parallel, as far as there are workers. Without thread support the reads run
+ * when they are submitted.
+ *
+ * Finished requests go to a free list of the reader, and are reused by later
+ * reads. The internal buffers of the copy are charged to the caller's
+ * structure too, through its memoryOwner pointer. IcsClose() detaches the
+ * reader, which is freed once its reads are done and their requests given
+ * back.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+
+typedef struct Ics_AsyncReader_ Ics_AsyncReader;
+
+/* The struct behind Ics_ReadRequest. */
+struct _Ics_ReadRequest {
+    Ics_AsyncReader  *reader;
+    size_t            offset[ICS_MAXDIM];
+    size_t            size[ICS_MAXDIM];
+    size_t            sampling[ICS_MAXDIM];
+    void             *dest;
+    size_t            n;
+    Ics_ReadCallback  callback;
+    void             *userData;
+    int               detached;            /* no handle, reuse when done */
+    int               done;                /* protected by IcsLockJobs() */
+    Ics_Error         error;
+    Ics_ReadRequest  *next;                /* in the queue or the free list */
+};
+
+
+/* The asynchronous reads of a handle. All but the copy, which only the job
+   reads with, are protected by IcsLockJobs(). */
+struct Ics_AsyncReader_ {
+    ICS               ics;                 /* copy of the caller's structure */
+    Ics_ReadRequest  *first;               /* queued reads, oldest first */
+    Ics_ReadRequest  *last;
+    Ics_ReadRequest  *spare;               /* finished requests */
+    size_t            nOut;                /* requests not in spare */
+    int               running;             /* a job does the queued reads */
+    int               closed;              /* the caller's handle is closed */
+};
+
+
+/* Is the reader of a closed handle no longer used? Call with the jobs
+   locked. */
+static int icsReaderUnused(Ics_AsyncReader *reader)
+{
+    return reader->closed && !reader->running && (reader->nOut == 0);
+}
+
+
+/* Free a reader and its free list. */
+static void icsFreeReader(Ics_AsyncReader *reader)
+{
+    Ics_ReadRequest *request;
+
+
+    while (reader->spare != NULL) {
+        request = reader->spare;
+        reader->spare = request->next;
+        free(request);
+    }
+    free(reader);
+}
+
+
+/* Give a request back to its reader, and free the reader if it is no longer
+   used. */
+static void icsReleaseRead(Ics_ReadRequest *request)
+{
+    Ics_AsyncReader *reader = request->reader;
+    int              unused;
+
+
+    IcsLockJobs();
+    request->next = reader->spare;
+    reader->spare = request;
+    reader->nOut--;
+    unused = icsReaderUnused(reader);
+    IcsUnlockJobs();
+    if (unused) icsFreeReader(reader);
+}
+
+
+/* Report the result of a read. */
+static void icsFinishRead(Ics_ReadRequest *request,
+                          Ics_Error        error)
+{
+    if (request->callback != NULL) {
+        request->callback(request->userData, error);
+    }
+    if (request->detached) {
+        icsReleaseRead(request);
+    } else {
+        IcsLockJobs();
+        request->error = error;
+        request->done = 1;
+        IcsSignalJobs();
+        IcsUnlockJobs();
+    }
+}
+
+
+/* The job: do the queued reads of a reader in order, until none are left. */
+static void icsAsyncReads(void *data)
+{
+    Ics_AsyncReader *reader = (Ics_AsyncReader*)data;
+    Ics_ReadRequest *request;
+    Ics_Error        error;
+    int              unused;
+
+
+    IcsLockJobs();
+    while (reader->first != NULL) {
+        request = reader->first;
+        reader->first = request->next;
+        if (reader->first == NULL) reader->last = NULL;
+        IcsUnlockJobs();
+        error = IcsGetROIData(&reader->ics, request->offset, request->size,
+                              request->sampling, request->dest, request->n);
+        if (reader->ics.blockRead != NULL) IcsCloseIds(&reader->ics);
+        icsFinishRead(request, error);
+        IcsLockJobs();
+    }
+    reader->running = 0;
+    unused = icsReaderUnused(reader);
+    IcsUnlockJobs();
+    if (unused) icsFreeReader(reader);
+}
+
+
+/* Get the reader of ics, creating it at the first read. */
+static Ics_AsyncReader *icsGetReader(ICS *ics)
+{
+    Ics_AsyncReader *reader, *created;
+
+
+    IcsLockJobs();
+    reader = (Ics_AsyncReader*)ics->asyncReads;
+    IcsUnlockJobs();
+    if (reader != NULL) return reader;
+
+    created = (Ics_AsyncReader*)malloc(sizeof(Ics_AsyncReader));
+    if (created == NULL) return NULL;
+        /* The copy does not share the open data file or the history. The
+           usage counters change under the memory lock. */
+    IcsLockJobs();
+    reader = (Ics_AsyncReader*)ics->asyncReads;
+    if (reader == NULL) {
+        reader = created;
+        created = NULL;
+        IcsLockMemory((Ics_Context*)ics->context);
+        memcpy(&reader->ics, ics, sizeof(ICS));
+        IcsUnlockMemory((Ics_Context*)ics->context);
+        reader->ics.blockRead = NULL;
+        reader->ics.history = NULL;
+        reader->ics.memoryInUse = 0;
+        reader->ics.memoryPeak = 0;
+        reader->ics.memoryOwner = ics;
+        reader->ics.asyncReads = NULL;
+        reader->first = reader->last = NULL;
+        reader->spare = NULL;
+        reader->nOut = 0;
+        reader->running = 0;
+        reader->closed = 0;
+        ics->asyncReads = reader;
+    }
+    IcsUnlockJobs();
+    free(created);
+
+    return reader;
+}
+
+
+/* Start reading a region of the image, as IcsGetROIData() does. */
+Ics_Error IcsSubmitROIRead(ICS               *ics,
+                           const size_t      *offset,
+                           const size_t      *size,
+                           const size_t      *sampling,
+                           void              *dest,
+                           size_t             n,
+                           Ics_ReadCallback   callback,
+                           void              *userData,
+                           Ics_ReadRequest  **request)
+{
+    ICSINIT;
+    Ics_AsyncReader *reader;
+    Ics_ReadRequest *req, *list, *next;
+    int              i, start;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_read))
+        return IcsErr_NotValidAction;
+    if ((callback == NULL) && (request == NULL)) return IcsErr_IllParameter;
+    if (request != NULL) *request = NULL;
+
+    reader = icsGetReader(ics);
+    if (reader == NULL) return IcsErr_Alloc;
+    IcsLockJobs();
+    req = reader->spare;
+    if (req != NULL) reader->spare = req->next;
+    IcsUnlockJobs();
+    if (req == NULL) {
+        req = (Ics_ReadRequest*)malloc(sizeof(Ics_ReadRequest));
+        if (req == NULL) return IcsErr_Alloc;
+    }
+    req->reader = reader;
+    for (i = 0; i < ics->dimensions; i++) {
+        req->offset[i] = offset != NULL ? offset[i] : 0;
+        req->size[i] = size != NULL ? size[i]
+                                    : ics->dim[i].size - req->offset[i];
+        req->sampling[i] = sampling != NULL ? sampling[i] : 1;
+    }
+    req->dest = dest;
+    req->n = n;
+    req->callback = callback;
+    req->userData = userData;
+    req->detached = request == NULL;
+    req->done = 0;
+    req->error = IcsErr_Ok;
+    req->next = NULL;
+    if (request != NULL) *request = req;
+
+        /* Queue it, and start a job unless one is doing the reads already */
+    IcsLockJobs();
+    if (reader->last != NULL) {
+        reader->last->next = req;
+    } else {
+        reader->first = req;
+    }
+    reader->last = req;
+    reader->nOut++;
+    start = !reader->running;
+    reader->running = 1;
+    IcsUnlockJobs();
+    if (!start) return error;
+
+    error = IcsStartJob((Ics_Context*)reader->ics.context, icsAsyncReads,
+                        reader);
+    if (error) {
+            /* Nothing will do the queued reads: fail the ones queued since,
+               and give this one back */
+        IcsLockJobs();
+        list = reader->first;
+        reader->first = reader->last = NULL;
+        reader->running = 0;
+        IcsUnlockJobs();
+        for (; list != NULL; list = next) {
+            next = list->next;
+            if (list != req) icsFinishRead(list, error);
+        }
+        icsReleaseRead(req);
+        if (request != NULL) *request = NULL;
+    }
+
+    return error;
+}
+
+
+/* Find out whether an asynchronous read has finished. */
+Ics_Error IcsPollRead(Ics_ReadRequest *request,
+                      int             *done)
+{
+    ICSINIT;
+
+
+    if ((request == NULL) || (done == NULL)) return IcsErr_IllParameter;
+    IcsLockJobs();
+    *done = request->done;
+    IcsUnlockJobs();
+
+    return error;
+}
+
+
+/* Wait for an asynchronous read to finish, and give back the request. */
+Ics_Error IcsWaitRead(Ics_ReadRequest *request)
+{
+    ICSINIT;
+
+
+    if (request == NULL) return IcsErr_IllParameter;
+    IcsLockJobs();
+    while (!request->done) {
+        IcsWaitJobs();
+    }
+    IcsUnlockJobs();
+    error = request->error;
+    icsReleaseRead(request);
+
+    return error;
+}
+
+
+/* Detach the reader of ics, which is being closed: its reads no longer charge
+   ics, and it is freed once they are done. */
+void IcsDetachReads(ICS *ics)
+{
+    Ics_AsyncReader *reader;
+    int              unused = 0;
+
+
+    IcsLockJobs();
+    reader = (Ics_AsyncReader*)ics->asyncReads;
+    ics->asyncReads = NULL;
+    if (reader != NULL) {
+        IcsLockMemory((Ics_Context*)reader->ics.context);
+        reader->ics.memoryOwner = NULL;
+        IcsUnlockMemory((Ics_Context*)reader->ics.context);
+        reader->closed = 1;
+        unused = icsReaderUnused(reader);
+    }
+    IcsUnlockJobs();
+    if (unused) icsFreeReader(reader);
+}
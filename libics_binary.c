@@ -48,6 +48,10 @@
  * The following internal functions are contained in this file:
  *
  *   IcsWritePlainWithStrides()
+ *   IcsGatherLines()
+ *   IcsReadIdsData()
+ *   IcsReadIdsRange()
+ *   IcsSetIdsData()
  *   IcsFillByteOrder()
  */
 
@@ -114,15 +118,234 @@ Ics_Error IcsWritePlainWithStrides(const void      *src,
 }
 
 
+/* Copy nLines image lines, starting at line firstLine, from strided data into a
+   contiguous buffer. A line runs along the first dimension; lines are numbered
+   in storage order over the remaining dimensions. */
+void IcsGatherLines(const void      *src,
+                    const size_t    *dim,
+                    const ptrdiff_t *stride,
+                    int              nDims,
+                    int              nBytes,
+                    size_t           firstLine,
+                    size_t           nLines,
+                    void            *dest)
+{
+    size_t      curpos[ICS_MAXDIM];
+    const char *data;
+    char       *out = (char*)dest;
+    int         i;
+    size_t      n;
+
+
+    for (i = 1; i < nDims; i++) {
+        curpos[i] = firstLine % dim[i];
+        firstLine /= dim[i];
+    }
+    for (n = 0; n < nLines; n++) {
+        data = (char const*)src;
+        for (i = 1; i < nDims; i++) {
+            data += (ptrdiff_t)curpos[i] * stride[i] * nBytes;
+        }
+        if (stride[0] == 1) {
+            memcpy(out, data, dim[0] * (size_t)nBytes);
+            out += dim[0] * (size_t)nBytes;
+        } else {
+            IcsGetKernels()->gather(out, data, stride[0] * nBytes, dim[0],
+                                    (size_t)nBytes);
+            out += dim[0] * (size_t)nBytes;
+        }
+        for (i = 1; i < nDims; i++) {
+            curpos[i]++;
+            if (curpos[i] < dim[i]) {
+                break;
+            }
+            curpos[i] = 0;
+        }
+    }
+}
+
+
+/* Delta code a copy of the data, and write that to the IDS file. */
+static Ics_Error icsWriteDeltaIds(const Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_Header *copy;
+    size_t      dim[ICS_MAXDIM];
+    size_t      n, nLines = 1;
+    char       *data;
+    int         i;
+
+
+    n = IcsGetDataSize(icsStruct);
+    copy = (Ics_Header*)malloc(sizeof(Ics_Header));
+    data = (char*)malloc(n);
+    if ((copy == NULL) || (data == NULL)) {
+        if (copy) free(copy);
+        if (data) free(data);
+        return IcsErr_Alloc;
+    }
+    if (icsStruct->dataStrides) {
+        for (i = 0; i < icsStruct->dimensions; i++) {
+            dim[i] = icsStruct->dim[i].size;
+            if (i > 0) nLines *= dim[i];
+        }
+        IcsGatherLines(icsStruct->data, dim, icsStruct->dataStrides,
+                       icsStruct->dimensions,
+                       (int)IcsGetDataTypeSize(icsStruct->imel.dataType), 0,
+                       nLines, data);
+    } else {
+        memcpy(data, icsStruct->data,
+               n < icsStruct->dataLength ? n : icsStruct->dataLength);
+    }
+    *copy = *icsStruct;
+    copy->data = data;
+    copy->dataLength = n;
+    copy->memoryInUse = 0;
+    copy->memoryPeak = 0;
+    copy->memoryOwner = (Ics_Header*)icsStruct;
+    copy->dataStrides = NULL;
+    copy->deltaDim = -1;
+    copy->writeZoneMap = 0;
+    error = IcsDeltaEncode(icsStruct, data, n);
+    if (!error) error = IcsWriteIds(copy);
+    free(data);
+    free(copy);
+
+    return error;
+}
+
+
+/* A data source that adds the data it provides to a zone map. */
+typedef struct {
+    Ics_DataSource *source;
+    void           *zoneMap;
+} Ics_ZoneSource;
+
+
+static Ics_Error icsZoneSourceFunc(void   *userData,
+                                   void   *dest,
+                                   size_t  n)
+{
+    ICSINIT;
+    Ics_ZoneSource *zs = (Ics_ZoneSource*)userData;
+
+
+    error = zs->source->func(zs->source->userData, dest, n);
+    if (!error) IcsAddToZoneMap(zs->zoneMap, dest, n);
+    return error;
+}
+
+
+/* Write the data given by the data source function to the IDS file.
+   Uncompressed and gzip-compressed data is streamed through a small buffer;
+   otherwise the data is collected first and written as usual. */
+static Ics_Error icsWriteSourceIds(const Ics_Header *icsStruct,
+                                   const char       *filename,
+                                   const char       *mode)
+{
+    ICSINIT;
+    Ics_DataSource *source = (Ics_DataSource*)icsStruct->dataSource;
+    Ics_DataSource  zoneSource;
+    Ics_ZoneSource  zs;
+    Ics_Header     *copy;
+    Ics_ZipIndex   *index  = NULL;
+    FILE           *fp;
+    char           *buf;
+    size_t          n, size;
+    int             stream;
+
+
+    size = IcsGetDataSize(icsStruct);
+    stream = (icsStruct->dedupStore[0] == '\0') && (icsStruct->deltaDim < 0)
+             && (icsStruct->chunkStore[0] == '\0');
+    stream = stream && ((icsStruct->compression == IcsCompr_uncompressed)
+#ifdef ICS_ZLIB
+                        || (icsStruct->compression == IcsCompr_gzip)
+#endif
+                        );
+    if (stream) {
+        if (icsStruct->writeZoneMap) {
+                /* Compute the zone map as the data passes by */
+            zs.source = source;
+            error = IcsNewZoneMap(icsStruct, &zs.zoneMap);
+            if (error) return error;
+            zoneSource.func = icsZoneSourceFunc;
+            zoneSource.userData = &zs;
+            source = &zoneSource;
+        }
+        fp = IcsFOpen(filename, mode);
+        if (fp == NULL) {
+            if (icsStruct->writeZoneMap) {
+                IcsFinishZoneMap(icsStruct, zs.zoneMap, IcsErr_FOpenIds);
+            }
+            return IcsErr_FOpenIds;
+        }
+        if (icsStruct->compression == IcsCompr_uncompressed) {
+            buf = (char*)IcsGetScratch(icsStruct, ICS_BUF_SIZE);
+            if (buf == NULL) error = IcsErr_Alloc;
+            while (!error && size > 0) {
+                n = size < ICS_BUF_SIZE ? size : ICS_BUF_SIZE;
+                error = source->func(source->userData, buf, n);
+                if (!error && fwrite(buf, 1, n, fp) != n) {
+                    error = IcsErr_FWriteIds;
+                }
+                size -= n;
+            }
+            IcsReleaseScratch(icsStruct, buf);
+        } else {
+            if (IcsWritesZipIndex(icsStruct)) {
+                error = IcsNewZipIndex(icsStruct, &index);
+            }
+            if (!error) {
+                error = IcsWriteZipSource(source->func, source->userData, size,
+                                          fp, icsStruct->compLevel, index,
+                                          icsStruct);
+            }
+        }
+        if (fclose(fp) == EOF) {
+            if (!error) error = IcsErr_FCloseIds;
+        }
+        if (index != NULL) error = IcsFinishZipIndex(icsStruct, index, error);
+        if (icsStruct->writeZoneMap) {
+            error = IcsFinishZoneMap(icsStruct, zs.zoneMap, error);
+        }
+        return error;
+    }
+
+    copy = (Ics_Header*)malloc(sizeof(Ics_Header));
+    buf = (char*)malloc(size);
+    if ((copy == NULL) || (buf == NULL)) {
+        if (copy) free(copy);
+        if (buf) free(buf);
+        return IcsErr_Alloc;
+    }
+    error = source->func(source->userData, buf, size);
+    *copy = *icsStruct;
+    copy->data = buf;
+    copy->dataLength = size;
+    copy->memoryInUse = 0;
+    copy->memoryPeak = 0;
+    copy->memoryOwner = (Ics_Header*)icsStruct;
+    copy->dataStrides = NULL;
+    copy->dataSource = NULL;
+    if (!error) error = IcsWriteIds(copy);
+    free(buf);
+    free(copy);
+
+    return error;
+}
+
+
 /* Write the data to an IDS file. */
 Ics_Error IcsWriteIds(const Ics_Header *icsStruct)
 {
     ICSINIT;
-    FILE   *fp;
-    char    filename[ICS_MAXPATHLEN];
-    char    mode[3] = "wb";
-    int     i;
-    size_t  dim[ICS_MAXDIM];
+    FILE         *fp;
+    char          filename[ICS_MAXPATHLEN];
+    char          mode[3] = "wb";
+    int           i;
+    size_t        dim[ICS_MAXDIM];
+    Ics_ZipIndex *index   = NULL;
 
 
     if (icsStruct->version == 1) {
@@ -130,15 +353,42 @@ Ics_Error IcsWriteIds(const Ics_Header *icsStruct)
     } else {
         if (icsStruct->srcFile[0] != '\0') return IcsErr_Ok;
             /* Do nothing: the data is in another file somewhere */
-        IcsStrCpy(filename, icsStruct->filename, ICS_MAXPATHLEN);
+        error = IcsGetOutputName(filename, icsStruct);
+        if (error) return error;
         mode[0] = 'a'; /* Open for append */
     }
+    if (icsStruct->dataSource != NULL)
+        return icsWriteSourceIds(icsStruct, filename, mode);
+    if ((icsStruct->chunkStore[0] != '\0') && (icsStruct->data == NULL)) {
+            /* An empty chunk directory, to be filled with IcsPutROIData() */
+        return IcsWriteChunks(icsStruct);
+    }
     if ((icsStruct->data == NULL) || (icsStruct->dataLength == 0))
         return IcsErr_MissingData;
+    if (icsStruct->writeZoneMap) {
+        error = IcsWriteZoneMap(icsStruct);
+        if (error) return error;
+    }
+    if (icsStruct->deltaDim >= 0) return icsWriteDeltaIds(icsStruct);
+    if (icsStruct->chunkStore[0] != '\0') {
+            /* The data goes into the chunk directory, the ICS file holds no
+               data */
+        return IcsWriteChunks(icsStruct);
+    }
 
     fp = IcsFOpen(filename, mode);
     if (fp == NULL) return IcsErr_FOpenIds;
 
+    if (icsStruct->dedupStore[0] != '\0') {
+            /* The data goes into the chunk store, we write only the list of
+               chunks */
+        error = IcsWriteDedup(icsStruct, fp);
+        if (fclose (fp) == EOF) {
+            if (!error) error = IcsErr_FCloseIds;
+        }
+        return error;
+    }
+
     for (i=0; i<icsStruct->dimensions; i++) {
         dim[i] = icsStruct->dim[i].size;
     }
@@ -175,18 +425,27 @@ Ics_Error IcsWriteIds(const Ics_Header *icsStruct)
             break;
 #ifdef ICS_ZLIB
         case IcsCompr_gzip:
+            if (IcsWritesZipIndex(icsStruct)) {
+                error = IcsNewZipIndex(icsStruct, &index);
+                if (error) break;
+            }
             if (icsStruct->dataStrides) {
                 size_t size = IcsGetDataTypeSize(icsStruct->imel.dataType);
                 error = IcsWriteZipWithStrides(icsStruct->data, dim,
                                                icsStruct->dataStrides,
                                                icsStruct->dimensions,
-                                               (int)size, fp, icsStruct->compLevel);
+                                               (int)size, fp, icsStruct->compLevel,
+                                               index, icsStruct);
             } else {
                 error = IcsWriteZip(icsStruct->data, icsStruct->dataLength, fp,
-                                    icsStruct->compLevel);
+                                    icsStruct->compLevel, index, icsStruct);
             }
             break;
 #endif
+        case IcsCompr_loco:
+        case IcsCompr_fpred:
+            error = IcsWriteTiles(icsStruct, fp);
+            break;
         default:
             error = IcsErr_UnknownCompression;
     }
@@ -194,6 +453,7 @@ Ics_Error IcsWriteIds(const Ics_Header *icsStruct)
     if (fclose (fp) == EOF) {
         if (!error) error = IcsErr_FCloseIds; /* Don't overwrite any previous error. */
     }
+    if (index != NULL) error = IcsFinishZipIndex(icsStruct, index, error);
     return error;
 }
 
@@ -218,7 +478,7 @@ Ics_Error IcsCopyIds(const char *infilename,
         error = IcsErr_FCopyIds;
         goto exit;
     }
-    if (fseek(in, (long)inoffset, SEEK_SET) != 0) {
+    if (IcsFSeek(in, (ics_t_sint64)inoffset, SEEK_SET) != 0) {
         error = IcsErr_FCopyIds;
         goto exit;
     }
@@ -255,21 +515,6 @@ Ics_Error IcsCopyIds(const char *infilename,
 }
 
 
-/* Check if a file exist. */
-static int IcsExistFile(const char *filename)
-{
-    FILE *fp;
-
-
-    if ((fp = IcsFOpen(filename, "rb")) != NULL) {
-        fclose (fp);
-        return 1;
-    } else {
-        return 0;
-    }
-}
-
-
 /* Find out if we are running on a little endian machine (Intel) or on a big
    endian machine. On Intel CPUs the least significant byte is stored first in
    memory. Returns: 1 if little endian; 0 big endian (e.g. MIPS). */
@@ -329,6 +574,7 @@ static Ics_Error IcsReorderIds(char        *buf,
     int  dstByteOrder[ICS_MAX_IMEL_SIZE];
     char imel[ICS_MAX_IMEL_SIZE];
     int  different = 0, empty = 0;
+    int  group, reversed;
 
 
     imels = length / (size_t)bytes;
@@ -344,6 +590,23 @@ static Ics_Error IcsReorderIds(char        *buf,
     }
     if (!different || empty) return IcsErr_Ok;
 
+        /* The common case is reversing groups of 2, 4 or 8 bytes (a complex
+           sample being two groups), for which there is a fast kernel. */
+    for (group = 2; group <= 8 && group <= bytes; group *= 2) {
+        if (bytes % group != 0) continue;
+        reversed = 1;
+        for (i = 0; i < bytes; i++) {
+            reversed &= (srcByteOrder[i] ==
+                         dstByteOrder[(i / group) * group + group - 1
+                                      - i % group]);
+        }
+        if (reversed) {
+            IcsGetKernels()->swapBytes(buf, length / (size_t)group,
+                                       (size_t)group);
+            return IcsErr_Ok;
+        }
+    }
+
     for (j = 0; j < imels; j++){
         for (i = 0; i < bytes; i++){
             imel[srcByteOrder[i]-1] = buf[i];
@@ -403,7 +666,7 @@ Ics_Error IcsOpenIds(Ics_Header *icsStruct)
 
     br->dataFilePtr = IcsFOpen(filename, "rb");
     if (br->dataFilePtr == NULL) return IcsErr_FOpenIds;
-    if (fseek(br->dataFilePtr, (long)offset, SEEK_SET) != 0) {
+    if (IcsFSeek(br->dataFilePtr, (ics_t_sint64)offset, SEEK_SET) != 0) {
         fclose(br->dataFilePtr);
         free(br);
         return IcsErr_FReadIds;
@@ -411,21 +674,47 @@ Ics_Error IcsOpenIds(Ics_Header *icsStruct)
 #ifdef ICS_ZLIB
     br->zlibStream = NULL;
     br->zlibInputBuffer = NULL;
+    br->zipIndex = NULL;
+    br->zipIndexRead = 0;
 #endif
     br->compressRead = 0;
+    br->dataOffset = offset;
+    br->dedup = NULL;
+    br->chunks = NULL;
+    br->tiles = NULL;
+    br->delta = NULL;
     icsStruct->blockRead = br;
 
+    if (icsStruct->chunkStore[0] != '\0') {
+            /* The data is in the chunk directory */
+        error = IcsOpenChunks(icsStruct);
+    } else if (icsStruct->dedupStore[0] != '\0') {
+            /* The data file contains the list of chunks in the store */
+        error = IcsOpenDedup(icsStruct);
 #ifdef ICS_ZLIB
-    if (icsStruct->compression == IcsCompr_gzip) {
+    } else if (icsStruct->compression == IcsCompr_gzip) {
         error = IcsOpenZip(icsStruct);
+#endif
+    } else if (IcsIsTileCompression(icsStruct->compression)) {
+        error = IcsOpenTiles(icsStruct);
+    }
+    if (!error && icsStruct->deltaDim >= 0) {
+        error = IcsOpenDelta(icsStruct);
         if (error) {
-            fclose (br->dataFilePtr);
-            free(icsStruct->blockRead);
-            icsStruct->blockRead = NULL;
-            return error;
+            if (br->dedup != NULL) IcsCloseDedup(icsStruct);
+            if (br->chunks != NULL) IcsCloseChunks(icsStruct);
+            if (br->tiles != NULL) IcsCloseTiles(icsStruct);
+#ifdef ICS_ZLIB
+            if (br->zlibStream != NULL) IcsCloseZip(icsStruct);
+#endif
         }
     }
-#endif
+    if (error) {
+        fclose (br->dataFilePtr);
+        free(icsStruct->blockRead);
+        icsStruct->blockRead = NULL;
+        return error;
+    }
 
     return error;
 }
@@ -448,7 +737,32 @@ Ics_Error IcsCloseIds(Ics_Header *icsStruct)
         else
             IcsCloseZip(icsStruct);
     }
+    IcsFreeZipIndex(icsStruct, (Ics_ZipIndex*)br->zipIndex);
 #endif
+    if (br->dedup != NULL) {
+        if (!error)
+            error = IcsCloseDedup(icsStruct);
+        else
+            IcsCloseDedup(icsStruct);
+    }
+    if (br->chunks != NULL) {
+        if (!error)
+            error = IcsCloseChunks(icsStruct);
+        else
+            IcsCloseChunks(icsStruct);
+    }
+    if (br->tiles != NULL) {
+        if (!error)
+            error = IcsCloseTiles(icsStruct);
+        else
+            IcsCloseTiles(icsStruct);
+    }
+    if (br->delta != NULL) {
+        if (!error)
+            error = IcsCloseDelta(icsStruct);
+        else
+            IcsCloseDelta(icsStruct);
+    }
     free(br);
     icsStruct->blockRead = NULL;
 
@@ -460,11 +774,41 @@ Ics_Error IcsCloseIds(Ics_Header *icsStruct)
 Ics_Error IcsReadIdsBlock(Ics_Header *icsStruct,
                           void       *dest,
                           size_t      n)
+{
+    Ics_BlockRead* br = (Ics_BlockRead*)icsStruct->blockRead;
+
+
+    if (br->delta != NULL) return IcsReadDeltaBlock(icsStruct, dest, n);
+    return IcsReadIdsData(icsStruct, dest, n);
+}
+
+
+/* Read a data block from an IDS file, without undoing the delta coding. */
+Ics_Error IcsReadIdsData(Ics_Header *icsStruct,
+                         void       *dest,
+                         size_t      n)
 {
     ICSINIT;
     Ics_BlockRead* br = (Ics_BlockRead*)icsStruct->blockRead;
 
 
+    if (br->chunks != NULL) {
+        error = IcsReadChunkBlock(icsStruct, dest, n);
+        if (!error) error = IcsReorderIds((char*)dest, n,
+                                          icsStruct->imel.dataType,
+                                          icsStruct->byteOrder,
+                                          IcsGetBytesPerSample(icsStruct));
+        return error;
+    }
+    if (br->dedup != NULL) {
+        error = IcsReadDedupBlock(icsStruct, dest, n);
+        if (!error) error = IcsReorderIds((char*)dest, n,
+                                          icsStruct->imel.dataType,
+                                          icsStruct->byteOrder,
+                                          IcsGetBytesPerSample(icsStruct));
+        return error;
+    }
+
     switch (icsStruct->compression) {
         case IcsCompr_uncompressed:
             if ((fread(dest, 1, n, br->dataFilePtr)) != n) {
@@ -480,6 +824,10 @@ Ics_Error IcsReadIdsBlock(Ics_Header *icsStruct,
             error = IcsReadZipBlock(icsStruct, dest, n);
             break;
 #endif
+        case IcsCompr_loco:
+        case IcsCompr_fpred:
+            error = IcsReadTileBlock(icsStruct, dest, n);
+            break;
         case IcsCompr_compress:
             if (br->compressRead) {
                 error = IcsErr_BlockNotAllowed;
@@ -500,29 +848,100 @@ Ics_Error IcsReadIdsBlock(Ics_Header *icsStruct,
 }
 
 
+/* Read n bytes at offset in uncompressed image data through a file handle of
+   its own, such that several threads can read at once. The IDS file must be
+   open. */
+Ics_Error IcsReadIdsRange(const Ics_Header *icsStruct,
+                          size_t            offset,
+                          void             *dest,
+                          size_t            n)
+{
+    ICSINIT;
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    FILE          *fp;
+    char           filename[ICS_MAXPATHLEN];
+
+
+    if (icsStruct->version == 1) {
+        IcsGetIdsName(filename, icsStruct->filename);
+    } else {
+        IcsStrCpy(filename, icsStruct->srcFile, ICS_MAXPATHLEN);
+    }
+    fp = IcsFOpen(filename, "rb");
+    if (fp == NULL) return IcsErr_FOpenIds;
+    if (IcsFSeek(fp, (ics_t_sint64)(br->dataOffset + offset), SEEK_SET) != 0) {
+        error = IcsErr_FReadIds;
+    } else if (fread(dest, 1, n, fp) != n) {
+        error = ferror(fp) ? IcsErr_FReadIds : IcsErr_EndOfStream;
+    }
+    if (fclose(fp) == EOF) {
+        if (!error) error = IcsErr_FCloseIds;
+    }
+    if (!error) error = IcsReorderIds((char*)dest, n, icsStruct->imel.dataType,
+                                      (int*)icsStruct->byteOrder,
+                                      IcsGetBytesPerSample(icsStruct));
+
+    return error;
+}
+
+
 /* Skip a data block from an IDS file. */
 Ics_Error IcsSkipIdsBlock(Ics_Header *icsStruct,
                           size_t      n)
 {
-    return IcsSetIdsBlock (icsStruct, (long)n, SEEK_CUR);
+    return IcsSetIdsBlock (icsStruct, (ics_t_sint64)n, SEEK_CUR);
 }
 
 
 /* Sets the file pointer into the IDS file. */
-Ics_Error IcsSetIdsBlock(Ics_Header *icsStruct,
-                         long        offset,
-                         int         whence)
+Ics_Error IcsSetIdsBlock(Ics_Header   *icsStruct,
+                         ics_t_sint64  offset,
+                         int           whence)
+{
+    Ics_BlockRead* br = (Ics_BlockRead*)icsStruct->blockRead;
+
+
+    if (br->delta != NULL) return IcsSetDeltaBlock(icsStruct, offset, whence);
+    return IcsSetIdsData(icsStruct, offset, whence);
+}
+
+
+/* Sets the file pointer into the IDS file, ignoring the delta coding. */
+Ics_Error IcsSetIdsData(Ics_Header   *icsStruct,
+                        ics_t_sint64  offset,
+                        int           whence)
 {
     ICSINIT;
     Ics_BlockRead* br = (Ics_BlockRead*)icsStruct->blockRead;
 
 
+    if (br->chunks != NULL) {
+        switch (whence) {
+            case SEEK_SET:
+            case SEEK_CUR:
+                return IcsSetChunkBlock(icsStruct, offset, whence);
+            default:
+                return IcsErr_IllParameter;
+        }
+    }
+    if (br->dedup != NULL) {
+        switch (whence) {
+            case SEEK_SET:
+            case SEEK_CUR:
+                return IcsSetDedupBlock(icsStruct, offset, whence);
+            default:
+                return IcsErr_IllParameter;
+        }
+    }
+
     switch (icsStruct->compression) {
         case IcsCompr_uncompressed:
             switch (whence) {
                 case SEEK_SET:
+                    offset += (ics_t_sint64)br->dataOffset;
+                    /* fall through */
                 case SEEK_CUR:
-                    if (fseek(br->dataFilePtr, (long)offset, whence) != 0) {
+                    if (IcsFSeek(br->dataFilePtr, offset, whence) != 0) {
                         if (ferror(br->dataFilePtr)) {
                             error = IcsErr_FReadIds;
                         } else {
@@ -546,6 +965,17 @@ Ics_Error IcsSetIdsBlock(Ics_Header *icsStruct,
             }
             break;
 #endif
+        case IcsCompr_loco:
+        case IcsCompr_fpred:
+            switch (whence) {
+                case SEEK_SET:
+                case SEEK_CUR:
+                    error = IcsSetTileBlock(icsStruct, offset, whence);
+                    break;
+                default:
+                    error = IcsErr_IllParameter;
+            }
+            break;
         case IcsCompr_compress:
             error = IcsErr_BlockNotAllowed;
             break;
@@ -0,0 +1,707 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * FILE : libics_chunks.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsPutROIData()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsGetChunkDims()
+ *   IcsWriteChunks()
+ *   IcsOpenChunks()
+ *   IcsCloseChunks()
+ *   IcsReadChunkBlock()
+ *   IcsSetChunkBlock()
+ *
+ * A chunk directory holds the image data split into N-dimensional chunks of
+ * equal size, each in its own file named after its chunk coordinates
+ * ("0.2.1" for the chunk with index 0 along x, 2 along y and 1 along z), with
+ * a ".gz" or ".<codec>" extension if it is compressed. Chunks at the end of a
+ * dimension are cut off at the image border. The ICS file holds no data, only
+ * the directory ("source chunks") and the chunk sizes ("layout chunks").
+ * Chunks are written to a temporary file which is then renamed, such that
+ * independent processes can write different chunks at the same time, and
+ * readers never see a partial chunk. A chunk file that does not exist reads
+ * as zeros.
+ *
+ * Reading goes through the normal block reading functions: the chunks of the
+ * slab that the current position falls in are decoded into buffers, which
+ * sequential reading and reading a region both walk through line by line. A
+ * slab holds all chunks along the dimensions below the highest dimension
+ * (from the second one up) whose chunks are more than one sample thick. Until
+ * the position leaves the slab, each of its chunks is thus decoded only once;
+ * with 64x64x64 chunks, a slab is 64 planes thick.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "libics_intern.h"
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+
+/* This is the struct behind the "void* chunks" in the Ics_BlockRead
+   structure: */
+typedef struct {
+    size_t  chunkDims[ICS_MAXDIM]; /* size of the chunks */
+    size_t  nChunks[ICS_MAXDIM];   /* number of chunks along each dimension */
+    size_t  total;                 /* total number of bytes in the image */
+    size_t  pos;                   /* current position in the image data */
+    int     slabDims;              /* dimensions covered by a slab */
+    size_t  slabChunks;            /* number of chunks in a slab */
+    size_t  slab;                  /* the slab in the buffers, or (size_t)-1
+                                      if none */
+    size_t  chunkBytes;            /* size of a buffer */
+    char  **buffers;               /* the chunks of the current slab */
+    char   *loaded;                /* which of the buffers are filled */
+} Ics_ChunkRead;
+
+
+/* What the parallel loops writing chunks need to know. */
+typedef struct {
+    const Ics_Header *icsStruct;
+    size_t            chunkDims[ICS_MAXDIM];
+    size_t            first[ICS_MAXDIM];     /* first chunk to write */
+    size_t            count[ICS_MAXDIM];     /* number of chunks to write */
+    size_t            offset[ICS_MAXDIM];    /* position of src in the image */
+    size_t            size[ICS_MAXDIM];      /* size of src */
+    ptrdiff_t         stride[ICS_MAXDIM];    /* strides of src, in samples */
+    const char       *src;
+    int               patch;                 /* src might not cover chunks */
+} Ics_ChunkWrite;
+
+
+/* Get the size of the chunks, and the number of chunks along each
+   dimension. */
+void IcsGetChunkDims(const Ics_Header *icsStruct,
+                     size_t           *chunkDims,
+                     size_t           *nChunks)
+{
+    int    i;
+    size_t size, c;
+
+
+    for (i = 0; i < icsStruct->dimensions; i++) {
+        size = icsStruct->dim[i].size;
+        c = icsStruct->chunkDims[i];
+        if ((c == 0) || (c > size)) c = size > 0 ? size : 1;
+        chunkDims[i] = c;
+        if (nChunks != NULL) nChunks[i] = (size + c - 1) / c;
+    }
+}
+
+
+/* Check that the chunks can be stored with the compression method of the
+   file. */
+static Ics_Error icsCheckCompression(const Ics_Header *icsStruct)
+{
+    switch (icsStruct->compression) {
+        case IcsCompr_uncompressed:
+            return IcsErr_Ok;
+#ifdef ICS_ZLIB
+        case IcsCompr_gzip:
+            return IcsErr_Ok;
+#endif
+        default:
+            if (!IcsIsTileCompression(icsStruct->compression)) {
+                return IcsErr_UnknownCompression;
+            }
+            if (!IcsTileSupports(icsStruct->compression,
+                                 icsStruct->imel.dataType)) {
+                return IcsErr_IllParameter;
+            }
+            return IcsErr_Ok;
+    }
+}
+
+
+/* Position and size of a chunk, and its number of samples. */
+static size_t icsChunkExtent(const Ics_Header *icsStruct,
+                             const size_t     *chunkDims,
+                             const size_t     *coords,
+                             size_t           *start,
+                             size_t           *extent)
+{
+    int    i;
+    size_t n = 1;
+
+
+    for (i = 0; i < icsStruct->dimensions; i++) {
+        start[i] = coords[i] * chunkDims[i];
+        extent[i] = icsStruct->dim[i].size - start[i];
+        if (extent[i] > chunkDims[i]) extent[i] = chunkDims[i];
+        n *= extent[i];
+    }
+    return n;
+}
+
+
+/* Build the name of a chunk file. */
+static Ics_Error icsChunkFileName(char             *name,
+                                  const Ics_Header *icsStruct,
+                                  const size_t     *coords)
+{
+    int    i, n;
+    size_t len;
+
+
+    IcsStrCpy(name, icsStruct->chunkStore, ICS_MAXPATHLEN);
+    len = strlen(name);
+    for (i = 0; i < icsStruct->dimensions; i++) {
+        n = snprintf(name + len, ICS_MAXPATHLEN - len, "%c%lu",
+                     i == 0 ? '/' : '.', (unsigned long)coords[i]);
+        if ((n < 0) || ((size_t)n >= ICS_MAXPATHLEN - len)) {
+            return IcsErr_FOpenIds;
+        }
+        len += (size_t)n;
+    }
+    if (icsStruct->compression == IcsCompr_gzip) {
+        n = snprintf(name + len, ICS_MAXPATHLEN - len, ".gz");
+    } else if (IcsIsTileCompression(icsStruct->compression)) {
+        n = snprintf(name + len, ICS_MAXPATHLEN - len, ".%s",
+                     IcsTileCompressionName(icsStruct->compression));
+    } else {
+        n = 0;
+    }
+    if ((n < 0) || ((size_t)n >= ICS_MAXPATHLEN - len)) return IcsErr_FOpenIds;
+    return IcsErr_Ok;
+}
+
+
+/* Copy an N-dimensional block of samples; strides are given in samples. */
+static void icsCopyRegion(char            *dest,
+                          const ptrdiff_t *destStride,
+                          const char      *src,
+                          const ptrdiff_t *srcStride,
+                          const size_t    *size,
+                          int              nDims,
+                          size_t           nBytes)
+{
+    size_t pos[ICS_MAXDIM];
+    size_t j;
+    int    i;
+
+
+    for (i = 0; i < nDims; i++) {
+        pos[i] = 0;
+    }
+    while (1) {
+        if ((destStride[0] == 1) && (srcStride[0] == 1)) {
+            memcpy(dest, src, size[0] * nBytes);
+        } else {
+            for (j = 0; j < size[0]; j++) {
+                memcpy(dest + (ptrdiff_t)j * destStride[0] * (ptrdiff_t)nBytes,
+                       src + (ptrdiff_t)j * srcStride[0] * (ptrdiff_t)nBytes,
+                       nBytes);
+            }
+        }
+        for (i = 1; i < nDims; i++) {
+            pos[i]++;
+            dest += destStride[i] * (ptrdiff_t)nBytes;
+            src += srcStride[i] * (ptrdiff_t)nBytes;
+            if (pos[i] < size[i]) break;
+            dest -= (ptrdiff_t)size[i] * destStride[i] * (ptrdiff_t)nBytes;
+            src -= (ptrdiff_t)size[i] * srcStride[i] * (ptrdiff_t)nBytes;
+            pos[i] = 0;
+        }
+        if (i == nDims) break;
+    }
+}
+
+
+/* Read a chunk file into dest. A chunk that was never written is all
+   zeros. */
+static Ics_Error icsLoadChunk(const Ics_Header *icsStruct,
+                              const size_t     *chunkDims,
+                              const size_t     *coords,
+                              char             *dest)
+{
+    ICSINIT;
+    FILE          *fp;
+    unsigned char *coded;
+    char           name[ICS_MAXPATHLEN];
+    size_t         start[ICS_MAXDIM], extent[ICS_MAXDIM];
+    size_t         n, len, length;
+    ics_t_sint64   end;
+
+
+    n = icsChunkExtent(icsStruct, chunkDims, coords, start, extent);
+    len = n * IcsGetDataTypeSize(icsStruct->imel.dataType);
+    error = icsChunkFileName(name, icsStruct, coords);
+    if (error) return error;
+    fp = IcsFOpen(name, "rb");
+    if (fp == NULL) {
+        if (errno != ENOENT) return IcsErr_FOpenIds;
+        memset(dest, 0, len);
+        return IcsErr_Ok;
+    }
+    if (icsStruct->compression == IcsCompr_gzip) {
+        error = IcsReadZipFile(fp, dest, len, icsStruct);
+    } else if (IcsIsTileCompression(icsStruct->compression)) {
+            /* The chunk is coded as a single tile, its lines being the lines
+               of all its planes */
+        if ((IcsFSeek(fp, 0, SEEK_END) != 0) || ((end = IcsFTell(fp)) < 0)
+            || (IcsFSeek(fp, 0, SEEK_SET) != 0)) {
+            error = IcsErr_FReadIds;
+        } else {
+            length = (size_t)end;
+            coded = (unsigned char*)IcsGetScratch(icsStruct, length);
+            if (coded == NULL) {
+                error = IcsErr_Alloc;
+            } else {
+                if (fread(coded, 1, length, fp) != length) {
+                    error = ferror(fp) ? IcsErr_FReadIds
+                                       : IcsErr_CorruptedStream;
+                }
+                if (!error) {
+                    error = IcsDecodeTile(icsStruct->compression, coded,
+                                          length, icsStruct->imel.dataType,
+                                          extent[0], n / extent[0], dest,
+                                          icsStruct);
+                }
+                IcsReleaseScratch(icsStruct, coded);
+            }
+        }
+    } else if (fread(dest, 1, len, fp) != len) {
+        error = ferror(fp) ? IcsErr_FReadIds : IcsErr_CorruptedStream;
+    }
+    if (fclose(fp) == EOF) {
+        if (!error) error = IcsErr_FCloseIds;
+    }
+
+    return error;
+}
+
+
+/* Write a chunk file, replacing the chunk if it exists. */
+static Ics_Error icsStoreChunk(const Ics_Header *icsStruct,
+                               const size_t     *chunkDims,
+                               const size_t     *coords,
+                               const char       *src)
+{
+    ICSINIT;
+    FILE          *fp;
+    unsigned char *coded;
+    char           name[ICS_MAXPATHLEN];
+    char           tmpname[ICS_MAXPATHLEN + 64];
+    size_t         start[ICS_MAXDIM], extent[ICS_MAXDIM];
+    size_t         n, len, length;
+
+
+    n = icsChunkExtent(icsStruct, chunkDims, coords, start, extent);
+    len = n * IcsGetDataTypeSize(icsStruct->imel.dataType);
+    error = icsChunkFileName(name, icsStruct, coords);
+    if (error) return error;
+
+        /* Write it to a temporary file first, then move it in place */
+    snprintf(tmpname, sizeof(tmpname), "%s.%lu.%lx.tmp", name,
+             (unsigned long)getpid(), (unsigned long)(size_t)&fp);
+    fp = IcsFOpen(tmpname, "wb");
+    if (fp == NULL) return IcsErr_FOpenIds;
+    if (icsStruct->compression == IcsCompr_gzip) {
+        error = IcsWriteZip(src, len, fp, icsStruct->compLevel, NULL, icsStruct);
+    } else if (IcsIsTileCompression(icsStruct->compression)) {
+        coded = (unsigned char*)IcsGetScratch(icsStruct, len + 1);
+        if (coded == NULL) {
+            error = IcsErr_Alloc;
+        } else {
+            error = IcsEncodeTile(icsStruct->compression, src,
+                                  icsStruct->imel.dataType, extent[0],
+                                  n / extent[0], coded, &length, icsStruct);
+            if (!error && fwrite(coded, 1, length, fp) != length) {
+                error = IcsErr_FWriteIds;
+            }
+            IcsReleaseScratch(icsStruct, coded);
+        }
+    } else if (fwrite(src, 1, len, fp) != len) {
+        error = IcsErr_FWriteIds;
+    }
+    if (fclose(fp) == EOF) {
+        if (!error) error = IcsErr_FCloseIds;
+    }
+    if (!error && rename(tmpname, name) != 0) {
+            /* Windows does not replace an existing file */
+        remove(name);
+        if (rename(tmpname, name) != 0) error = IcsErr_FWriteIds;
+    }
+    if (error) remove(tmpname);
+
+    return error;
+}
+
+
+/* Write chunk i of the chunks given in the Ics_ChunkWrite structure, taking
+   its contents from src. */
+static Ics_Error icsWriteChunk(void   *data,
+                               size_t  i)
+{
+    ICSINIT;
+    Ics_ChunkWrite   *cw        = (Ics_ChunkWrite*)data;
+    const Ics_Header *icsStruct = cw->icsStruct;
+    int               p         = icsStruct->dimensions;
+    size_t            coords[ICS_MAXDIM];
+    size_t            start[ICS_MAXDIM], extent[ICS_MAXDIM];
+    size_t            lo[ICS_MAXDIM], size[ICS_MAXDIM];
+    ptrdiff_t         stride[ICS_MAXDIM];
+    size_t            n, nBytes, hi;
+    ptrdiff_t         srcPos    = 0, destPos = 0;
+    int               whole     = 1, j;
+    char             *buf;
+
+
+    for (j = 0; j < p; j++) {
+        coords[j] = cw->first[j] + i % cw->count[j];
+        i /= cw->count[j];
+    }
+    n = icsChunkExtent(icsStruct, cw->chunkDims, coords, start, extent);
+    nBytes = IcsGetDataTypeSize(icsStruct->imel.dataType);
+
+        /* The part of the chunk that is in src */
+    for (j = 0; j < p; j++) {
+        lo[j] = start[j] > cw->offset[j] ? start[j] : cw->offset[j];
+        hi = start[j] + extent[j];
+        if (hi > cw->offset[j] + cw->size[j]) hi = cw->offset[j] + cw->size[j];
+        size[j] = hi - lo[j];
+        whole = whole && (size[j] == extent[j]);
+        stride[j] = j == 0 ? 1 : stride[j - 1] * (ptrdiff_t)extent[j - 1];
+        srcPos += (ptrdiff_t)(lo[j] - cw->offset[j]) * cw->stride[j];
+        destPos += (ptrdiff_t)(lo[j] - start[j]) * stride[j];
+    }
+
+    buf = (char*)IcsGetScratch(icsStruct, n * nBytes);
+    if (buf == NULL) return IcsErr_Alloc;
+    if (!whole && cw->patch) {
+            /* Update the part of the existing chunk */
+        error = icsLoadChunk(icsStruct, cw->chunkDims, coords, buf);
+    }
+    if (!error) {
+        icsCopyRegion(buf + destPos * (ptrdiff_t)nBytes, stride,
+                      cw->src + srcPos * (ptrdiff_t)nBytes, cw->stride, size,
+                      p, nBytes);
+        error = icsStoreChunk(icsStruct, cw->chunkDims, coords, buf);
+    }
+    IcsReleaseScratch(icsStruct, buf);
+
+    return error;
+}
+
+
+/* Write the image data to the chunk directory. Without data only the
+   directory is created. */
+Ics_Error IcsWriteChunks(const Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_ChunkWrite cw;
+    size_t         n = 1;
+    int            i;
+
+
+    error = icsCheckCompression(icsStruct);
+    if (error) return error;
+    if (IcsMkDir(icsStruct->chunkStore) != 0) return IcsErr_FOpenIds;
+    if (icsStruct->data == NULL) return IcsErr_Ok;
+
+    cw.icsStruct = icsStruct;
+    IcsGetChunkDims(icsStruct, cw.chunkDims, cw.count);
+    for (i = 0; i < icsStruct->dimensions; i++) {
+        cw.first[i] = 0;
+        cw.offset[i] = 0;
+        cw.size[i] = icsStruct->dim[i].size;
+        if (icsStruct->dataStrides) {
+            cw.stride[i] = icsStruct->dataStrides[i];
+        } else {
+            cw.stride[i] = i == 0 ? 1 : cw.stride[i - 1]
+                                        * (ptrdiff_t)icsStruct->dim[i - 1].size;
+        }
+        n *= cw.count[i];
+    }
+    cw.src = (const char*)icsStruct->data;
+    cw.patch = 0;
+
+    return IcsParallelFor((Ics_Context*)icsStruct->context, n, icsWriteChunk,
+                          &cw);
+}
+
+
+/* Write a region of the image to the chunk directory the image data is
+   stored in. Only the chunks that overlap the region are rewritten. */
+Ics_Error IcsPutROIData(ICS          *ics,
+                        const size_t *offset,
+                        const size_t *size,
+                        const void   *src,
+                        size_t        n)
+{
+    ICSINIT;
+    Ics_ChunkWrite cw;
+    Ics_ChunkRead *cr;
+    int            byteOrder[ICS_MAX_IMEL_SIZE];
+    size_t         roiSize, nChunks = 1;
+    int            i, nBytes;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+    if (ics->chunkStore[0] == '\0') return IcsErr_NotValidAction;
+
+    nBytes = IcsGetBytesPerSample(ics);
+    IcsFillByteOrder(ics->imel.dataType, nBytes, byteOrder);
+    for (i = 0; i < nBytes; i++) {
+        if (ics->byteOrder[i] != byteOrder[i]) return IcsErr_NotValidAction;
+    }
+    if ((n == 0) || (src == NULL)) return IcsErr_Ok;
+    error = icsCheckCompression(ics);
+    if (error) return error;
+
+    cw.icsStruct = ics;
+    IcsGetChunkDims(ics, cw.chunkDims, NULL);
+    roiSize = (size_t)nBytes;
+    for (i = 0; i < ics->dimensions; i++) {
+        cw.offset[i] = offset != NULL ? offset[i] : 0;
+        if (cw.offset[i] > ics->dim[i].size) return IcsErr_IllegalROI;
+        cw.size[i] = size != NULL ? size[i] : ics->dim[i].size - cw.offset[i];
+        if (cw.offset[i] + cw.size[i] > ics->dim[i].size)
+            return IcsErr_IllegalROI;
+        if (cw.size[i] == 0) return IcsErr_Ok;
+        cw.stride[i] = (ptrdiff_t)(roiSize / (size_t)nBytes);
+        roiSize *= cw.size[i];
+        cw.first[i] = cw.offset[i] / cw.chunkDims[i];
+        cw.count[i] = (cw.offset[i] + cw.size[i] - 1) / cw.chunkDims[i]
+                    - cw.first[i] + 1;
+        nChunks *= cw.count[i];
+    }
+    if (n < roiSize) return IcsErr_BufferTooSmall;
+    cw.src = (const char*)src;
+    cw.patch = 1;
+
+        /* The zone map no longer describes the data */
+    IcsRemoveZoneMap(ics);
+    error = IcsParallelFor((Ics_Context*)ics->context, nChunks, icsWriteChunk,
+                           &cw);
+
+        /* Chunks being read might have changed */
+    if ((ics->blockRead != NULL)
+        && (((Ics_BlockRead*)ics->blockRead)->chunks != NULL)) {
+        cr = (Ics_ChunkRead*)((Ics_BlockRead*)ics->blockRead)->chunks;
+        cr->slab = (size_t)-1;
+    }
+
+    return error;
+}
+
+
+/* Prepare reading from the chunk directory. */
+Ics_Error IcsOpenChunks(Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_ChunkRead *cr;
+    size_t         x;
+    int            i;
+
+
+    for (i = 0; i < icsStruct->dimensions; i++) {
+        if (icsStruct->chunkDims[i] == 0) return IcsErr_CorruptedStream;
+    }
+    error = icsCheckCompression(icsStruct);
+    if (error) return error;
+
+    cr = (Ics_ChunkRead*)IcsGetScratch(icsStruct, sizeof(Ics_ChunkRead));
+    if (cr == NULL) return IcsErr_Alloc;
+    IcsGetChunkDims(icsStruct, cr->chunkDims, cr->nChunks);
+    cr->total = IcsGetDataSize(icsStruct);
+    cr->pos = 0;
+    cr->slab = (size_t)-1;
+    cr->chunkBytes = IcsGetDataTypeSize(icsStruct->imel.dataType);
+    for (i = 0; i < icsStruct->dimensions; i++) {
+        cr->chunkBytes *= cr->chunkDims[i];
+    }
+    cr->slabDims = 1;
+    for (i = 2; i < icsStruct->dimensions; i++) {
+        if (cr->chunkDims[i] > 1) cr->slabDims = i;
+    }
+    cr->slabChunks = 1;
+    for (i = 0; i < cr->slabDims; i++) {
+        cr->slabChunks *= cr->nChunks[i];
+    }
+    cr->buffers = (char**)IcsGetScratch(icsStruct,
+                                        cr->slabChunks * sizeof(char*));
+    cr->loaded = (char*)IcsGetScratch(icsStruct, cr->slabChunks);
+    if ((cr->buffers == NULL) || (cr->loaded == NULL)) {
+        IcsReleaseScratch(icsStruct, cr->buffers);
+        IcsReleaseScratch(icsStruct, cr->loaded);
+        IcsReleaseScratch(icsStruct, cr);
+        return IcsErr_Alloc;
+    }
+    for (x = 0; x < cr->slabChunks; x++) {
+        cr->buffers[x] = NULL;
+    }
+    memset(cr->loaded, 0, cr->slabChunks);
+
+    br->chunks = cr;
+    return error;
+}
+
+
+/* Free the chunk buffers. */
+Ics_Error IcsCloseChunks(Ics_Header *icsStruct)
+{
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_ChunkRead *cr = (Ics_ChunkRead*)br->chunks;
+    size_t         i;
+
+
+    for (i = 0; i < cr->slabChunks; i++) {
+        IcsReleaseScratch(icsStruct, cr->buffers[i]);
+    }
+    IcsReleaseScratch(icsStruct, cr->buffers);
+    IcsReleaseScratch(icsStruct, cr->loaded);
+    IcsReleaseScratch(icsStruct, cr);
+    br->chunks = NULL;
+
+    return IcsErr_Ok;
+}
+
+
+/* Read a data block from the chunk directory. */
+Ics_Error IcsReadChunkBlock(Ics_Header *icsStruct,
+                            void       *outBuf,
+                            size_t      len)
+{
+    ICSINIT;
+    Ics_BlockRead *br     = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_ChunkRead *cr     = (Ics_ChunkRead*)br->chunks;
+    char          *out    = (char*)outBuf;
+    int            p      = icsStruct->dimensions;
+    size_t         nBytes = IcsGetDataTypeSize(icsStruct->imel.dataType);
+    size_t         pos[ICS_MAXDIM], coords[ICS_MAXDIM];
+    size_t         start[ICS_MAXDIM], extent[ICS_MAXDIM];
+    size_t         sample, slab, inChunk, stride, n, x, y;
+    int            i;
+
+
+    while (len > 0) {
+        if (cr->pos >= cr->total) return IcsErr_EndOfStream;
+
+            /* Find the chunk the current position is in */
+        sample = cr->pos / nBytes;
+        for (i = 0; i < p; i++) {
+            pos[i] = sample % icsStruct->dim[i].size;
+            sample /= icsStruct->dim[i].size;
+            coords[i] = pos[i] / cr->chunkDims[i];
+        }
+        slab = 0;
+        for (i = p - 1; i >= cr->slabDims; i--) {
+            slab = slab * cr->nChunks[i] + coords[i];
+        }
+        if (slab != cr->slab) {
+            memset(cr->loaded, 0, cr->slabChunks);
+            cr->slab = slab;
+        }
+        x = 0;
+        for (i = cr->slabDims - 1; i >= 0; i--) {
+            x = x * cr->nChunks[i] + coords[i];
+        }
+        if (!cr->loaded[x]) {
+            if (cr->buffers[x] == NULL) {
+                cr->buffers[x] = (char*)IcsGetScratch(icsStruct,
+                                                      cr->chunkBytes);
+            }
+            if (cr->buffers[x] == NULL) {
+                    /* Over the memory limit, take the buffer of another chunk
+                       in the slab, which is then read again when needed */
+                for (y = 0; y < cr->slabChunks; y++) {
+                    if (cr->buffers[y] != NULL) break;
+                }
+                if (y == cr->slabChunks) return IcsErr_Alloc;
+                cr->buffers[x] = cr->buffers[y];
+                cr->buffers[y] = NULL;
+                cr->loaded[y] = 0;
+            }
+            error = icsLoadChunk(icsStruct, cr->chunkDims, coords,
+                                 cr->buffers[x]);
+            if (error) return error;
+            cr->loaded[x] = 1;
+        }
+
+            /* Copy the rest of the line within this chunk */
+        icsChunkExtent(icsStruct, cr->chunkDims, coords, start, extent);
+        inChunk = 0;
+        stride = 1;
+        for (i = 0; i < p; i++) {
+            inChunk += (pos[i] - start[i]) * stride;
+            stride *= extent[i];
+        }
+        inChunk = inChunk * nBytes + cr->pos % nBytes;
+        n = (start[0] + extent[0] - pos[0]) * nBytes - cr->pos % nBytes;
+        if (n > len) n = len;
+        memcpy(out, cr->buffers[x] + inChunk, n);
+        out += n;
+        len -= n;
+        cr->pos += n;
+    }
+
+    return error;
+}
+
+
+/* Set the read position in the image data. */
+Ics_Error IcsSetChunkBlock(Ics_Header   *icsStruct,
+                           ics_t_sint64  offset,
+                           int           whence)
+{
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_ChunkRead *cr = (Ics_ChunkRead*)br->chunks;
+    size_t         base;
+
+
+    base = whence == SEEK_CUR ? cr->pos : 0;
+    if ((offset < 0) && ((size_t)(-offset) > base)) return IcsErr_IllParameter;
+    base = offset < 0 ? base - (size_t)(-offset) : base + (size_t)offset;
+    if (base > cr->total) return IcsErr_EndOfStream;
+    cr->pos = base;
+
+    return IcsErr_Ok;
+}
@@ -74,8 +74,6 @@
 
 
 #define INIT_BITS 9  /* initial number of bits/code */
-#define HBITS 17     /* 50% occupancy */
-#define HSIZE (1<<HBITS)
 #define BITS  16
 
 
@@ -88,7 +86,7 @@
 }
 #define TAB_PREFIXOF(i)       codeTab[i]
 #define TAB_SUFFIXOF(i)       hTab[i]
-#define DE_STACK              (&(hTab[HSIZE-1]))
+#define DE_STACK              (&(hTab[2 * tabSize - 1]))
 #define CLEAR_TAB_PREFIXOF()  memset(codeTab, 0, 256)
 
 
@@ -118,29 +116,19 @@ Ics_Error IcsReadCompress(Ics_Header *IcsStruct,
     int             maxBits;
     size_t          i;
     size_t          offset;
+    size_t          tabSize;
     unsigned char  *inBuffer   = NULL;
     unsigned char  *hTab    = NULL;
     unsigned short *codeTab = NULL;
 
 
-        /* Dynamically allocate memory that's static in (N)compress. */
-    inBuffer = (unsigned char*)malloc(IBUFSIZ + IBUFXTRA);
+        /* Dynamically allocate memory that's static in (N)compress; with a
+           context the buffers are reused. */
+    inBuffer = (unsigned char*)IcsGetScratch(IcsStruct, IBUFSIZ + IBUFXTRA);
     if (inBuffer == NULL) {
         error = IcsErr_Alloc;
         goto exit;
     }
-        /* Not sure about the size of this thing, original code uses a long int
-           array that's cast to char: */
-    hTab = (unsigned char*)malloc(HSIZE * 4);
-    if (hTab == NULL) {
-        error = IcsErr_Alloc;
-        goto exit;
-    }
-    codeTab = (unsigned short*)malloc(HSIZE * sizeof(unsigned short));
-    if (codeTab == NULL) {
-        error = IcsErr_Alloc;
-        goto exit;
-    }
 
     if ((rSize = fread(inBuffer, 1, IBUFSIZ, br->dataFilePtr)) <= 0) {
         error = IcsErr_FReadIds;
@@ -160,6 +148,21 @@ Ics_Error IcsReadCompress(Ics_Header *IcsStruct,
         goto exit;
     }
 
+        /* The tables only need an entry per code of maxBits bits; hTab holds
+           the suffixes followed by the stack of decoded characters. */
+    tabSize = (size_t)MAXCODE(maxBits < INIT_BITS ? INIT_BITS : maxBits);
+    hTab = (unsigned char*)IcsGetScratch(IcsStruct, 2 * tabSize);
+    if (hTab == NULL) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+    codeTab = (unsigned short*)IcsGetScratch(IcsStruct,
+                                              tabSize * sizeof(unsigned short));
+    if (codeTab == NULL) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+
     maxCode = MAXCODE(nBits = INIT_BITS) - 1;
     bitMask = (1 << nBits) - 1;
     oldCode = -1;
@@ -288,8 +291,8 @@ Ics_Error IcsReadCompress(Ics_Header *IcsStruct,
     }
 
   exit:
-    if (inBuffer) free(inBuffer);
-    if (hTab) free(hTab);
-    if (codeTab) free(codeTab);
+    IcsReleaseScratch(IcsStruct, inBuffer);
+    IcsReleaseScratch(IcsStruct, hTab);
+    IcsReleaseScratch(IcsStruct, codeTab);
     return error;
 }
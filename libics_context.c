@@ -0,0 +1,527 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * FILE : libics_context.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsNewContext()
+ *   IcsNewContextWithAllocator()
+ *   IcsFreeContext()
+ *   IcsSetContext()
+ *   IcsSetMemoryLimit()
+ *   IcsGetMemoryUsage()
+ *   IcsSetContextMemoryLimit()
+ *   IcsGetContextMemoryUsage()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsGetContextThreads()
+ *   IcsContextAlloc()
+ *   IcsContextFree()
+ *   IcsGetScratch()
+ *   IcsReleaseScratch()
+ *
+ * An execution context shared by several ICS handles. It limits the number of
+ * threads used by the parallel loops and background jobs of those handles,
+ * keeps their worker threads alive between calls (see libics_thread.c), and
+ * recycles the scratch buffers they need, so that repeated reads and writes
+ * do not allocate memory once the buffers have been created. Scratch buffers
+ * are kept in free lists by size class (powers of two, at least
+ * ICS_SCRATCH_MIN bytes); the lists are protected by the memory lock of the
+ * context (see IcsLockMemory()), as are the memory counters. Memory is
+ * obtained through the allocator given when creating the context, or through
+ * malloc(). Without a context, scratch buffers are simply malloc()ed and
+ * free()d.
+ *
+ * The memory of the scratch buffers is accounted to the handle they are taken
+ * for, and the memory obtained from the allocator to the context (including
+ * the buffers kept in its free lists), each with a peak value and an optional
+ * limit. A buffer that would exceed a limit is not allocated: IcsGetScratch()
+ * returns NULL, as if out of memory, after a context has first given its free
+ * buffers back to the allocator. Callers that can do with less memory then
+ * fall back to smaller buffers.
+ */
+
+
+#include <stdlib.h>
+#include "libics_intern.h"
+
+
+/* Smallest scratch buffer, as a power of two. */
+#define ICS_SCRATCH_MIN_BITS 12
+#define ICS_SCRATCH_MIN      ((size_t)1 << ICS_SCRATCH_MIN_BITS)
+
+
+/* Header in front of each scratch buffer, and of the memory allocated through
+   a context; the union keeps the buffer suitably aligned. */
+typedef union Ics_Scratch_ {
+    struct {
+        union Ics_Scratch_ *next;      /* next buffer in the free list */
+        size_t              size;      /* bytes following the header */
+    } h;
+    double                  d;
+    void                   *p;
+    ics_t_uint64            u;
+} Ics_Scratch;
+
+
+/* Add size bytes to the memory in use of a handle or context, unless that
+   exceeds limit (0 for none). Must be called with the memory lock held. */
+static int icsCharge(size_t *inUse,
+                     size_t *peak,
+                     size_t  limit,
+                     size_t  size)
+{
+    if ((limit > 0) && ((*inUse > limit) || (size > limit - *inUse))) return 0;
+    *inUse += size;
+    if (*peak < *inUse) *peak = *inUse;
+    return 1;
+}
+
+
+/* Give a buffer allocated with icsAllocMemory() back to the allocator. The
+   caller discounts it. A user allocator is called with the job lock held, as
+   the worker threads allocate too. */
+static void icsFreeMemory(Ics_Context *context,
+                          Ics_Scratch *buf)
+{
+    if ((context != NULL) && (context->freeFunc != NULL)) {
+        IcsLockJobs();
+        context->freeFunc(context->userData, buf);
+        IcsUnlockJobs();
+    } else {
+        free(buf);
+    }
+}
+
+
+/* Give the buffers in the free lists of a context back to its allocator. */
+static void icsTrimScratch(Ics_Context *context)
+{
+    Ics_Scratch *buf;
+    Ics_Scratch *spare = NULL;
+    int          i;
+
+
+    IcsLockMemory(context);
+    for (i = 0; i < ICS_SCRATCH_CLASSES; i++) {
+        while (context->scratch[i] != NULL) {
+            buf = (Ics_Scratch*)context->scratch[i];
+            context->scratch[i] = buf->h.next;
+            context->memoryInUse -= sizeof(Ics_Scratch) + buf->h.size;
+            buf->h.next = spare;
+            spare = buf;
+        }
+    }
+    IcsUnlockMemory(context);
+    while (spare != NULL) {
+        buf = spare;
+        spare = buf->h.next;
+        icsFreeMemory(context, buf);
+    }
+}
+
+
+/* Allocate a buffer of size bytes after a header, from the allocator of the
+   context and accounted to it. When that would exceed the limit of the
+   context, the buffers in its free lists are freed first. */
+static Ics_Scratch *icsAllocMemory(Ics_Context *context,
+                                   size_t       size)
+{
+    Ics_Scratch *buf;
+    size_t       bytes = sizeof(Ics_Scratch) + size;
+    int          fits;
+
+
+    if (context != NULL) {
+        IcsLockMemory(context);
+        fits = icsCharge(&context->memoryInUse, &context->memoryPeak,
+                         context->memoryLimit, bytes);
+        IcsUnlockMemory(context);
+        if (!fits) {
+            icsTrimScratch(context);
+            IcsLockMemory(context);
+            fits = icsCharge(&context->memoryInUse, &context->memoryPeak,
+                             context->memoryLimit, bytes);
+            IcsUnlockMemory(context);
+        }
+        if (!fits) return NULL;
+    }
+
+    if ((context != NULL) && (context->allocFunc != NULL)) {
+        IcsLockJobs();
+        buf = (Ics_Scratch*)context->allocFunc(context->userData, bytes);
+        IcsUnlockJobs();
+    } else {
+        buf = (Ics_Scratch*)malloc(bytes);
+    }
+    if (buf == NULL) {
+        if (context != NULL) {
+            IcsLockMemory(context);
+            context->memoryInUse -= bytes;
+            IcsUnlockMemory(context);
+        }
+        return NULL;
+    }
+    buf->h.next = NULL;
+    buf->h.size = size;
+
+    return buf;
+}
+
+
+/* Create a context that uses at most nThreads threads (all processors if
+   nThreads <= 0) and malloc() to allocate memory. */
+Ics_Error IcsNewContext(Ics_Context **context,
+                        int           nThreads)
+{
+    return IcsNewContextWithAllocator(context, nThreads, NULL, NULL, NULL);
+}
+
+
+/* Create a context that uses at most nThreads threads and allocFunc and
+   freeFunc to allocate memory. */
+Ics_Error IcsNewContextWithAllocator(Ics_Context   **context,
+                                     int             nThreads,
+                                     Ics_AllocFunc   allocFunc,
+                                     Ics_FreeFunc    freeFunc,
+                                     void           *userData)
+{
+    ICSINIT;
+    Ics_Context *ctx;
+    int          i;
+
+
+    if (context == NULL) return IcsErr_IllParameter;
+    *context = NULL;
+    if ((allocFunc == NULL) != (freeFunc == NULL)) return IcsErr_IllParameter;
+
+    if (allocFunc != NULL) {
+        ctx = (Ics_Context*)allocFunc(userData, sizeof(Ics_Context));
+    } else {
+        ctx = (Ics_Context*)malloc(sizeof(Ics_Context));
+    }
+    if (ctx == NULL) return IcsErr_Alloc;
+    if (nThreads <= 0 || nThreads > IcsGetNumThreads()) {
+        nThreads = IcsGetNumThreads();
+    }
+    ctx->nThreads = nThreads;
+    ctx->allocFunc = allocFunc;
+    ctx->freeFunc = freeFunc;
+    ctx->userData = userData;
+    ctx->memoryInUse = 0;
+    ctx->memoryPeak = 0;
+    ctx->memoryLimit = 0;
+    for (i = 0; i < ICS_SCRATCH_CLASSES; i++) {
+        ctx->scratch[i] = NULL;
+    }
+    ctx->jobs.first = NULL;
+    ctx->jobs.last = NULL;
+    ctx->jobs.spare = NULL;
+    ctx->jobs.nQueued = 0;
+    ctx->jobs.nWorkers = 0;
+    ctx->jobs.nIdle = 0;
+    ctx->jobs.stop = 0;
+    *context = ctx;
+
+    return error;
+}
+
+
+/* Stop the worker threads of the context and free all its memory. The
+   handles using the context must have been closed, and all its asynchronous
+   reads finished. */
+Ics_Error IcsFreeContext(Ics_Context *context)
+{
+    ICSINIT;
+
+
+    if (context == NULL) return IcsErr_IllParameter;
+
+    IcsStopJobs(context);
+    icsTrimScratch(context);
+    if (context->freeFunc != NULL) {
+        context->freeFunc(context->userData, context);
+    } else {
+        free(context);
+    }
+
+    return error;
+}
+
+
+/* Let an ICS handle use a context, or no context if context is NULL. */
+Ics_Error IcsSetContext(ICS         *ics,
+                        Ics_Context *context)
+{
+    ICSINIT;
+
+
+    if (ics == NULL) return IcsErr_NotValidAction;
+        /* Buffers of an open data stream belong to the old context */
+    if (ics->blockRead != NULL) return IcsErr_NotValidAction;
+        /* And so do the asynchronous reads */
+    if (ics->asyncReads != NULL) return IcsErr_NotValidAction;
+
+    ics->context = context;
+
+    return error;
+}
+
+
+/* Limit the memory of the internal buffers of an ICS handle to limit bytes,
+   or remove the limit if limit is 0. */
+Ics_Error IcsSetMemoryLimit(ICS    *ics,
+                            size_t  limit)
+{
+    ICSINIT;
+
+
+    if (ics == NULL) return IcsErr_NotValidAction;
+
+    IcsLockMemory((Ics_Context*)ics->context);
+    ics->memoryLimit = limit;
+    IcsUnlockMemory((Ics_Context*)ics->context);
+
+    return error;
+}
+
+
+/* Get the memory currently used by the internal buffers of an ICS handle, and
+   the most it has used at once. Either pointer can be NULL. */
+Ics_Error IcsGetMemoryUsage(const ICS *ics,
+                            size_t    *inUse,
+                            size_t    *peak)
+{
+    ICSINIT;
+
+
+    if (ics == NULL) return IcsErr_NotValidAction;
+
+    IcsLockMemory((Ics_Context*)ics->context);
+    if (inUse != NULL) *inUse = ics->memoryInUse;
+    if (peak != NULL) *peak = ics->memoryPeak;
+    IcsUnlockMemory((Ics_Context*)ics->context);
+
+    return error;
+}
+
+
+/* Limit the memory a context obtains from its allocator to limit bytes, or
+   remove the limit if limit is 0. Setting a limit frees the buffers in the
+   free lists. */
+Ics_Error IcsSetContextMemoryLimit(Ics_Context *context,
+                                   size_t       limit)
+{
+    ICSINIT;
+
+
+    if (context == NULL) return IcsErr_IllParameter;
+
+    IcsLockMemory(context);
+    context->memoryLimit = limit;
+    IcsUnlockMemory(context);
+    if (limit > 0) icsTrimScratch(context);
+
+    return error;
+}
+
+
+/* Get the memory a context currently holds, including the scratch buffers in
+   its free lists, and the most it has held at once. Either pointer can be
+   NULL. */
+Ics_Error IcsGetContextMemoryUsage(const Ics_Context *context,
+                                   size_t            *inUse,
+                                   size_t            *peak)
+{
+    ICSINIT;
+
+
+    if (context == NULL) return IcsErr_IllParameter;
+
+    IcsLockMemory(context);
+    if (inUse != NULL) *inUse = context->memoryInUse;
+    if (peak != NULL) *peak = context->memoryPeak;
+    IcsUnlockMemory(context);
+
+    return error;
+}
+
+
+/* The number of threads used for parallel loops and background jobs in a
+   context. */
+int IcsGetContextThreads(const Ics_Context *context)
+{
+    return context != NULL ? context->nThreads : IcsGetNumThreads();
+}
+
+
+/* Allocate memory with the allocator of a context, accounted to the context.
+   Returns NULL if out of memory or over the limit of the context. */
+void *IcsContextAlloc(Ics_Context *context,
+                      size_t       size)
+{
+    Ics_Scratch *buf;
+
+
+    if (context == NULL) return malloc(size);
+
+    buf = icsAllocMemory(context, size);
+    return buf != NULL ? buf + 1 : NULL;
+}
+
+
+/* Free memory allocated with IcsContextAlloc(). */
+void IcsContextFree(Ics_Context *context,
+                    void        *ptr)
+{
+    Ics_Scratch *buf;
+
+
+    if (ptr == NULL) return;
+    if (context == NULL) {
+        free(ptr);
+        return;
+    }
+
+    buf = (Ics_Scratch*)ptr - 1;
+    IcsLockMemory(context);
+    context->memoryInUse -= sizeof(Ics_Scratch) + buf->h.size;
+    IcsUnlockMemory(context);
+    icsFreeMemory(context, buf);
+}
+
+
+/* Get a scratch buffer of at least size bytes for an ICS handle, to be given
+   back with IcsReleaseScratch(). With a context the buffer comes from its free
+   lists. Returns NULL if out of memory or over the limit of the handle or the
+   context. */
+void *IcsGetScratch(const Ics_Header *ics,
+                    size_t            size)
+{
+        /* The usage counters change also for a handle we only read from */
+    Ics_Header  *handle    = (Ics_Header*)ics;
+    Ics_Header  *owner     = NULL;
+    Ics_Context *context   = NULL;
+    Ics_Scratch *buf       = NULL;
+    size_t       sizeClass = 0;
+    int          fits      = 1;
+
+
+    if (ics != NULL) context = (Ics_Context*)ics->context;
+    if (context != NULL) {
+        while ((ICS_SCRATCH_MIN << sizeClass) < size) {
+            sizeClass++;
+            if (sizeClass >= ICS_SCRATCH_CLASSES) return NULL;
+        }
+        size = ICS_SCRATCH_MIN << sizeClass;
+    } else if (size == 0) {
+        size = 1;
+    }
+
+    IcsLockMemory(context);
+    if (handle != NULL) {
+        fits = icsCharge(&handle->memoryInUse, &handle->memoryPeak,
+                         handle->memoryLimit, sizeof(Ics_Scratch) + size);
+        owner = (Ics_Header*)handle->memoryOwner;
+        if (fits && (owner != NULL) &&
+            !icsCharge(&owner->memoryInUse, &owner->memoryPeak,
+                       owner->memoryLimit, sizeof(Ics_Scratch) + size)) {
+            handle->memoryInUse -= sizeof(Ics_Scratch) + size;
+            fits = 0;
+        }
+    }
+    if (fits && (context != NULL)) {
+        buf = (Ics_Scratch*)context->scratch[sizeClass];
+        if (buf != NULL) context->scratch[sizeClass] = buf->h.next;
+    }
+    IcsUnlockMemory(context);
+    if (!fits) return NULL;
+    if (buf == NULL) {
+        buf = icsAllocMemory(context, size);
+        if (buf == NULL) {
+            if (handle != NULL) {
+                IcsLockMemory(context);
+                handle->memoryInUse -= sizeof(Ics_Scratch) + size;
+                owner = (Ics_Header*)handle->memoryOwner;
+                if (owner != NULL) {
+                    owner->memoryInUse -= sizeof(Ics_Scratch) + size;
+                }
+                IcsUnlockMemory(context);
+            }
+            return NULL;
+        }
+    }
+
+    return buf + 1;
+}
+
+
+/* Give back a buffer obtained with IcsGetScratch() for the same handle. */
+void IcsReleaseScratch(const Ics_Header *ics,
+                       void             *ptr)
+{
+    Ics_Header  *handle    = (Ics_Header*)ics;
+    Ics_Header  *owner;
+    Ics_Context *context   = NULL;
+    Ics_Scratch *buf;
+    size_t       sizeClass = 0;
+
+
+    if (ptr == NULL) return;
+
+    buf = (Ics_Scratch*)ptr - 1;
+    if (ics != NULL) context = (Ics_Context*)ics->context;
+    if (context != NULL) {
+        while ((ICS_SCRATCH_MIN << sizeClass) < buf->h.size) {
+            sizeClass++;
+        }
+    }
+    IcsLockMemory(context);
+    if (handle != NULL) {
+        handle->memoryInUse -= sizeof(Ics_Scratch) + buf->h.size;
+        owner = (Ics_Header*)handle->memoryOwner;
+        if (owner != NULL) {
+            owner->memoryInUse -= sizeof(Ics_Scratch) + buf->h.size;
+        }
+    }
+    if (context != NULL) {
+        buf->h.next = (Ics_Scratch*)context->scratch[sizeClass];
+        context->scratch[sizeClass] = buf;
+    }
+    IcsUnlockMemory(context);
+    if (context == NULL) free(buf);
+}
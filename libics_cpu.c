@@ -0,0 +1,1020 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_cpu.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsGetCpuLevel()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsGetKernels()
+ *
+ * The inner loops that dominate reading and writing (byte swapping, the min/max
+ * search of the preview, copying samples from and to strided buffers, summing
+ * rows for thumbnails) come in
+ * several versions, each compiled for a specific instruction set with a
+ * per-function target attribute, so that a generic build of the library still
+ * uses the vector units of the machine it runs on. The best version supported
+ * by the CPU is selected the first time a kernel is needed. The environment
+ * variable ICS_CPU_LEVEL ("generic", "sse4.2", "avx2", "avx512" or "neon")
+ * lowers the level, which is useful for testing and benchmarking; it cannot
+ * select instructions the CPU does not have.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__))
+#define ICS_CPU_X86
+#define ICS_TARGET(t) __attribute__((target(t)))
+#include <immintrin.h>
+#elif (defined(_M_X64) || defined(_M_IX86)) \
+    && defined(_MSC_VER) && _MSC_VER >= 1900
+#define ICS_CPU_X86
+#define ICS_TARGET(t)
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ICS_CPU_NEON
+#include <arm_neon.h>
+#endif
+
+
+static const char *const icsCpuLevelNames[] = {
+    "generic", "sse4.2", "avx2", "avx512", "neon"
+};
+
+
+/*
+ * Generic versions, written such that the compiler can vectorize them for the
+ * baseline instruction set.
+ */
+
+static void icsSwapBytesGeneric(void   *buf,
+                                size_t  n,
+                                size_t  size)
+{
+    unsigned char *p = (unsigned char*)buf;
+    size_t         i;
+
+
+    switch (size) {
+        case 2:
+            for (i = 0; i < n; i++, p += 2) {
+                unsigned char t = p[0];
+                p[0] = p[1];
+                p[1] = t;
+            }
+            break;
+        case 4:
+            for (i = 0; i < n; i++, p += 4) {
+                ics_t_uint32 v;
+                memcpy(&v, p, 4);
+                v = (v >> 24) | ((v >> 8) & 0xff00u) | ((v << 8) & 0xff0000u)
+                    | (v << 24);
+                memcpy(p, &v, 4);
+            }
+            break;
+        case 8:
+            for (i = 0; i < n; i++, p += 8) {
+                ics_t_uint32 lo, hi;
+                memcpy(&lo, p, 4);
+                memcpy(&hi, p + 4, 4);
+                lo = (lo >> 24) | ((lo >> 8) & 0xff00u)
+                    | ((lo << 8) & 0xff0000u) | (lo << 24);
+                hi = (hi >> 24) | ((hi >> 8) & 0xff00u)
+                    | ((hi << 8) & 0xff0000u) | (hi << 24);
+                memcpy(p, &hi, 4);
+                memcpy(p + 4, &lo, 4);
+            }
+            break;
+    }
+}
+
+
+static void icsMinMaxUint8Generic(const ics_t_uint8 *buf,
+                                  size_t             n,
+                                  ics_t_uint8       *min,
+                                  ics_t_uint8       *max)
+{
+    ics_t_uint8 lo = buf[0], hi = buf[0];
+    size_t      i;
+
+
+    for (i = 1; i < n; i++) {
+        if (lo > buf[i]) lo = buf[i];
+        if (hi < buf[i]) hi = buf[i];
+    }
+    *min = lo;
+    *max = hi;
+}
+
+
+static void icsMinMaxUint16Generic(const ics_t_uint16 *buf,
+                                   size_t              n,
+                                   ics_t_uint16       *min,
+                                   ics_t_uint16       *max)
+{
+    ics_t_uint16 lo = buf[0], hi = buf[0];
+    size_t       i;
+
+
+    for (i = 1; i < n; i++) {
+        if (lo > buf[i]) lo = buf[i];
+        if (hi < buf[i]) hi = buf[i];
+    }
+    *min = lo;
+    *max = hi;
+}
+
+
+static void icsScatterGeneric(char       *dest,
+                              ptrdiff_t   stride,
+                              const char *src,
+                              size_t      n,
+                              size_t      size)
+{
+    size_t i;
+
+
+        /* Fixed-size copies compile to single loads and stores. */
+    switch (size) {
+        case 1:
+            for (i = 0; i < n; i++, dest += stride) *dest = src[i];
+            break;
+        case 2:
+            for (i = 0; i < n; i++, dest += stride, src += 2)
+                memcpy(dest, src, 2);
+            break;
+        case 4:
+            for (i = 0; i < n; i++, dest += stride, src += 4)
+                memcpy(dest, src, 4);
+            break;
+        case 8:
+            for (i = 0; i < n; i++, dest += stride, src += 8)
+                memcpy(dest, src, 8);
+            break;
+        default:
+            for (i = 0; i < n; i++, dest += stride, src += size)
+                memcpy(dest, src, size);
+            break;
+    }
+}
+
+
+static void icsGatherGeneric(char       *dest,
+                             const char *src,
+                             ptrdiff_t   stride,
+                             size_t      n,
+                             size_t      size)
+{
+    size_t i;
+
+
+    switch (size) {
+        case 1:
+            for (i = 0; i < n; i++, src += stride) dest[i] = *src;
+            break;
+        case 2:
+            for (i = 0; i < n; i++, src += stride, dest += 2)
+                memcpy(dest, src, 2);
+            break;
+        case 4:
+            for (i = 0; i < n; i++, src += stride, dest += 4)
+                memcpy(dest, src, 4);
+            break;
+        case 8:
+            for (i = 0; i < n; i++, src += stride, dest += 8)
+                memcpy(dest, src, 8);
+            break;
+        default:
+            for (i = 0; i < n; i++, src += stride, dest += size)
+                memcpy(dest, src, size);
+            break;
+    }
+}
+
+
+static void icsAccumulateUint8Generic(float             *acc,
+                                      const ics_t_uint8 *src,
+                                      size_t             n)
+{
+    size_t i;
+
+
+    for (i = 0; i < n; i++) acc[i] += (float)src[i];
+}
+
+
+static void icsAccumulateUint16Generic(float              *acc,
+                                       const ics_t_uint16 *src,
+                                       size_t              n)
+{
+    size_t i;
+
+
+    for (i = 0; i < n; i++) acc[i] += (float)src[i];
+}
+
+
+#ifdef ICS_CPU_X86
+
+/* Byte shuffle that reverses each group of 2, 4 or 8 bytes in 16 bytes. */
+static const char icsSwapMask[3][16] = {
+    {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8}
+};
+
+
+static int icsSwapMaskIndex(size_t size)
+{
+    return size == 2 ? 0 : size == 4 ? 1 : 2;
+}
+
+
+/*
+ * SSE4.2 versions.
+ */
+
+ICS_TARGET("sse4.2")
+static void icsSwapBytesSse42(void   *buf,
+                              size_t  n,
+                              size_t  size)
+{
+    char    *p = (char*)buf;
+    size_t   i, len = n * size;
+    __m128i  mask;
+
+
+    mask = _mm_loadu_si128((const __m128i*)icsSwapMask[icsSwapMaskIndex(size)]);
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        _mm_storeu_si128((__m128i*)(p + i), _mm_shuffle_epi8(v, mask));
+    }
+    icsSwapBytesGeneric(p + i, (len - i) / size, size);
+}
+
+
+ICS_TARGET("sse4.2")
+static void icsMinMaxUint8Sse42(const ics_t_uint8 *buf,
+                                size_t             n,
+                                ics_t_uint8       *min,
+                                ics_t_uint8       *max)
+{
+    size_t      i;
+    __m128i     lo, hi;
+    ics_t_uint8 l[16], h[16];
+    ics_t_uint8 a, b;
+
+
+    if (n < 16) {
+        icsMinMaxUint8Generic(buf, n, min, max);
+        return;
+    }
+    lo = hi = _mm_loadu_si128((const __m128i*)buf);
+    for (i = 16; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+        lo = _mm_min_epu8(lo, v);
+        hi = _mm_max_epu8(hi, v);
+    }
+    _mm_storeu_si128((__m128i*)l, lo);
+    _mm_storeu_si128((__m128i*)h, hi);
+    icsMinMaxUint8Generic(l, 16, min, &a);
+    icsMinMaxUint8Generic(h, 16, &a, max);
+    if (i < n) {
+        icsMinMaxUint8Generic(buf + i, n - i, &a, &b);
+        if (*min > a) *min = a;
+        if (*max < b) *max = b;
+    }
+}
+
+
+ICS_TARGET("sse4.2")
+static void icsMinMaxUint16Sse42(const ics_t_uint16 *buf,
+                                 size_t              n,
+                                 ics_t_uint16       *min,
+                                 ics_t_uint16       *max)
+{
+    size_t       i;
+    __m128i      lo, hi;
+    ics_t_uint16 l[8], h[8];
+    ics_t_uint16 a, b;
+
+
+    if (n < 8) {
+        icsMinMaxUint16Generic(buf, n, min, max);
+        return;
+    }
+    lo = hi = _mm_loadu_si128((const __m128i*)buf);
+    for (i = 8; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+        lo = _mm_min_epu16(lo, v);
+        hi = _mm_max_epu16(hi, v);
+    }
+    _mm_storeu_si128((__m128i*)l, lo);
+    _mm_storeu_si128((__m128i*)h, hi);
+    icsMinMaxUint16Generic(l, 8, min, &a);
+    icsMinMaxUint16Generic(h, 8, &a, max);
+    if (i < n) {
+        icsMinMaxUint16Generic(buf + i, n - i, &a, &b);
+        if (*min > a) *min = a;
+        if (*max < b) *max = b;
+    }
+}
+
+
+ICS_TARGET("sse4.2")
+static void icsAccumulateUint8Sse42(float             *acc,
+                                    const ics_t_uint8 *src,
+                                    size_t             n)
+{
+    size_t i;
+    int    w;
+
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v;
+        memcpy(&w, src + i, 4);
+        v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(w));
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                          _mm_cvtepi32_ps(v)));
+    }
+    icsAccumulateUint8Generic(acc + i, src + i, n - i);
+}
+
+
+ICS_TARGET("sse4.2")
+static void icsAccumulateUint16Sse42(float              *acc,
+                                     const ics_t_uint16 *src,
+                                     size_t              n)
+{
+    size_t i;
+
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_cvtepu16_epi32(
+            _mm_loadl_epi64((const __m128i*)(src + i)));
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                          _mm_cvtepi32_ps(v)));
+    }
+    icsAccumulateUint16Generic(acc + i, src + i, n - i);
+}
+
+
+/*
+ * AVX2 versions.
+ */
+
+ICS_TARGET("avx2")
+static void icsSwapBytesAvx2(void   *buf,
+                             size_t  n,
+                             size_t  size)
+{
+    char    *p = (char*)buf;
+    size_t   i, len = n * size;
+    __m256i  mask;
+
+
+        /* The shuffle works within 128-bit lanes, so the mask is repeated. */
+    mask = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)icsSwapMask[icsSwapMaskIndex(size)]));
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        _mm256_storeu_si256((__m256i*)(p + i), _mm256_shuffle_epi8(v, mask));
+    }
+    icsSwapBytesGeneric(p + i, (len - i) / size, size);
+}
+
+
+ICS_TARGET("avx2")
+static void icsMinMaxUint8Avx2(const ics_t_uint8 *buf,
+                               size_t             n,
+                               ics_t_uint8       *min,
+                               ics_t_uint8       *max)
+{
+    size_t      i;
+    __m256i     lo, hi;
+    ics_t_uint8 l[32], h[32];
+    ics_t_uint8 a, b;
+
+
+    if (n < 32) {
+        icsMinMaxUint8Generic(buf, n, min, max);
+        return;
+    }
+    lo = hi = _mm256_loadu_si256((const __m256i*)buf);
+    for (i = 32; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buf + i));
+        lo = _mm256_min_epu8(lo, v);
+        hi = _mm256_max_epu8(hi, v);
+    }
+    _mm256_storeu_si256((__m256i*)l, lo);
+    _mm256_storeu_si256((__m256i*)h, hi);
+    icsMinMaxUint8Generic(l, 32, min, &a);
+    icsMinMaxUint8Generic(h, 32, &a, max);
+    if (i < n) {
+        icsMinMaxUint8Generic(buf + i, n - i, &a, &b);
+        if (*min > a) *min = a;
+        if (*max < b) *max = b;
+    }
+}
+
+
+ICS_TARGET("avx2")
+static void icsMinMaxUint16Avx2(const ics_t_uint16 *buf,
+                                size_t              n,
+                                ics_t_uint16       *min,
+                                ics_t_uint16       *max)
+{
+    size_t       i;
+    __m256i      lo, hi;
+    ics_t_uint16 l[16], h[16];
+    ics_t_uint16 a, b;
+
+
+    if (n < 16) {
+        icsMinMaxUint16Generic(buf, n, min, max);
+        return;
+    }
+    lo = hi = _mm256_loadu_si256((const __m256i*)buf);
+    for (i = 16; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buf + i));
+        lo = _mm256_min_epu16(lo, v);
+        hi = _mm256_max_epu16(hi, v);
+    }
+    _mm256_storeu_si256((__m256i*)l, lo);
+    _mm256_storeu_si256((__m256i*)h, hi);
+    icsMinMaxUint16Generic(l, 16, min, &a);
+    icsMinMaxUint16Generic(h, 16, &a, max);
+    if (i < n) {
+        icsMinMaxUint16Generic(buf + i, n - i, &a, &b);
+        if (*min > a) *min = a;
+        if (*max < b) *max = b;
+    }
+}
+
+
+/* Gather 4- and 8-byte samples with the AVX2 gather instructions, as long as
+   the byte offsets within one vector fit in 32 bits. */
+ICS_TARGET("avx2")
+static void icsGatherAvx2(char       *dest,
+                          const char *src,
+                          ptrdiff_t   stride,
+                          size_t      n,
+                          size_t      size)
+{
+    size_t  i = 0;
+    __m256i index;
+    __m128i index4;
+
+
+    if (size == 4 && stride > -(1 << 27) && stride < (1 << 27)) {
+        index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                   _mm256_set1_epi32((int)stride));
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_si256((__m256i*)dest,
+                                _mm256_i32gather_epi32((const int*)src, index,
+                                                       1));
+            src += 8 * stride;
+            dest += 32;
+        }
+    } else if (size == 8 && stride > -(1 << 28) && stride < (1 << 28)) {
+        index4 = _mm_mullo_epi32(_mm_setr_epi32(0, 1, 2, 3),
+                                 _mm_set1_epi32((int)stride));
+        for (; i + 4 <= n; i += 4) {
+            _mm256_storeu_si256((__m256i*)dest,
+                                _mm256_i32gather_epi64((const long long*)src,
+                                                       index4, 1));
+            src += 4 * stride;
+            dest += 32;
+        }
+    }
+    icsGatherGeneric(dest, src, stride, n - i, size);
+}
+
+
+ICS_TARGET("avx2")
+static void icsAccumulateUint8Avx2(float             *acc,
+                                   const ics_t_uint8 *src,
+                                   size_t             n)
+{
+    size_t i;
+
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i*)(src + i)));
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                                _mm256_cvtepi32_ps(v)));
+    }
+    icsAccumulateUint8Generic(acc + i, src + i, n - i);
+}
+
+
+ICS_TARGET("avx2")
+static void icsAccumulateUint16Avx2(float              *acc,
+                                    const ics_t_uint16 *src,
+                                    size_t              n)
+{
+    size_t i;
+
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu16_epi32(
+            _mm_loadu_si128((const __m128i*)(src + i)));
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                                _mm256_cvtepi32_ps(v)));
+    }
+    icsAccumulateUint16Generic(acc + i, src + i, n - i);
+}
+
+
+/*
+ * AVX-512 versions (AVX-512F and AVX-512BW).
+ */
+
+ICS_TARGET("avx512f,avx512bw")
+static void icsSwapBytesAvx512(void   *buf,
+                               size_t  n,
+                               size_t  size)
+{
+    char    *p = (char*)buf;
+    size_t   i, len = n * size;
+    __m512i  mask;
+
+
+    mask = _mm512_broadcast_i32x4(
+        _mm_loadu_si128((const __m128i*)icsSwapMask[icsSwapMaskIndex(size)]));
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(p + i));
+        _mm512_storeu_si512((void*)(p + i), _mm512_shuffle_epi8(v, mask));
+    }
+    icsSwapBytesGeneric(p + i, (len - i) / size, size);
+}
+
+
+ICS_TARGET("avx512f,avx512bw")
+static void icsMinMaxUint8Avx512(const ics_t_uint8 *buf,
+                                 size_t             n,
+                                 ics_t_uint8       *min,
+                                 ics_t_uint8       *max)
+{
+    size_t      i;
+    __m512i     lo, hi;
+    ics_t_uint8 l[64], h[64];
+    ics_t_uint8 a, b;
+
+
+    if (n < 64) {
+        icsMinMaxUint8Generic(buf, n, min, max);
+        return;
+    }
+    lo = hi = _mm512_loadu_si512((const void*)buf);
+    for (i = 64; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(buf + i));
+        lo = _mm512_min_epu8(lo, v);
+        hi = _mm512_max_epu8(hi, v);
+    }
+    _mm512_storeu_si512((void*)l, lo);
+    _mm512_storeu_si512((void*)h, hi);
+    icsMinMaxUint8Generic(l, 64, min, &a);
+    icsMinMaxUint8Generic(h, 64, &a, max);
+    if (i < n) {
+        icsMinMaxUint8Generic(buf + i, n - i, &a, &b);
+        if (*min > a) *min = a;
+        if (*max < b) *max = b;
+    }
+}
+
+
+ICS_TARGET("avx512f,avx512bw")
+static void icsMinMaxUint16Avx512(const ics_t_uint16 *buf,
+                                  size_t              n,
+                                  ics_t_uint16       *min,
+                                  ics_t_uint16       *max)
+{
+    size_t       i;
+    __m512i      lo, hi;
+    ics_t_uint16 l[32], h[32];
+    ics_t_uint16 a, b;
+
+
+    if (n < 32) {
+        icsMinMaxUint16Generic(buf, n, min, max);
+        return;
+    }
+    lo = hi = _mm512_loadu_si512((const void*)buf);
+    for (i = 32; i + 32 <= n; i += 32) {
+        __m512i v = _mm512_loadu_si512((const void*)(buf + i));
+        lo = _mm512_min_epu16(lo, v);
+        hi = _mm512_max_epu16(hi, v);
+    }
+    _mm512_storeu_si512((void*)l, lo);
+    _mm512_storeu_si512((void*)h, hi);
+    icsMinMaxUint16Generic(l, 32, min, &a);
+    icsMinMaxUint16Generic(h, 32, &a, max);
+    if (i < n) {
+        icsMinMaxUint16Generic(buf + i, n - i, &a, &b);
+        if (*min > a) *min = a;
+        if (*max < b) *max = b;
+    }
+}
+
+
+/* Scatter 4- and 8-byte samples with the AVX-512 scatter instructions, as
+   long as the byte offsets within one vector fit in 32 bits. */
+ICS_TARGET("avx512f,avx512bw")
+static void icsScatterAvx512(char       *dest,
+                             ptrdiff_t   stride,
+                             const char *src,
+                             size_t      n,
+                             size_t      size)
+{
+    size_t  i = 0;
+    __m512i index;
+
+
+    if (size == 4 && stride > -(1 << 26) && stride < (1 << 26)) {
+        index = _mm512_mullo_epi32(
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                              8, 9, 10, 11, 12, 13, 14, 15),
+            _mm512_set1_epi32((int)stride));
+        for (; i + 16 <= n; i += 16) {
+            _mm512_i32scatter_epi32(dest, index,
+                                    _mm512_loadu_si512((const void*)src), 1);
+            dest += 16 * stride;
+            src += 64;
+        }
+    } else if (size == 8 && stride > -(1 << 27) && stride < (1 << 27)) {
+        __m256i index8 = _mm256_mullo_epi32(
+            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+            _mm256_set1_epi32((int)stride));
+        for (; i + 8 <= n; i += 8) {
+            _mm512_i32scatter_epi64(dest, index8,
+                                    _mm512_loadu_si512((const void*)src), 1);
+            dest += 8 * stride;
+            src += 64;
+        }
+    }
+    icsScatterGeneric(dest, stride, src, n - i, size);
+}
+
+/* As icsScatterAvx512, but gathering. */
+ICS_TARGET("avx512f,avx512bw")
+static void icsGatherAvx512(char       *dest,
+                            const char *src,
+                            ptrdiff_t   stride,
+                            size_t      n,
+                            size_t      size)
+{
+    size_t  i = 0;
+    __m512i index;
+    __m256i index8;
+
+
+    if (size == 4 && stride > -(1 << 26) && stride < (1 << 26)) {
+        index = _mm512_mullo_epi32(
+            _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                              8, 9, 10, 11, 12, 13, 14, 15),
+            _mm512_set1_epi32((int)stride));
+        for (; i + 16 <= n; i += 16) {
+            _mm512_storeu_si512((void*)dest,
+                                _mm512_i32gather_epi32(index, src, 1));
+            src += 16 * stride;
+            dest += 64;
+        }
+    } else if (size == 8 && stride > -(1 << 27) && stride < (1 << 27)) {
+        index8 = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                    _mm256_set1_epi32((int)stride));
+        for (; i + 8 <= n; i += 8) {
+            _mm512_storeu_si512((void*)dest,
+                                _mm512_i32gather_epi64(index8, src, 1));
+            src += 8 * stride;
+            dest += 64;
+        }
+    }
+    icsGatherGeneric(dest, src, stride, n - i, size);
+}
+
+ICS_TARGET("avx512f,avx512bw")
+static void icsAccumulateUint8Avx512(float             *acc,
+                                     const ics_t_uint8 *src,
+                                     size_t             n)
+{
+    size_t i;
+
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_cvtepu8_epi32(
+            _mm_loadu_si128((const __m128i*)(src + i)));
+        _mm512_storeu_ps(acc + i, _mm512_add_ps(_mm512_loadu_ps(acc + i),
+                                                _mm512_cvtepi32_ps(v)));
+    }
+    icsAccumulateUint8Generic(acc + i, src + i, n - i);
+}
+
+
+ICS_TARGET("avx512f,avx512bw")
+static void icsAccumulateUint16Avx512(float              *acc,
+                                      const ics_t_uint16 *src,
+                                      size_t              n)
+{
+    size_t i;
+
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_cvtepu16_epi32(
+            _mm256_loadu_si256((const __m256i*)(src + i)));
+        _mm512_storeu_ps(acc + i, _mm512_add_ps(_mm512_loadu_ps(acc + i),
+                                                _mm512_cvtepi32_ps(v)));
+    }
+    icsAccumulateUint16Generic(acc + i, src + i, n - i);
+}
+
+#endif /* ICS_CPU_X86 */
+
+
+#ifdef ICS_CPU_NEON
+
+/*
+ * NEON versions.
+ */
+
+static void icsSwapBytesNeon(void   *buf,
+                             size_t  n,
+                             size_t  size)
+{
+    ics_t_uint8 *p = (ics_t_uint8*)buf;
+    size_t       i, len = n * size;
+
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(p + i);
+        switch (size) {
+            case 2: v = vrev16q_u8(v); break;
+            case 4: v = vrev32q_u8(v); break;
+            default: v = vrev64q_u8(v); break;
+        }
+        vst1q_u8(p + i, v);
+    }
+    icsSwapBytesGeneric(p + i, (len - i) / size, size);
+}
+
+
+static void icsMinMaxUint8Neon(const ics_t_uint8 *buf,
+                               size_t             n,
+                               ics_t_uint8       *min,
+                               ics_t_uint8       *max)
+{
+    size_t      i;
+    uint8x16_t  lo, hi;
+    ics_t_uint8 l, h;
+
+
+    if (n < 16) {
+        icsMinMaxUint8Generic(buf, n, min, max);
+        return;
+    }
+    lo = hi = vld1q_u8(buf);
+    for (i = 16; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(buf + i);
+        lo = vminq_u8(lo, v);
+        hi = vmaxq_u8(hi, v);
+    }
+    *min = vminvq_u8(lo);
+    *max = vmaxvq_u8(hi);
+    if (i < n) {
+        icsMinMaxUint8Generic(buf + i, n - i, &l, &h);
+        if (*min > l) *min = l;
+        if (*max < h) *max = h;
+    }
+}
+
+
+static void icsMinMaxUint16Neon(const ics_t_uint16 *buf,
+                                size_t              n,
+                                ics_t_uint16       *min,
+                                ics_t_uint16       *max)
+{
+    size_t       i;
+    uint16x8_t   lo, hi;
+    ics_t_uint16 l, h;
+
+
+    if (n < 8) {
+        icsMinMaxUint16Generic(buf, n, min, max);
+        return;
+    }
+    lo = hi = vld1q_u16(buf);
+    for (i = 8; i + 8 <= n; i += 8) {
+        uint16x8_t v = vld1q_u16(buf + i);
+        lo = vminq_u16(lo, v);
+        hi = vmaxq_u16(hi, v);
+    }
+    *min = vminvq_u16(lo);
+    *max = vmaxvq_u16(hi);
+    if (i < n) {
+        icsMinMaxUint16Generic(buf + i, n - i, &l, &h);
+        if (*min > l) *min = l;
+        if (*max < h) *max = h;
+    }
+}
+
+static void icsAccumulateUint8Neon(float             *acc,
+                                   const ics_t_uint8 *src,
+                                   size_t             n)
+{
+    size_t i;
+
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        uint16x8_t v = vmovl_u8(vld1_u8(src + i));
+        float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+        float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(v)));
+        vst1q_f32(acc + i, vaddq_f32(vld1q_f32(acc + i), lo));
+        vst1q_f32(acc + i + 4, vaddq_f32(vld1q_f32(acc + i + 4), hi));
+    }
+    icsAccumulateUint8Generic(acc + i, src + i, n - i);
+}
+
+
+static void icsAccumulateUint16Neon(float              *acc,
+                                    const ics_t_uint16 *src,
+                                    size_t              n)
+{
+    size_t i;
+
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        uint16x8_t v = vld1q_u16(src + i);
+        float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+        float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(v)));
+        vst1q_f32(acc + i, vaddq_f32(vld1q_f32(acc + i), lo));
+        vst1q_f32(acc + i + 4, vaddq_f32(vld1q_f32(acc + i + 4), hi));
+    }
+    icsAccumulateUint16Generic(acc + i, src + i, n - i);
+}
+
+#endif /* ICS_CPU_NEON */
+
+
+/* The kernel tables, one per level. */
+static const Ics_Kernels icsKernelsGeneric = {
+    IcsCpu_generic, icsSwapBytesGeneric, icsMinMaxUint8Generic,
+    icsMinMaxUint16Generic, icsScatterGeneric, icsGatherGeneric,
+    icsAccumulateUint8Generic, icsAccumulateUint16Generic
+};
+
+#ifdef ICS_CPU_X86
+static const Ics_Kernels icsKernelsSse42 = {
+    IcsCpu_sse42, icsSwapBytesSse42, icsMinMaxUint8Sse42,
+    icsMinMaxUint16Sse42, icsScatterGeneric, icsGatherGeneric,
+    icsAccumulateUint8Sse42, icsAccumulateUint16Sse42
+};
+
+static const Ics_Kernels icsKernelsAvx2 = {
+    IcsCpu_avx2, icsSwapBytesAvx2, icsMinMaxUint8Avx2,
+    icsMinMaxUint16Avx2, icsScatterGeneric, icsGatherAvx2,
+    icsAccumulateUint8Avx2, icsAccumulateUint16Avx2
+};
+
+static const Ics_Kernels icsKernelsAvx512 = {
+    IcsCpu_avx512, icsSwapBytesAvx512, icsMinMaxUint8Avx512,
+    icsMinMaxUint16Avx512, icsScatterAvx512, icsGatherAvx512,
+    icsAccumulateUint8Avx512, icsAccumulateUint16Avx512
+};
+#endif
+
+#ifdef ICS_CPU_NEON
+static const Ics_Kernels icsKernelsNeon = {
+    IcsCpu_neon, icsSwapBytesNeon, icsMinMaxUint8Neon,
+    icsMinMaxUint16Neon, icsScatterGeneric, icsGatherGeneric,
+    icsAccumulateUint8Neon, icsAccumulateUint16Neon
+};
+#endif
+
+
+/* Find the best level supported by the CPU and the operating system. */
+static Ics_CpuLevel icsDetectCpuLevel(void)
+{
+#if defined(ICS_CPU_X86) && defined(_MSC_VER)
+    int                info[4];
+    int                maxLeaf;
+    unsigned long long xcr0 = 0;
+
+
+    __cpuid(info, 0);
+    maxLeaf = info[0];
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 20))) return IcsCpu_generic;    /* SSE4.2 */
+    if (!(info[2] & (1 << 27)) || maxLeaf < 7)            /* OSXSAVE */
+        return IcsCpu_sse42;
+    xcr0 = _xgetbv(0);
+    if ((xcr0 & 0x6) != 0x6) return IcsCpu_sse42;         /* AVX state */
+    __cpuidex(info, 7, 0);
+    if (!(info[1] & (1 << 5))) return IcsCpu_sse42;       /* AVX2 */
+    if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16))    /* AVX-512F */
+        && (info[1] & (1 << 30)))                         /* AVX-512BW */
+        return IcsCpu_avx512;
+    return IcsCpu_avx2;
+#elif defined(ICS_CPU_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return IcsCpu_avx512;
+    if (__builtin_cpu_supports("avx2")) return IcsCpu_avx2;
+    if (__builtin_cpu_supports("sse4.2")) return IcsCpu_sse42;
+    return IcsCpu_generic;
+#elif defined(ICS_CPU_NEON)
+    return IcsCpu_neon;
+#else
+    return IcsCpu_generic;
+#endif
+}
+
+
+/* Apply the ICS_CPU_LEVEL environment variable, which can only lower the
+   level. */
+static Ics_CpuLevel icsLimitCpuLevel(Ics_CpuLevel level)
+{
+    const char *env = getenv("ICS_CPU_LEVEL");
+    int         i;
+
+
+    if (env == NULL) return level;
+    for (i = 0; i <= (int)IcsCpu_neon; i++) {
+        if (strcmp(env, icsCpuLevelNames[i]) == 0) break;
+    }
+    if (i > (int)IcsCpu_neon) return level;           /* unknown name */
+    if (i == (int)IcsCpu_generic) return IcsCpu_generic;
+    if ((level == IcsCpu_neon) != (i == (int)IcsCpu_neon)) return level;
+    return (Ics_CpuLevel)i < level ? (Ics_CpuLevel)i : level;
+}
+
+
+/* Get the kernels for this CPU. Selecting them is idempotent, so concurrent
+   first calls at worst do the detection twice. */
+const Ics_Kernels *IcsGetKernels(void)
+{
+    static const Ics_Kernels *volatile kernels = NULL;
+    const Ics_Kernels                 *k = kernels;
+
+
+    if (k != NULL) return k;
+    switch (icsLimitCpuLevel(icsDetectCpuLevel())) {
+#ifdef ICS_CPU_X86
+        case IcsCpu_sse42:  k = &icsKernelsSse42;  break;
+        case IcsCpu_avx2:   k = &icsKernelsAvx2;   break;
+        case IcsCpu_avx512: k = &icsKernelsAvx512; break;
+#endif
+#ifdef ICS_CPU_NEON
+        case IcsCpu_neon:   k = &icsKernelsNeon;   break;
+#endif
+        default:            k = &icsKernelsGeneric; break;
+    }
+    kernels = k;
+    return k;
+}
+
+
+/* Get the name of the instruction set level used by the library. */
+const char *IcsGetCpuLevel(void)
+{
+    return icsCpuLevelNames[IcsGetKernels()->level];
+}
@@ -75,7 +75,10 @@ Ics_Symbol G_SubCatSymbols[] =
     {"type",               ICSTOK_TYPE},
     {"model",              ICSTOK_MODEL},
     {"s_params",           ICSTOK_SPARAMS},
-    {"s_states",           ICSTOK_SSTATES}
+    {"s_states",           ICSTOK_SSTATES},
+    {"store",              ICSTOK_STORE},
+    {"filter",             ICSTOK_FILTER},
+    {"chunks",             ICSTOK_CHUNKS}
 };
 
 
@@ -124,6 +127,9 @@ Ics_Symbol G_ValueSymbols[] =
     {"uncompressed",      ICSTOK_COMPR_UNCOMPRESSED},
     {"compress",          ICSTOK_COMPR_COMPRESS},
     {"gzip",              ICSTOK_COMPR_GZIP},
+    {"loco",              ICSTOK_COMPR_LOCO},
+    {"fpred",             ICSTOK_COMPR_FPRED},
+    {"delta",             ICSTOK_FILTER_DELTA},
     {"integer",           ICSTOK_FORMAT_INTEGER},
     {"real",              ICSTOK_FORMAT_REAL},
     {"float",             ICSTOK_FORMAT_REAL}, /* CAUTION: this makes this list
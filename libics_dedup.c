@@ -0,0 +1,642 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_dedup.c
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsWriteDedup()
+ *   IcsOpenDedup()
+ *   IcsCloseDedup()
+ *   IcsReadDedupBlock()
+ *   IcsSetDedupBlock()
+ *
+ * A deduplicating chunk store is a directory in which image data is stored as
+ * chunks, each in its own file named after a 128-bit hash of its contents.
+ * When writing, the image is split into chunks of whole lines that never span
+ * more than one 2D plane, such that unchanged planes or channels, and uniform
+ * background regions, produce identical chunks. A chunk that is already in the
+ * store is not written again. The IDS data then contains a chunk list instead
+ * of the image data:
+ *
+ *   "ICSDEDUP", version, number of chunks,
+ *   for each chunk: hash (2 words), length in bytes, encoding
+ *
+ * with each item stored as a 64-bit little-endian word. The encoding is the
+ * Ics_Compression value used for the chunk file (uncompressed, gzip, or one of
+ * the tile codecs, which code a chunk as a single tile); chunks stored with
+ * compression have a ".gz" or ".<codec name>" extension. Chunk files live in a
+ * sub-directory named after the first two hex digits of the hash, to keep the
+ * directories at a manageable size. New chunks are written to a temporary file
+ * which is then renamed, such that concurrent writers sharing a store never
+ * see a partial chunk.
+ *
+ * The hash used is XXH64 (by Yann Collet), computed twice with two different
+ * seeds.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics_intern.h"
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+
+#define ICS_DEDUP_MAGIC   "ICSDEDUP"
+#define ICS_DEDUP_VERSION 1
+#define ICS_DEDUP_SEED    0x243F6A8885A308D3ULL /* seed for the second hash */
+
+/* The encodings a chunk can be found in */
+static const Ics_Compression icsChunkEncodings[] = {
+    IcsCompr_uncompressed, IcsCompr_gzip, IcsCompr_loco, IcsCompr_fpred
+};
+#define ICS_N_CHUNK_ENCODINGS \
+    (sizeof(icsChunkEncodings) / sizeof(Ics_Compression))
+
+
+#define ICS_PRIME64_1 0x9E3779B185EBCA87ULL
+#define ICS_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define ICS_PRIME64_3 0x165667B19E3779F9ULL
+#define ICS_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define ICS_PRIME64_5 0x27D4EB2F165667C5ULL
+
+
+/* A chunk in the chunk list. */
+typedef struct {
+    ics_t_uint64 hash[2];  /* 128-bit hash of the chunk contents */
+    size_t       offset;   /* position of the chunk in the image data */
+    size_t       length;   /* number of bytes in the chunk */
+    int          encoding; /* how the chunk file is compressed */
+} Ics_DedupChunk;
+
+
+/* This is the struct behind the "void* dedup" in the Ics_BlockRead
+   structure: */
+typedef struct {
+    Ics_DedupChunk *chunks;  /* the chunk list */
+    size_t          nChunks; /* number of chunks in the list */
+    size_t          total;   /* total number of bytes in the image data */
+    size_t          pos;     /* current position in the image data */
+    size_t          current; /* chunk in the buffer, nChunks if none */
+    char           *buffer;  /* holds the current chunk */
+} Ics_DedupRead;
+
+
+static ics_t_uint64 icsRotl64(ics_t_uint64 x,
+                              int          r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+
+/* Reads a 64-bit little-endian word from memory. */
+static ics_t_uint64 icsRead64(const unsigned char *p)
+{
+    return  (ics_t_uint64)p[0]        | ((ics_t_uint64)p[1] << 8)
+         | ((ics_t_uint64)p[2] << 16) | ((ics_t_uint64)p[3] << 24)
+         | ((ics_t_uint64)p[4] << 32) | ((ics_t_uint64)p[5] << 40)
+         | ((ics_t_uint64)p[6] << 48) | ((ics_t_uint64)p[7] << 56);
+}
+
+
+/* Reads a 32-bit little-endian word from memory. */
+static ics_t_uint64 icsRead32(const unsigned char *p)
+{
+    return  (ics_t_uint64)p[0]        | ((ics_t_uint64)p[1] << 8)
+         | ((ics_t_uint64)p[2] << 16) | ((ics_t_uint64)p[3] << 24);
+}
+
+
+static ics_t_uint64 icsXXH64Round(ics_t_uint64 acc,
+                                  ics_t_uint64 input)
+{
+    acc += input * ICS_PRIME64_2;
+    acc  = icsRotl64(acc, 31);
+    return acc * ICS_PRIME64_1;
+}
+
+
+static ics_t_uint64 icsXXH64Merge(ics_t_uint64 acc,
+                                  ics_t_uint64 val)
+{
+    acc ^= icsXXH64Round(0, val);
+    return acc * ICS_PRIME64_1 + ICS_PRIME64_4;
+}
+
+
+/* The XXH64 hash of a block of memory. */
+static ics_t_uint64 icsXXH64(const void   *data,
+                             size_t        len,
+                             ics_t_uint64  seed)
+{
+    const unsigned char *p   = (const unsigned char*)data;
+    const unsigned char *end = p + len;
+    ics_t_uint64         h, v1, v2, v3, v4;
+
+
+    if (len >= 32) {
+        const unsigned char *limit = end - 32;
+        v1 = seed + ICS_PRIME64_1 + ICS_PRIME64_2;
+        v2 = seed + ICS_PRIME64_2;
+        v3 = seed;
+        v4 = seed - ICS_PRIME64_1;
+        do {
+            v1 = icsXXH64Round(v1, icsRead64(p));
+            v2 = icsXXH64Round(v2, icsRead64(p + 8));
+            v3 = icsXXH64Round(v3, icsRead64(p + 16));
+            v4 = icsXXH64Round(v4, icsRead64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = icsRotl64(v1, 1) + icsRotl64(v2, 7) + icsRotl64(v3, 12)
+            + icsRotl64(v4, 18);
+        h = icsXXH64Merge(h, v1);
+        h = icsXXH64Merge(h, v2);
+        h = icsXXH64Merge(h, v3);
+        h = icsXXH64Merge(h, v4);
+    } else {
+        h = seed + ICS_PRIME64_5;
+    }
+    h += (ics_t_uint64)len;
+
+    while (p + 8 <= end) {
+        h ^= icsXXH64Round(0, icsRead64(p));
+        h  = icsRotl64(h, 27) * ICS_PRIME64_1 + ICS_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= icsRead32(p) * ICS_PRIME64_1;
+        h  = icsRotl64(h, 23) * ICS_PRIME64_2 + ICS_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * ICS_PRIME64_5;
+        h  = icsRotl64(h, 11) * ICS_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= ICS_PRIME64_2;
+    h ^= h >> 29;
+    h *= ICS_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+
+/* Build the name of a chunk file in the store. If dir is not NULL, it gets the
+   name of the sub-directory the chunk file lives in. */
+static Ics_Error icsChunkName(char               *name,
+                              char               *dir,
+                              const char         *store,
+                              const ics_t_uint64  hash[2],
+                              int                 encoding)
+{
+    int  n;
+    char ext[16] = "";
+
+
+    if (encoding == IcsCompr_gzip) {
+        strcpy(ext, ".gz");
+    } else if (IcsIsTileCompression((Ics_Compression)encoding)) {
+        snprintf(ext, sizeof(ext), ".%s",
+                 IcsTileCompressionName((Ics_Compression)encoding));
+    }
+    n = snprintf(name, ICS_MAXPATHLEN, "%s/%02x/%016llx%016llx%s", store,
+                 (unsigned int)(hash[0] >> 56), (unsigned long long)hash[0],
+                 (unsigned long long)hash[1], ext);
+    if ((n < 0) || (n >= ICS_MAXPATHLEN)) return IcsErr_FOpenIds;
+    if (dir != NULL) {
+        n = snprintf(dir, ICS_MAXPATHLEN, "%s/%02x", store,
+                     (unsigned int)(hash[0] >> 56));
+        if ((n < 0) || (n >= ICS_MAXPATHLEN)) return IcsErr_FOpenIds;
+    }
+    return IcsErr_Ok;
+}
+
+
+/* Put a chunk in the store, unless it is already there. On return, encoding
+   holds the compression of the chunk file in the store. */
+static Ics_Error icsStoreChunk(const Ics_Header   *icsStruct,
+                               const ics_t_uint64  hash[2],
+                               const void         *src,
+                               size_t              len,
+                               int                *encoding)
+{
+    ICSINIT;
+    FILE           *fp;
+    const char     *store       = icsStruct->dedupStore;
+    Ics_Compression compression = icsStruct->compression;
+    unsigned char  *coded;
+    char            name[ICS_MAXPATHLEN];
+    char            dir[ICS_MAXPATHLEN];
+    char            tmpname[ICS_MAXPATHLEN + 64];
+    size_t          lineBytes   = icsStruct->dim[0].size
+                                  * IcsGetDataTypeSize(icsStruct->imel.dataType);
+    size_t          length, i;
+
+
+        /* Is the chunk already in the store, in whichever encoding? */
+    error = icsChunkName(name, dir, store, hash, (int)compression);
+    if (error) return error;
+    *encoding = (int)compression;
+    if (IcsExistFile(name)) return IcsErr_Ok;
+    for (i = 0; i < ICS_N_CHUNK_ENCODINGS; i++) {
+        if (icsChunkEncodings[i] == compression) continue;
+        error = icsChunkName(tmpname, NULL, store, hash, icsChunkEncodings[i]);
+        if (error) return error;
+        if (IcsExistFile(tmpname)) {
+            *encoding = icsChunkEncodings[i];
+            return IcsErr_Ok;
+        }
+    }
+
+        /* Write it to a temporary file first, then move it in place */
+    if (IcsMkDir(store) != 0 || IcsMkDir(dir) != 0) return IcsErr_FOpenIds;
+    snprintf(tmpname, sizeof(tmpname), "%s.%lu.%lx.tmp", name,
+             (unsigned long)getpid(), (unsigned long)(size_t)&fp);
+    fp = IcsFOpen(tmpname, "wb");
+    if (fp == NULL) return IcsErr_FOpenIds;
+    if (compression == IcsCompr_gzip) {
+        error = IcsWriteZip(src, len, fp, icsStruct->compLevel, NULL, icsStruct);
+    } else if (IcsIsTileCompression(compression)) {
+            /* The chunk is coded as a single tile */
+        coded = (unsigned char*)IcsGetScratch(icsStruct, len + 1);
+        if (coded == NULL) {
+            error = IcsErr_Alloc;
+        } else {
+            error = IcsEncodeTile(compression, src, icsStruct->imel.dataType,
+                                  icsStruct->dim[0].size, len / lineBytes,
+                                  coded, &length, icsStruct);
+            if (!error && fwrite(coded, 1, length, fp) != length) {
+                error = IcsErr_FWriteIds;
+            }
+            IcsReleaseScratch(icsStruct, coded);
+        }
+    } else if (fwrite(src, 1, len, fp) != len) {
+        error = IcsErr_FWriteIds;
+    }
+    if (fclose(fp) == EOF) {
+        if (!error) error = IcsErr_FCloseIds;
+    }
+    if (!error && rename(tmpname, name) != 0) {
+            /* Another writer might have stored the same chunk meanwhile */
+        if (!IcsExistFile(name)) error = IcsErr_FWriteIds;
+    }
+    remove(tmpname);
+
+    return error;
+}
+
+
+/* Write the image data to the chunk store, and the chunk list to fp. */
+Ics_Error IcsWriteDedup(const Ics_Header *icsStruct,
+                        FILE             *fp)
+{
+    ICSINIT;
+    Ics_TileLayout layout;
+    size_t         dim[ICS_MAXDIM];
+    size_t         nBytes, chunk, firstLine, nLines, len;
+    ics_t_uint64   hash[2];
+    const char    *src;
+    char          *buf = NULL;
+    int            i, encoding;
+
+
+    for (i = 0; i < icsStruct->dimensions; i++) {
+        dim[i] = icsStruct->dim[i].size;
+    }
+    nBytes = IcsGetDataTypeSize(icsStruct->imel.dataType);
+
+        /* Chunks are made of whole lines, and don't cross plane boundaries */
+    error = IcsGetTileLayout(icsStruct, 0, icsStruct->dedupChunkSize > 0
+                             ? icsStruct->dedupChunkSize : ICS_DEDUP_CHUNK_SIZE,
+                             &layout);
+    if (error) return error;
+    if (IcsIsTileCompression(icsStruct->compression)
+        && !IcsTileSupports(icsStruct->compression, icsStruct->imel.dataType)) {
+        return IcsErr_IllParameter;
+    }
+
+    if (icsStruct->dataStrides) {
+        buf = (char*)IcsGetScratch(icsStruct,
+                                   layout.linesPerTile * layout.lineBytes);
+        if (buf == NULL) return IcsErr_Alloc;
+    }
+
+        /* The chunk list header */
+    if (fwrite(ICS_DEDUP_MAGIC, 1, 8, fp) != 8) error = IcsErr_FWriteIds;
+    if (!error) error = IcsPutWord(fp, ICS_DEDUP_VERSION);
+    if (!error) error = IcsPutWord(fp, (ics_t_uint64)layout.nTiles);
+
+        /* Store each of the chunks, and add it to the list */
+    for (chunk = 0; !error && chunk < layout.nTiles; chunk++) {
+        IcsGetTileLines(&layout, chunk, &firstLine, &nLines);
+        len = nLines * layout.lineBytes;
+        if (buf != NULL) {
+            IcsGatherLines(icsStruct->data, dim, icsStruct->dataStrides,
+                           icsStruct->dimensions, (int)nBytes, firstLine,
+                           nLines, buf);
+            src = buf;
+        } else {
+            src = (const char*)icsStruct->data + firstLine * layout.lineBytes;
+        }
+        hash[0] = icsXXH64(src, len, 0);
+        hash[1] = icsXXH64(src, len, ICS_DEDUP_SEED);
+        error = icsStoreChunk(icsStruct, hash, src, len, &encoding);
+        if (!error) error = IcsPutWord(fp, hash[0]);
+        if (!error) error = IcsPutWord(fp, hash[1]);
+        if (!error) error = IcsPutWord(fp, (ics_t_uint64)len);
+        if (!error) error = IcsPutWord(fp, (ics_t_uint64)encoding);
+    }
+
+    IcsReleaseScratch(icsStruct, buf);
+
+    return error;
+}
+
+
+/* Read the chunk list from the data file. */
+Ics_Error IcsOpenDedup(Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_DedupRead *dr;
+    char           magic[8];
+    ics_t_uint64   version, n, length, encoding;
+    size_t         i, maxLength = 0;
+
+
+    if (fread(magic, 1, 8, br->dataFilePtr) != 8
+        || memcmp(magic, ICS_DEDUP_MAGIC, 8) != 0) {
+        return IcsErr_CorruptedStream;
+    }
+    error = IcsGetWord(br->dataFilePtr, &version);
+    if (!error && version != ICS_DEDUP_VERSION) error = IcsErr_CorruptedStream;
+    if (!error) error = IcsGetWord(br->dataFilePtr, &n);
+    if (error) return error;
+    if (n > (ics_t_uint64)((size_t)-1 / sizeof(Ics_DedupChunk))) {
+        return IcsErr_CorruptedStream;
+    }
+
+    dr = (Ics_DedupRead*)IcsGetScratch(icsStruct, sizeof(Ics_DedupRead));
+    if (dr == NULL) return IcsErr_Alloc;
+    dr->nChunks = (size_t)n;
+    dr->total = 0;
+    dr->pos = 0;
+    dr->current = dr->nChunks;
+    dr->buffer = NULL;
+    dr->chunks = (Ics_DedupChunk*)IcsGetScratch(icsStruct, dr->nChunks
+                                                * sizeof(Ics_DedupChunk));
+    if (dr->chunks == NULL) {
+        IcsReleaseScratch(icsStruct, dr);
+        return IcsErr_Alloc;
+    }
+    for (i = 0; !error && i < dr->nChunks; i++) {
+        error = IcsGetWord(br->dataFilePtr, &dr->chunks[i].hash[0]);
+        if (!error) error = IcsGetWord(br->dataFilePtr, &dr->chunks[i].hash[1]);
+        if (!error) error = IcsGetWord(br->dataFilePtr, &length);
+        if (!error) error = IcsGetWord(br->dataFilePtr, &encoding);
+        if (!error && (encoding != IcsCompr_uncompressed
+                       && encoding != IcsCompr_gzip
+                       && !IcsIsTileCompression((Ics_Compression)encoding))) {
+            error = IcsErr_UnknownCompression;
+        }
+        if (!error) {
+            dr->chunks[i].offset = dr->total;
+            dr->chunks[i].length = (size_t)length;
+            dr->chunks[i].encoding = (int)encoding;
+            dr->total += (size_t)length;
+            if ((size_t)length > maxLength) maxLength = (size_t)length;
+        }
+    }
+    if (!error && maxLength > 0) {
+        dr->buffer = (char*)IcsGetScratch(icsStruct, maxLength);
+        if (dr->buffer == NULL) error = IcsErr_Alloc;
+    }
+    if (error) {
+        IcsReleaseScratch(icsStruct, dr->chunks);
+        IcsReleaseScratch(icsStruct, dr);
+        return error;
+    }
+
+    br->dedup = dr;
+    return error;
+}
+
+
+/* Free the chunk list. */
+Ics_Error IcsCloseDedup(Ics_Header *icsStruct)
+{
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_DedupRead *dr = (Ics_DedupRead*)br->dedup;
+
+
+    IcsReleaseScratch(icsStruct, dr->buffer);
+    IcsReleaseScratch(icsStruct, dr->chunks);
+    IcsReleaseScratch(icsStruct, dr);
+    br->dedup = NULL;
+
+    return IcsErr_Ok;
+}
+
+
+/* Read a chunk file coded as a single tile. */
+static Ics_Error icsReadTileFile(const Ics_Header     *icsStruct,
+                                 FILE                 *fp,
+                                 const Ics_DedupChunk *chunk,
+                                 void                 *dest)
+{
+    ICSINIT;
+    unsigned char *coded;
+    size_t         length, lineBytes;
+    ics_t_sint64   end;
+
+
+    lineBytes = icsStruct->dim[0].size
+              * IcsGetDataTypeSize(icsStruct->imel.dataType);
+    if ((lineBytes == 0) || (chunk->length % lineBytes != 0)) {
+        return IcsErr_CorruptedStream;
+    }
+    if ((IcsFSeek(fp, 0, SEEK_END) != 0) || ((end = IcsFTell(fp)) < 0)
+        || (IcsFSeek(fp, 0, SEEK_SET) != 0)) {
+        return IcsErr_FReadIds;
+    }
+    length = (size_t)end;
+    coded = (unsigned char*)IcsGetScratch(icsStruct, length);
+    if (coded == NULL) return IcsErr_Alloc;
+    if (fread(coded, 1, length, fp) != length) {
+        error = ferror(fp) ? IcsErr_FReadIds : IcsErr_CorruptedStream;
+    }
+    if (!error) {
+        error = IcsDecodeTile((Ics_Compression)chunk->encoding, coded, length,
+                              icsStruct->imel.dataType, icsStruct->dim[0].size,
+                              chunk->length / lineBytes, dest, icsStruct);
+    }
+    IcsReleaseScratch(icsStruct, coded);
+
+    return error;
+}
+
+
+/* Read a chunk from the store into dest, and verify its contents. */
+static Ics_Error icsLoadChunk(const Ics_Header     *icsStruct,
+                              const Ics_DedupChunk *chunk,
+                              void                 *dest)
+{
+    ICSINIT;
+    FILE *fp;
+    char  name[ICS_MAXPATHLEN];
+
+
+    error = icsChunkName(name, NULL, icsStruct->dedupStore, chunk->hash,
+                         chunk->encoding);
+    if (error) return error;
+    fp = IcsFOpen(name, "rb");
+    if (fp == NULL) return IcsErr_FOpenIds;
+    if (chunk->encoding == IcsCompr_gzip) {
+        error = IcsReadZipFile(fp, dest, chunk->length, icsStruct);
+    } else if (IcsIsTileCompression((Ics_Compression)chunk->encoding)) {
+        error = icsReadTileFile(icsStruct, fp, chunk, dest);
+    } else if (fread(dest, 1, chunk->length, fp) != chunk->length) {
+        error = ferror(fp) ? IcsErr_FReadIds : IcsErr_CorruptedStream;
+    }
+    if (fclose(fp) == EOF) {
+        if (!error) error = IcsErr_FCloseIds;
+    }
+    if (!error && icsXXH64(dest, chunk->length, 0) != chunk->hash[0]) {
+        error = IcsErr_CorruptedStream;
+    }
+
+    return error;
+}
+
+
+/* Find the chunk that contains position pos in the image data. */
+static size_t icsFindChunk(const Ics_DedupRead *dr,
+                           size_t               pos)
+{
+    size_t lo = 0, hi = dr->nChunks, mid;
+
+
+        /* Sequential reading hits the current or the next chunk */
+    if (dr->current < dr->nChunks) {
+        lo = dr->current;
+        if (pos >= dr->chunks[lo].offset) {
+            if (pos < dr->chunks[lo].offset + dr->chunks[lo].length) return lo;
+            if ((lo + 1 < hi) && (pos < dr->chunks[lo + 1].offset
+                                  + dr->chunks[lo + 1].length)) return lo + 1;
+        } else {
+            hi = lo;
+            lo = 0;
+        }
+    }
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (dr->chunks[mid].offset <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+/* Read a data block from the chunk store. */
+Ics_Error IcsReadDedupBlock(Ics_Header *icsStruct,
+                            void       *outBuf,
+                            size_t      len)
+{
+    ICSINIT;
+    Ics_BlockRead  *br  = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_DedupRead  *dr  = (Ics_DedupRead*)br->dedup;
+    char           *out = (char*)outBuf;
+    Ics_DedupChunk *chunk;
+    size_t          k, inChunk, n;
+
+
+    while (len > 0) {
+        if (dr->pos >= dr->total) return IcsErr_EndOfStream;
+        k = icsFindChunk(dr, dr->pos);
+        chunk = dr->chunks + k;
+        inChunk = dr->pos - chunk->offset;
+        n = chunk->length - inChunk;
+        if (n > len) n = len;
+        if ((k != dr->current) && (n == chunk->length)) {
+                /* The whole chunk is requested, avoid the extra copy */
+            error = icsLoadChunk(icsStruct, chunk, out);
+            if (error) return error;
+        } else {
+            if (k != dr->current) {
+                dr->current = dr->nChunks;
+                error = icsLoadChunk(icsStruct, chunk, dr->buffer);
+                if (error) return error;
+                dr->current = k;
+            }
+            memcpy(out, dr->buffer + inChunk, n);
+        }
+        out += n;
+        len -= n;
+        dr->pos += n;
+    }
+
+    return error;
+}
+
+
+/* Set the read position in the image data. */
+Ics_Error IcsSetDedupBlock(Ics_Header   *icsStruct,
+                           ics_t_sint64  offset,
+                           int           whence)
+{
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_DedupRead *dr = (Ics_DedupRead*)br->dedup;
+    size_t         base;
+
+
+    base = whence == SEEK_CUR ? dr->pos : 0;
+    if ((offset < 0) && ((size_t)(-offset) > base)) return IcsErr_IllParameter;
+    base = offset < 0 ? base - (size_t)(-offset) : base + (size_t)offset;
+    if (base > dr->total) return IcsErr_EndOfStream;
+    dr->pos = base;
+
+    return IcsErr_Ok;
+}
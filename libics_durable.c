@@ -0,0 +1,720 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+
+/*
+ * FILE : libics_durable.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsSetDefaultDurability()
+ *   IcsFlushDurable()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsGetDefaultDurability()
+ *   IcsGetOutputName()
+ *   IcsCommitOutput()
+ *
+ * Making written files durable. With a durability policy, the ICS file is
+ * written under a temporary name (the name with ".tmp" appended). When it is
+ * closed, the IDS file, the zone map, the GZIP index, the files in a chunk
+ * store and the temporary ICS file are flushed to disk, and only then is the
+ * ICS file renamed and its directory flushed. A crash can thus leave a
+ * temporary file behind, but never an ICS file whose data is not on disk.
+ *
+ * With the group policy, closed files are queued, and a background thread
+ * commits all files queued within a window at once. On Linux, each file system
+ * involved is then flushed with a single syncfs(); elsewhere the files are
+ * flushed one by one, but still outside of IcsClose(). Without threads, the
+ * queue is committed by the first IcsClose() after the window has passed, or
+ * by IcsFlushDurable(). Files still queued when the program exits normally are
+ * committed by an exit handler.
+ */
+
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for syncfs() */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "libics_intern.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#ifdef ICS_THREADS
+#include <process.h>
+#endif
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#ifdef ICS_THREADS
+#include <pthread.h>
+#endif
+#endif
+
+
+#define ICS_TEMP_EXT ".tmp"
+
+/* The number of file systems flushed once per batch; further ones are
+   flushed again for each file. */
+#define ICS_MAX_SYNC_DEVS 16
+
+
+/* A closed ICS file, waiting to be made durable and visible. */
+typedef struct Ics_PendingFile_ {
+    char                     name[ICS_MAXPATHLEN];     /* the ICS file */
+    char                     tempName[ICS_MAXPATHLEN]; /* where it was written */
+    char                     dataName[ICS_MAXPATHLEN]; /* IDS file, or "" */
+    char                     zoneName[ICS_MAXPATHLEN]; /* zone map, or "" */
+    char                     zipIndex[ICS_MAXPATHLEN]; /* GZIP index, or "" */
+    char                     storeDir[ICS_MAXPATHLEN]; /* chunk store, or "" */
+    Ics_Error                error;
+    struct Ics_PendingFile_ *next;
+} Ics_PendingFile;
+
+
+/* The file systems already flushed in a batch. */
+typedef struct {
+#if defined(__linux__)
+    dev_t devs[ICS_MAX_SYNC_DEVS];
+#endif
+    int   n;
+    int   group; /* flush whole file systems where possible */
+} Ics_SyncState;
+
+
+static volatile int     icsDefaultDurability = IcsDurability_none;
+
+    /* The queue of the group policy, protected by icsPendingLock */
+static size_t           icsWindow         = ICS_DURABLE_WINDOW;
+static Ics_PendingFile *icsPendingFirst   = NULL;
+static Ics_PendingFile *icsPendingLast    = NULL;
+static double           icsPendingSince   = 0.0;  /* when the first was queued */
+static size_t           icsQueued         = 0;    /* files queued so far */
+static size_t           icsCommitted      = 0;    /* files committed so far */
+static Ics_Error        icsGroupError     = IcsErr_Ok;
+static int              icsFlushNow       = 0;
+static int              icsFlusherRunning = 0;
+static int              icsAtExit         = 0;    /* exit handler registered */
+
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+static SRWLOCK            icsPendingLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE icsPendingDone = CONDITION_VARIABLE_INIT;
+#else
+static pthread_mutex_t    icsPendingLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     icsPendingDone = PTHREAD_COND_INITIALIZER;
+#endif
+#endif
+
+
+/* The current time in seconds. */
+static double icsNow(void)
+{
+#if defined(_WIN32)
+    return (double)GetTickCount64() / 1000.0;
+#else
+    struct timespec ts;
+
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+
+static void icsLockPending(void)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(&icsPendingLock);
+#else
+    pthread_mutex_lock(&icsPendingLock);
+#endif
+#endif
+}
+
+
+static void icsUnlockPending(void)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    ReleaseSRWLockExclusive(&icsPendingLock);
+#else
+    pthread_mutex_unlock(&icsPendingLock);
+#endif
+#endif
+}
+
+
+/* Wait until icsSignalPending() is called, or until the time given by icsNow()
+   reaches deadline if it is not 0. Must be called with the lock held. */
+static void icsWaitPending(double deadline)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    DWORD  ms = INFINITE;
+    double left;
+
+
+    if (deadline > 0.0) {
+        left = deadline - icsNow();
+        ms = left > 0.0 ? (DWORD)(left * 1000.0) + 1 : 0;
+    }
+    SleepConditionVariableSRW(&icsPendingDone, &icsPendingLock, ms, 0);
+#else
+    struct timespec ts;
+
+
+    if (deadline > 0.0) {
+        ts.tv_sec = (time_t)deadline;
+        ts.tv_nsec = (long)((deadline - (double)ts.tv_sec) * 1e9);
+        pthread_cond_timedwait(&icsPendingDone, &icsPendingLock, &ts);
+    } else {
+        pthread_cond_wait(&icsPendingDone, &icsPendingLock);
+    }
+#endif
+#else
+    (void)deadline;
+#endif
+}
+
+
+static void icsSignalPending(void)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    WakeAllConditionVariable(&icsPendingDone);
+#else
+    pthread_cond_broadcast(&icsPendingDone);
+#endif
+#endif
+}
+
+
+/* Flush a file to disk. */
+static Ics_Error icsSyncFile(const char *name,
+                             Ics_Error   failure)
+{
+    ICSINIT;
+#if defined(_WIN32)
+    FILE *fp = IcsFOpen(name, "r+b");
+
+
+    if (fp == NULL) return failure;
+    if (_commit(_fileno(fp)) != 0) error = failure;
+    if (fclose(fp) == EOF) error = failure;
+#else
+    int fd = open(name, O_RDONLY);
+
+
+    if (fd < 0) return failure;
+#if defined(_POSIX_SYNCHRONIZED_IO) && (_POSIX_SYNCHRONIZED_IO > 0)
+    if (fdatasync(fd) != 0) error = failure;
+#else
+    if (fsync(fd) != 0) error = failure;
+#endif
+    close(fd);
+#endif
+
+    return error;
+}
+
+
+/* Flush the file system holding name, if the batch did not do so yet, or
+   otherwise the file itself. A directory is flushed with everything in it,
+   which is only possible on Linux; elsewhere all file systems are flushed. */
+static Ics_Error icsSyncPath(const char    *name,
+                             int            isDir,
+                             Ics_Error      failure,
+                             Ics_SyncState *state)
+{
+    ICSINIT;
+#if defined(__linux__)
+    struct stat info;
+    int         fd, i;
+
+
+    if (!state->group && !isDir) return icsSyncFile(name, failure);
+    fd = open(name, O_RDONLY);
+    if (fd < 0) return failure;
+    if (fstat(fd, &info) != 0) {
+        error = failure;
+    } else {
+        for (i = 0; i < state->n; i++) {
+            if (state->devs[i] == info.st_dev) break;
+        }
+        if (i == state->n) {
+            if (syncfs(fd) != 0) error = failure;
+            if (!error && (state->n < ICS_MAX_SYNC_DEVS)) {
+                state->devs[state->n++] = info.st_dev;
+            }
+        }
+    }
+    close(fd);
+#else
+    if (!isDir) return icsSyncFile(name, failure);
+#if !defined(_WIN32)
+    if (state->n == 0) {
+        sync();
+        state->n = 1;
+    }
+#endif
+    (void)failure;
+#endif
+
+    return error;
+}
+
+
+/* Copy the directory part of name into dir. */
+static void icsDirName(char       *dir,
+                       const char *name)
+{
+    char *sep;
+
+
+    IcsStrCpy(dir, name, ICS_MAXPATHLEN);
+    sep = strrchr(dir, '/');
+    if (sep == NULL) {
+        IcsStrCpy(dir, ".", ICS_MAXPATHLEN);
+    } else if (sep == dir) {
+        sep[1] = '\0';
+    } else {
+        *sep = '\0';
+    }
+}
+
+
+/* Flush a directory, such that a rename in it is durable. */
+static Ics_Error icsSyncDir(const char *dir)
+{
+    ICSINIT;
+#if !defined(_WIN32)
+    int fd;
+
+
+    fd = open(dir, O_RDONLY);
+    if (fd < 0) return IcsErr_FWriteIcs;
+    if (fsync(fd) != 0) error = IcsErr_FWriteIcs;
+    close(fd);
+#else
+        /* NTFS journals the rename itself */
+    (void)dir;
+#endif
+
+    return error;
+}
+
+
+/* Make a list of closed files durable, then visible, and free it. Returns the
+   first error. */
+static Ics_Error icsCommitFiles(Ics_PendingFile *list,
+                                int              group)
+{
+    ICSINIT;
+    Ics_PendingFile *file, *next;
+    Ics_SyncState    state;
+    Ics_Error        e;
+    char             dir[ICS_MAXPATHLEN];
+    char             lastDir[ICS_MAXPATHLEN] = "";
+
+
+    state.n = 0;
+    state.group = group;
+
+        /* The data and the headers go to disk first */
+    for (file = list; file != NULL; file = file->next) {
+        e = IcsErr_Ok;
+        if (file->storeDir[0] != '\0') {
+            e = icsSyncPath(file->storeDir, 1, IcsErr_FWriteIds, &state);
+        }
+        if (!e && (file->dataName[0] != '\0')) {
+            e = icsSyncPath(file->dataName, 0, IcsErr_FWriteIds, &state);
+        }
+        if (!e && (file->zoneName[0] != '\0')) {
+            e = icsSyncPath(file->zoneName, 0, IcsErr_FWriteIds, &state);
+        }
+        if (!e && (file->zipIndex[0] != '\0')) {
+            e = icsSyncPath(file->zipIndex, 0, IcsErr_FWriteIds, &state);
+        }
+        if (!e) e = icsSyncPath(file->tempName, 0, IcsErr_FWriteIcs, &state);
+        file->error = e;
+    }
+
+        /* Then the headers appear under their final names */
+    for (file = list; file != NULL; file = file->next) {
+#if defined(_WIN32)
+            /* rename() does not replace an existing file on Windows */
+        if (!file->error && !MoveFileExA(file->tempName, file->name,
+                                         MOVEFILE_REPLACE_EXISTING |
+                                         MOVEFILE_WRITE_THROUGH)) {
+            file->error = IcsErr_FTempMoveIcs;
+        }
+#else
+            /* If this fails, the old file is kept */
+        if (!file->error && rename(file->tempName, file->name)) {
+            file->error = IcsErr_FTempMoveIcs;
+        }
+#endif
+        if (file->error) {
+            remove(file->tempName);
+        } else {
+            icsDirName(dir, file->name);
+            if (strcmp(dir, lastDir) != 0) {
+                file->error = icsSyncDir(dir);
+                IcsStrCpy(lastDir, dir, ICS_MAXPATHLEN);
+            }
+        }
+        if (file->error && !error) error = file->error;
+    }
+
+    for (file = list; file != NULL; file = next) {
+        next = file->next;
+        free(file);
+    }
+
+    return error;
+}
+
+
+/* Take the queue of pending files. Must be called with the lock held. */
+static Ics_PendingFile *icsTakePending(size_t *n)
+{
+    Ics_PendingFile *list = icsPendingFirst;
+    Ics_PendingFile *file;
+
+
+    *n = 0;
+    for (file = list; file != NULL; file = file->next) (*n)++;
+    icsPendingFirst = icsPendingLast = NULL;
+    icsFlushNow = 0;
+
+    return list;
+}
+
+
+/* Commit a list taken from the queue, and record the result. */
+static void icsCommitPending(Ics_PendingFile *list,
+                             size_t           n)
+{
+    Ics_Error error = icsCommitFiles(list, 1);
+
+
+    icsLockPending();
+    if (error && !icsGroupError) icsGroupError = error;
+    icsCommitted += n;
+    icsSignalPending();
+    icsUnlockPending();
+}
+
+
+#ifdef ICS_THREADS
+
+/* Commit the queue each time the window of its first file has passed, until
+   it stays empty. */
+static void icsFlusher(void)
+{
+    Ics_PendingFile *list;
+    size_t           n;
+    double           deadline;
+
+
+    icsLockPending();
+    while (icsPendingFirst != NULL) {
+        deadline = icsPendingSince + (double)icsWindow / 1000.0;
+        if (!icsFlushNow && (icsNow() < deadline)) {
+            icsWaitPending(deadline);
+            continue;
+        }
+        list = icsTakePending(&n);
+        icsUnlockPending();
+        icsCommitPending(list, n);
+        icsLockPending();
+    }
+    icsFlusherRunning = 0;
+    icsUnlockPending();
+}
+
+
+#if defined(_WIN32)
+static unsigned __stdcall icsFlusherMain(void *arg)
+{
+    (void)arg;
+    icsFlusher();
+    return 0;
+}
+#else
+static void *icsFlusherMain(void *arg)
+{
+    (void)arg;
+    icsFlusher();
+    return NULL;
+}
+#endif
+
+
+/* Start a detached flusher thread. Returns 0 on failure. */
+static int icsStartFlusher(void)
+{
+#if defined(_WIN32)
+    HANDLE thread;
+
+
+    thread = (HANDLE)_beginthreadex(NULL, 0, icsFlusherMain, NULL, 0, NULL);
+    if (thread == 0) return 0;
+    CloseHandle(thread);
+    return 1;
+#else
+    pthread_t thread;
+
+
+    if (pthread_create(&thread, NULL, icsFlusherMain, NULL) != 0) return 0;
+    pthread_detach(thread);
+    return 1;
+#endif
+}
+
+#endif /* ICS_THREADS */
+
+
+/* Commit the files still queued when the program exits. */
+static void icsFlushAtExit(void)
+{
+    Ics_PendingFile *list;
+    size_t           target, n;
+
+
+    icsLockPending();
+    target = icsQueued;
+    list = icsTakePending(&n);
+    icsUnlockPending();
+    if (list != NULL) icsCommitPending(list, n);
+#if !defined(_WIN32)
+        /* Wait for the files the flusher is committing. On Windows, other
+           threads are gone by the time a DLL runs its exit handlers. */
+    icsLockPending();
+    while (icsCommitted < target) {
+        icsWaitPending(0.0);
+    }
+    icsUnlockPending();
+#endif
+}
+
+
+/* Add a closed file to the queue of the group policy. */
+static void icsQueueFile(Ics_PendingFile *file)
+{
+    Ics_PendingFile *list = NULL;
+    size_t           n    = 0;
+
+
+    icsLockPending();
+    file->next = NULL;
+    if (icsPendingLast != NULL) {
+        icsPendingLast->next = file;
+    } else {
+        icsPendingFirst = file;
+        icsPendingSince = icsNow();
+    }
+    icsPendingLast = file;
+    icsQueued++;
+    if (!icsAtExit) {
+        if (atexit(icsFlushAtExit) == 0) {
+            icsAtExit = 1;
+        } else {
+                /* Without an exit handler, nothing may stay queued */
+            icsFlushNow = 1;
+        }
+    }
+#ifdef ICS_THREADS
+    if (!icsFlusherRunning) {
+        if (icsStartFlusher()) {
+            icsFlusherRunning = 1;
+        } else {
+                /* No thread to do it, commit here */
+            list = icsTakePending(&n);
+        }
+    }
+#else
+    if (icsFlushNow ||
+        (icsNow() >= icsPendingSince + (double)icsWindow / 1000.0)) {
+        list = icsTakePending(&n);
+    }
+#endif
+    icsUnlockPending();
+    if (list != NULL) icsCommitPending(list, n);
+}
+
+
+/* Set the durability policy for files opened for writing from now on. */
+Ics_Error IcsSetDefaultDurability(Ics_Durability durability,
+                                  size_t         window)
+{
+    ICSINIT;
+
+
+    if ((durability != IcsDurability_none) &&
+        (durability != IcsDurability_sync) &&
+        (durability != IcsDurability_group)) {
+        return IcsErr_IllParameter;
+    }
+    IcsAtomicSet(&icsDefaultDurability, (int)durability);
+    icsLockPending();
+    icsWindow = window > 0 ? window : ICS_DURABLE_WINDOW;
+    icsUnlockPending();
+
+    return error;
+}
+
+
+/* Wait until the files closed so far are durable and visible. */
+Ics_Error IcsFlushDurable(void)
+{
+    ICSINIT;
+    Ics_PendingFile *list = NULL;
+    size_t           target, n = 0;
+
+
+    icsLockPending();
+    target = icsQueued;
+    if (icsFlusherRunning) {
+        icsFlushNow = 1;
+        icsSignalPending();
+    } else if (icsPendingFirst != NULL) {
+        list = icsTakePending(&n);
+    }
+    icsUnlockPending();
+    if (list != NULL) icsCommitPending(list, n);
+
+    icsLockPending();
+    while (icsCommitted < target) {
+        icsWaitPending(0.0);
+    }
+    error = icsGroupError;
+    icsGroupError = IcsErr_Ok;
+    icsUnlockPending();
+
+    return error;
+}
+
+
+/* Returns the policy for new files opened for writing. */
+Ics_Durability IcsGetDefaultDurability(void)
+{
+    return (Ics_Durability)IcsAtomicGet(&icsDefaultDurability);
+}
+
+
+/* Make the name of the file the ICS file is written to: the ICS file itself,
+   or with a durability policy, a temporary file next to it. dest must hold
+   ICS_MAXPATHLEN characters. */
+Ics_Error IcsGetOutputName(char             *dest,
+                           const Ics_Header *icsStruct)
+{
+    ICSINIT;
+
+
+    IcsStrCpy(dest, icsStruct->filename, ICS_MAXPATHLEN);
+    if ((icsStruct->fileMode == IcsFileMode_write) &&
+        (icsStruct->durability != IcsDurability_none)) {
+        if (strlen(dest) + strlen(ICS_TEMP_EXT) >= ICS_MAXPATHLEN) {
+            return IcsErr_FOpenIcs;
+        }
+        strcat(dest, ICS_TEMP_EXT);
+    }
+
+    return error;
+}
+
+
+/* Make the files written for the ICS structure durable, and give the ICS file
+   its final name. If error is set, writing failed, and the temporary file is
+   removed instead. Returns error, or the error of committing the files. */
+Ics_Error IcsCommitOutput(const Ics_Header *icsStruct,
+                          Ics_Error         error)
+{
+    Ics_PendingFile *file;
+    char             tempName[ICS_MAXPATHLEN];
+
+
+    if ((icsStruct->fileMode != IcsFileMode_write) ||
+        (icsStruct->durability == IcsDurability_none)) {
+        return error;
+    }
+    if (IcsGetOutputName(tempName, icsStruct) != IcsErr_Ok) return error;
+    if (error) {
+        remove(tempName);
+        return error;
+    }
+
+    file = (Ics_PendingFile*)calloc(1, sizeof(Ics_PendingFile));
+    if (file == NULL) {
+        remove(tempName);
+        return IcsErr_Alloc;
+    }
+    IcsStrCpy(file->name, icsStruct->filename, ICS_MAXPATHLEN);
+    IcsStrCpy(file->tempName, tempName, ICS_MAXPATHLEN);
+    if (icsStruct->version == 1) {
+        IcsGetIdsName(file->dataName, icsStruct->filename);
+    }
+    if (icsStruct->writeZoneMap) {
+        IcsGetSidecarName(file->zoneName, icsStruct->filename,
+                          ICS_ZONE_EXT);
+    }
+    if (IcsWritesZipIndex(icsStruct)) {
+        IcsGetSidecarName(file->zipIndex, icsStruct->filename,
+                          ICS_ZINDEX_EXT);
+    }
+    if (icsStruct->chunkStore[0] != '\0') {
+        IcsStrCpy(file->storeDir, icsStruct->chunkStore, ICS_MAXPATHLEN);
+    } else if (icsStruct->dedupStore[0] != '\0') {
+        IcsStrCpy(file->storeDir, icsStruct->dedupStore, ICS_MAXPATHLEN);
+    }
+
+    if (icsStruct->durability == IcsDurability_sync) {
+        file->next = NULL;
+        return icsCommitFiles(file, 0);
+    }
+    icsQueueFile(file);
+
+    return IcsErr_Ok;
+}
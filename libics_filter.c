@@ -0,0 +1,551 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_filter.c
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsDeltaEncode()
+ *   IcsOpenDelta()
+ *   IcsCloseDelta()
+ *   IcsReadDeltaBlock()
+ *   IcsSetDeltaBlock()
+ *
+ * Delta coding along the time dimension: each frame (the set of imels with
+ * the same index along the time dimension) is stored as the difference with
+ * the previous frame, except for keyframes, which are stored as-is. Every
+ * deltaKeyInterval-th frame is a keyframe, so reading any frame requires at
+ * most that many frames to be read. Integer samples are stored as the
+ * difference modulo 2^bits, mapped such that small negative differences become
+ * small positive values (zig-zag coding); floating-point samples are stored as
+ * the XOR of the bit patterns. Both are exactly invertible. The coding is done
+ * before compression, so it applies to any compression method.
+ *
+ * When reading, the decoded data is kept by its position within the frame,
+ * together with the frame it belongs to. Decoding part of a frame needs only
+ * the same part of the previous frame, which is there after reading that one,
+ * such that sequential and region reads don't read any data twice. If it is
+ * not there, the frames from the previous keyframe on are decoded in one pass
+ * forward, which bounds the cost of random access.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+
+/* A part of the decoded data kept: bytes [start, end) within the frame hold
+   the data of the given frame. */
+typedef struct {
+    size_t start;
+    size_t end;
+    size_t frame;     /* counted from the start of the image data */
+} Ics_DeltaSpan;
+
+/* This is the struct behind the "void* delta" in the Ics_BlockRead
+   structure: */
+typedef struct {
+    size_t         unit;     /* bytes per sample */
+    int            isFloat;  /* floating-point samples are XORed */
+    size_t         imel;     /* bytes per imel */
+    size_t         stride;   /* bytes between consecutive frames */
+    size_t         nFrames;  /* size of the time dimension */
+    size_t         key;      /* keyframe interval */
+    size_t         pos;      /* current position in the image data, in bytes */
+    char          *kept;     /* decoded data, by position within the frame */
+    Ics_DeltaSpan *spans;    /* what is in kept, sorted and not overlapping */
+    size_t         nSpans;
+    size_t         maxSpans;
+} Ics_DeltaRead;
+
+
+/* Get the delta coding parameters for the image. */
+static Ics_Error icsDeltaParams(const Ics_Header *icsStruct,
+                                Ics_DeltaRead    *dr)
+{
+    Ics_Format format;
+    int        sign, i;
+    size_t     bits;
+
+
+    if ((icsStruct->deltaDim < 0)
+        || (icsStruct->deltaDim >= icsStruct->dimensions)
+        || (icsStruct->deltaKeyInterval < 1)) {
+        return IcsErr_IllParameter;
+    }
+    IcsGetPropsDataType(icsStruct->imel.dataType, &format, &sign, &bits);
+    dr->imel = IcsGetDataTypeSize(icsStruct->imel.dataType);
+    dr->isFloat = format != IcsForm_integer;
+    dr->unit = format == IcsForm_complex ? dr->imel / 2 : dr->imel;
+    if (dr->unit == 0) return IcsErr_UnknownDataType;
+    dr->stride = dr->imel;
+    for (i = 0; i < icsStruct->deltaDim; i++) {
+        dr->stride *= icsStruct->dim[i].size;
+    }
+    dr->nFrames = icsStruct->dim[icsStruct->deltaDim].size;
+    dr->key = icsStruct->deltaKeyInterval;
+    return IcsErr_Ok;
+}
+
+
+/* Code n bytes of samples in data as the difference with those in ref. */
+static void icsDeltaMake(char          *data,
+                         const char    *ref,
+                         size_t         n,
+                         Ics_DeltaRead *dr)
+{
+    size_t i;
+
+
+    if (dr->isFloat) {
+        for (i = 0; i < n; i++) {
+            data[i] ^= ref[i];
+        }
+        return;
+    }
+    switch (dr->unit) {
+        case 1:
+            for (i = 0; i < n; i++) {
+                ics_t_uint8 d = (ics_t_uint8)((ics_t_uint8)data[i]
+                                              - (ics_t_uint8)ref[i]);
+                data[i] = (char)((d & 0x80) ? ((~d << 1) | 1) : (d << 1));
+            }
+            break;
+        case 2:
+            for (i = 0; i < n; i += 2) {
+                ics_t_uint16 v, r, d;
+                memcpy(&v, data + i, 2);
+                memcpy(&r, ref + i, 2);
+                d = (ics_t_uint16)(v - r);
+                d = (ics_t_uint16)((d & 0x8000) ? ((~d << 1) | 1) : (d << 1));
+                memcpy(data + i, &d, 2);
+            }
+            break;
+        case 4:
+            for (i = 0; i < n; i += 4) {
+                ics_t_uint32 v, r, d;
+                memcpy(&v, data + i, 4);
+                memcpy(&r, ref + i, 4);
+                d = v - r;
+                d = (d & 0x80000000u) ? ((~d << 1) | 1) : (d << 1);
+                memcpy(data + i, &d, 4);
+            }
+            break;
+        default:
+            for (i = 0; i < n; i += 8) {
+                ics_t_uint64 v, r, d;
+                memcpy(&v, data + i, 8);
+                memcpy(&r, ref + i, 8);
+                d = v - r;
+                d = (d >> 63) ? ((~d << 1) | 1) : (d << 1);
+                memcpy(data + i, &d, 8);
+            }
+    }
+}
+
+
+/* Undo icsDeltaMake(). */
+static void icsDeltaUndo(char          *data,
+                         const char    *ref,
+                         size_t         n,
+                         Ics_DeltaRead *dr)
+{
+    size_t i;
+
+
+    if (dr->isFloat) {
+        for (i = 0; i < n; i++) {
+            data[i] ^= ref[i];
+        }
+        return;
+    }
+    switch (dr->unit) {
+        case 1:
+            for (i = 0; i < n; i++) {
+                ics_t_uint8 d = (ics_t_uint8)data[i];
+                d = (ics_t_uint8)((d & 1) ? ~(d >> 1) : (d >> 1));
+                data[i] = (char)(ics_t_uint8)((ics_t_uint8)ref[i] + d);
+            }
+            break;
+        case 2:
+            for (i = 0; i < n; i += 2) {
+                ics_t_uint16 r, d;
+                memcpy(&d, data + i, 2);
+                memcpy(&r, ref + i, 2);
+                d = (ics_t_uint16)((d & 1) ? ~(d >> 1) : (d >> 1));
+                d = (ics_t_uint16)(r + d);
+                memcpy(data + i, &d, 2);
+            }
+            break;
+        case 4:
+            for (i = 0; i < n; i += 4) {
+                ics_t_uint32 r, d;
+                memcpy(&d, data + i, 4);
+                memcpy(&r, ref + i, 4);
+                d = (d & 1) ? ~(d >> 1) : (d >> 1);
+                d = r + d;
+                memcpy(data + i, &d, 4);
+            }
+            break;
+        default:
+            for (i = 0; i < n; i += 8) {
+                ics_t_uint64 r, d;
+                memcpy(&d, data + i, 8);
+                memcpy(&r, ref + i, 8);
+                d = (d & 1) ? ~(d >> 1) : (d >> 1);
+                d = r + d;
+                memcpy(data + i, &d, 8);
+            }
+    }
+}
+
+
+/* Delta code the image data, in place. data holds the whole image, without
+   strides, in the machine's byte order. */
+Ics_Error IcsDeltaEncode(const Ics_Header *icsStruct,
+                         void             *data,
+                         size_t            n)
+{
+    ICSINIT;
+    Ics_DeltaRead dr;
+    char         *p = (char*)data;
+    size_t        q, len;
+
+
+    error = icsDeltaParams(icsStruct, &dr);
+    if (error) return error;
+    if (n < dr.stride) return IcsErr_Ok;
+
+        /* Go backwards, such that the previous frame is still intact */
+    q = ((n - 1) / dr.stride) * dr.stride;
+    for (;;) {
+        len = n - q < dr.stride ? n - q : dr.stride;
+        if (((q / dr.stride) % dr.nFrames) % dr.key != 0) {
+            icsDeltaMake(p + q, p + q - dr.stride, len, &dr);
+        }
+        if (q == 0) break;
+        q -= dr.stride;
+    }
+
+    return error;
+}
+
+
+/* Prepare for reading delta coded data. */
+Ics_Error IcsOpenDelta(Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_DeltaRead *dr;
+
+
+    dr = (Ics_DeltaRead*)IcsGetScratch(icsStruct, sizeof(Ics_DeltaRead));
+    if (dr == NULL) return IcsErr_Alloc;
+    error = icsDeltaParams(icsStruct, dr);
+    if (!error) {
+        dr->maxSpans = 16;
+        dr->kept = (char*)IcsGetScratch(icsStruct, dr->stride);
+        dr->spans = (Ics_DeltaSpan*)IcsGetScratch(
+            icsStruct, dr->maxSpans * sizeof(Ics_DeltaSpan));
+        if ((dr->kept == NULL) || (dr->spans == NULL)) {
+            if (dr->kept != NULL) IcsReleaseScratch(icsStruct, dr->kept);
+            if (dr->spans != NULL) IcsReleaseScratch(icsStruct, dr->spans);
+            error = IcsErr_Alloc;
+        }
+    }
+    if (error) {
+        IcsReleaseScratch(icsStruct, dr);
+        return error;
+    }
+    dr->pos = 0;
+    dr->nSpans = 0;
+
+    br->delta = dr;
+    return error;
+}
+
+
+/* Free the delta decoding state. */
+Ics_Error IcsCloseDelta(Ics_Header *icsStruct)
+{
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_DeltaRead *dr = (Ics_DeltaRead*)br->delta;
+
+
+    IcsReleaseScratch(icsStruct, dr->kept);
+    IcsReleaseScratch(icsStruct, dr->spans);
+    IcsReleaseScratch(icsStruct, dr);
+    br->delta = NULL;
+
+    return IcsErr_Ok;
+}
+
+
+/* Is the decoded data at [pos, pos+n), which lies within one frame, kept? */
+static int icsDeltaIsKept(const Ics_DeltaRead *dr,
+                          size_t               pos,
+                          size_t               n)
+{
+    size_t i;
+    size_t frame = pos / dr->stride;
+    size_t start = pos % dr->stride;
+    size_t end   = start + n;
+
+
+    for (i = 0; (i < dr->nSpans) && (start < end); i++) {
+        if (dr->spans[i].end <= start) continue;
+        if ((dr->spans[i].start > start) || (dr->spans[i].frame != frame)) {
+            return 0;
+        }
+        start = dr->spans[i].end;
+    }
+    return start >= end;
+}
+
+
+/* Keep the decoded data src at [pos, pos+n), which lies within one frame. */
+static Ics_Error icsDeltaKeep(Ics_Header    *icsStruct,
+                              Ics_DeltaRead *dr,
+                              size_t         pos,
+                              const char    *src,
+                              size_t         n)
+{
+    Ics_DeltaSpan *spans = dr->spans;
+    Ics_DeltaSpan  left, right;
+    size_t         frame = pos / dr->stride;
+    size_t         start = pos % dr->stride;
+    size_t         end   = start + n;
+    size_t         i, j, k;
+    int            hasLeft, hasRight;
+
+
+    if (n == 0) return IcsErr_Ok;
+    if (dr->nSpans + 2 > dr->maxSpans) {
+        spans = (Ics_DeltaSpan*)IcsGetScratch(
+            icsStruct, 2 * dr->maxSpans * sizeof(Ics_DeltaSpan));
+        if (spans == NULL) return IcsErr_Alloc;
+        memcpy(spans, dr->spans, dr->nSpans * sizeof(Ics_DeltaSpan));
+        IcsReleaseScratch(icsStruct, dr->spans);
+        dr->spans = spans;
+        dr->maxSpans *= 2;
+    }
+    memcpy(dr->kept + start, src, n);
+
+        /* Spans [i, j) overlap the new one, and are replaced by it and by
+           the parts of the first and last that stick out */
+    for (i = 0; (i < dr->nSpans) && (spans[i].end <= start); i++) ;
+    for (j = i; (j < dr->nSpans) && (spans[j].start < end); j++) ;
+    hasLeft = (i < j) && (spans[i].start < start);
+    hasRight = (i < j) && (spans[j - 1].end > end);
+    if (hasLeft) {
+        left = spans[i];
+        left.end = start;
+    }
+    if (hasRight) {
+        right = spans[j - 1];
+        right.start = end;
+    }
+    k = i + (size_t)hasLeft + 1 + (size_t)hasRight;
+    memmove(spans + k, spans + j, (dr->nSpans - j) * sizeof(Ics_DeltaSpan));
+    dr->nSpans = dr->nSpans + k - j;
+    if (hasLeft) spans[i++] = left;
+    spans[i].start = start;
+    spans[i].end = end;
+    spans[i].frame = frame;
+    if (hasRight) spans[i + 1] = right;
+
+        /* Merge with the neighbours if they continue it */
+    if ((i + 1 < dr->nSpans) && (spans[i + 1].start == end)
+        && (spans[i + 1].frame == frame)) {
+        spans[i].end = spans[i + 1].end;
+        memmove(spans + i + 1, spans + i + 2,
+                (dr->nSpans - i - 2) * sizeof(Ics_DeltaSpan));
+        dr->nSpans--;
+    }
+    if ((i > 0) && (spans[i - 1].end == start)
+        && (spans[i - 1].frame == frame)) {
+        spans[i - 1].end = spans[i].end;
+        memmove(spans + i, spans + i + 1,
+                (dr->nSpans - i - 1) * sizeof(Ics_DeltaSpan));
+        dr->nSpans--;
+    }
+
+    return IcsErr_Ok;
+}
+
+
+/* Decode the whole of the given frame into kept, reading forward from the
+   keyframe before it. This moves the position in the IDS file. */
+static Ics_Error icsDeltaDecodeFrame(Ics_Header    *icsStruct,
+                                     Ics_DeltaRead *dr,
+                                     size_t         frame)
+{
+    ICSINIT;
+    size_t f   = frame - (frame % dr->nFrames) % dr->key;
+    char  *tmp;
+
+
+    dr->nSpans = 0;
+    tmp = (char*)IcsGetScratch(icsStruct, dr->stride);
+    if (tmp == NULL) return IcsErr_Alloc;
+    error = IcsSetIdsData(icsStruct, (ics_t_sint64)(f * dr->stride), SEEK_SET);
+    if (!error) error = IcsReadIdsData(icsStruct, dr->kept, dr->stride);
+    while (!error && (f < frame)) {
+        error = IcsReadIdsData(icsStruct, tmp, dr->stride);
+        if (!error) {
+            icsDeltaUndo(tmp, dr->kept, dr->stride, dr);
+            memcpy(dr->kept, tmp, dr->stride);
+        }
+        f++;
+    }
+    IcsReleaseScratch(icsStruct, tmp);
+    if (!error) {
+        dr->spans[0].start = 0;
+        dr->spans[0].end = dr->stride;
+        dr->spans[0].frame = frame;
+        dr->nSpans = 1;
+    }
+
+    return error;
+}
+
+
+/* Decode the delta coded data in buf, which was read from [pos, pos+n). */
+static Ics_Error icsDeltaDecode(Ics_Header    *icsStruct,
+                                Ics_DeltaRead *dr,
+                                size_t         pos,
+                                size_t         n,
+                                char          *buf,
+                                int           *moved)
+{
+    ICSINIT;
+    size_t q, len, m, ref;
+
+
+        /* Process runs of data within one frame, first to last, such that the
+           previous frame is decoded when we need it */
+    for (q = pos; q < pos + n; q += len) {
+        len = dr->stride - q % dr->stride;
+        if (len > pos + n - q) len = pos + n - q;
+        if (((q / dr->stride) % dr->nFrames) % dr->key == 0) continue;
+        ref = q - dr->stride;
+        m = 0;
+        if (ref < pos) {
+                /* The reference starts before the data in buf */
+            m = pos - ref < len ? pos - ref : len;
+            if (!icsDeltaIsKept(dr, ref, m)) {
+                *moved = 1;
+                error = icsDeltaDecodeFrame(icsStruct, dr, ref / dr->stride);
+                if (error) return error;
+            }
+            icsDeltaUndo(buf + (q - pos), dr->kept + ref % dr->stride, m, dr);
+        }
+        if (m < len) {
+            icsDeltaUndo(buf + (q - pos) + m, buf + (ref + m - pos), len - m,
+                         dr);
+        }
+    }
+
+    return error;
+}
+
+
+/* Read a data block of delta coded data. */
+Ics_Error IcsReadDeltaBlock(Ics_Header *icsStruct,
+                            void       *outBuf,
+                            size_t      len)
+{
+    ICSINIT;
+    Ics_BlockRead *br    = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_DeltaRead *dr    = (Ics_DeltaRead*)br->delta;
+    char          *out   = (char*)outBuf;
+    size_t         pos   = dr->pos;
+    int            moved = 0;
+    size_t         q, run;
+
+
+    if ((pos % dr->imel != 0) || (len % dr->imel != 0)) {
+        return IcsErr_BlockNotAllowed;
+    }
+    error = IcsReadIdsData(icsStruct, outBuf, len);
+    if (!error) error = icsDeltaDecode(icsStruct, dr, pos, len, out, &moved);
+    if (error) return error;
+    dr->pos = pos + len;
+    if (moved) error = IcsSetIdsData(icsStruct, (ics_t_sint64)dr->pos,
+                                      SEEK_SET);
+
+        /* Keep the last frame's worth of decoded data */
+    q = len > dr->stride ? dr->pos - dr->stride : pos;
+    for (; !error && (q < dr->pos); q += run) {
+        run = dr->stride - q % dr->stride;
+        if (run > dr->pos - q) run = dr->pos - q;
+        error = icsDeltaKeep(icsStruct, dr, q, out + (q - pos), run);
+    }
+
+    return error;
+}
+
+
+/* Set the read position in delta coded data. */
+Ics_Error IcsSetDeltaBlock(Ics_Header   *icsStruct,
+                           ics_t_sint64  offset,
+                           int           whence)
+{
+    ICSINIT;
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_DeltaRead *dr = (Ics_DeltaRead*)br->delta;
+    size_t         pos;
+
+
+    switch (whence) {
+        case SEEK_SET:
+            if (offset < 0) return IcsErr_IllParameter;
+            pos = (size_t)offset;
+            break;
+        case SEEK_CUR:
+            if ((offset < 0) && ((size_t)(-offset) > dr->pos)) {
+                return IcsErr_IllParameter;
+            }
+            pos = offset < 0 ? dr->pos - (size_t)(-offset)
+                             : dr->pos + (size_t)offset;
+            break;
+        default:
+            return IcsErr_IllParameter;
+    }
+    error = IcsSetIdsData(icsStruct, offset, whence);
+    if (!error) dr->pos = pos;
+
+    return error;
+}
@@ -0,0 +1,424 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_fpred.c
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsFpredSupports()
+ *   IcsFpredEncode()
+ *   IcsFpredDecode()
+ *
+ * This is a lossless codec for floating-point data (real and complex, 32 and
+ * 64 bit), in the spirit of fpzip and ndzip. The bit pattern of each sample is
+ * mapped to an unsigned integer that has the same ordering as the
+ * floating-point values, and predicted from its neighbours with the Lorenzo
+ * predictor (left + up - up-left), computed in integer arithmetic so that the
+ * prediction is exact on every platform. The prediction error is mapped to an
+ * unsigned value with small magnitude (zig-zag coding), and errors are packed
+ * in blocks of ICS_FPRED_BLOCK samples, using for each block as many bits per
+ * sample as its largest error needs. The real and imaginary components of
+ * complex data are predicted separately.
+ *
+ * A tile is coded independently of other tiles. The coded tile starts with a
+ * flags byte that records the byte order of the writer, such that the decoded
+ * data has the same byte order as the original.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+
+#define ICS_FPRED_BLOCK     16   /* samples per block of prediction errors */
+#define ICS_FPRED_BIGENDIAN 0x01
+
+
+/* Properties of a data type for this codec. */
+typedef struct {
+    int          bytes; /* bytes per component */
+    int          comps; /* components per imel (1 or 2) */
+    ics_t_uint64 sign;  /* sign bit of a component */
+    ics_t_uint64 mask;  /* all bits of a component */
+} Ics_FpredType;
+
+
+/* Bit packer, writes most significant bits first. */
+typedef struct {
+    unsigned char *out;
+    size_t         pos;
+    size_t         capacity;
+    ics_t_uint64   acc;
+    int            nBits;
+} Ics_BitPacker;
+
+
+static int icsIsBigEndianMachine(void)
+{
+    int i = 1;
+    return *(char*)&i != 1;
+}
+
+
+static int icsFpredType(Ics_DataType   dataType,
+                        Ics_FpredType *t)
+{
+    switch (dataType) {
+        case Ics_real32:
+            t->bytes = 4;
+            t->comps = 1;
+            break;
+        case Ics_real64:
+            t->bytes = 8;
+            t->comps = 1;
+            break;
+        case Ics_complex32:
+            t->bytes = 4;
+            t->comps = 2;
+            break;
+        case Ics_complex64:
+            t->bytes = 8;
+            t->comps = 2;
+            break;
+        default:
+            return 0;
+    }
+    t->sign = (ics_t_uint64)1 << (8 * t->bytes - 1);
+    t->mask = t->sign | (t->sign - 1);
+    return 1;
+}
+
+
+/* Map a floating-point bit pattern to an integer with the same ordering. */
+static ics_t_uint64 icsFpredMap(ics_t_uint64         x,
+                                const Ics_FpredType *t)
+{
+    return (x & t->sign) ? (~x & t->mask) : (x | t->sign);
+}
+
+
+static ics_t_uint64 icsFpredUnmap(ics_t_uint64         u,
+                                  const Ics_FpredType *t)
+{
+    return (u & t->sign) ? (u & ~t->sign) : (~u & t->mask);
+}
+
+
+static ics_t_uint64 icsFpredLoad(const char          *p,
+                                 const Ics_FpredType *t)
+{
+    ics_t_uint32 x32;
+    ics_t_uint64 x64;
+
+
+    if (t->bytes == 4) {
+        memcpy(&x32, p, 4);
+        return x32;
+    }
+    memcpy(&x64, p, 8);
+    return x64;
+}
+
+
+static void icsFpredStore(char                *p,
+                          ics_t_uint64         x,
+                          const Ics_FpredType *t)
+{
+    ics_t_uint32 x32;
+
+
+    if (t->bytes == 4) {
+        x32 = (ics_t_uint32)x;
+        memcpy(p, &x32, 4);
+    } else {
+        memcpy(p, &x, 8);
+    }
+}
+
+
+/* The Lorenzo predictor. Samples outside the tile are replaced by their
+   neighbours inside it. */
+static ics_t_uint64 icsFpredPredict(const ics_t_uint64 *cur,
+                                    const ics_t_uint64 *prev,
+                                    size_t              i,
+                                    size_t              y,
+                                    int                 comps)
+{
+    if (y == 0) {
+        return i >= (size_t)comps ? cur[i - (size_t)comps] : 0;
+    }
+    if (i < (size_t)comps) return prev[i];
+    return cur[i - (size_t)comps] + prev[i] - prev[i - (size_t)comps];
+}
+
+
+/* Output n bits of x (n <= 32). */
+static void icsPackBits(Ics_BitPacker *w,
+                        ics_t_uint64   x,
+                        int            n)
+{
+    w->acc = (w->acc << n) | (x & (((ics_t_uint64)1 << n) - 1));
+    w->nBits += n;
+    while (w->nBits >= 8) {
+        w->nBits -= 8;
+        if (w->pos < w->capacity) {
+            w->out[w->pos] = (unsigned char)(w->acc >> w->nBits);
+        }
+        w->pos++;
+    }
+}
+
+
+static void icsPackValue(Ics_BitPacker *w,
+                         ics_t_uint64   x,
+                         int            n)
+{
+    if (n > 32) {
+        icsPackBits(w, x >> 32, n - 32);
+        n = 32;
+    }
+    icsPackBits(w, x, n);
+}
+
+
+/* Write a block of prediction errors. */
+static void icsFpredFlush(Ics_BitPacker      *w,
+                          const ics_t_uint64 *block,
+                          size_t              n)
+{
+    ics_t_uint64 all = 0;
+    size_t       i;
+    int          width = 0;
+
+
+    for (i = 0; i < n; i++) {
+        all |= block[i];
+    }
+    while (all) {
+        width++;
+        all >>= 1;
+    }
+    icsPackBits(w, (ics_t_uint64)width, 8);
+    if (width > 0) {
+        for (i = 0; i < n; i++) {
+            icsPackValue(w, block[i], width);
+        }
+    }
+}
+
+
+/* Reads n bits (n <= 64) from the input, MSB first. Returns non-zero when
+   reading past the end of the input. */
+static int icsUnpackValue(const unsigned char *in,
+                          size_t               length,
+                          size_t              *bitPos,
+                          int                  n,
+                          ics_t_uint64        *x)
+{
+    size_t pos   = *bitPos;
+    int    avail;
+
+
+    if (pos + (size_t)n > length * 8) return 1;
+    *x = 0;
+    while (n > 0) {
+        avail = 8 - (int)(pos & 7);
+        if (avail > n) avail = n;
+        *x = (*x << avail) | (ics_t_uint64)(
+            (in[pos >> 3] >> (8 - (int)(pos & 7) - avail)) & ((1 << avail) - 1));
+        pos += (size_t)avail;
+        n -= avail;
+    }
+    *bitPos = pos;
+    return 0;
+}
+
+
+/* Returns non-zero if the data type can be coded. */
+int IcsFpredSupports(Ics_DataType dataType)
+{
+    Ics_FpredType t;
+
+
+    return icsFpredType(dataType, &t);
+}
+
+
+/* Code a tile of width x height imels. Returns IcsErr_BufferTooSmall if the
+   coded tile does not fit in capacity bytes. */
+Ics_Error IcsFpredEncode(const void       *src,
+                         Ics_DataType      dataType,
+                         size_t            width,
+                         size_t            height,
+                         unsigned char    *dest,
+                         size_t            capacity,
+                         size_t           *length,
+                         const Ics_Header *icsStruct)
+{
+    Ics_FpredType  t;
+    Ics_BitPacker  w;
+    ics_t_uint64   block[ICS_FPRED_BLOCK];
+    ics_t_uint64  *rows, *cur, *prev, *tmp, u, d;
+    const char    *in = (const char*)src;
+    size_t         rowSamples, x, y, n = 0;
+
+
+    if (!icsFpredType(dataType, &t)) return IcsErr_IllParameter;
+    if (capacity < 1) return IcsErr_BufferTooSmall;
+    rowSamples = width * (size_t)t.comps;
+    rows = (ics_t_uint64*)IcsGetScratch(icsStruct, 2 * rowSamples
+                                                   * sizeof(ics_t_uint64));
+    if (rows == NULL) return IcsErr_Alloc;
+    cur = rows;
+    prev = rows + rowSamples;
+
+    dest[0] = icsIsBigEndianMachine() ? ICS_FPRED_BIGENDIAN : 0;
+    w.out = dest + 1;
+    w.pos = 0;
+    w.capacity = capacity - 1;
+    w.acc = 0;
+    w.nBits = 0;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < rowSamples; x++) {
+            u = icsFpredMap(icsFpredLoad(in, &t), &t);
+            in += t.bytes;
+            cur[x] = u;
+            d = (u - icsFpredPredict(cur, prev, x, y, t.comps)) & t.mask;
+                /* Zig-zag: small negative errors become small values */
+            block[n++] = (d & t.sign) ? ((~d << 1) | 1) & t.mask
+                                      : (d << 1) & t.mask;
+            if (n == ICS_FPRED_BLOCK) {
+                icsFpredFlush(&w, block, n);
+                n = 0;
+                if (w.pos > w.capacity) {
+                    IcsReleaseScratch(icsStruct, rows);
+                    return IcsErr_BufferTooSmall;
+                }
+            }
+        }
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    if (n > 0) icsFpredFlush(&w, block, n);
+    if (w.nBits > 0) icsPackBits(&w, 0, 8 - w.nBits);
+    IcsReleaseScratch(icsStruct, rows);
+    if (w.pos > w.capacity) return IcsErr_BufferTooSmall;
+    *length = w.pos + 1;
+
+    return IcsErr_Ok;
+}
+
+
+/* Decode a tile of width x height imels. */
+Ics_Error IcsFpredDecode(const unsigned char *src,
+                         size_t               length,
+                         Ics_DataType         dataType,
+                         size_t               width,
+                         size_t               height,
+                         void                *dest,
+                         const Ics_Header    *icsStruct)
+{
+    ICSINIT;
+    Ics_FpredType  t;
+    ics_t_uint64   block[ICS_FPRED_BLOCK];
+    ics_t_uint64  *rows, *cur, *prev, *tmp, u, z;
+    char          *out = (char*)dest;
+    size_t         rowSamples, x, y, i, j, n, bitPos = 0, left;
+    ics_t_uint64   nb;
+
+
+    if (!icsFpredType(dataType, &t)) return IcsErr_IllParameter;
+    if (length < 1) return IcsErr_CorruptedStream;
+    rowSamples = width * (size_t)t.comps;
+    rows = (ics_t_uint64*)IcsGetScratch(icsStruct, 2 * rowSamples
+                                                   * sizeof(ics_t_uint64));
+    if (rows == NULL) return IcsErr_Alloc;
+    cur = rows;
+    prev = rows + rowSamples;
+
+    left = rowSamples * height;
+    n = 0;
+    i = 0;
+    for (y = 0; !error && y < height; y++) {
+        for (x = 0; x < rowSamples; x++) {
+            if (i == n) {
+                    /* Read the next block */
+                n = left < ICS_FPRED_BLOCK ? left : ICS_FPRED_BLOCK;
+                left -= n;
+                i = 0;
+                if (icsUnpackValue(src + 1, length - 1, &bitPos, 8, &nb)
+                    || (nb > (ics_t_uint64)(8 * t.bytes))) {
+                    error = IcsErr_CorruptedStream;
+                    break;
+                }
+                for (j = 0; j < n; j++) {
+                    block[j] = 0;
+                    if ((nb > 0) && icsUnpackValue(src + 1, length - 1, &bitPos,
+                                                   (int)nb, block + j)) {
+                        error = IcsErr_CorruptedStream;
+                        break;
+                    }
+                }
+                if (error) break;
+            }
+            z = block[i++];
+            z = (z & 1) ? ~(z >> 1) : (z >> 1);
+            u = (icsFpredPredict(cur, prev, x, y, t.comps) + z) & t.mask;
+            cur[x] = u;
+            icsFpredStore(out, icsFpredUnmap(u, &t), &t);
+            out += t.bytes;
+        }
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    IcsReleaseScratch(icsStruct, rows);
+
+        /* Restore the byte order of the writer */
+    if (!error && (((src[0] & ICS_FPRED_BIGENDIAN) != 0)
+                   != icsIsBigEndianMachine())) {
+        out = (char*)dest;
+        for (i = 0; i < rowSamples * height; i++, out += t.bytes) {
+            for (j = 0; j < (size_t)t.bytes / 2; j++) {
+                char c = out[j];
+                out[j] = out[(size_t)t.bytes - 1 - j];
+                out[(size_t)t.bytes - 1 - j] = c;
+            }
+        }
+    }
+
+    return error;
+}
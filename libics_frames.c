@@ -0,0 +1,470 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * FILE : libics_frames.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsStartFrameWriter()
+ *   IcsPushFrame()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsFinishFrames()
+ *
+ * Writing an image frame by frame as it is acquired, from several threads at
+ * once. A frame is a sample of the last dimension. Producers push frame
+ * descriptors onto a lock-free stack; the first producer to push onto an
+ * empty stack starts a job that takes the whole stack and starts one job per
+ * frame to compress it (gzip) or just pass it on (uncompressed). Frames are
+ * then written in index order by whichever job holds the writer token, after
+ * which the producer's release function is called. The frames in flight are
+ * kept in a ring of queue-depth slots, indexed by frame index: a producer
+ * only waits if its frame is that far ahead of the next frame to write.
+ * Producers never code or write frames themselves: if no job can be started,
+ * the push fails, and so does the writer.
+ *
+ * Compressed frames are deflated independently and end in a sync flush, so
+ * that their concatenation is a single deflate stream in an ordinary GZIP
+ * file; the CRCs of the frames are combined as they are written. Decompression
+ * can start afresh at each frame, which makes the frames the restart points of
+ * the GZIP index, if one is written.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+
+/* A frame in flight. */
+typedef struct Ics_Frame_ {
+    struct Ics_Frame_       *next;     /* link in the stack of pushed frames */
+    struct _Ics_FrameWriter *writer;
+    size_t                   index;
+    const void              *data;
+    Ics_FrameReleaseFunc     release;
+    void                    *userData;
+    unsigned char           *coded;    /* compressed frame (gzip only) */
+    size_t                   length;   /* length of the compressed frame */
+    unsigned long            crc;      /* CRC of the frame (gzip only) */
+    volatile int             inUse;    /* 1 from push until written */
+    volatile int             ready;    /* 1 when it can be written */
+} Ics_Frame;
+
+
+struct _Ics_FrameWriter {
+    Ics_Header       *ics;
+    Ics_Context      *context;
+    FILE             *fp;
+    size_t            frameSize;  /* bytes per frame */
+    size_t            nFrames;
+    size_t            depth;      /* number of slots */
+    Ics_Frame        *slots;
+    void *volatile    pushed;     /* stack of pushed frames, newest first */
+    volatile size_t   nextWrite;  /* index of the next frame to write */
+    volatile size_t   nPushed;
+    volatile size_t   nProcessed; /* frames written or waiting for a gap */
+    volatile int      writing;    /* the writer token */
+    volatile int      error;      /* first error */
+    unsigned long     crc;        /* CRC of the frames written */
+    ics_t_uint64      written;    /* bytes of the GZIP stream written */
+    Ics_ZipIndex     *index;      /* index of the GZIP stream, or NULL */
+};
+
+
+/* Keep the first error. */
+static void icsFrameError(Ics_FrameWriter *writer,
+                          Ics_Error        error)
+{
+    if (error) IcsAtomicCas(&writer->error, IcsErr_Ok, (int)error);
+}
+
+
+/* Wake up the threads waiting for frames to be written. */
+static void icsSignalFrames(void)
+{
+    IcsLockJobs();
+    IcsSignalJobs();
+    IcsUnlockJobs();
+}
+
+
+/* Is the next frame to write ready? */
+static int icsNextFrameReady(Ics_FrameWriter *writer)
+{
+    size_t     next = IcsAtomicAdd(&writer->nextWrite, 0);
+    Ics_Frame *frame;
+
+
+    if (next >= writer->nFrames) return 0;
+    frame = writer->slots + next % writer->depth;
+    return IcsAtomicGet(&frame->ready) && (frame->index == next);
+}
+
+
+/* Write the frames that are ready, in order, if no other thread does. After
+   an error the frames are released without writing them. */
+static void icsWriteFrames(Ics_FrameWriter *writer)
+{
+    Ics_Frame *frame;
+    size_t     next;
+    int        compressed = writer->ics->compression == IcsCompr_gzip;
+
+
+    while (icsNextFrameReady(writer) && IcsAtomicCas(&writer->writing, 0, 1)) {
+        while (icsNextFrameReady(writer)) {
+            next = IcsAtomicAdd(&writer->nextWrite, 0);
+            frame = writer->slots + next % writer->depth;
+            if (!IcsAtomicGet(&writer->error)) {
+                if (compressed) {
+                        /* Each frame is a restart point for the index */
+                    IcsAddToZipIndex(writer->index, next * writer->frameSize,
+                                     writer->written, writer->crc);
+                    if (fwrite(frame->coded, 1, frame->length, writer->fp)
+                        != frame->length) {
+                        icsFrameError(writer, IcsErr_FWriteIds);
+                    }
+                    writer->written += frame->length;
+                    writer->crc = IcsCombineCrc(writer->crc, frame->crc,
+                                                writer->frameSize);
+                } else if (fwrite(frame->data, 1, writer->frameSize,
+                                  writer->fp) != writer->frameSize) {
+                    icsFrameError(writer, IcsErr_FWriteIds);
+                }
+            }
+            if (frame->release != NULL) {
+                frame->release(frame->userData, frame->index, frame->data);
+            }
+            IcsAtomicSet(&frame->ready, 0);
+            IcsAtomicSet(&frame->inUse, 0);
+            IcsAtomicAdd(&writer->nextWrite, 1);
+            icsSignalFrames();
+        }
+            /* Another frame may have become ready before the token was given
+               back; the loop condition checks again */
+        IcsAtomicCas(&writer->writing, 1, 0);
+    }
+}
+
+
+/* Compress a frame, then write what can be written. */
+static void icsCodeFrame(void *data)
+{
+    Ics_Frame       *frame  = (Ics_Frame*)data;
+    Ics_FrameWriter *writer = frame->writer;
+    Ics_Error        error;
+
+
+    if ((writer->ics->compression == IcsCompr_gzip)
+        && !IcsAtomicGet(&writer->error)) {
+        error = IcsDeflateBlock(frame->data, writer->frameSize,
+                                writer->ics->compLevel,
+                                frame->index == writer->nFrames - 1,
+                                frame->coded, &frame->length, &frame->crc,
+                                writer->ics);
+        icsFrameError(writer, error);
+    }
+    IcsAtomicSet(&frame->ready, 1);
+    icsWriteFrames(writer);
+    IcsAtomicAdd(&writer->nProcessed, 1);
+    icsSignalFrames();
+}
+
+
+/* Take all pushed frames and code them in parallel, oldest first. */
+static void icsTakeFrames(void *data)
+{
+    Ics_FrameWriter *writer = (Ics_FrameWriter*)data;
+    Ics_Frame       *list, *frame, *next;
+
+
+    list = (Ics_Frame*)IcsAtomicSwapPtr(&writer->pushed, NULL);
+    frame = NULL;
+    while (list != NULL) {
+        next = list->next;
+        list->next = frame;
+        frame = list;
+        list = next;
+    }
+    while (frame != NULL) {
+        next = frame->next;
+        if ((next == NULL)
+            || (IcsStartJob(writer->context, icsCodeFrame, frame) != IcsErr_Ok)) {
+                /* The last one, or no job could be started: do it here */
+            icsCodeFrame(frame);
+        }
+        frame = next;
+    }
+}
+
+
+/* No job could be started to take the pushed frames: give back the frame
+   pushed by the caller, and release the frames pushed since without coding or
+   writing them. The writer fails with error. */
+static void icsDropFrames(Ics_FrameWriter *writer,
+                          Ics_Frame       *own,
+                          Ics_Error        error)
+{
+    Ics_Frame *list, *next;
+
+
+    icsFrameError(writer, error);
+    list = (Ics_Frame*)IcsAtomicSwapPtr(&writer->pushed, NULL);
+    while (list != NULL) {
+        next = list->next;
+        if (list == own) {
+            IcsAtomicSet(&own->inUse, 0);
+            IcsAtomicAdd(&writer->nPushed, (size_t)-1);
+            icsSignalFrames();
+        } else {
+            icsCodeFrame(list);
+        }
+        list = next;
+    }
+}
+
+
+/* Start writing the image frame by frame: write the header and create the
+   data file. Frames are given with IcsPushFrame(), IcsClose() finishes the
+   file. */
+Ics_Error IcsStartFrameWriter(ICS              *ics,
+                              size_t            queueDepth,
+                              Ics_FrameWriter **writer)
+{
+    ICSINIT;
+    Ics_FrameWriter *w;
+    char             filename[ICS_MAXPATHLEN];
+    size_t           i, bound = 0;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+    if ((writer == NULL) || (queueDepth == 0)) return IcsErr_IllParameter;
+    *writer = NULL;
+#ifndef ICS_THREADS
+        /* The frames are coded and written by worker threads only */
+    return IcsErr_NotValidAction;
+#endif
+
+    if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->data != NULL) return IcsErr_DuplicateData;
+    if (ics->dataSource != NULL) return IcsErr_DuplicateData;
+    if (ics->frameWriter != NULL) return IcsErr_DuplicateData;
+    if (ics->dimensions == 0) return IcsErr_NoLayout;
+    if (IcsGetDataSize(ics) == 0) return IcsErr_MissingData;
+        /* The frames are written as they come */
+    if (((ics->compression != IcsCompr_uncompressed)
+         && (ics->compression != IcsCompr_gzip))
+        || (ics->deltaDim >= 0) || (ics->dedupStore[0] != '\0')
+        || (ics->chunkStore[0] != '\0') || ics->writeZoneMap) {
+        return IcsErr_NotValidAction;
+    }
+
+    w = (Ics_FrameWriter*)IcsGetScratch(ics, sizeof(Ics_FrameWriter));
+    if (w == NULL) return IcsErr_Alloc;
+    w->ics = ics;
+    w->context = (Ics_Context*)ics->context;
+    w->fp = NULL;
+    w->nFrames = ics->dim[ics->dimensions - 1].size;
+    w->frameSize = IcsGetDataSize(ics) / w->nFrames;
+    w->depth = queueDepth < w->nFrames ? queueDepth : w->nFrames;
+    w->pushed = NULL;
+    w->nextWrite = 0;
+    w->nPushed = 0;
+    w->nProcessed = 0;
+    w->writing = 0;
+    w->error = IcsErr_Ok;
+    w->crc = 0;
+    w->written = 0;
+    w->index = NULL;
+    w->slots = (Ics_Frame*)IcsGetScratch(ics, w->depth * sizeof(Ics_Frame));
+    if (w->slots == NULL) {
+        IcsReleaseScratch(ics, w);
+        return IcsErr_Alloc;
+    }
+    if (ics->compression == IcsCompr_gzip) {
+        bound = IcsDeflateBound(w->frameSize);
+    }
+    for (i = 0; i < w->depth; i++) {
+        w->slots[i].writer = w;
+        w->slots[i].inUse = 0;
+        w->slots[i].ready = 0;
+        w->slots[i].coded = NULL;
+        if (bound > 0) {
+            w->slots[i].coded = (unsigned char*)IcsGetScratch(ics, bound);
+            if (w->slots[i].coded == NULL) error = IcsErr_Alloc;
+        }
+    }
+
+        /* Write the header, the data follows it or goes in the IDS file */
+    if (!error) error = IcsWriteIcs(ics, NULL);
+    if (!error) {
+        if (ics->version == 1) {
+            IcsGetIdsName(filename, ics->filename);
+            w->fp = IcsFOpen(filename, "wb");
+        } else {
+            error = IcsGetOutputName(filename, ics);
+            if (!error) w->fp = IcsFOpen(filename, "ab");
+        }
+        if (w->fp == NULL) error = IcsErr_FOpenIds;
+    }
+    if (!error && (ics->compression == IcsCompr_gzip)) {
+        error = IcsWriteZipHeader(w->fp);
+        w->written = ICS_ZIP_HEADER_SIZE;
+        if (!error && IcsWritesZipIndex(ics)) {
+            error = IcsNewZipIndex(ics, &w->index);
+        }
+    }
+    if (error) {
+        if (w->fp != NULL) fclose(w->fp);
+        IcsFreeZipIndex(ics, w->index);
+        for (i = 0; i < w->depth; i++) {
+            IcsReleaseScratch(ics, w->slots[i].coded);
+        }
+        IcsReleaseScratch(ics, w->slots);
+        IcsReleaseScratch(ics, w);
+        return error;
+    }
+
+    ics->frameWriter = w;
+    *writer = w;
+
+    return error;
+}
+
+
+/* Give frame number index to the writer; it is released with release() once
+   it has been written. */
+Ics_Error IcsPushFrame(Ics_FrameWriter      *writer,
+                       size_t                index,
+                       const void           *frame,
+                       Ics_FrameReleaseFunc  release,
+                       void                 *userData)
+{
+    ICSINIT;
+    Ics_Frame *slot;
+    void      *head;
+
+
+    if ((writer == NULL) || (frame == NULL)) return IcsErr_IllParameter;
+    if (index >= writer->nFrames) return IcsErr_IllParameter;
+    error = (Ics_Error)IcsAtomicGet(&writer->error);
+    if (error) return error;
+
+        /* Wait until the frame fits in the ring */
+    if (index >= IcsAtomicAdd(&writer->nextWrite, 0) + writer->depth) {
+        IcsLockJobs();
+        while ((index >= IcsAtomicAdd(&writer->nextWrite, 0) + writer->depth)
+               && !IcsAtomicGet(&writer->error)) {
+            IcsWaitJobs();
+        }
+        IcsUnlockJobs();
+        error = (Ics_Error)IcsAtomicGet(&writer->error);
+        if (error) return error;
+    }
+    if (index < IcsAtomicAdd(&writer->nextWrite, 0)) return IcsErr_DuplicateData;
+    slot = writer->slots + index % writer->depth;
+    if (!IcsAtomicCas(&slot->inUse, 0, 1)) return IcsErr_DuplicateData;
+    slot->index = index;
+    slot->data = frame;
+    slot->release = release;
+    slot->userData = userData;
+    IcsAtomicAdd(&writer->nPushed, 1);
+
+        /* Push it on the stack; a push on an empty stack starts a job to take
+           the frames */
+    head = NULL;
+    do {
+        slot->next = (Ics_Frame*)head;
+    } while (!IcsAtomicCasPtr(&writer->pushed, &head, slot));
+    if (head == NULL) {
+        error = IcsStartJob(writer->context, icsTakeFrames, writer);
+        if (error) icsDropFrames(writer, slot, error);
+    }
+
+    return error;
+}
+
+
+/* Wait for the frames pushed to be written, finish the data file and free
+   the writer. Called by IcsClose(). */
+Ics_Error IcsFinishFrames(Ics_Header *ics)
+{
+    ICSINIT;
+    Ics_FrameWriter *writer = (Ics_FrameWriter*)ics->frameWriter;
+    Ics_Frame       *frame;
+    size_t           i;
+
+
+    if (writer == NULL) return IcsErr_Ok;
+
+    IcsLockJobs();
+    while (IcsAtomicAdd(&writer->nProcessed, 0)
+           < IcsAtomicAdd(&writer->nPushed, 0)) {
+        IcsWaitJobs();
+    }
+    IcsUnlockJobs();
+
+    error = (Ics_Error)IcsAtomicGet(&writer->error);
+    if (writer->nextWrite < writer->nFrames) {
+            /* Frames are missing, release the ones waiting for them */
+        for (i = 0; i < writer->depth; i++) {
+            frame = writer->slots + i;
+            if (frame->ready && (frame->release != NULL)) {
+                frame->release(frame->userData, frame->index, frame->data);
+            }
+        }
+        if (!error) error = IcsErr_MissingData;
+    } else if (!error && (ics->compression == IcsCompr_gzip)) {
+        IcsAddToZipIndex(writer->index, writer->frameSize * writer->nFrames,
+                         writer->written, writer->crc);
+        error = IcsWriteZipTrailer(writer->fp, writer->crc,
+                                   writer->frameSize * writer->nFrames);
+    }
+    if ((fclose(writer->fp) == EOF) && !error) error = IcsErr_FCloseIds;
+    if (writer->index != NULL) {
+        error = IcsFinishZipIndex(ics, writer->index, error);
+    }
+
+    for (i = 0; i < writer->depth; i++) {
+        IcsReleaseScratch(ics, writer->slots[i].coded);
+    }
+    IcsReleaseScratch(ics, writer->slots);
+    IcsReleaseScratch(ics, writer);
+    ics->frameWriter = NULL;
+
+    return error;
+}
@@ -38,13 +38,24 @@
  *
  *   IcsWriteZip()
  *   IcsWriteZipWithStrides()
+ *   IcsWriteZipSource()
+ *   IcsWriteZipHeader()
+ *   IcsWriteZipTrailer()
+ *   IcsDeflateBound()
+ *   IcsDeflateBlock()
+ *   IcsCombineCrc()
  *   IcsOpenZip()
  *   IcsCloseZip()
  *   IcsReadZipBlock()
  *   IcsSetZipBlock()
+ *   IcsReadZipFile()
  *
  * This is the only file that contains any zlib dependancies.
  *
+ * The buffers used here and the memory allocated by zlib are scratch buffers
+ * of the ICS handle (see libics_context.c), so that they are accounted to it,
+ * and with a context are reused by the next stream.
+ *
  * Because of a defect in the zlib interface, the only way of using gzread
  * and gzwrite on streams that are already open is through file handles (which
  * are not ANSI C). The weird thing is that zlib creates a stream from this
@@ -106,6 +117,41 @@ static unsigned long int icsGetLong(FILE *file)
 }
 
 
+#ifdef ICS_ZLIB
+/* zlib memory allocation through the scratch buffers of a handle. */
+static voidpf icsZAlloc(voidpf opaque,
+                        uInt   items,
+                        uInt   size)
+{
+    return IcsGetScratch((const Ics_Header*)opaque, (size_t)items * size);
+}
+
+
+static void icsZFree(voidpf opaque,
+                     voidpf address)
+{
+    IcsReleaseScratch((const Ics_Header*)opaque, address);
+}
+
+
+/* Let zlib allocate its memory as scratch buffers of a handle, if there is
+   one. */
+static void icsZInit(z_stream         *stream,
+                     const Ics_Header *icsStruct)
+{
+    if (icsStruct != NULL) {
+        stream->zalloc = icsZAlloc;
+        stream->zfree = icsZFree;
+        stream->opaque = (voidpf)icsStruct;
+    } else {
+        stream->zalloc = (alloc_func)0;
+        stream->zfree = (free_func)0;
+        stream->opaque = (voidpf)0;
+    }
+}
+#endif
+
+
 /* Write ZIP compressed data. This function mostly does:
      gzFile out;
      char mode[4]; strcpy(mode, "wb0"); mode[2] += level;
@@ -114,28 +160,29 @@ static unsigned long int icsGetLong(FILE *file)
      if (gzwrite(out, (const voidp)inbuf, n) != (int)n)
      error = IcsErr_CompressionProblem;
      gzclose(out); */
-Ics_Error IcsWriteZip(const void *inBuf,
-                      size_t      len,
-                      FILE       *file,
-                      int         level)
+Ics_Error IcsWriteZip(const void       *inBuf,
+                      size_t            len,
+                      FILE             *file,
+                      int               level,
+                      Ics_ZipIndex     *index,
+                      const Ics_Header *icsStruct)
 {
 #ifdef ICS_ZLIB
     z_stream     stream;
     Byte *       outBuf;    /* output buffer */
     int          err, flush;
-    size_t       totalCount;
+    size_t       totalCount, block, next;
+    ics_t_uint64 written;
     unsigned int have;
     uLong        crc;
 
 
         /* Create an output buffer */
-    outBuf = (Byte*)malloc(ICS_BUF_SIZE);
+    outBuf = (Byte*)IcsGetScratch(icsStruct, ICS_BUF_SIZE);
     if (outBuf == Z_NULL) return IcsErr_Alloc;
 
         /* Initialize the stream for output */
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = (voidpf)0;
+    icsZInit(&stream, icsStruct);
     stream.avail_in = 0;
     stream.next_in = NULL;
     stream.next_out = Z_NULL;
@@ -147,7 +194,7 @@ Ics_Error IcsWriteZip(const void *inBuf,
                         Z_DEFAULT_STRATEGY);
         /* windowBits is passed < 0 to suppress zlib header */
     if (err != Z_OK) {
-        free(outBuf);
+        IcsReleaseScratch(icsStruct, outBuf);
         if (err == Z_VERSION_ERROR) {
             return IcsErr_WrongZlibVersion;
         } else {
@@ -159,18 +206,26 @@ Ics_Error IcsWriteZip(const void *inBuf,
     fprintf(file, "%c%c%c%c%c%c%c%c%c%c", gz_magic[0], gz_magic[1], Z_DEFLATED,
             0,0,0,0,0,0, OS_CODE);
 
-        /* Write the compressed data */
+        /* Write the compressed data; the stream is flushed at the restart
+           points of the index */
     totalCount = 0;
+    written = ICS_ZIP_HEADER_SIZE;
+    next = index != NULL ? index->next : len;
     do {
-        if (len - totalCount < ICS_BUF_SIZE) {
-            stream.avail_in = (uInt)(len - totalCount);
-        } else {
-            stream.avail_in = ICS_BUF_SIZE;
+        block = len - totalCount < ICS_BUF_SIZE ? len - totalCount
+                                                : ICS_BUF_SIZE;
+        if ((next > totalCount) && (block > next - totalCount)) {
+            block = next - totalCount;
         }
+        stream.avail_in = (uInt)block;
         stream.next_in = (Bytef*)inBuf + totalCount;
         crc = crc32(crc, stream.next_in, stream.avail_in);
         totalCount += stream.avail_in;
-        flush = totalCount >= len ? Z_FINISH : Z_NO_FLUSH;
+        if (totalCount >= len) {
+            flush = Z_FINISH;
+        } else {
+            flush = totalCount == next ? Z_FULL_FLUSH : Z_NO_FLUSH;
+        }
         do {
             stream.avail_out = ICS_BUF_SIZE;
             stream.next_out = outBuf;
@@ -178,16 +233,21 @@ Ics_Error IcsWriteZip(const void *inBuf,
             have = ICS_BUF_SIZE - stream.avail_out;
             if (fwrite(outBuf, 1, have, file) != have || ferror(file)) {
                 deflateEnd(&stream);
-                free(outBuf);
+                IcsReleaseScratch(icsStruct, outBuf);
                 return IcsErr_FWriteIds;
             }
+            written += have;
         } while (stream.avail_out == 0);
+        if (flush != Z_NO_FLUSH) {
+            IcsAddToZipIndex(index, totalCount, written, crc);
+            if (index != NULL) next = index->next;
+        }
     } while (flush != Z_FINISH);
 
         /* Was all the input processed? */
     if (stream.avail_in != 0) {
         deflateEnd(&stream);
-        free(outBuf);
+        IcsReleaseScratch(icsStruct, outBuf);
         return IcsErr_CompressionProblem;
     }
         /* Write the CRC and original data length */
@@ -197,7 +257,7 @@ Ics_Error IcsWriteZip(const void *inBuf,
     icsPutLong(file, totalCount & 0xFFFFFFFF);
         /* Deallocate stuff */
     err = deflateEnd(&stream);
-    free(outBuf);
+    IcsReleaseScratch(icsStruct, outBuf);
 
     return err == Z_OK ? IcsErr_Ok : IcsErr_CompressionProblem;
 #else
@@ -207,45 +267,44 @@ Ics_Error IcsWriteZip(const void *inBuf,
 
 
 /* Write ZIP compressed data, with strides. */
-Ics_Error IcsWriteZipWithStrides(const void      *src,
-                                 const size_t    *dim,
-                                 const ptrdiff_t *stride,
-                                 int              nDims,
-                                 int              nBytes,
-                                 FILE            *file,
-                                 int              level)
+Ics_Error IcsWriteZipWithStrides(const void       *src,
+                                 const size_t     *dim,
+                                 const ptrdiff_t  *stride,
+                                 int               nDims,
+                                 int               nBytes,
+                                 FILE             *file,
+                                 int               level,
+                                 Ics_ZipIndex     *index,
+                                 const Ics_Header *icsStruct)
 {
 #ifdef ICS_ZLIB
     ICSINIT;
     z_stream     stream;
     Byte        *inBuf              = 0; /* input buffer */
-    Byte        *inBuf_ptr;
     Byte        *outBuf             = 0; /* output buffer */
     size_t       curPos[ICS_MAXDIM];
     char const  *data;
     int          i, err, done;
-    size_t       j;
     size_t       count, totalCount = 0;
+    ics_t_uint64 written            = ICS_ZIP_HEADER_SIZE;
     uLong        crc;
     const int    contiguousLine    = stride[0]==1;
 
 
         /* Create an output buffer */
-    outBuf = (Byte*)malloc(ICS_BUF_SIZE);
+    outBuf = (Byte*)IcsGetScratch(icsStruct, ICS_BUF_SIZE);
     if (outBuf == Z_NULL) return IcsErr_Alloc;
         /* Create an input buffer */
     if (!contiguousLine) {
-        inBuf = (Byte*)malloc(dim[0] * (size_t)nBytes);
+        inBuf = (Byte*)IcsGetScratch(icsStruct, dim[0] * (size_t)nBytes);
         if (inBuf == Z_NULL) {
-            free(outBuf);
+            IcsReleaseScratch(icsStruct, outBuf);
             return IcsErr_Alloc;
         }
     }
 
         /* Initialize the stream for output */
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = (voidpf)0;
+    icsZInit(&stream, icsStruct);
     stream.next_in = (Bytef*)0;
     stream.avail_in = 0;
     stream.next_out = Z_NULL;
@@ -254,8 +313,8 @@ Ics_Error IcsWriteZipWithStrides(const void      *src,
                        DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
         /* windowBits is passed < 0 to suppress zlib header */
     if (err != Z_OK) {
-        free(outBuf);
-        if (!contiguousLine) free(inBuf);
+        IcsReleaseScratch(icsStruct, outBuf);
+        if (!contiguousLine) IcsReleaseScratch(icsStruct, inBuf);
         if (err == Z_VERSION_ERROR) {
             return IcsErr_WrongZlibVersion;
         } else {
@@ -283,12 +342,8 @@ Ics_Error IcsWriteZipWithStrides(const void      *src,
         if (contiguousLine) {
             inBuf = (Byte*)data;
         } else {
-            inBuf_ptr = inBuf;
-            for (j = 0; j < dim[0]; j++) {
-                memcpy(inBuf_ptr, data, (size_t)nBytes);
-                data += stride[0] * nBytes;
-                inBuf_ptr += nBytes;
-            }
+            IcsGetKernels()->gather((char*)inBuf, data, stride[0] * nBytes,
+                                    dim[0], (size_t)nBytes);
         }
             /* Write the compressed data */
         stream.next_in = (Bytef*)inBuf;
@@ -300,6 +355,7 @@ Ics_Error IcsWriteZipWithStrides(const void      *src,
                     error = IcsErr_FWriteIds;
                     goto error_exit;
                 }
+                written += ICS_BUF_SIZE;
                 stream.next_out = outBuf;
                 stream.avail_out = ICS_BUF_SIZE;
             }
@@ -314,6 +370,29 @@ Ics_Error IcsWriteZipWithStrides(const void      *src,
             goto error_exit;
         }
         crc = crc32(crc, (Bytef*)inBuf, (uInt)(dim[0] * (size_t)nBytes));
+            /* Flush the stream at the restart points of the index */
+        if ((index != NULL) && (totalCount == index->next)
+            && (totalCount < index->size)) {
+            do {
+                if (stream.avail_out == 0) {
+                    if (fwrite(outBuf, 1, ICS_BUF_SIZE, file)
+                        != ICS_BUF_SIZE) {
+                        error = IcsErr_FWriteIds;
+                        goto error_exit;
+                    }
+                    written += ICS_BUF_SIZE;
+                    stream.next_out = outBuf;
+                    stream.avail_out = ICS_BUF_SIZE;
+                }
+                err = deflate(&stream, Z_FULL_FLUSH);
+            } while ((err == Z_OK) && (stream.avail_out == 0));
+            if (err != Z_OK) {
+                error = IcsErr_CompressionProblem;
+                goto error_exit;
+            }
+            IcsAddToZipIndex(index, totalCount,
+                             written + ICS_BUF_SIZE - stream.avail_out, crc);
+        }
             /* This is part of the N-D loop */
         for (i = 1; i < nDims; i++) {
             curPos[i]++;
@@ -336,6 +415,7 @@ Ics_Error IcsWriteZipWithStrides(const void      *src,
                 error = IcsErr_FWriteIds;
                 goto error_exit;
             }
+            written += count;
             stream.next_out = outBuf;
             stream.avail_out = ICS_BUF_SIZE;
         }
@@ -349,6 +429,7 @@ Ics_Error IcsWriteZipWithStrides(const void      *src,
         }
         done = (stream.avail_out != 0 || err == Z_STREAM_END);
     }
+    IcsAddToZipIndex(index, totalCount, written, crc);
         /* Write the CRC and original data length */
     icsPutLong(file, crc);
     icsPutLong(file, totalCount & 0xFFFFFFFF);
@@ -356,8 +437,8 @@ Ics_Error IcsWriteZipWithStrides(const void      *src,
   error_exit:
         /* Deallocate stuff */
     err = deflateEnd(&stream);
-    free(outBuf);
-    if (!contiguousLine) free(inBuf);
+    IcsReleaseScratch(icsStruct, outBuf);
+    if (!contiguousLine) IcsReleaseScratch(icsStruct, inBuf);
 
     if (error) {
         return error;
@@ -370,17 +451,235 @@ Ics_Error IcsWriteZipWithStrides(const void      *src,
 }
 
 
-    /* Start reading ZIP compressed data. This function mostly does:
-       br->ZlibStream = gzdopen(dup(fileno(br->DataFilePtr)), "rb"); */
-Ics_Error IcsOpenZip(Ics_Header *icsStruct)
+/* Write ZIP compressed data obtained block by block from a data source
+   function. */
+Ics_Error IcsWriteZipSource(Ics_DataSourceFunc  func,
+                            void               *userData,
+                            size_t              len,
+                            FILE               *file,
+                            int                 level,
+                            Ics_ZipIndex       *index,
+                            const Ics_Header   *icsStruct)
 {
 #ifdef ICS_ZLIB
-    Ics_BlockRead * br   = (Ics_BlockRead*)icsStruct->blockRead;
-    FILE           *file = br->dataFilePtr;
-    z_stream*       stream;
-    void           *inBuf;
-    int             err;
-    int             method, flags; /* hold data from the GZIP header */
+    ICSINIT;
+    z_stream     stream;
+    Byte        *inBuf, *outBuf;
+    int          err, flush;
+    size_t       totalCount, next;
+    ics_t_uint64 written;
+    unsigned int have;
+    uLong        crc;
+
+
+    inBuf = (Byte*)IcsGetScratch(icsStruct, ICS_BUF_SIZE);
+    outBuf = (Byte*)IcsGetScratch(icsStruct, ICS_BUF_SIZE);
+    if ((inBuf == Z_NULL) || (outBuf == Z_NULL)) {
+        IcsReleaseScratch(icsStruct, inBuf);
+        IcsReleaseScratch(icsStruct, outBuf);
+        return IcsErr_Alloc;
+    }
+
+    icsZInit(&stream, icsStruct);
+    stream.avail_in = 0;
+    stream.next_in = NULL;
+    stream.next_out = Z_NULL;
+    stream.avail_out = 0;
+    crc = crc32(0L, Z_NULL, 0);
+    err = deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL,
+                       Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+        IcsReleaseScratch(icsStruct, inBuf);
+        IcsReleaseScratch(icsStruct, outBuf);
+        return err == Z_VERSION_ERROR ? IcsErr_WrongZlibVersion
+                                      : IcsErr_CompressionProblem;
+    }
+
+        /* Write a very simple GZIP header: */
+    fprintf(file, "%c%c%c%c%c%c%c%c%c%c", gz_magic[0], gz_magic[1], Z_DEFLATED,
+            0,0,0,0,0,0, OS_CODE);
+
+        /* Fetch a block, compress it, repeat; see IcsWriteZip() for the
+           restart points of the index */
+    totalCount = 0;
+    written = ICS_ZIP_HEADER_SIZE;
+    next = index != NULL ? index->next : len;
+    do {
+        stream.avail_in = (uInt)(len - totalCount < ICS_BUF_SIZE
+                                 ? len - totalCount : ICS_BUF_SIZE);
+        if ((next > totalCount) && (stream.avail_in > next - totalCount)) {
+            stream.avail_in = (uInt)(next - totalCount);
+        }
+        error = func(userData, inBuf, stream.avail_in);
+        if (error) break;
+        stream.next_in = inBuf;
+        crc = crc32(crc, inBuf, stream.avail_in);
+        totalCount += stream.avail_in;
+        if (totalCount >= len) {
+            flush = Z_FINISH;
+        } else {
+            flush = totalCount == next ? Z_FULL_FLUSH : Z_NO_FLUSH;
+        }
+        do {
+            stream.avail_out = ICS_BUF_SIZE;
+            stream.next_out = outBuf;
+            deflate(&stream, flush);
+            have = ICS_BUF_SIZE - stream.avail_out;
+            if (fwrite(outBuf, 1, have, file) != have || ferror(file)) {
+                error = IcsErr_FWriteIds;
+            }
+            written += have;
+        } while (!error && stream.avail_out == 0);
+        if (!error && (flush != Z_NO_FLUSH)) {
+            IcsAddToZipIndex(index, totalCount, written, crc);
+            if (index != NULL) next = index->next;
+        }
+    } while (!error && flush != Z_FINISH);
+    if (!error && stream.avail_in != 0) error = IcsErr_CompressionProblem;
+
+    if (!error) {
+            /* Write the CRC and original data length, see IcsWriteZip() */
+        icsPutLong(file, crc);
+        icsPutLong(file, totalCount & 0xFFFFFFFF);
+    }
+    err = deflateEnd(&stream);
+    IcsReleaseScratch(icsStruct, inBuf);
+    IcsReleaseScratch(icsStruct, outBuf);
+
+    if (error) return error;
+    return err == Z_OK ? IcsErr_Ok : IcsErr_CompressionProblem;
+#else
+    return IcsErr_UnknownCompression;
+#endif
+}
+
+
+/* Write the GZIP header of a stream made of blocks deflated separately with
+   IcsDeflateBlock(). */
+Ics_Error IcsWriteZipHeader(FILE *file)
+{
+#ifdef ICS_ZLIB
+    fprintf(file, "%c%c%c%c%c%c%c%c%c%c", gz_magic[0], gz_magic[1], Z_DEFLATED,
+            0,0,0,0,0,0, OS_CODE);
+    return ferror(file) ? IcsErr_FWriteIds : IcsErr_Ok;
+#else
+    return IcsErr_UnknownCompression;
+#endif
+}
+
+
+/* Write the CRC and the length of all the data in the stream. */
+Ics_Error IcsWriteZipTrailer(FILE          *file,
+                             unsigned long  crc,
+                             size_t         len)
+{
+    icsPutLong(file, crc);
+    icsPutLong(file, len & 0xFFFFFFFF);
+    return ferror(file) ? IcsErr_FWriteIds : IcsErr_Ok;
+}
+
+
+/* The largest size of len bytes compressed by IcsDeflateBlock(). */
+size_t IcsDeflateBound(size_t len)
+{
+        /* As compressBound(), with room for the flush marker */
+    return len + (len >> 12) + (len >> 14) + (len >> 25) + 64;
+}
+
+
+/* Compress a block of data independently of the previous blocks, so that
+   blocks can be compressed in parallel and their output concatenated into
+   a single deflate stream. Only the last block finishes the stream; the
+   others end in a sync flush, on a byte boundary. dest must hold
+   IcsDeflateBound(len) bytes; its used length is returned in length, and the
+   CRC of the uncompressed data in crc. */
+Ics_Error IcsDeflateBlock(const void       *src,
+                          size_t            len,
+                          int               level,
+                          int               last,
+                          void             *dest,
+                          size_t           *length,
+                          unsigned long    *crc,
+                          const Ics_Header *icsStruct)
+{
+#ifdef ICS_ZLIB
+    ICSINIT;
+    z_stream     stream;
+    const Bytef *in       = (const Bytef*)src;
+    size_t       todo     = len;
+    size_t       capacity = IcsDeflateBound(len);
+    uLong        sum;
+    uInt         block;
+    int          err, flush;
+
+
+    icsZInit(&stream, icsStruct);
+    stream.avail_in = 0;
+    stream.next_in = NULL;
+    stream.next_out = (Bytef*)dest;
+    stream.avail_out = 0;
+    err = deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL,
+                       Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+        return err == Z_VERSION_ERROR ? IcsErr_WrongZlibVersion
+                                      : IcsErr_CompressionProblem;
+    }
+
+        /* zlib counts in uInt, feed large blocks in pieces */
+    sum = crc32(0L, Z_NULL, 0);
+    do {
+        block = (uInt)(todo < 0x40000000 ? todo : 0x40000000);
+        sum = crc32(sum, in, block);
+        stream.next_in = (Bytef*)in;
+        stream.avail_in = block;
+        in += block;
+        todo -= block;
+        flush = todo > 0 ? Z_NO_FLUSH : last ? Z_FINISH : Z_SYNC_FLUSH;
+        do {
+            if (stream.avail_out == 0) {
+                block = (uInt)(capacity < 0x40000000 ? capacity : 0x40000000);
+                stream.avail_out = block;
+                capacity -= block;
+            }
+            err = deflate(&stream, flush);
+        } while ((err == Z_OK) && (stream.avail_out == 0) && (capacity > 0));
+        if ((err != Z_OK) && (err != Z_STREAM_END)) break;
+    } while (todo > 0);
+    if (((err != Z_OK) && (err != Z_STREAM_END)) || (stream.avail_in != 0)
+        || (last && (err != Z_STREAM_END))
+        || ((stream.avail_out == 0) && (capacity == 0))) {
+        error = IcsErr_CompressionProblem;
+    }
+    *length = (size_t)((char*)stream.next_out - (char*)dest);
+    *crc = sum;
+    deflateEnd(&stream);
+
+    return error;
+#else
+    return IcsErr_UnknownCompression;
+#endif
+}
+
+
+/* The CRC of two blocks of data, given their CRCs and the length of the
+   second block. */
+unsigned long IcsCombineCrc(unsigned long crc1,
+                            unsigned long crc2,
+                            size_t        len2)
+{
+#ifdef ICS_ZLIB
+    return crc32_combine(crc1, crc2, (z_off_t)len2);
+#else
+    return 0;
+#endif
+}
+
+
+#ifdef ICS_ZLIB
+/* Check the GZIP header and skip over it. */
+static Ics_Error icsReadZipHeader(FILE *file)
+{
+    int method, flags; /* hold data from the GZIP header */
 
 
         /* check the GZIP header */
@@ -390,13 +689,13 @@ Ics_Error IcsOpenZip(Ics_Header *icsStruct)
     flags = getc(file);
     if ((method != Z_DEFLATED) || ((flags & RESERVED) != 0))
         return IcsErr_CorruptedStream;
-    fseek(file, 6, SEEK_CUR);          /* Discard time, xflags and OS code: */
+    IcsFSeek(file, 6, SEEK_CUR);       /* Discard time, xflags and OS code: */
     if ((flags & EXTRA_FIELD) != 0) {  /* skip the extra field */
         size_t len;
         len  =  (uInt)getc(file);
         len += ((uInt)getc(file)) << 8;
         if (feof (file)) return IcsErr_CorruptedStream;
-        fseek(file, (long)len, SEEK_CUR);
+        IcsFSeek(file, (ics_t_sint64)len, SEEK_CUR);
     }
     if ((flags & ORIG_NAME) != 0) {   /* skip the original file name */
         int c;
@@ -407,20 +706,42 @@ Ics_Error IcsOpenZip(Ics_Header *icsStruct)
         while (((c = getc(file)) != 0) && (c != EOF));
     }
     if ((flags & HEAD_CRC) != 0) {    /* skip the header crc */
-        fseek(file, 2, SEEK_CUR);
+        IcsFSeek(file, 2, SEEK_CUR);
     }
     if (feof(file) || ferror(file)) return IcsErr_CorruptedStream;
 
+    return IcsErr_Ok;
+}
+#endif
+
+
+    /* Start reading ZIP compressed data. This function mostly does:
+       br->ZlibStream = gzdopen(dup(fileno(br->DataFilePtr)), "rb"); */
+Ics_Error IcsOpenZip(Ics_Header *icsStruct)
+{
+#ifdef ICS_ZLIB
+    ICSINIT;
+    Ics_BlockRead * br      = (Ics_BlockRead*)icsStruct->blockRead;
+    FILE           *file    = br->dataFilePtr;
+    z_stream*       stream;
+    void           *inBuf;
+    int             err;
+
+
+    error = icsReadZipHeader(file);
+    if (error) return error;
+
         /* Create an input buffer */
-    inBuf = malloc(ICS_BUF_SIZE);
+    inBuf = IcsGetScratch(icsStruct, ICS_BUF_SIZE);
     if (inBuf == NULL) return IcsErr_Alloc;
 
         /* Initialize the stream for input */
-    stream = (z_stream*)malloc(sizeof (z_stream));
-    if (stream == NULL) return IcsErr_Alloc;
-    stream->zalloc = NULL;
-    stream->zfree = NULL;
-    stream->opaque = NULL;
+    stream = (z_stream*)IcsGetScratch(icsStruct, sizeof (z_stream));
+    if (stream == NULL) {
+        IcsReleaseScratch(icsStruct, inBuf);
+        return IcsErr_Alloc;
+    }
+    icsZInit(stream, icsStruct);
     stream->next_in = NULL;
     stream->avail_in = 0;
     stream->next_out = NULL;
@@ -436,9 +757,12 @@ Ics_Error IcsOpenZip(Ics_Header *icsStruct)
         if (err != Z_VERSION_ERROR) {
             inflateEnd(stream);
         }
-        free(inBuf);
+        IcsReleaseScratch(icsStruct, stream);
+        IcsReleaseScratch(icsStruct, inBuf);
         if (err == Z_VERSION_ERROR) {
             return IcsErr_WrongZlibVersion;
+        } else if (err == Z_MEM_ERROR) {
+            return IcsErr_Alloc;
         } else {
             return IcsErr_DecompressionProblem;
         }
@@ -447,6 +771,7 @@ Ics_Error IcsOpenZip(Ics_Header *icsStruct)
     br->zlibStream = stream;
     br->zlibInputBuffer = inBuf;
     br->zlibCRC = crc32(0L, Z_NULL, 0);
+    br->zlibPos = 0;
     return IcsErr_Ok;
 #else
     return IcsErr_UnknownCompression;
@@ -459,14 +784,14 @@ Ics_Error IcsOpenZip(Ics_Header *icsStruct)
 Ics_Error IcsCloseZip(Ics_Header *icsStruct)
 {
 #ifdef ICS_ZLIB
-    Ics_BlockRead *br     = (Ics_BlockRead*)icsStruct->blockRead;
-    z_stream*      stream = (z_stream*)br->zlibStream;
+    Ics_BlockRead *br      = (Ics_BlockRead*)icsStruct->blockRead;
+    z_stream*      stream  = (z_stream*)br->zlibStream;
     int            err;
 
     err = inflateEnd(stream);
-    free(stream);
+    IcsReleaseScratch(icsStruct, stream);
     br->zlibStream = NULL;
-    free(br->zlibInputBuffer);
+    IcsReleaseScratch(icsStruct, br->zlibInputBuffer);
     br->zlibInputBuffer = NULL;
 
     if (err != Z_OK) {
@@ -491,7 +816,7 @@ Ics_Error IcsReadZipBlock(Ics_Header *icsStruct,
     z_stream*      stream  = (z_stream*)br->zlibStream;
     void          *inBuf   = br->zlibInputBuffer;
     int            err;
-    size_t         prevout = stream->total_out, todo = len;
+    size_t         todo    = len;
     unsigned int   bufsize, done;
     Bytef         *prevbuf;
 
@@ -516,24 +841,27 @@ Ics_Error IcsReadZipBlock(Ics_Header *icsStruct,
             prevbuf = stream->next_out = (Bytef*)outBuf + len - todo;;
             err = inflate(stream, Z_NO_FLUSH);
             if (!(err == Z_OK || err == Z_STREAM_END || err == Z_BUF_ERROR)) {
-                return IcsErr_FReadIds;
+                return err == Z_MEM_ERROR ? IcsErr_Alloc : IcsErr_FReadIds;
             }
             done = bufsize - stream->avail_out;
             todo -= done;
+            br->zlibPos += done;
             br->zlibCRC = crc32(br->zlibCRC, prevbuf, done);
         } while (stream->avail_out == 0);
     } while (err != Z_STREAM_END && todo > 0);
 
         /* Set the file pointer back so that unused input can be read again. */
-    fseek(file, -(int)stream->avail_in, SEEK_CUR);
+    if (IcsFSeek(file, -(ics_t_sint64)stream->avail_in, SEEK_CUR) != 0) {
+        return IcsErr_FReadIds;
+    }
 
     if (err == Z_STREAM_END) {
             /* All the data has been decompressed: Check CRC and original data
-               size */
+               size, which the trailer stores modulo 2^32 */
         if (icsGetLong(file) != br->zlibCRC) {
             err = Z_STREAM_ERROR;
         } else {
-            if (icsGetLong(file) != stream->total_out) {
+            if (icsGetLong(file) != (br->zlibPos & 0xFFFFFFFF)) {
                 err = Z_STREAM_ERROR;
             }
         }
@@ -542,7 +870,7 @@ Ics_Error IcsReadZipBlock(Ics_Header *icsStruct,
         /* Report errors */
     if (err == Z_STREAM_ERROR) return IcsErr_CorruptedStream;
     if (err == Z_STREAM_END) {
-        if (len != stream->total_out - prevout) return IcsErr_EndOfStream;
+        if (todo != 0) return IcsErr_EndOfStream;
         return IcsErr_Ok;
     }
     if (err == Z_OK) return IcsErr_Ok;
@@ -553,43 +881,98 @@ Ics_Error IcsReadZipBlock(Ics_Header *icsStruct,
 }
 
 
+#ifdef ICS_ZLIB
+/* Continue decompressing from a restart point in the index of the stream. */
+static Ics_Error icsRestartZip(Ics_Header              *icsStruct,
+                               const Ics_ZipIndexEntry *entry)
+{
+    Ics_BlockRead *br     = (Ics_BlockRead*)icsStruct->blockRead;
+    z_stream      *stream = (z_stream*)br->zlibStream;
+
+
+    if (IcsFSeek(br->dataFilePtr,
+                 (ics_t_sint64)(br->dataOffset + entry->filePos),
+                 SEEK_SET) != 0) {
+        return IcsErr_FReadIds;
+    }
+    if (inflateReset(stream) != Z_OK) return IcsErr_DecompressionProblem;
+    stream->next_in = (Bytef*)br->zlibInputBuffer;
+    stream->avail_in = 0;
+    br->zlibCRC = entry->crc;
+    br->zlibPos = entry->dataPos;
+    return IcsErr_Ok;
+}
+#endif
+
+
 /* Skip ZIP compressed data block. This function mostly does:
-     gzseek((gzFile)br->ZlibStream, (z_off_t)offset, whence); */
-Ics_Error IcsSetZipBlock(Ics_Header *icsStruct,
-                          long        offset,
-                          int         whence)
+     gzseek((gzFile)br->ZlibStream, (z_off_t)offset, whence);
+   If the stream has an index (see libics_zipindex.c), decompression continues
+   from the last restart point before the new position, if that is ahead. */
+Ics_Error IcsSetZipBlock(Ics_Header   *icsStruct,
+                          ics_t_sint64  offset,
+                          int           whence)
 {
 #ifdef ICS_ZLIB
     ICSINIT;
-    size_t         n, bufsize;
-    void          *buf;
-    Ics_BlockRead *br     = (Ics_BlockRead*)icsStruct->blockRead;
-    z_stream*      stream = (z_stream*)br->zlibStream;
+    ics_t_uint64             n, target;
+    size_t                   bufsize;
+    void                    *buf;
+    Ics_BlockRead           *br     = (Ics_BlockRead*)icsStruct->blockRead;
+    const Ics_ZipIndexEntry *entry;
 
     if ((whence == SEEK_CUR) && (offset<0)) {
-        offset += (long)stream->total_out;
+        offset += (ics_t_sint64)br->zlibPos;
         whence = SEEK_SET;
     }
+    if ((whence == SEEK_SET) && (offset < 0)) return IcsErr_IllParameter;
+    target = (ics_t_uint64)offset;
+    if (whence == SEEK_CUR) target += br->zlibPos;
+
+        /* Jump to a restart point, if there is one closer than the current
+           position; the index is read when first needed */
+    if (!br->zipIndexRead && (target > br->zlibPos)) {
+        br->zipIndexRead = 1;
+        error = IcsReadZipIndex(icsStruct, (Ics_ZipIndex**)&br->zipIndex);
+        if (error) return error;
+    }
+    entry = IcsFindZipIndex((Ics_ZipIndex*)br->zipIndex, target);
+    if ((entry != NULL) && ((entry->dataPos > br->zlibPos)
+                            || (target < br->zlibPos))) {
+        error = icsRestartZip(icsStruct, entry);
+        if (error) return error;
+    }
+    if (target >= br->zlibPos) {
+            /* Skip forward from here */
+        offset = (ics_t_sint64)(target - br->zlibPos);
+        whence = SEEK_CUR;
+        if (offset == 0) return IcsErr_Ok;
+    }
+
     if (whence == SEEK_SET) {
-        if (offset < 0) return IcsErr_IllParameter;
-        error = IcsCloseIds(icsStruct);
+            /* Restart the stream from the beginning */
+        error = IcsCloseZip(icsStruct);
         if (error) return error;
-        error = IcsOpenIds(icsStruct);
+        if (IcsFSeek(br->dataFilePtr, (ics_t_sint64)br->dataOffset,
+                     SEEK_SET) != 0) {
+            return IcsErr_FReadIds;
+        }
+        error = IcsOpenZip(icsStruct);
         if (error) return error;
         if (offset==0) return IcsErr_Ok;
     }
 
     bufsize = (unsigned int)(offset < ICS_BUF_SIZE ? offset : ICS_BUF_SIZE);
-    buf = malloc(bufsize);
+    buf = IcsGetScratch(icsStruct, bufsize);
     if (buf == NULL) return IcsErr_Alloc;
 
-    n = (size_t)offset;
+    n = (ics_t_uint64)offset;
     while (n > 0) {
         if (n > bufsize) {
             error = IcsReadZipBlock(icsStruct, buf, bufsize);
             n -= bufsize;
         } else {
-            error = IcsReadZipBlock(icsStruct, buf, n);
+            error = IcsReadZipBlock(icsStruct, buf, (size_t)n);
             break;
         }
         if (error) {
@@ -597,7 +980,106 @@ Ics_Error IcsSetZipBlock(Ics_Header *icsStruct,
         }
     }
 
-    free(buf);
+    IcsReleaseScratch(icsStruct, buf);
+
+    return error;
+#else
+    return IcsErr_UnknownCompression;
+#endif
+}
+
+
+/* Read a complete GZIP compressed stream of known uncompressed length from a
+   file into a buffer, checking the CRC and data size in the trailer. */
+Ics_Error IcsReadZipFile(FILE             *file,
+                         void             *outBuf,
+                         size_t            len,
+                         const Ics_Header *icsStruct)
+{
+#ifdef ICS_ZLIB
+    ICSINIT;
+    z_stream     stream;
+    Byte        *inBuf;
+    int          err  = Z_OK;
+    size_t       todo = len;
+    uLong        crc;
+    uInt         block;
+    const Bytef *p;
+
+
+    error = icsReadZipHeader(file);
+    if (error) return error;
+
+        /* Create an input buffer */
+    inBuf = (Byte*)IcsGetScratch(icsStruct, ICS_BUF_SIZE);
+    if (inBuf == NULL) return IcsErr_Alloc;
+
+        /* Initialize the stream for input */
+    icsZInit(&stream, icsStruct);
+    stream.next_in = inBuf;
+    stream.avail_in = 0;
+    stream.next_out = (Bytef*)outBuf;
+    stream.avail_out = 0;
+    err = inflateInit2(&stream, -MAX_WBITS);
+    if (err != Z_OK) {
+        IcsReleaseScratch(icsStruct, inBuf);
+        if (err == Z_VERSION_ERROR) return IcsErr_WrongZlibVersion;
+        return err == Z_MEM_ERROR ? IcsErr_Alloc : IcsErr_DecompressionProblem;
+    }
+
+        /* Decompress straight into the output buffer */
+    while (err != Z_STREAM_END) {
+        if (stream.avail_in == 0) {
+            stream.avail_in = (uInt)fread(inBuf, 1, ICS_BUF_SIZE, file);
+            stream.next_in = inBuf;
+            if (ferror(file)) {
+                error = IcsErr_FReadIds;
+                break;
+            }
+            if (stream.avail_in == 0) {
+                error = IcsErr_EndOfStream;
+                break;
+            }
+        }
+        if (stream.avail_out == 0) {
+            if (todo == 0) {
+                    /* More data in the stream than expected */
+                error = IcsErr_CorruptedStream;
+                break;
+            }
+            stream.avail_out = (uInt)(todo < 0x40000000 ? todo : 0x40000000);
+            todo -= stream.avail_out;
+        }
+        err = inflate(&stream, Z_NO_FLUSH);
+        if (!(err == Z_OK || err == Z_STREAM_END)) {
+            error = err == Z_MEM_ERROR ? IcsErr_Alloc : IcsErr_CorruptedStream;
+            break;
+        }
+    }
+
+    if (!error) {
+        if (todo + stream.avail_out != 0) {
+            error = IcsErr_EndOfStream;
+        } else {
+                /* Check CRC and original data size */
+            IcsFSeek(file, -(ics_t_sint64)stream.avail_in, SEEK_CUR);
+            crc = crc32(0L, Z_NULL, 0);
+            for (p = (const Bytef*)outBuf, todo = len; todo > 0; ) {
+                block = (uInt)(todo < 0x40000000 ? todo : 0x40000000);
+                crc = crc32(crc, p, block);
+                p += block;
+                todo -= block;
+            }
+            if (icsGetLong(file) != crc) {
+                error = IcsErr_CorruptedStream;
+            } else if (icsGetLong(file) != (len & 0xFFFFFFFF)) {
+                error = IcsErr_CorruptedStream;
+            }
+        }
+    }
+
+    inflateEnd(&stream);
+    IcsReleaseScratch(icsStruct, inBuf);
 
     return error;
 #else
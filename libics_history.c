@@ -53,6 +53,7 @@
  * The following internal functions are contained in this file:
  *
  *   IcsInternAddHistory()
+ *   IcsInternSetHistoryRange()
  */
 
 /* The void* History in the ICS struct is a pointer to a struct defined in
@@ -70,7 +71,13 @@
    array element is set to NULL. It is not possible to move the other array
    elements down because that could invalidate iterators. IcsFreeHistory() frees
    all of these strings, the array and the struct, leaving the History pointer
-   in the ICS struct as NULL. */
+   in the ICS struct as NULL.
+
+   When reading, IcsReadIcs() does not add the history lines to the array, but
+   only notes where they are in the ICS file (unreadStart and unreadEnd).
+   Files can have many thousands of history lines, and most programs never look
+   at them. The functions here call IcsReadHistory() before using the array,
+   which adds the lines on first use. */
 
 
 #include <stdlib.h>
@@ -78,6 +85,27 @@
 #include "libics_intern.h"
 
 
+/* Allocate the history struct and array. */
+static Ics_History *icsNewHistory(Ics_Header *ics)
+{
+    Ics_History *hist;
+
+
+    hist = (Ics_History*)malloc(sizeof(Ics_History));
+    if (hist == NULL) return NULL;
+    hist->strings = (char**)malloc(ICS_HISTARRAY_INCREMENT * sizeof(char*));
+    if (hist->strings == NULL) {
+        free(hist);
+        return NULL;
+    }
+    hist->length = ICS_HISTARRAY_INCREMENT;
+    hist->nStr = 0;
+    hist->unreadStart = hist->unreadEnd = 0;
+    ics->history = hist;
+    return hist;
+}
+
+
 /* Add HISTORY line to the ICS file. key can be NULL. */
 Ics_Error IcsAddHistoryString(ICS        *ics,
                               const char *key,
@@ -90,6 +118,8 @@ Ics_Error IcsAddHistoryString(ICS        *ics,
     if ((ics == NULL) || (ics->fileMode == IcsFileMode_read))
         return IcsErr_NotValidAction;
 
+    error = IcsReadHistory(ics);
+    if (error) return error;
     if (key == NULL) {
         key = "";
     }
@@ -129,17 +159,8 @@ Ics_Error IcsInternAddHistory(Ics_Header *ics,
 
         /* Allocate array if necessary */
     if (ics->history == NULL) {
-        ics->history = malloc(sizeof(Ics_History));
-        if (ics->history == NULL) return IcsErr_Alloc;
-        hist = (Ics_History*)ics->history;
-        hist->strings = (char**)malloc(ICS_HISTARRAY_INCREMENT * sizeof(char*));
-        if (hist->strings == NULL) {
-            free(ics->history);
-            ics->history = NULL;
-            return IcsErr_Alloc;
-        }
-        hist->length = ICS_HISTARRAY_INCREMENT;
-        hist->nStr = 0;
+        hist = icsNewHistory(ics);
+        if (hist == NULL) return IcsErr_Alloc;
     } else {
         hist = (Ics_History*)ics->history;
     }
@@ -177,6 +198,29 @@ Ics_Error IcsInternAddHistory(Ics_Header *ics,
     return error;
 }
 
+
+/* Note the history lines of an ICS file being read, to be read by
+   IcsReadHistory() when they are first needed. */
+Ics_Error IcsInternSetHistoryRange(Ics_Header   *ics,
+                                   ics_t_sint64  start,
+                                   ics_t_sint64  end,
+                                   const char   *seps)
+{
+    ICSINIT;
+    Ics_History *hist = (Ics_History*)ics->history;
+
+
+    if (hist == NULL) {
+        hist = icsNewHistory(ics);
+        if (hist == NULL) return IcsErr_Alloc;
+    }
+    hist->unreadStart = start;
+    hist->unreadEnd = end;
+    memcpy(hist->seps, seps, 3);
+
+    return error;
+}
+
 /* Get the number of HISTORY lines from the ICS file. */
 Ics_Error IcsGetNumHistoryStrings(ICS *ics,
                                   int *num)
@@ -186,6 +230,8 @@ Ics_Error IcsGetNumHistoryStrings(ICS *ics,
     Ics_History *hist;
 
     if (ics == NULL) return IcsErr_NotValidAction;
+    error = IcsReadHistory(ics);
+    if (error) return error;
 
     hist = (Ics_History*)ics->history;
 
@@ -230,6 +276,8 @@ Ics_Error IcsNewHistoryIterator(ICS                 *ics,
     Ics_History *hist;
 
     if (ics == NULL) return IcsErr_NotValidAction;
+    error = IcsReadHistory(ics);
+    if (error) return error;
 
     hist = (Ics_History*)ics->history;
 
@@ -328,6 +376,8 @@ Ics_Error IcsGetHistoryStringIF(ICS                 *ics,
     Ics_History *hist;
 
     if (ics == NULL) return IcsErr_NotValidAction;
+    error = IcsReadHistory(ics);
+    if (error) return error;
 
     hist = (Ics_History*)ics->history;
 
@@ -408,6 +458,8 @@ Ics_Error IcsDeleteHistory(ICS        *ics,
     Ics_History *hist;
 
     if (ics == NULL) return IcsErr_NotValidAction;
+    error = IcsReadHistory(ics);
+    if (error) return error;
 
     hist = (Ics_History*)ics->history;
 
@@ -454,6 +506,8 @@ Ics_Error IcsDeleteHistoryStringI(ICS                 *ics,
     Ics_History *hist;
 
     if (ics == NULL) return IcsErr_NotValidAction;
+    error = IcsReadHistory(ics);
+    if (error) return error;
 
     hist = (Ics_History*)ics->history;
 
@@ -485,6 +539,8 @@ Ics_Error IcsReplaceHistoryStringI(ICS                 *ics,
     Ics_History *hist;
 
     if (ics == NULL) return IcsErr_NotValidAction;
+    error = IcsReadHistory(ics);
+    if (error) return error;
 
     hist = (Ics_History*)ics->history;
 
@@ -102,6 +102,9 @@ typedef enum {
     ICSTOK_MODEL,
     ICSTOK_SPARAMS,
     ICSTOK_SSTATES,
+    ICSTOK_STORE,
+    ICSTOK_FILTER,
+    ICSTOK_CHUNKS,
     ICSTOK_LASTSUB,
 
         /* SubsubCategory tokens: */
@@ -148,6 +151,9 @@ typedef enum {
     ICSTOK_COMPR_UNCOMPRESSED,
     ICSTOK_COMPR_COMPRESS,
     ICSTOK_COMPR_GZIP,
+    ICSTOK_COMPR_LOCO,
+    ICSTOK_COMPR_FPRED,
+    ICSTOK_FILTER_DELTA,
     ICSTOK_FORMAT_INTEGER,
     ICSTOK_FORMAT_REAL,
     ICSTOK_FORMAT_COMPLEX,
@@ -207,6 +213,9 @@ typedef struct {
     int      nStr;    /* Index past the last one in the array; sort of the
                          number of strings in the array, except that some array
                          elements might be NULL */
+    ics_t_sint64 unreadStart; /* Byte range in the ICS file of history lines */
+    ics_t_sint64 unreadEnd;   /* not read yet, see IcsReadHistory() */
+    char         seps[3];     /* Separators used in the ICS file */
 } Ics_History;
 
 /* This is the struct behind the "void* BlockRead" in the ICS structure: */
@@ -216,16 +225,44 @@ typedef struct {
     void          *zlibStream;      /* z_stream* (or gzFile) for zlib */
     void          *zlibInputBuffer; /* Input buffer for compressed data */
     unsigned long  zlibCRC;         /* running CRC */
+    ics_t_uint64   zlibPos;         /* bytes decompressed so far; the counter
+                                       in z_stream can have 32 bits */
+    void          *zipIndex;        /* Ics_ZipIndex* of the stream, if any */
+    int            zipIndexRead;    /* set to non-zero once it was looked for */
 #endif
     int            compressRead;    /* set to non-zero when IcsReadCompress has
                                       been called */
+    void          *dedup;           /* chunk list when reading from a
+                                       deduplicating chunk store */
+    void          *chunks;          /* chunk cache when reading from a chunk
+                                       directory */
+    void          *tiles;           /* tile index when reading tiled data */
+    void          *delta;           /* state for undoing the delta coding */
+    size_t         dataOffset;      /* offset of the image data in the file */
 } Ics_BlockRead;
 
 
+/* The void* dataSource in the ICS structure points to this: */
+typedef struct {
+    Ics_DataSourceFunc  func;
+    void               *userData;
+} Ics_DataSource;
+
+
 /* Assorted support functions */
 FILE *IcsFOpen(const char *path,
                const char *mode);
 
+int IcsFSeek(FILE         *fp,
+             ics_t_sint64  offset,
+             int           whence);
+
+ics_t_sint64 IcsFTell(FILE *fp);
+
+int IcsExistFile(const char *filename);
+
+int IcsMkDir(const char *path);
+
 size_t IcsStrToSize(const char *str);
 
 void IcsStrCpy(char       *dest,
@@ -240,6 +277,16 @@ int IcsGetBytesPerSample(const Ics_Header *IcsStruct);
 void IcsGetFileName(char       *dest,
                     const char *src);
 
+char *IcsGetSidecarName(char       *dest,
+                        const char *src,
+                        const char *ext);
+
+Ics_Error IcsPutWord(FILE         *file,
+                     ics_t_uint64  x);
+
+Ics_Error IcsGetWord(FILE         *file,
+                     ics_t_uint64 *x);
+
 Ics_Error IcsOpenIcs(FILE **fpp,
                      char  *filename,
                      int    forceName);
@@ -249,6 +296,13 @@ Ics_Error IcsInternAddHistory(Ics_Header *ics,
                               const char *stuff,
                               const char *seps);
 
+Ics_Error IcsInternSetHistoryRange(Ics_Header   *ics,
+                                   ics_t_sint64  start,
+                                   ics_t_sint64  end,
+                                   const char   *seps);
+
+Ics_Error IcsReadHistory(Ics_Header *icsStruct);
+
 /* Binary data support functions */
 void IcsFillByteOrder(Ics_DataType dataType,
                       int          bytes,
@@ -261,23 +315,123 @@ Ics_Error IcsWritePlainWithStrides(const void      *src,
                                    int              nBytes,
                                    FILE            *file);
 
+void IcsGatherLines(const void      *src,
+                    const size_t    *dim,
+                    const ptrdiff_t *stride,
+                    int              nDims,
+                    int              nBytes,
+                    size_t           firstLine,
+                    size_t           nLines,
+                    void            *dest);
+
+Ics_Error IcsReadIdsData(Ics_Header *IcsStruct,
+                         void       *dest,
+                         size_t      n);
+
+Ics_Error IcsReadIdsRange(const Ics_Header *IcsStruct,
+                          size_t            offset,
+                          void             *dest,
+                          size_t            n);
+
+Ics_Error IcsSetIdsData(Ics_Header   *IcsStruct,
+                        ics_t_sint64  offset,
+                        int           whence);
+
 Ics_Error IcsCopyIds(const char *infilename,
                      size_t      inoffset,
                      const char *outfilename);
 
+/* GZIP indices, see libics_zipindex.c */
+#define ICS_ZINDEX_EXT ".izx"
+
+typedef struct {
+    ics_t_uint64  dataPos; /* offset in the image data */
+    ics_t_uint64  filePos; /* offset in the GZIP stream, from its header */
+    unsigned long crc;     /* CRC of the image data before dataPos */
+} Ics_ZipIndexEntry;
+
+typedef struct {
+    size_t             size;       /* size of the image data */
+    size_t             interval;   /* bytes of image data between entries */
+    size_t             next;       /* data offset of the next entry to add */
+    size_t             nEntries;
+    size_t             maxEntries;
+    Ics_ZipIndexEntry *entries;
+} Ics_ZipIndex;
+
+int IcsWritesZipIndex(const Ics_Header *IcsStruct);
+
+Ics_Error IcsNewZipIndex(const Ics_Header  *IcsStruct,
+                         Ics_ZipIndex     **index);
+
+void IcsAddToZipIndex(Ics_ZipIndex  *index,
+                      ics_t_uint64   dataPos,
+                      ics_t_uint64   filePos,
+                      unsigned long  crc);
+
+Ics_Error IcsFinishZipIndex(const Ics_Header *IcsStruct,
+                            Ics_ZipIndex     *index,
+                            Ics_Error         error);
+
+Ics_Error IcsReadZipIndex(const Ics_Header  *IcsStruct,
+                          Ics_ZipIndex     **index);
+
+const Ics_ZipIndexEntry *IcsFindZipIndex(const Ics_ZipIndex *index,
+                                         ics_t_uint64        dataPos);
+
+void IcsFreeZipIndex(const Ics_Header *IcsStruct,
+                     Ics_ZipIndex     *index);
+
+void IcsRemoveZipIndex(const Ics_Header *IcsStruct);
+
 /* zlib interface functions */
-Ics_Error IcsWriteZip(const void *src,
-                      size_t      n,
-                      FILE       *fp,
-                      int         CompLevel);
-
-Ics_Error IcsWriteZipWithStrides(const void      *src,
-                                 const size_t    *dim,
-                                 const ptrdiff_t *stride,
-                                 int              nDims,
-                                 int              nBytes,
-                                 FILE            *file,
-                                 int              level);
+#define ICS_ZIP_HEADER_SIZE 10 /* size of the GZIP header written */
+
+Ics_Error IcsWriteZip(const void       *src,
+                      size_t            n,
+                      FILE             *fp,
+                      int               CompLevel,
+                      Ics_ZipIndex     *index,
+                      const Ics_Header *icsStruct);
+
+Ics_Error IcsWriteZipWithStrides(const void       *src,
+                                 const size_t     *dim,
+                                 const ptrdiff_t  *stride,
+                                 int               nDims,
+                                 int               nBytes,
+                                 FILE             *file,
+                                 int               level,
+                                 Ics_ZipIndex     *index,
+                                 const Ics_Header *icsStruct);
+
+Ics_Error IcsWriteZipSource(Ics_DataSourceFunc  func,
+                            void               *userData,
+                            size_t              len,
+                            FILE               *file,
+                            int                 level,
+                            Ics_ZipIndex       *index,
+                            const Ics_Header   *icsStruct);
+
+Ics_Error IcsWriteZipHeader(FILE *file);
+
+Ics_Error IcsWriteZipTrailer(FILE          *file,
+                             unsigned long  crc,
+                             size_t         len);
+
+size_t IcsDeflateBound(size_t len);
+
+Ics_Error IcsDeflateBlock(const void       *src,
+                          size_t            len,
+                          int               level,
+                          int               last,
+                          void             *dest,
+                          size_t           *length,
+                          unsigned long    *crc,
+                          const Ics_Header *icsStruct);
+
+unsigned long IcsCombineCrc(unsigned long crc1,
+                            unsigned long crc2,
+                            size_t        len2);
 
 Ics_Error IcsOpenZip(Ics_Header *IcsStruct);
 
@@ -287,9 +441,354 @@ Ics_Error IcsReadZipBlock(Ics_Header *IcsStruct,
                           void       *outBuf,
                           size_t      len);
 
-Ics_Error IcsSetZipBlock(Ics_Header *IcsStruct,
-                         long        offset,
-                         int         whence);
+Ics_Error IcsSetZipBlock(Ics_Header   *IcsStruct,
+                         ics_t_sint64  offset,
+                         int           whence);
+
+Ics_Error IcsReadZipFile(FILE             *file,
+                         void             *outBuf,
+                         size_t            len,
+                         const Ics_Header *icsStruct);
+
+/* Deduplicating chunk store */
+Ics_Error IcsWriteDedup(const Ics_Header *IcsStruct,
+                        FILE             *fp);
+
+Ics_Error IcsOpenDedup(Ics_Header *IcsStruct);
+
+Ics_Error IcsCloseDedup(Ics_Header *IcsStruct);
+
+Ics_Error IcsReadDedupBlock(Ics_Header *IcsStruct,
+                            void       *outBuf,
+                            size_t      len);
+
+Ics_Error IcsSetDedupBlock(Ics_Header   *IcsStruct,
+                           ics_t_sint64  offset,
+                           int           whence);
+
+/* Chunk directory */
+void IcsGetChunkDims(const Ics_Header *IcsStruct,
+                     size_t           *chunkDims,
+                     size_t           *nChunks);
+
+Ics_Error IcsWriteChunks(const Ics_Header *IcsStruct);
+
+Ics_Error IcsOpenChunks(Ics_Header *IcsStruct);
+
+Ics_Error IcsCloseChunks(Ics_Header *IcsStruct);
+
+Ics_Error IcsReadChunkBlock(Ics_Header *IcsStruct,
+                            void       *outBuf,
+                            size_t      len);
+
+Ics_Error IcsSetChunkBlock(Ics_Header   *IcsStruct,
+                           ics_t_sint64  offset,
+                           int           whence);
+
+/* Zone maps */
+#define ICS_ZONE_EXT ".izm"
+
+Ics_Error IcsNewZoneMap(const Ics_Header  *IcsStruct,
+                        void             **zoneMap);
+
+void IcsAddToZoneMap(void       *zoneMap,
+                     const void *src,
+                     size_t      n);
+
+Ics_Error IcsFinishZoneMap(const Ics_Header *IcsStruct,
+                           void             *zoneMap,
+                           Ics_Error         error);
+
+Ics_Error IcsWriteZoneMap(const Ics_Header *IcsStruct);
+
+Ics_Error IcsStampZoneMap(const Ics_Header *IcsStruct);
+
+void IcsRemoveZoneMap(const Ics_Header *IcsStruct);
+
+/* Durable output, see libics_durable.c */
+Ics_Durability IcsGetDefaultDurability(void);
+
+Ics_Error IcsGetOutputName(char             *dest,
+                           const Ics_Header *IcsStruct);
+
+Ics_Error IcsCommitOutput(const Ics_Header *IcsStruct,
+                          Ics_Error         error);
+
+/* Memory-mapped output */
+Ics_Error IcsUnmapData(Ics_Header *IcsStruct);
+
+/* Frame writer */
+Ics_Error IcsFinishFrames(Ics_Header *IcsStruct);
+
+/* Tiled data streams */
+typedef struct {
+    size_t lineBytes;     /* bytes in an image line */
+    size_t linesPerPlane; /* image lines in a 2D plane */
+    size_t linesPerTile;  /* image lines in a tile (the last tile in a plane
+                             can have fewer) */
+    size_t tilesPerPlane; /* tiles in a 2D plane */
+    size_t nPlanes;       /* 2D planes in the image */
+    size_t nTiles;        /* tiles in the image */
+} Ics_TileLayout;
+
+Ics_Error IcsGetTileLayout(const Ics_Header *IcsStruct,
+                           size_t            linesPerTile,
+                           size_t            maxBytes,
+                           Ics_TileLayout   *layout);
+
+void IcsGetTileLines(const Ics_TileLayout *layout,
+                     size_t                tile,
+                     size_t               *firstLine,
+                     size_t               *nLines);
+
+int IcsIsTileCompression(Ics_Compression compression);
+
+const char *IcsTileCompressionName(Ics_Compression compression);
+
+int IcsTileSupports(Ics_Compression compression,
+                    Ics_DataType    dataType);
+
+Ics_Error IcsEncodeTile(Ics_Compression   compression,
+                        const void       *src,
+                        Ics_DataType      dataType,
+                        size_t            width,
+                        size_t            height,
+                        unsigned char    *dest,
+                        size_t           *length,
+                        const Ics_Header *icsStruct);
+
+Ics_Error IcsDecodeTile(Ics_Compression      compression,
+                        const unsigned char *src,
+                        size_t               length,
+                        Ics_DataType         dataType,
+                        size_t               width,
+                        size_t               height,
+                        void                *dest,
+                        const Ics_Header    *icsStruct);
+
+Ics_Error IcsWriteTiles(const Ics_Header *IcsStruct,
+                        FILE             *fp);
+
+Ics_Error IcsOpenTiles(Ics_Header *IcsStruct);
+
+Ics_Error IcsCloseTiles(Ics_Header *IcsStruct);
+
+Ics_Error IcsReadTileBlock(Ics_Header *IcsStruct,
+                           void       *outBuf,
+                           size_t      len);
+
+Ics_Error IcsSetTileBlock(Ics_Header   *IcsStruct,
+                          ics_t_sint64  offset,
+                          int           whence);
+
+/* Lossless image codec */
+int IcsLocoSupports(Ics_DataType dataType);
+
+Ics_Error IcsLocoEncode(const void       *src,
+                        Ics_DataType      dataType,
+                        size_t            width,
+                        size_t            height,
+                        unsigned char    *dest,
+                        size_t            capacity,
+                        size_t           *length,
+                        const Ics_Header *icsStruct);
+
+Ics_Error IcsLocoDecode(const unsigned char *src,
+                        size_t               length,
+                        Ics_DataType         dataType,
+                        size_t               width,
+                        size_t               height,
+                        void                *dest,
+                        const Ics_Header    *icsStruct);
+
+/* Delta coding along the time dimension */
+Ics_Error IcsDeltaEncode(const Ics_Header *IcsStruct,
+                         void             *data,
+                         size_t            n);
+
+Ics_Error IcsOpenDelta(Ics_Header *IcsStruct);
+
+Ics_Error IcsCloseDelta(Ics_Header *IcsStruct);
+
+Ics_Error IcsReadDeltaBlock(Ics_Header *IcsStruct,
+                            void       *outBuf,
+                            size_t      len);
+
+Ics_Error IcsSetDeltaBlock(Ics_Header   *IcsStruct,
+                           ics_t_sint64  offset,
+                           int           whence);
+
+/* Lossless floating-point codec */
+int IcsFpredSupports(Ics_DataType dataType);
+
+Ics_Error IcsFpredEncode(const void       *src,
+                         Ics_DataType      dataType,
+                         size_t            width,
+                         size_t            height,
+                         unsigned char    *dest,
+                         size_t            capacity,
+                         size_t           *length,
+                         const Ics_Header *icsStruct);
+
+Ics_Error IcsFpredDecode(const unsigned char *src,
+                         size_t               length,
+                         Ics_DataType         dataType,
+                         size_t               width,
+                         size_t               height,
+                         void                *dest,
+                         const Ics_Header    *icsStruct);
+
+/* Parallel loops */
+typedef Ics_Error (*Ics_ParallelFunc)(void   *data,
+                                      size_t  i);
+
+int IcsGetNumThreads(void);
+
+Ics_Error IcsParallelFor(Ics_Context      *context,
+                         size_t            n,
+                         Ics_ParallelFunc  func,
+                         void             *data);
+
+/* Background jobs */
+typedef void (*Ics_JobFunc)(void *data);
+
+/* A queued background job. */
+typedef struct Ics_Job_ {
+    Ics_JobFunc      func;
+    void            *data;
+    struct Ics_Job_ *next;
+} Ics_Job;
+
+/* The jobs waiting for a worker thread, see libics_thread.c. */
+typedef struct {
+    Ics_Job *first;    /* next job to run */
+    Ics_Job *last;     /* last job queued */
+    Ics_Job *spare;    /* finished jobs, reused by a context */
+    int      nQueued;  /* number of jobs in the queue */
+    int      nWorkers; /* number of worker threads */
+    int      nIdle;    /* number of those waiting for a job */
+    int      stop;     /* set to 1 to make the workers exit */
+} Ics_JobQueue;
+
+Ics_Error IcsStartJob(Ics_Context  *context,
+                      Ics_JobFunc   func,
+                      void         *data);
+
+void IcsStopJobs(Ics_Context *context);
+
+void IcsLockJobs(void);
+
+void IcsUnlockJobs(void);
+
+void IcsWaitJobs(void);
+
+void IcsSignalJobs(void);
+
+void IcsLockMemory(const Ics_Context *context);
+
+void IcsUnlockMemory(const Ics_Context *context);
+
+/* Asynchronous reads, see libics_async.c */
+void IcsDetachReads(ICS *ics);
+
+/* Atomic operations */
+size_t IcsAtomicAdd(volatile size_t *value,
+                    size_t           add);
+
+int IcsAtomicGet(volatile int *value);
+
+void IcsAtomicSet(volatile int *value,
+                  int           newValue);
+
+int IcsAtomicCas(volatile int *value,
+                 int           expected,
+                 int           newValue);
+
+int IcsAtomicCasPtr(void *volatile *ptr,
+                    void          **expected,
+                    void           *newValue);
+
+void *IcsAtomicSwapPtr(void *volatile *ptr,
+                       void           *newValue);
+
+/* Shared execution contexts, see libics_context.c */
+#define ICS_SCRATCH_CLASSES 32
+
+struct _Ics_Context {
+    int            nThreads;    /* maximum number of threads */
+    Ics_AllocFunc  allocFunc;   /* allocator, NULL for malloc() */
+    Ics_FreeFunc   freeFunc;
+    void          *userData;    /* passed to allocFunc and freeFunc */
+    size_t         memoryInUse; /* bytes obtained from the allocator */
+    size_t         memoryPeak;
+    size_t         memoryLimit; /* 0 if not limited */
+        /* Free scratch buffers, by size class: */
+    void          *scratch[ICS_SCRATCH_CLASSES];
+    Ics_JobQueue   jobs;        /* background jobs and their workers */
+};
+
+int IcsGetContextThreads(const Ics_Context *context);
+
+void *IcsContextAlloc(Ics_Context *context,
+                      size_t       size);
+
+void IcsContextFree(Ics_Context *context,
+                    void        *ptr);
+
+void *IcsGetScratch(const Ics_Header *ics,
+                    size_t            size);
+
+void IcsReleaseScratch(const Ics_Header *ics,
+                       void             *ptr);
+
+/* CPU-specific kernels, see libics_cpu.c */
+typedef enum {
+    IcsCpu_generic = 0,
+    IcsCpu_sse42,
+    IcsCpu_avx2,
+    IcsCpu_avx512,
+    IcsCpu_neon
+} Ics_CpuLevel;
+
+typedef struct {
+    Ics_CpuLevel level;
+        /* Reverse the bytes of n samples of size bytes each (2, 4 or 8). */
+    void (*swapBytes)(void   *buf,
+                      size_t  n,
+                      size_t  size);
+        /* Find the minimum and maximum of n > 0 samples. */
+    void (*minMaxUint8)(const ics_t_uint8 *buf,
+                        size_t             n,
+                        ics_t_uint8       *min,
+                        ics_t_uint8       *max);
+    void (*minMaxUint16)(const ics_t_uint16 *buf,
+                         size_t              n,
+                         ics_t_uint16       *min,
+                         ics_t_uint16       *max);
+        /* Copy n contiguous samples of size bytes each to dest, stride bytes
+           apart. */
+    void (*scatter)(char       *dest,
+                    ptrdiff_t   stride,
+                    const char *src,
+                    size_t      n,
+                    size_t      size);
+        /* Copy n samples of size bytes each, stride bytes apart in src, to
+           contiguous dest. */
+    void (*gather)(char       *dest,
+                   const char *src,
+                   ptrdiff_t   stride,
+                   size_t      n,
+                   size_t      size);
+        /* Add n samples, converted to float, to n accumulators. */
+    void (*accumulateUint8)(float             *acc,
+                            const ics_t_uint8 *src,
+                            size_t             n);
+    void (*accumulateUint16)(float              *acc,
+                             const ics_t_uint16 *src,
+                             size_t              n);
+} Ics_Kernels;
+
+const Ics_Kernels *IcsGetKernels(void);
 
 /* Reading COMPRESS-compressed data */
 Ics_Error IcsReadCompress(Ics_Header *IcsStruct,
@@ -43,6 +43,7 @@
 #define LIBICS_LL_H
 
 
+#include <stdint.h>
 #include "libics.h"
 
 
@@ -93,9 +94,13 @@ ICSEXPORT Ics_Error IcsReadIdsBlock(Ics_Header *icsStruct,
 ICSEXPORT Ics_Error IcsSkipIdsBlock(Ics_Header *icsStruct,
                                     size_t      len);
 
-/* Sets the file pointer into the image data on disk (fseek anywhere). */
+/* Sets the file pointer into the image data on disk (fseek anywhere). The
+   offset has 64 bits on all systems, so that large files can be addressed.
+   With SEEK_SET the offset is relative to the start of the image data, also
+   when the data follows the header in a version 2.0 file. Up to libics 1.6.2
+   it was relative to the start of the file for uncompressed data. */
 ICSEXPORT Ics_Error IcsSetIdsBlock(Ics_Header *icsStruct,
-                                   long        offset,
+                                   int64_t     offset,
                                    int         whence);
 
 /* Reads image data from disk. */
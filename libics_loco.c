@@ -0,0 +1,634 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_loco.c
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsLocoSupports()
+ *   IcsLocoEncode()
+ *   IcsLocoDecode()
+ *
+ * This is a lossless image codec for 8 and 16 bit integer data, following
+ * LOCO-I (the algorithm behind JPEG-LS, M.J. Weinberger, G. Seroussi and
+ * G. Sapiro, IEEE Trans. Image Processing 9(8), 2000): each sample is predicted
+ * from its neighbours with the median edge detector, the prediction is
+ * corrected with a bias learned per context (365 contexts, from the quantized
+ * local gradients), and the prediction error is written with an adaptive
+ * Golomb-Rice code. Run mode is not implemented, and the bit stream is not
+ * JPEG-LS compatible.
+ *
+ * A tile is coded independently of other tiles. The coded tile starts with two
+ * bytes: the number of bits per sample used for coding (the smallest value
+ * that represents all samples in the tile), and a flags byte. 16-bit samples
+ * are coded by value, the flags record the byte order of the writer such that
+ * the decoded data has the same byte order as the original.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+
+#define ICS_LOCO_CONTEXTS 365  /* number of contexts             */
+#define ICS_LOCO_RESET    64   /* context statistics halve here  */
+#define ICS_LOCO_MIN_C    -128 /* bias correction limits         */
+#define ICS_LOCO_MAX_C    127
+#define ICS_LOCO_BIGENDIAN 0x01
+
+
+/* Context statistics and coding parameters. */
+typedef struct {
+    int A[ICS_LOCO_CONTEXTS]; /* accumulated error magnitudes */
+    int B[ICS_LOCO_CONTEXTS]; /* accumulated errors (bias)    */
+    int C[ICS_LOCO_CONTEXTS]; /* bias correction values       */
+    int N[ICS_LOCO_CONTEXTS]; /* context occurrence counts    */
+    int maxval;               /* largest sample value         */
+    int range;                /* number of sample values      */
+    int bits;                 /* bits per sample              */
+    int limit;                /* maximum code length          */
+    int t1, t2, t3;           /* gradient thresholds          */
+} Ics_LocoState;
+
+
+/* Bit stream writer. */
+typedef struct {
+    unsigned char *out;
+    size_t         pos;
+    size_t         capacity;
+    ics_t_uint64   acc;
+    int            nBits;
+} Ics_BitWriter;
+
+
+/* Bit stream reader. */
+typedef struct {
+    const unsigned char *in;
+    size_t               pos;
+    size_t               length;
+    ics_t_uint64         acc;   /* left-aligned, unused bits are zero */
+    int                  nBits;
+} Ics_BitReader;
+
+
+static int icsIsBigEndianMachine(void)
+{
+    int i = 1;
+    return *(char*)&i != 1;
+}
+
+
+static int icsClamp(int x,
+                    int lo,
+                    int hi)
+{
+    return x < lo ? lo : (x > hi ? hi : x);
+}
+
+
+static void icsLocoInit(Ics_LocoState *s,
+                        int            bits)
+{
+    int i, factor, a;
+
+
+    s->bits = bits;
+    s->maxval = (1 << bits) - 1;
+    s->range = s->maxval + 1;
+    s->limit = 2 * (bits + (bits > 8 ? bits : 8));
+        /* Default thresholds of JPEG-LS */
+    if (s->maxval >= 128) {
+        factor = ((s->maxval < 4095 ? s->maxval : 4095) + 128) >> 8;
+        s->t1 = icsClamp(factor + 2, 1, s->maxval);
+        s->t2 = icsClamp(factor * 4 + 3, s->t1, s->maxval);
+        s->t3 = icsClamp(factor * 17 + 4, s->t2, s->maxval);
+    } else {
+        factor = 256 / (s->maxval + 1);
+        s->t1 = icsClamp(3 / factor > 2 ? 3 / factor : 2, 1, s->maxval);
+        s->t2 = icsClamp(7 / factor > 3 ? 7 / factor : 3, s->t1, s->maxval);
+        s->t3 = icsClamp(21 / factor > 4 ? 21 / factor : 4, s->t2, s->maxval);
+    }
+    a = (s->range + 32) >> 6;
+    if (a < 2) a = 2;
+    for (i = 0; i < ICS_LOCO_CONTEXTS; i++) {
+        s->A[i] = a;
+        s->B[i] = 0;
+        s->C[i] = 0;
+        s->N[i] = 1;
+    }
+}
+
+
+static int icsLocoQuantize(const Ics_LocoState *s,
+                           int                  d)
+{
+    if (d <= -s->t3) return -4;
+    if (d <= -s->t2) return -3;
+    if (d <= -s->t1) return -2;
+    if (d < 0) return -1;
+    if (d == 0) return 0;
+    if (d < s->t1) return 1;
+    if (d < s->t2) return 2;
+    if (d < s->t3) return 3;
+    return 4;
+}
+
+
+/* Compute the context and the corrected prediction for a sample, given its
+   neighbours a (left), b (above), c (above left) and d (above right). */
+static void icsLocoPredict(const Ics_LocoState *s,
+                           int                  a,
+                           int                  b,
+                           int                  c,
+                           int                  d,
+                           int                 *ctx,
+                           int                 *sign,
+                           int                 *px)
+{
+    int q1, q2, q3, p;
+
+
+    q1 = icsLocoQuantize(s, d - b);
+    q2 = icsLocoQuantize(s, b - c);
+    q3 = icsLocoQuantize(s, c - a);
+    if ((q1 < 0) || ((q1 == 0) && ((q2 < 0) || ((q2 == 0) && (q3 < 0))))) {
+        q1 = -q1;
+        q2 = -q2;
+        q3 = -q3;
+        *sign = -1;
+    } else {
+        *sign = 1;
+    }
+    *ctx = q1 * 81 + q2 * 9 + q3;
+
+        /* Median edge detector */
+    if (c >= (a > b ? a : b)) {
+        p = a < b ? a : b;
+    } else if (c <= (a < b ? a : b)) {
+        p = a > b ? a : b;
+    } else {
+        p = a + b - c;
+    }
+    p += *sign * s->C[*ctx];
+    *px = icsClamp(p, 0, s->maxval);
+}
+
+
+/* The Golomb-Rice parameter for a context. */
+static int icsLocoK(const Ics_LocoState *s,
+                    int                  ctx)
+{
+    int k;
+
+
+    for (k = 0; (s->N[ctx] << k) < s->A[ctx]; k++);
+    return k;
+}
+
+
+/* Update the context statistics with a prediction error. */
+static void icsLocoUpdate(Ics_LocoState *s,
+                          int            ctx,
+                          int            err)
+{
+    int *A = s->A + ctx, *B = s->B + ctx, *C = s->C + ctx, *N = s->N + ctx;
+
+
+    *B += err;
+    *A += err < 0 ? -err : err;
+    if (*N == ICS_LOCO_RESET) {
+        *A >>= 1;
+        *B = *B >= 0 ? *B >> 1 : -((1 - *B) >> 1);
+        *N >>= 1;
+    }
+    (*N)++;
+    if (*B <= -*N) {
+        *B += *N;
+        if (*C > ICS_LOCO_MIN_C) (*C)--;
+        if (*B <= -*N) *B = -*N + 1;
+    } else if (*B > 0) {
+        *B -= *N;
+        if (*C < ICS_LOCO_MAX_C) (*C)++;
+        if (*B > 0) *B = 0;
+    }
+}
+
+
+static int icsPutBits(Ics_BitWriter *w,
+                      ics_t_uint64   value,
+                      int            n)
+{
+    w->acc = (w->acc << n) | value;
+    w->nBits += n;
+    while (w->nBits >= 8) {
+        if (w->pos >= w->capacity) return 1;
+        w->nBits -= 8;
+        w->out[w->pos++] = (unsigned char)(w->acc >> w->nBits);
+    }
+    return 0;
+}
+
+
+static int icsPutZeros(Ics_BitWriter *w,
+                       int            n)
+{
+    while (n > 32) {
+        if (icsPutBits(w, 0, 32)) return 1;
+        n -= 32;
+    }
+    return icsPutBits(w, 0, n);
+}
+
+
+static int icsFlushBits(Ics_BitWriter *w)
+{
+    if (w->nBits > 0) {
+        return icsPutBits(w, 0, 8 - w->nBits);
+    }
+    return 0;
+}
+
+
+static void icsRefillBits(Ics_BitReader *r)
+{
+    while (r->nBits <= 56) {
+        if (r->pos < r->length) {
+            r->acc |= (ics_t_uint64)r->in[r->pos] << (56 - r->nBits);
+        }
+            /* Past the end we shift in zeros, but keep counting so that the
+               caller can detect the overrun. */
+        r->pos++;
+        r->nBits += 8;
+    }
+}
+
+
+static int icsGetBits(Ics_BitReader *r,
+                      int            n)
+{
+    int value;
+
+
+    if (n == 0) return 0;
+    if (r->nBits < n) icsRefillBits(r);
+    value = (int)(r->acc >> (64 - n));
+    r->acc <<= n;
+    r->nBits -= n;
+    return value;
+}
+
+
+static int icsLeadingZeros(ics_t_uint64 x)
+{
+#if defined(__GNUC__)
+    return x ? __builtin_clzll(x) : 64;
+#else
+    int n = 0;
+    if (x == 0) return 64;
+    while (!(x & 0x8000000000000000ULL)) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+
+/* Count (and consume) zero bits up to the next one bit, which is also
+   consumed. Stops counting at max. */
+static int icsGetZeros(Ics_BitReader *r,
+                       int            max)
+{
+    int z = 0, lz;
+
+
+    for (;;) {
+        if (r->nBits < 32) icsRefillBits(r);
+        lz = icsLeadingZeros(r->acc);
+        if (lz < r->nBits) {
+            z += lz;
+            r->acc <<= lz + 1;
+            r->nBits -= lz + 1;
+            return z;
+        }
+        z += r->nBits;
+        r->acc = 0;
+        r->nBits = 0;
+        if (z > max) return z;
+    }
+}
+
+
+/* Write a mapped prediction error with the limited length Golomb code. */
+static int icsLocoPutCode(Ics_BitWriter       *w,
+                          const Ics_LocoState *s,
+                          int                  merr,
+                          int                  k)
+{
+    int q = merr >> k;
+
+
+    if (q < s->limit - s->bits - 1) {
+        if (icsPutZeros(w, q)) return 1;
+        return icsPutBits(w, ((ics_t_uint64)1 << k)
+                          | (ics_t_uint64)(merr & ((1 << k) - 1)), k + 1);
+    } else {
+        if (icsPutZeros(w, s->limit - s->bits - 1)) return 1;
+        return icsPutBits(w, ((ics_t_uint64)1 << s->bits)
+                          | (ics_t_uint64)(merr - 1), s->bits + 1);
+    }
+}
+
+
+static int icsLocoGetCode(Ics_BitReader       *r,
+                          const Ics_LocoState *s,
+                          int                  k)
+{
+    int q = icsGetZeros(r, s->limit);
+
+
+    if (q < s->limit - s->bits - 1) {
+        return (q << k) | icsGetBits(r, k);
+    } else {
+        return icsGetBits(r, s->bits) + 1;
+    }
+}
+
+
+/* Load a line of samples, mapping signed values to unsigned. */
+static void icsLocoLoadLine(const void   *src,
+                            Ics_DataType  dataType,
+                            size_t        width,
+                            int          *line)
+{
+    size_t i;
+
+
+    switch (dataType) {
+        case Ics_uint8:
+            for (i = 0; i < width; i++)
+                line[i] = ((const ics_t_uint8*)src)[i];
+            break;
+        case Ics_sint8:
+            for (i = 0; i < width; i++)
+                line[i] = ((const ics_t_sint8*)src)[i] + 128;
+            break;
+        case Ics_uint16:
+            for (i = 0; i < width; i++)
+                line[i] = ((const ics_t_uint16*)src)[i];
+            break;
+        case Ics_sint16:
+            for (i = 0; i < width; i++)
+                line[i] = ((const ics_t_sint16*)src)[i] + 32768;
+            break;
+        default:
+            break;
+    }
+}
+
+
+/* Store a line of samples, undoing the mapping of icsLocoLoadLine(). */
+static void icsLocoStoreLine(const int    *line,
+                             Ics_DataType  dataType,
+                             size_t        width,
+                             int           swap,
+                             void         *dest)
+{
+    size_t       i;
+    ics_t_uint16 v;
+
+
+    switch (dataType) {
+        case Ics_uint8:
+            for (i = 0; i < width; i++)
+                ((ics_t_uint8*)dest)[i] = (ics_t_uint8)line[i];
+            break;
+        case Ics_sint8:
+            for (i = 0; i < width; i++)
+                ((ics_t_sint8*)dest)[i] = (ics_t_sint8)(line[i] - 128);
+            break;
+        case Ics_uint16:
+        case Ics_sint16:
+                /* The offset of signed data is a flip of the top bit */
+            for (i = 0; i < width; i++) {
+                v = (ics_t_uint16)line[i];
+                if (dataType == Ics_sint16) v ^= 0x8000;
+                if (swap) v = (ics_t_uint16)((v >> 8) | (v << 8));
+                ((ics_t_uint16*)dest)[i] = v;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+/* Get the neighbours of sample x on the current line. On the first line of the
+   tile the line above is not available, and only the left neighbour is
+   used. */
+#define ICS_LOCO_NEIGHBOURS                                           \
+    if (prev == NULL) {                                               \
+        a = x > 0 ? cur[x-1] : mid;                                   \
+        b = c = d = a;                                                \
+    } else {                                                          \
+        b = prev[x];                                                  \
+        a = x > 0 ? cur[x-1] : b;                                     \
+        c = x > 0 ? prev[x-1] : b;                                    \
+        d = x + 1 < width ? prev[x+1] : b;                            \
+    }
+
+
+/* Returns non-zero if the data type can be coded. */
+int IcsLocoSupports(Ics_DataType dataType)
+{
+    return (dataType == Ics_uint8) || (dataType == Ics_sint8)
+        || (dataType == Ics_uint16) || (dataType == Ics_sint16);
+}
+
+
+/* Code a tile of width x height samples. Returns IcsErr_BufferTooSmall if the
+   coded tile does not fit in capacity bytes. */
+Ics_Error IcsLocoEncode(const void       *src,
+                        Ics_DataType      dataType,
+                        size_t            width,
+                        size_t            height,
+                        unsigned char    *dest,
+                        size_t            capacity,
+                        size_t           *length,
+                        const Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_LocoState *s;
+    Ics_BitWriter  w;
+    int           *lines, *prev, *cur, *tmp;
+    int            a, b, c, d, ctx, sign, px, err, merr, k, bits, mid, max = 0;
+    size_t         x, y, nBytes = IcsGetDataTypeSize(dataType);
+
+
+    if (capacity < 2) return IcsErr_BufferTooSmall;
+    s = (Ics_LocoState*)IcsGetScratch(icsStruct, sizeof(Ics_LocoState));
+    lines = (int*)IcsGetScratch(icsStruct, 2 * width * sizeof(int));
+    if ((s == NULL) || (lines == NULL)) {
+        IcsReleaseScratch(icsStruct, s);
+        IcsReleaseScratch(icsStruct, lines);
+        return IcsErr_Alloc;
+    }
+
+        /* Find the number of bits needed for this tile */
+    for (y = 0; y < height; y++) {
+        icsLocoLoadLine((const char*)src + y * width * nBytes, dataType,
+                        width, lines);
+        for (x = 0; x < width; x++) {
+            if (lines[x] > max) max = lines[x];
+        }
+    }
+    for (bits = 2; (1 << bits) <= max; bits++);
+    icsLocoInit(s, bits);
+    mid = 1 << (bits - 1);
+
+    dest[0] = (unsigned char)bits;
+    dest[1] = icsIsBigEndianMachine() ? ICS_LOCO_BIGENDIAN : 0;
+    w.out = dest;
+    w.pos = 2;
+    w.capacity = capacity;
+    w.acc = 0;
+    w.nBits = 0;
+
+    prev = NULL;
+    cur = lines;
+    for (y = 0; !error && y < height; y++) {
+        icsLocoLoadLine((const char*)src + y * width * nBytes, dataType,
+                        width, cur);
+        for (x = 0; x < width; x++) {
+            ICS_LOCO_NEIGHBOURS
+            icsLocoPredict(s, a, b, c, d, &ctx, &sign, &px);
+            err = sign * (cur[x] - px);
+            if (err < 0) err += s->range;
+            if (err >= (s->range + 1) / 2) err -= s->range;
+            k = icsLocoK(s, ctx);
+            if ((k == 0) && (2 * s->B[ctx] <= -s->N[ctx])) {
+                merr = err >= 0 ? 2 * err + 1 : -2 * (err + 1);
+            } else {
+                merr = err >= 0 ? 2 * err : -2 * err - 1;
+            }
+            if (icsLocoPutCode(&w, s, merr, k)) {
+                error = IcsErr_BufferTooSmall;
+                break;
+            }
+            icsLocoUpdate(s, ctx, err);
+        }
+        tmp = prev == NULL ? lines + width : prev;
+        prev = cur;
+        cur = tmp;
+    }
+    if (!error && icsFlushBits(&w)) error = IcsErr_BufferTooSmall;
+    *length = w.pos;
+
+    IcsReleaseScratch(icsStruct, s);
+    IcsReleaseScratch(icsStruct, lines);
+    return error;
+}
+
+
+/* Decode a tile of width x height samples. */
+Ics_Error IcsLocoDecode(const unsigned char *src,
+                        size_t               length,
+                        Ics_DataType         dataType,
+                        size_t               width,
+                        size_t               height,
+                        void                *dest,
+                        const Ics_Header    *icsStruct)
+{
+    ICSINIT;
+    Ics_LocoState *s;
+    Ics_BitReader  r;
+    int           *lines, *prev, *cur, *tmp;
+    int            a, b, c, d, ctx, sign, px, err, merr, k, bits, mid, swap;
+    size_t         x, y, nBytes = IcsGetDataTypeSize(dataType);
+
+
+    if (length < 2) return IcsErr_CorruptedStream;
+    bits = src[0];
+    if ((bits < 2) || (bits > 8 * (int)nBytes)) return IcsErr_CorruptedStream;
+    swap = ((src[1] & ICS_LOCO_BIGENDIAN) != 0) != icsIsBigEndianMachine();
+
+    s = (Ics_LocoState*)IcsGetScratch(icsStruct, sizeof(Ics_LocoState));
+    lines = (int*)IcsGetScratch(icsStruct, 2 * width * sizeof(int));
+    if ((s == NULL) || (lines == NULL)) {
+        IcsReleaseScratch(icsStruct, s);
+        IcsReleaseScratch(icsStruct, lines);
+        return IcsErr_Alloc;
+    }
+    icsLocoInit(s, bits);
+    mid = 1 << (bits - 1);
+
+    r.in = src;
+    r.pos = 2;
+    r.length = length;
+    r.acc = 0;
+    r.nBits = 0;
+
+    prev = NULL;
+    cur = lines;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            ICS_LOCO_NEIGHBOURS
+            icsLocoPredict(s, a, b, c, d, &ctx, &sign, &px);
+            k = icsLocoK(s, ctx);
+            merr = icsLocoGetCode(&r, s, k);
+            if ((k == 0) && (2 * s->B[ctx] <= -s->N[ctx])) {
+                err = (merr & 1) ? (merr - 1) / 2 : -(merr / 2) - 1;
+            } else {
+                err = (merr & 1) ? -((merr + 1) / 2) : merr / 2;
+            }
+            icsLocoUpdate(s, ctx, err);
+            px += sign * err;
+            if (px < 0) px += s->range;
+            if (px >= s->range) px -= s->range;
+            cur[x] = px;
+        }
+        icsLocoStoreLine(cur, dataType, width, swap,
+                         (char*)dest + y * width * nBytes);
+        tmp = prev == NULL ? lines + width : prev;
+        prev = cur;
+        cur = tmp;
+    }
+        /* Did we read past the end of the data? */
+    if (r.pos - (size_t)(r.nBits / 8) > length) error = IcsErr_CorruptedStream;
+
+    IcsReleaseScratch(icsStruct, s);
+    IcsReleaseScratch(icsStruct, lines);
+    return error;
+}
@@ -0,0 +1,281 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * FILE : libics_map.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsMapData()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsUnmapData()
+ *
+ * Writing the image data through a writable memory map of the IDS file (or of
+ * the data part of a version 2.0 ICS file). The file is created at its final
+ * size and the caller fills in the data in place, so that there is no image
+ * buffer in memory and no copy when closing. Only uncompressed data can be
+ * written this way. POSIX systems use mmap(), Windows uses file mappings.
+ */
+
+
+    /* Request 64-bit file offsets on 32-bit POSIX systems, as in
+       libics_util.c. */
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+/* A writable memory map of the image data. */
+typedef struct {
+    char   *base;   /* start of the mapped region */
+    size_t  length; /* length of the mapped region */
+#if defined(_WIN32)
+    HANDLE  file;
+    HANDLE  map;
+#endif
+} Ics_DataMap;
+
+
+#if defined(_WIN32)
+
+/* Open a file for reading and writing, converting the UTF-8 name as IcsFOpen()
+   does. */
+static HANDLE icsOpenMapFile(const char *path)
+{
+    wchar_t *wpath;
+    HANDLE   file = INVALID_HANDLE_VALUE;
+    int      n    = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+
+
+    wpath = (wchar_t*)malloc(n * sizeof(wchar_t));
+    if (wpath == NULL) return file;
+    if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, n)) {
+        file = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    free(wpath);
+    return file;
+}
+
+#endif
+
+
+/* Extend the file to offset + size bytes, and map the last size bytes. */
+static Ics_Error icsMapFile(const char   *filename,
+                            ics_t_uint64  offset,
+                            size_t        size,
+                            Ics_DataMap  *map,
+                            void        **data)
+{
+    ICSINIT;
+    ics_t_uint64 start, end = offset + size;
+    size_t       skip;
+#if defined(_WIN32)
+    SYSTEM_INFO  info;
+
+
+    GetSystemInfo(&info);
+    skip = (size_t)(offset % info.dwAllocationGranularity);
+    start = offset - skip;
+    map->length = size + skip;
+    map->file = icsOpenMapFile(filename);
+    if (map->file == INVALID_HANDLE_VALUE) return IcsErr_FOpenIds;
+        /* Creating the mapping extends the file */
+    map->map = CreateFileMappingW(map->file, NULL, PAGE_READWRITE,
+                                  (DWORD)(end >> 32), (DWORD)end, NULL);
+    if (map->map == NULL) {
+        error = IcsErr_FWriteIds;
+    } else {
+        map->base = (char*)MapViewOfFile(map->map, FILE_MAP_WRITE,
+                                         (DWORD)(start >> 32), (DWORD)start,
+                                         map->length);
+        if (map->base == NULL) {
+            CloseHandle(map->map);
+            error = IcsErr_FWriteIds;
+        }
+    }
+    if (error) {
+        CloseHandle(map->file);
+        return error;
+    }
+#else
+    int fd;
+    long pageSize;
+
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize <= 0) pageSize = 4096;
+    skip = (size_t)(offset % (ics_t_uint64)pageSize);
+    start = offset - skip;
+    map->length = size + skip;
+    if ((ics_t_uint64)(off_t)end != end) return IcsErr_FWriteIds;
+    fd = open(filename, O_RDWR);
+    if (fd < 0) return IcsErr_FOpenIds;
+    if (ftruncate(fd, (off_t)end) != 0) {
+        error = IcsErr_FWriteIds;
+    } else {
+        map->base = (char*)mmap(NULL, map->length, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, (off_t)start);
+        if (map->base == (char*)MAP_FAILED) error = IcsErr_FWriteIds;
+    }
+        /* The mapping stays valid after closing the file */
+    close(fd);
+    if (error) return error;
+#endif
+    *data = map->base + skip;
+
+    return error;
+}
+
+
+/* Write the header and create the data file at its final size, and return a
+   pointer to the data in the file. */
+Ics_Error IcsMapData(ICS        *ics,
+                     void      **data,
+                     ptrdiff_t  *strides)
+{
+    ICSINIT;
+    Ics_DataMap  *map;
+    FILE         *fp;
+    char          filename[ICS_MAXPATHLEN];
+    ics_t_sint64  offset = 0;
+    size_t        size;
+    int           i;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+    if (data == NULL) return IcsErr_IllParameter;
+
+    if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->data != NULL) return IcsErr_DuplicateData;
+    if (ics->dataSource != NULL) return IcsErr_DuplicateData;
+    if (ics->frameWriter != NULL) return IcsErr_DuplicateData;
+    if (ics->dimensions == 0) return IcsErr_NoLayout;
+        /* The data must be stored as it is in memory */
+    if ((ics->compression != IcsCompr_uncompressed) ||
+        (ics->deltaDim >= 0) || (ics->dedupStore[0] != '\0') ||
+        (ics->chunkStore[0] != '\0')) {
+        return IcsErr_NotValidAction;
+    }
+    size = IcsGetDataSize(ics);
+    if (size == 0) return IcsErr_MissingData;
+
+    error = IcsWriteIcs(ics, NULL);
+    if (error) return error;
+    if (ics->version == 1) {
+            /* A new, empty IDS file */
+        IcsGetIdsName(filename, ics->filename);
+        fp = IcsFOpen(filename, "wb");
+        if (fp == NULL) return IcsErr_FOpenIds;
+    } else {
+            /* The data follows the header */
+        error = IcsGetOutputName(filename, ics);
+        if (error) return error;
+        fp = IcsFOpen(filename, "ab");
+        if (fp == NULL) return IcsErr_FOpenIds;
+        if (IcsFSeek(fp, 0, SEEK_END) != 0) error = IcsErr_FReadIds;
+        if (!error) offset = IcsFTell(fp);
+        if (offset < 0) error = IcsErr_FReadIds;
+    }
+    if (fclose(fp) == EOF) {
+        if (!error) error = IcsErr_FCloseIds;
+    }
+    if (error) return error;
+
+    map = (Ics_DataMap*)malloc(sizeof(Ics_DataMap));
+    if (map == NULL) return IcsErr_Alloc;
+    error = icsMapFile(filename, (ics_t_uint64)offset, size, map, data);
+    if (error) {
+        free(map);
+        return error;
+    }
+    ics->dataMap = map;
+    ics->data = *data;
+    ics->dataLength = size;
+    ics->dataStrides = NULL;
+
+    if (strides != NULL) {
+        strides[0] = 1;
+        for (i = 1; i < ics->dimensions; i++) {
+            strides[i] = strides[i - 1] * (ptrdiff_t)ics->dim[i - 1].size;
+        }
+    }
+
+    return error;
+}
+
+
+/* Write the memory-mapped data to disk and remove the map. */
+Ics_Error IcsUnmapData(ICS *ics)
+{
+    ICSINIT;
+    Ics_DataMap *map = (Ics_DataMap*)ics->dataMap;
+
+
+    if (map == NULL) return IcsErr_Ok;
+#if defined(_WIN32)
+    if (!FlushViewOfFile(map->base, 0)) error = IcsErr_FWriteIds;
+    if (!UnmapViewOfFile(map->base) && !error) error = IcsErr_FCloseIds;
+    CloseHandle(map->map);
+    if (!FlushFileBuffers(map->file) && !error) error = IcsErr_FWriteIds;
+    if (!CloseHandle(map->file) && !error) error = IcsErr_FCloseIds;
+#else
+    if (msync(map->base, map->length, MS_SYNC) != 0) error = IcsErr_FWriteIds;
+    if ((munmap(map->base, map->length) != 0) && !error) {
+        error = IcsErr_FCloseIds;
+    }
+#endif
+    free(map);
+    ics->dataMap = NULL;
+    ics->data = NULL;
+    ics->dataLength = 0;
+
+    return error;
+}
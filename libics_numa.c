@@ -0,0 +1,331 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * FILE : libics_numa.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsGetNumaNodes()
+ *   IcsGetDataPartitioned()
+ *
+ * Reading the image data such that its pages are spread over the NUMA nodes
+ * of the machine. Memory pages are placed on the node of the thread that
+ * first writes to them, so the destination is split into partitions, and each
+ * partition is first touched by a worker of its own, optionally bound to the
+ * node the partition is meant for. Uncompressed data is then also read by
+ * these workers, each through its own file handle; other data is read as
+ * usual, into pages that are already placed.
+ *
+ * The NUMA topology is read from /sys/devices/system/node on Linux, and
+ * obtained from the system on Windows. Elsewhere the machine is taken to have
+ * a single node, and workers are not bound.
+ */
+
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* for sched_setaffinity() */
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics_intern.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#endif
+
+
+#define ICS_MAX_NODES 64
+
+
+/* The affinity of a thread before it was bound to a node. */
+typedef struct {
+    int            bound;
+#if defined(__linux__)
+    cpu_set_t      cpus;
+#elif defined(_WIN32) && (_WIN32_WINNT >= 0x0601)
+    GROUP_AFFINITY cpus;
+#endif
+} Ics_NodeBinding;
+
+
+/* What the workers filling the partitions need to know. */
+typedef struct {
+    Ics_Header *icsStruct;
+    char       *dest;
+    size_t     *bounds;   /* partition i is dest[bounds[i]] to dest[bounds[i+1]] */
+    size_t      nParts;
+    int         nNodes;
+    int         bind;     /* bind the workers to the nodes */
+    int         read;     /* the workers read the data as well */
+    size_t      pageSize;
+} Ics_Partitions;
+
+
+static size_t icsPageSize(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+
+
+    GetSystemInfo(&info);
+    return (size_t)info.dwPageSize;
+#else
+    long size = sysconf(_SC_PAGESIZE);
+
+
+    return size > 0 ? (size_t)size : 4096;
+#endif
+}
+
+
+#if defined(__linux__)
+/* Read the list of CPUs of a node, as in "0-7,16-23". */
+static int icsNodeCpus(int        node,
+                       cpu_set_t *cpus)
+{
+    FILE         *fp;
+    char          path[64];
+    char          list[1024];
+    char         *p;
+    unsigned long first, last;
+
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    fp = fopen(path, "r");
+    if (fp == NULL) return 0;
+    p = fgets(list, sizeof(list), fp);
+    fclose(fp);
+    if (p == NULL) return 0;
+
+    CPU_ZERO(cpus);
+    while ((*p >= '0') && (*p <= '9')) {
+        first = last = strtoul(p, &p, 10);
+        if (*p == '-') last = strtoul(p + 1, &p, 10);
+        for (; (first <= last) && (first < CPU_SETSIZE); first++) {
+            CPU_SET(first, cpus);
+        }
+        if (*p == ',') p++;
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+#endif
+
+
+/* Bind the calling thread to the CPUs of a node. */
+static void icsBindToNode(int              node,
+                          Ics_NodeBinding *saved)
+{
+    saved->bound = 0;
+#if defined(__linux__)
+    {
+        cpu_set_t cpus;
+
+
+        if (!icsNodeCpus(node, &cpus)) return;
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &saved->cpus) != 0) return;
+        saved->bound = sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == 0;
+    }
+#elif defined(_WIN32) && (_WIN32_WINNT >= 0x0601)
+    {
+        GROUP_AFFINITY cpus;
+
+
+        memset(&cpus, 0, sizeof(cpus));
+        if (!GetNumaNodeProcessorMaskEx((USHORT)node, &cpus)) return;
+        saved->bound = SetThreadGroupAffinity(GetCurrentThread(), &cpus,
+                                              &saved->cpus) != 0;
+    }
+#else
+    (void)node;
+#endif
+}
+
+
+/* Undo icsBindToNode(). */
+static void icsUnbind(Ics_NodeBinding *saved)
+{
+    if (!saved->bound) return;
+#if defined(__linux__)
+    sched_setaffinity(0, sizeof(cpu_set_t), &saved->cpus);
+#elif defined(_WIN32) && (_WIN32_WINNT >= 0x0601)
+    SetThreadGroupAffinity(GetCurrentThread(), &saved->cpus, NULL);
+#endif
+}
+
+
+/* Returns the number of NUMA nodes of the machine. */
+int IcsGetNumaNodes(void)
+{
+#if defined(__linux__)
+    char path[64];
+    int  n;
+
+
+    for (n = 0; n < ICS_MAX_NODES; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+        if (access(path, F_OK) != 0) break;
+    }
+    return n > 0 ? n : 1;
+#elif defined(_WIN32)
+    ULONG highest;
+
+
+    if (!GetNumaHighestNodeNumber(&highest)) return 1;
+    return highest < ICS_MAX_NODES ? (int)highest + 1 : ICS_MAX_NODES;
+#else
+    return 1;
+#endif
+}
+
+
+/* Touch the pages of partition i, and read its data if the workers do. */
+static Ics_Error icsFillPartition(void   *data,
+                                  size_t  i)
+{
+    ICSINIT;
+    Ics_Partitions  *parts = (Ics_Partitions*)data;
+    char            *start = parts->dest + parts->bounds[i];
+    size_t           n     = parts->bounds[i + 1] - parts->bounds[i];
+    size_t           j;
+    Ics_NodeBinding  saved;
+
+
+    if (n == 0) return IcsErr_Ok;
+    saved.bound = 0;
+    if (parts->bind) {
+        icsBindToNode((int)(i * (size_t)parts->nNodes / parts->nParts),
+                      &saved);
+    }
+    if (parts->read) {
+        error = IcsReadIdsRange(parts->icsStruct, parts->bounds[i], start, n);
+    } else {
+        for (j = 0; j < n; j += parts->pageSize) {
+            start[j] = 0;
+        }
+        start[n - 1] = 0;
+    }
+    icsUnbind(&saved);
+
+    return error;
+}
+
+
+/* Read the image data from an ICS file, such that the pages of each partition
+   of dest are placed on the NUMA node of the worker that fills it. */
+Ics_Error IcsGetDataPartitioned(ICS          *ics,
+                                void         *dest,
+                                size_t        n,
+                                const size_t *partSizes,
+                                size_t        nParts,
+                                int           bindNodes)
+{
+    ICSINIT;
+    Ics_Partitions  parts;
+    Ics_BlockRead  *br;
+    size_t          i, pos, offset;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if ((n == 0) || (dest == NULL)) return IcsErr_Ok;
+    parts.nNodes = IcsGetNumaNodes();
+    if (nParts == 0) {
+        if (partSizes != NULL) return IcsErr_IllParameter;
+        nParts = (size_t)parts.nNodes;
+    }
+    parts.bounds = (size_t*)malloc((nParts + 1) * sizeof(size_t));
+    if (parts.bounds == NULL) return IcsErr_Alloc;
+    parts.pageSize = icsPageSize();
+
+        /* The partitions are either given, or an even split on page
+           boundaries */
+    parts.bounds[0] = 0;
+    offset = (size_t)dest % parts.pageSize;
+    for (i = 1; i <= nParts; i++) {
+        if (partSizes != NULL) {
+            pos = parts.bounds[i - 1] + partSizes[i - 1];
+            if ((pos < parts.bounds[i - 1]) || (pos > n)) {
+                error = IcsErr_IllParameter;
+                goto exit;
+            }
+        } else {
+            pos = (n / nParts) * i + (n % nParts) * i / nParts + offset;
+            pos = (pos + parts.pageSize / 2) / parts.pageSize * parts.pageSize;
+            pos = pos > offset ? pos - offset : 0;
+            if (pos < parts.bounds[i - 1]) pos = parts.bounds[i - 1];
+            if ((pos > n) || (i == nParts)) pos = n;
+        }
+        parts.bounds[i] = pos;
+    }
+    if (parts.bounds[nParts] != n) {
+        error = IcsErr_IllParameter;
+        goto exit;
+    }
+
+    error = IcsOpenIds(ics);
+    if (error) goto exit;
+    br = (Ics_BlockRead*)ics->blockRead;
+    parts.icsStruct = ics;
+    parts.dest = (char*)dest;
+    parts.nParts = nParts;
+    parts.bind = bindNodes && (parts.nNodes > 1);
+    parts.read = (ics->compression == IcsCompr_uncompressed)
+              && (br->dedup == NULL) && (br->chunks == NULL)
+              && (br->delta == NULL);
+    error = IcsParallelFor((Ics_Context*)ics->context, nParts,
+                           icsFillPartition, &parts);
+    if (!error && !parts.read) {
+            /* The data is read in order, into the placed pages */
+        error = IcsReadIdsBlock(ics, dest, n);
+    }
+    if (!error) {
+        error = IcsCloseIds(ics);
+    } else {
+        IcsCloseIds(ics);
+    }
+
+  exit:
+    free(parts.bounds);
+    return error;
+}
@@ -35,15 +35,53 @@
  * The following library functions are contained in this file:
  *
  *   IcsLoadPreview()
+ *   IcsLoadThumbnails()
  *   IcsGetPreviewData()
+ *   IcsGetPreviewPlanes()
+ *   IcsGetThumbnailData()
+ *   IcsGetBinnedROIData()
+ *
+ * Thumbnails are made from a subset of the image lines: a line step is chosen
+ * such that about two lines are read for each line of the thumbnail, and only
+ * those lines are read from the file. The lines are summed with the vectorized
+ * kernels of libics_cpu.c and averaged over the area of each thumbnail pixel.
+ *
+ * Previews of all planes are made in a single pass through the file: each
+ * plane is read, skipping the planes in between, and scaled to its own range.
+ * For a common scaling the range of each plane is kept, and the planes are
+ * rescaled with a lookup table once the global range is known.
+ *
+ * Binned reads stream through all lines of the region once. Each line is
+ * reduced along the first dimension into a plane of bins held as doubles;
+ * when the last line of a bin along the last dimension has been read, the
+ * plane is written out and reset.
  */
 
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "libics_intern.h"
 
 
+/* For the mean of uint8 and uint16 data, this many consecutive lines of the
+   same bin are summed with the vectorized kernels in float before they are
+   added to the plane of bins. 256 lines of uint16 data sum to less than 2^24,
+   so the float sums are exact. */
+#define ICS_BIN_FLOAT_LINES 256
+
+
+/* State shared by the workers of IcsLoadThumbnails(). */
+typedef struct {
+    const char *const *filenames;
+    size_t             planeNumber;
+    size_t             width;
+    size_t             height;
+    Ics_ThumbnailFunc  func;
+    void              *userData;
+} Ics_ThumbnailBatch;
+
+
 /* Read a plane out of an ICS file. The buffer is malloc'd, xsize and ysize are
    set to the image size. The data type is always uint8. You need to free() the
    data block when you're done. */
@@ -85,6 +123,226 @@ Ics_Error IcsLoadPreview(const char  *filename,
 }
 
 
+/* Make the thumbnail of file i of the batch and pass it on. */
+static Ics_Error icsMakeThumbnail(void   *data,
+                                  size_t  i)
+{
+    ICSINIT;
+    Ics_ThumbnailBatch *batch = (Ics_ThumbnailBatch*)data;
+    ICS                *ics;
+    unsigned char      *buf;
+    int                 valid;
+
+
+    buf = malloc(batch->width * batch->height);
+    if (buf == NULL) return IcsErr_Alloc;
+    error = IcsOpen(&ics, batch->filenames[i], "r");
+    if (!error) {
+        error = IcsGetThumbnailData(ics, buf, batch->width, batch->height,
+                                    batch->planeNumber);
+        if (error)
+            IcsClose(ics);
+        else
+            error = IcsClose(ics);
+    }
+    valid = (error == IcsErr_Ok) || (error == IcsErr_FSizeConflict);
+    error = batch->func(batch->userData, i, error, valid ? buf : NULL);
+    free(buf);
+    return error;
+}
+
+
+/* Make thumbnails of one plane of each of n files, and pass them to func. */
+Ics_Error IcsLoadThumbnails(const char *const *filenames,
+                            size_t             n,
+                            size_t             planeNumber,
+                            size_t             width,
+                            size_t             height,
+                            Ics_ThumbnailFunc  func,
+                            void              *userData)
+{
+    Ics_ThumbnailBatch batch;
+
+
+    if ((filenames == NULL) || (func == NULL) || (width == 0) || (height == 0))
+        return IcsErr_IllParameter;
+    batch.filenames = filenames;
+    batch.planeNumber = planeNumber;
+    batch.width = width;
+    batch.height = height;
+    batch.func = func;
+    batch.userData = userData;
+    return IcsParallelFor(NULL, n, icsMakeThumbnail, &batch);
+}
+
+
+/* Convert n samples to double. Complex samples take two values. */
+static void icsLineToDouble(double       *dest,
+                            const void   *src,
+                            Ics_DataType  dataType,
+                            size_t        n)
+{
+    size_t i;
+
+
+    switch (dataType) {
+        case Ics_uint8:
+        {
+            const ics_t_uint8 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_sint8:
+        {
+            const ics_t_sint8 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_uint16:
+        {
+            const ics_t_uint16 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_sint16:
+        {
+            const ics_t_sint16 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_uint32:
+        {
+            const ics_t_uint32 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_sint32:
+        {
+            const ics_t_sint32 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_real32:
+        case Ics_complex32:
+        {
+            const ics_t_real32 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_real64:
+        case Ics_complex64:
+            memcpy(dest, src, n * sizeof(double));
+            break;
+        default:
+            break;
+    }
+}
+
+
+/* Convert a line of n samples to double. Complex samples are converted to
+   their magnitude; line must hold 2 * n values for them. */
+static void icsPreviewLine(double       *line,
+                           const void   *src,
+                           Ics_DataType  dataType,
+                           size_t        n)
+{
+    size_t i;
+
+
+    if ((dataType == Ics_complex32) || (dataType == Ics_complex64)) {
+        icsLineToDouble(line, src, dataType, 2 * n);
+        for (i = 0; i < n; i++) {
+            line[i] = sqrt(line[2 * i] * line[2 * i] +
+                           line[2 * i + 1] * line[2 * i + 1]);
+        }
+    } else {
+        icsLineToDouble(line, src, dataType, n);
+    }
+}
+
+
+/* Convert a plane to uint8 as IcsGetPreviewData() does, reading it line by
+   line twice instead of holding it in memory: once for its range, once to
+   scale it. The data stream must be open at the start of the data. */
+static Ics_Error icsPreviewStreamed(ICS    *ics,
+                                    void   *dest,
+                                    size_t  planeNumber)
+{
+    ICSINIT;
+    Ics_DataType   dt      = ics->imel.dataType;
+    int            complex = (dt == Ics_complex32) || (dt == Ics_complex64);
+    size_t         xs      = ics->dim[0].size;
+    size_t         ys      = ics->dim[1].size;
+    size_t         lineSize, x, y;
+    double         min     = 0.0, max = 0.0, gain = 0.0;
+    double        *line;
+    char          *buf;
+    unsigned char *out;
+    int            pass;
+
+
+    lineSize = xs * (size_t)IcsGetBytesPerSample(ics);
+    buf = (char*)IcsGetScratch(ics, lineSize);
+    line = (double*)IcsGetScratch(ics, 2 * xs * sizeof(double));
+    if ((buf == NULL) || (line == NULL)) {
+        IcsCloseIds(ics);
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            error = IcsCloseIds(ics);
+            if (!error) error = IcsOpenIds(ics);
+            if (error) goto exit;
+        }
+        if (planeNumber > 0) {
+            error = IcsSkipIdsBlock(ics, planeNumber * ys * lineSize);
+        }
+        out = (unsigned char*)dest;
+        for (y = 0; !error && (y < ys); y++, out += xs) {
+            error = IcsReadIdsBlock(ics, buf, lineSize);
+            if (error) break;
+            if (complex) {
+                    /* The same modulus as for the plane held in memory */
+                icsLineToDouble(line, buf, dt, 2 * xs);
+                for (x = 0; x < xs; x++) {
+                    line[x] = line[2 * x] * line[2 * x]
+                        * line[2 * x + 1] * line[2 * x + 1];
+                }
+            } else {
+                icsLineToDouble(line, buf, dt, xs);
+            }
+            for (x = 0; x < xs; x++) {
+                if (pass == 0) {
+                    if ((y == 0) && (x == 0)) min = max = line[0];
+                    if (max < line[x]) max = line[x];
+                    if (min > line[x]) min = line[x];
+                } else {
+                    out[x] = (unsigned char)((line[x] - min) * gain);
+                }
+            }
+        }
+        if (error) break;
+        if (pass == 0) {
+            if (complex) {
+                min = sqrt(min);
+                max = sqrt(max);
+            }
+            gain = 255.0 / (max - min);
+        }
+    }
+    if (error)
+        IcsCloseIds(ics);
+    else
+        error = IcsCloseIds(ics);
+
+  exit:
+    IcsReleaseScratch(ics, buf);
+    IcsReleaseScratch(ics, line);
+    return error;
+}
+
+
 /* Read a plane of the actual image data from an ICS file, and convert it to
    uint8. */
 Ics_Error IcsGetPreviewData(ICS    *ics,
@@ -120,8 +378,15 @@ Ics_Error IcsGetPreviewData(ICS    *ics,
     }
     bps = (size_t)IcsGetBytesPerSample(ics);
     if (bps > 1) {
-        buf = malloc (roiSize * bps);
-        if (buf == NULL) return IcsErr_Alloc;
+        buf = IcsGetScratch(ics, roiSize * bps);
+        if (buf == NULL) {
+                /* Over the memory limit, convert the plane line by line */
+            error = icsPreviewStreamed(ics, dest, planeNumber);
+            if ((error == IcsErr_Ok) && sizeConflict) {
+                error = IcsErr_OutputNotFilled;
+            }
+            return error;
+        }
     }
     else {
         buf = dest;
@@ -135,7 +400,7 @@ Ics_Error IcsGetPreviewData(ICS    *ics,
         error != IcsErr_FSizeConflict &&
         error != IcsErr_OutputNotFilled) {
         if (bps > 1) {
-            free (buf);
+            IcsReleaseScratch(ics, buf);
         }
         return error;
     }
@@ -146,14 +411,9 @@ Ics_Error IcsGetPreviewData(ICS    *ics,
             ics_t_uint8 *out = dest;
             int          offset;
             double       gain;
-            int          max = *in, min = *in;
+            ics_t_uint8  max, min;
 
-            in++;
-            for (i = 1; i < roiSize; i++, in++) {
-                if (max < *in) max = *in;
-                if (min > *in) min = *in;
-            }
-            in = buf;
+            IcsGetKernels()->minMaxUint8(in, roiSize, &min, &max);
             offset = min;
             gain = 255.0 / (max - min);
             for (i = 0; i < roiSize; i++, in++, out++) {
@@ -188,14 +448,9 @@ Ics_Error IcsGetPreviewData(ICS    *ics,
             ics_t_uint8  *out = dest;
             int           offset;
             double        gain;
-            int           max = *in, min = *in;
+            ics_t_uint16  max, min;
 
-            in++;
-            for (i = 1; i < roiSize; i++, in++) {
-                if (max < *in) max = *in;
-                if (min > *in) min = *in;
-            }
-            in = buf;
+            IcsGetKernels()->minMaxUint16(in, roiSize, &min, &max);
             offset = min;
             gain = 255.0 / (max - min);
             for (i = 0; i < roiSize; i++, in++, out++) {
@@ -373,10 +628,13 @@ Ics_Error IcsGetPreviewData(ICS    *ics,
         }
         break;
         default:
+            if (bps > 1) {
+                IcsReleaseScratch(ics, buf);
+            }
             return IcsErr_UnknownDataType;
     }
     if (bps > 1) {
-        free (buf);
+        IcsReleaseScratch(ics, buf);
     }
 
     if ((error == IcsErr_Ok) && sizeConflict) {
@@ -384,3 +642,717 @@ Ics_Error IcsGetPreviewData(ICS    *ics,
     }
     return error;
 }
+
+
+/* Read every planeStep-th plane of the image data in one pass, and convert
+   them to uint8 in a montage of columns planes wide. */
+Ics_Error IcsGetPreviewPlanes(ICS    *ics,
+                              void   *dest,
+                              size_t  n,
+                              size_t  planeStep,
+                              size_t  columns,
+                              int     globalScale)
+{
+    ICSINIT;
+    size_t         xs, ys, nPlanes, nOut, rows, width, bps, lineSize, planeSize;
+    size_t         k, x, y, v;
+    double        *line  = NULL;
+    double        *range = NULL;
+    double         min, max, gain, value;
+    char          *buf   = NULL;
+    unsigned char *out;
+    unsigned char  lut[256];
+    int            j, sizeConflict = 0;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+    if (ics->dimensions < 2) return IcsErr_NotValidAction;
+
+    if ((n == 0) || (dest == NULL)) return IcsErr_Ok;
+    if (planeStep == 0) planeStep = 1;
+    if (columns == 0) columns = 1;
+    xs = ics->dim[0].size;
+    ys = ics->dim[1].size;
+    nPlanes = 1;
+    for (j = 2; j < ics->dimensions; j++) {
+        nPlanes *= ics->dim[j].size;
+    }
+    nOut = (nPlanes + planeStep - 1) / planeStep;
+    rows = (nOut + columns - 1) / columns;
+    width = columns * xs;
+    if (n != width * ys * rows) {
+        sizeConflict = 1;
+        if (n < width * ys * rows) return IcsErr_BufferTooSmall;
+    }
+    bps = (size_t)IcsGetBytesPerSample(ics);
+    lineSize = xs * bps;
+    planeSize = ys * lineSize;
+    switch (ics->imel.dataType) {
+        case Ics_uint8:
+        case Ics_sint8:
+        case Ics_uint16:
+        case Ics_sint16:
+        case Ics_uint32:
+        case Ics_sint32:
+        case Ics_real32:
+        case Ics_real64:
+        case Ics_complex32:
+        case Ics_complex64:
+            break;
+        default:
+            return IcsErr_UnknownDataType;
+    }
+
+    buf = (char*)IcsGetScratch(ics, planeSize);
+    line = (double*)IcsGetScratch(ics, 2 * xs * sizeof(double));
+    range = (double*)IcsGetScratch(ics, 2 * nOut * sizeof(double));
+    if ((buf == NULL) || (line == NULL) || (range == NULL)) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+        /* The cells of the montage without plane stay black */
+    memset(dest, 0, width * ys * rows);
+
+    if (ics->blockRead != NULL) {
+        error = IcsCloseIds(ics);
+        if (error) goto exit;
+    }
+    error = IcsOpenIds(ics);
+    if (error) goto exit;
+    for (k = 0; k < nOut; k++) {
+        if ((k > 0) && (planeStep > 1)) {
+            error = IcsSkipIdsBlock(ics, (planeStep - 1) * planeSize);
+            if (error) break;
+        }
+        error = IcsReadIdsBlock(ics, buf, planeSize);
+        if (error) break;
+
+            /* The range of the plane */
+        min = max = 0.0;
+        for (y = 0; y < ys; y++) {
+            icsPreviewLine(line, buf + y * lineSize, ics->imel.dataType, xs);
+            if (y == 0) min = max = line[0];
+            for (x = 0; x < xs; x++) {
+                if (min > line[x]) min = line[x];
+                if (max < line[x]) max = line[x];
+            }
+        }
+        range[2 * k] = min;
+        range[2 * k + 1] = max;
+
+            /* The plane, scaled to its range */
+        gain = max > min ? 255.0 / (max - min) : 0.0;
+        out = (unsigned char*)dest + (k / columns) * ys * width +
+            (k % columns) * xs;
+        for (y = 0; y < ys; y++, out += width) {
+            icsPreviewLine(line, buf + y * lineSize, ics->imel.dataType, xs);
+            for (x = 0; x < xs; x++) {
+                out[x] = (unsigned char)((line[x] - min) * gain);
+            }
+        }
+    }
+    if (error) {
+        IcsCloseIds(ics);
+        goto exit;
+    }
+    error = IcsCloseIds(ics);
+    if (error) goto exit;
+
+    if (globalScale && (nOut > 0)) {
+            /* Map each plane from its own range to the global one */
+        min = range[0];
+        max = range[1];
+        for (k = 1; k < nOut; k++) {
+            if (min > range[2 * k]) min = range[2 * k];
+            if (max < range[2 * k + 1]) max = range[2 * k + 1];
+        }
+        gain = max > min ? 255.0 / (max - min) : 0.0;
+        for (k = 0; k < nOut; k++) {
+            for (v = 0; v < 256; v++) {
+                value = range[2 * k] +
+                    (double)v * (range[2 * k + 1] - range[2 * k]) / 255.0;
+                value = (value - min) * gain + 0.5;
+                lut[v] = (unsigned char)(value > 255.0 ? 255.0 : value);
+            }
+            out = (unsigned char*)dest + (k / columns) * ys * width +
+                (k % columns) * xs;
+            for (y = 0; y < ys; y++, out += width) {
+                for (x = 0; x < xs; x++) {
+                    out[x] = lut[out[x]];
+                }
+            }
+        }
+    }
+    if (sizeConflict) error = IcsErr_OutputNotFilled;
+
+  exit:
+    IcsReleaseScratch(ics, buf);
+    IcsReleaseScratch(ics, line);
+    IcsReleaseScratch(ics, range);
+    return error;
+}
+
+
+/* Convert n samples to float and add them to acc. Complex samples contribute
+   their magnitude. */
+static void icsAccumulateLine(float        *acc,
+                              const void   *src,
+                              Ics_DataType  dataType,
+                              size_t        n)
+{
+    size_t i;
+
+
+    switch (dataType) {
+        case Ics_uint8:
+            IcsGetKernels()->accumulateUint8(acc, src, n);
+            break;
+        case Ics_sint8:
+        {
+            const ics_t_sint8 *in = src;
+            for (i = 0; i < n; i++) acc[i] += (float)in[i];
+        }
+        break;
+        case Ics_uint16:
+            IcsGetKernels()->accumulateUint16(acc, src, n);
+            break;
+        case Ics_sint16:
+        {
+            const ics_t_sint16 *in = src;
+            for (i = 0; i < n; i++) acc[i] += (float)in[i];
+        }
+        break;
+        case Ics_uint32:
+        {
+            const ics_t_uint32 *in = src;
+            for (i = 0; i < n; i++) acc[i] += (float)in[i];
+        }
+        break;
+        case Ics_sint32:
+        {
+            const ics_t_sint32 *in = src;
+            for (i = 0; i < n; i++) acc[i] += (float)in[i];
+        }
+        break;
+        case Ics_real32:
+        {
+            const ics_t_real32 *in = src;
+            for (i = 0; i < n; i++) acc[i] += in[i];
+        }
+        break;
+        case Ics_real64:
+        {
+            const ics_t_real64 *in = src;
+            for (i = 0; i < n; i++) acc[i] += (float)in[i];
+        }
+        break;
+        case Ics_complex32:
+        {
+            const ics_t_real32 *in = src;
+            for (i = 0; i < n; i++, in += 2) {
+                acc[i] += (float)sqrt(in[0] * in[0] + in[1] * in[1]);
+            }
+        }
+        break;
+        case Ics_complex64:
+        {
+            const ics_t_real64 *in = src;
+            for (i = 0; i < n; i++, in += 2) {
+                acc[i] += (float)sqrt(in[0] * in[0] + in[1] * in[1]);
+            }
+        }
+        break;
+        default:
+            break;
+    }
+}
+
+
+/* Read a plane of the image data from an ICS file, scaled down to width x
+   height pixels and converted to uint8. */
+Ics_Error IcsGetThumbnailData(ICS    *ics,
+                              void   *dest,
+                              size_t  width,
+                              size_t  height,
+                              size_t  planeNumber)
+{
+    ICSINIT;
+    size_t         offset[ICS_MAXDIM], size[ICS_MAXDIM], sampling[ICS_MAXDIM];
+    size_t         xs, ys, tw, th, step, nLines, bps, lineSize, plane;
+    size_t         x, y, i, x0, x1, r0, r1, curLoc, newLoc, loaded;
+    size_t        *col;
+    double         scale, sum, min, max, gain;
+    float         *acc, *thumb, *t;
+    char          *buf, *src;
+    unsigned char *out;
+    int            j, sizeConflict = 0, streamed;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if ((dest == NULL) || (width == 0) || (height == 0)) return IcsErr_Ok;
+    if ((ics->imel.dataType == Ics_unknown) ||
+        (ics->imel.dataType > Ics_complex64))
+        return IcsErr_UnknownDataType;
+    plane = planeNumber;
+    for (j = 0; j < ics->dimensions; j++) {
+        if (ics->dim[j].size == 0) return IcsErr_IllegalROI;
+        offset[j] = 0;
+        size[j] = ics->dim[j].size;
+        sampling[j] = 1;
+        if (j >= 2) {
+            offset[j] = plane % size[j];
+            plane /= size[j];
+            size[j] = 1;
+        }
+    }
+    if (plane > 0) return IcsErr_IllegalROI;
+    xs = ics->dim[0].size;
+    ys = ics->dimensions > 1 ? ics->dim[1].size : 1;
+
+        /* Fit the image in the thumbnail, keeping the aspect ratio */
+    scale = (double)xs / (double)width;
+    if (scale < (double)ys / (double)height) {
+        scale = (double)ys / (double)height;
+    }
+    tw = (size_t)((double)xs / scale + 0.5);
+    th = (size_t)((double)ys / scale + 0.5);
+    if (tw < 1) tw = 1;
+    if (tw > width) tw = width;
+    if (th < 1) th = 1;
+    if (th > height) th = height;
+
+        /* Read every step-th line of the plane */
+    step = ys / (2 * th);
+    if (step < 1) step = 1;
+    if (ics->dimensions > 1) sampling[1] = step;
+    nLines = (ys + step - 1) / step;
+    bps = (size_t)IcsGetBytesPerSample(ics);
+    lineSize = xs * bps;
+    buf = IcsGetScratch(ics, nLines * lineSize);
+    streamed = buf == NULL;
+    if (streamed) {
+            /* Over the memory limit, read the lines one at a time */
+        buf = IcsGetScratch(ics, lineSize);
+    }
+    acc = IcsGetScratch(ics, xs * sizeof(float));
+    thumb = IcsGetScratch(ics, tw * th * sizeof(float));
+    col = IcsGetScratch(ics, (tw + 1) * sizeof(size_t));
+    if ((buf == NULL) || (acc == NULL) || (thumb == NULL) || (col == NULL)) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+    if (ics->blockRead != NULL) {
+        error = IcsCloseIds(ics);
+        if (error) goto exit;
+    }
+    if (streamed) {
+        error = IcsOpenIds(ics);
+        if (error) goto exit;
+    } else {
+        error = IcsGetROIData(ics, offset, size, sampling, buf,
+                              nLines * lineSize);
+        if (error != IcsErr_Ok &&
+            error != IcsErr_FSizeConflict &&
+            error != IcsErr_OutputNotFilled) {
+            goto exit;
+        }
+        sizeConflict = error == IcsErr_FSizeConflict;
+        error = IcsErr_Ok;
+    }
+
+        /* Average the area covered by each thumbnail pixel: sum lines first,
+           then columns */
+    for (x = 0; x <= tw; x++) {
+        col[x] = x * xs / tw;
+    }
+    t = thumb;
+    curLoc = 0;
+    loaded = nLines;
+    for (y = 0; y < th; y++) {
+        r0 = y * nLines / th;
+        r1 = (y + 1) * nLines / th;
+        if (r1 <= r0) r1 = r0 + 1;
+        memset(acc, 0, xs * sizeof(float));
+        for (i = r0; i < r1; i++) {
+            src = buf + i * lineSize;
+            if (streamed) {
+                    /* Lines are needed in order, some of them twice */
+                src = buf;
+                if (i != loaded) {
+                    newLoc = (planeNumber * ys + i * step) * lineSize;
+                    if (curLoc < newLoc) {
+                        error = IcsSkipIdsBlock(ics, newLoc - curLoc);
+                        curLoc = newLoc;
+                    }
+                    if (!error) error = IcsReadIdsBlock(ics, buf, lineSize);
+                    if (error) break;
+                    curLoc += lineSize;
+                    loaded = i;
+                }
+            }
+            icsAccumulateLine(acc, src, ics->imel.dataType, xs);
+        }
+        if (error) break;
+        for (x = 0; x < tw; x++, t++) {
+            x0 = col[x];
+            x1 = col[x + 1] > x0 ? col[x + 1] : x0 + 1;
+            sum = 0.0;
+            for (i = x0; i < x1; i++) {
+                sum += acc[i];
+            }
+            *t = (float)(sum / (double)((x1 - x0) * (r1 - r0)));
+        }
+    }
+    if (error) goto exit;
+
+        /* Stretch to uint8 */
+    min = max = thumb[0];
+    for (i = 1; i < tw * th; i++) {
+        if (min > thumb[i]) min = thumb[i];
+        if (max < thumb[i]) max = thumb[i];
+    }
+    gain = max > min ? 255.0 / (max - min) : 0.0;
+    memset(dest, 0, width * height);
+    out = (unsigned char*)dest + (height - th) / 2 * width + (width - tw) / 2;
+    t = thumb;
+    for (y = 0; y < th; y++, out += width) {
+        for (x = 0; x < tw; x++, t++) {
+            out[x] = (unsigned char)((*t - min) * gain + 0.5);
+        }
+    }
+    error = sizeConflict ? IcsErr_FSizeConflict : IcsErr_Ok;
+
+  exit:
+    if (streamed && (ics->blockRead != NULL)) {
+        if (error)
+            IcsCloseIds(ics);
+        else
+            error = IcsCloseIds(ics);
+    }
+    IcsReleaseScratch(ics, buf);
+    IcsReleaseScratch(ics, acc);
+    IcsReleaseScratch(ics, thumb);
+    IcsReleaseScratch(ics, col);
+    return error;
+}
+
+
+/* Reduce a line of n pixels of nc values each into bins of bin pixels, and
+   combine the result with the n/bin bins in dest. */
+static void icsBinLine(double       *dest,
+                       const double *line,
+                       size_t        n,
+                       size_t        nc,
+                       size_t        bin,
+                       Ics_BinMode   mode)
+{
+    size_t i, end, k;
+
+
+    n *= nc;
+    bin *= nc;
+    for (i = 0; i < n; i = end, dest += nc) {
+        end = i + bin < n ? i + bin : n;
+        switch (mode) {
+            case IcsBin_mean:
+                for (k = i; k < end; k++) dest[(k - i) % nc] += line[k];
+                break;
+            case IcsBin_max:
+                for (k = i; k < end; k++) {
+                    if (dest[(k - i) % nc] < line[k]) {
+                        dest[(k - i) % nc] = line[k];
+                    }
+                }
+                break;
+            case IcsBin_min:
+                for (k = i; k < end; k++) {
+                    if (dest[(k - i) % nc] > line[k]) {
+                        dest[(k - i) % nc] = line[k];
+                    }
+                }
+                break;
+        }
+    }
+}
+
+
+/* Write a plane of bins to dest, in the data type of the image. The plane has
+   nDims dimensions of out[i] bins; for the mean, each value is divided by the
+   number of samples in its bin, which is smaller at the end of a dimension
+   that is not a multiple of the bin size. weight is the number of lines in the
+   bin along the remaining dimension. */
+static void icsStoreBins(void         *dest,
+                         const double *plane,
+                         Ics_DataType  dataType,
+                         size_t        nc,
+                         Ics_BinMode   mode,
+                         int           nDims,
+                         const size_t *size,
+                         const size_t *bin,
+                         const size_t *out,
+                         double        weight)
+{
+    size_t idx[ICS_MAXDIM];
+    size_t i, c, nBins, ext;
+    double scale, v;
+    int    j;
+
+
+    nBins = 1;
+    for (j = 0; j < nDims; j++) {
+        idx[j] = 0;
+        nBins *= out[j];
+    }
+    for (i = 0; i < nBins; i++) {
+        scale = 1.0;
+        if (mode == IcsBin_mean) {
+            scale = weight;
+            for (j = 0; j < nDims; j++) {
+                ext = size[j] - idx[j] * bin[j];
+                scale *= (double)(ext < bin[j] ? ext : bin[j]);
+            }
+            scale = 1.0 / scale;
+        }
+        for (c = 0; c < nc; c++) {
+            v = plane[i * nc + c] * scale;
+            switch (dataType) {
+                case Ics_uint8:
+                    ((ics_t_uint8*)dest)[i] = (ics_t_uint8)floor(v + 0.5);
+                    break;
+                case Ics_sint8:
+                    ((ics_t_sint8*)dest)[i] = (ics_t_sint8)floor(v + 0.5);
+                    break;
+                case Ics_uint16:
+                    ((ics_t_uint16*)dest)[i] = (ics_t_uint16)floor(v + 0.5);
+                    break;
+                case Ics_sint16:
+                    ((ics_t_sint16*)dest)[i] = (ics_t_sint16)floor(v + 0.5);
+                    break;
+                case Ics_uint32:
+                    ((ics_t_uint32*)dest)[i] = (ics_t_uint32)floor(v + 0.5);
+                    break;
+                case Ics_sint32:
+                    ((ics_t_sint32*)dest)[i] = (ics_t_sint32)floor(v + 0.5);
+                    break;
+                case Ics_real32:
+                case Ics_complex32:
+                    ((ics_t_real32*)dest)[i * nc + c] = (ics_t_real32)v;
+                    break;
+                case Ics_real64:
+                case Ics_complex64:
+                    ((ics_t_real64*)dest)[i * nc + c] = v;
+                    break;
+                default:
+                    break;
+            }
+        }
+        for (j = 0; j < nDims; j++) {
+            if (++idx[j] < out[j]) break;
+            idx[j] = 0;
+        }
+    }
+}
+
+
+/* Set all bins in a plane to the start value for mode. */
+static void icsResetBins(double      *plane,
+                         size_t       n,
+                         Ics_BinMode  mode)
+{
+    size_t i;
+    double v = mode == IcsBin_max ? -HUGE_VAL :
+               mode == IcsBin_min ? HUGE_VAL : 0.0;
+
+
+    for (i = 0; i < n; i++) {
+        plane[i] = v;
+    }
+}
+
+
+/* Read a square region of the image data from an ICS file, reduced by an
+   integer factor in each dimension. */
+Ics_Error IcsGetBinnedROIData(ICS          *ics,
+                              const size_t *offsetPtr,
+                              const size_t *sizePtr,
+                              const size_t *binningPtr,
+                              Ics_BinMode   mode,
+                              void         *destPtr,
+                              size_t        n)
+{
+    ICSINIT;
+    size_t        offset[ICS_MAXDIM], size[ICS_MAXDIM], bin[ICS_MAXDIM];
+    size_t        out[ICS_MAXDIM], curPos[ICS_MAXDIM], fileStride[ICS_MAXDIM];
+    size_t        imelSize, nc, lineSize, nPlane, planeSize, outSize;
+    size_t        curLoc, newLoc, row, accRow, nAcc, k;
+    double        weight;
+    double       *plane = NULL;
+    double       *line  = NULL;
+    float        *acc   = NULL;
+    char         *buf   = NULL;
+    char         *dest  = (char*)destPtr;
+    int           i, p, nPlaneDims, useAcc;
+    Ics_DataType  dt;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if ((n == 0) || (dest == NULL)) return IcsErr_Ok;
+    dt = ics->imel.dataType;
+    if ((dt == Ics_unknown) || (dt > Ics_complex64))
+        return IcsErr_UnknownDataType;
+    nc = ((dt == Ics_complex32) || (dt == Ics_complex64)) ? 2 : 1;
+    if ((mode != IcsBin_mean) && ((nc == 2) ||
+                                  ((mode != IcsBin_max) &&
+                                   (mode != IcsBin_min))))
+        return IcsErr_IllParameter;
+    p = ics->dimensions;
+    imelSize = (size_t)IcsGetBytesPerSample(ics);
+    outSize = imelSize;
+    for (i = 0; i < p; i++) {
+        offset[i] = offsetPtr != NULL ? offsetPtr[i] : 0;
+        if (offset[i] > ics->dim[i].size) return IcsErr_IllegalROI;
+        size[i] = sizePtr != NULL ? sizePtr[i] : ics->dim[i].size - offset[i];
+        bin[i] = binningPtr != NULL ? binningPtr[i] : 1;
+        if ((bin[i] < 1) || (offset[i] + size[i] > ics->dim[i].size))
+            return IcsErr_IllegalROI;
+        out[i] = (size[i] + bin[i] - 1) / bin[i];
+        outSize *= out[i];
+    }
+    if (n < outSize) return IcsErr_BufferTooSmall;
+    if (outSize == 0) return IcsErr_Ok;
+
+        /* The plane of bins covers all dimensions but the last one */
+    nPlaneDims = p > 1 ? p - 1 : 1;
+    nPlane = 1;
+    for (i = 0; i < nPlaneDims; i++) {
+        nPlane *= out[i];
+    }
+    planeSize = nPlane * imelSize;
+    fileStride[0] = 1;
+    for (i = 1; i < p; i++) {
+        fileStride[i] = fileStride[i - 1] * ics->dim[i - 1].size;
+    }
+    lineSize = size[0] * imelSize;
+    useAcc = (mode == IcsBin_mean) && ((dt == Ics_uint8) || (dt == Ics_uint16));
+    buf = IcsGetScratch(ics, lineSize);
+    line = IcsGetScratch(ics, size[0] * nc * sizeof(double));
+    plane = IcsGetScratch(ics, nPlane * nc * sizeof(double));
+    if (useAcc) acc = IcsGetScratch(ics, size[0] * sizeof(float));
+    if ((buf == NULL) || (line == NULL) || (plane == NULL) ||
+        (useAcc && (acc == NULL))) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+    if (useAcc) memset(acc, 0, size[0] * sizeof(float));
+    if (ics->blockRead != NULL) {
+        error = IcsCloseIds(ics);
+        if (error) goto exit;
+    }
+    error = IcsOpenIds(ics);
+    if (error) goto exit;
+
+    icsResetBins(plane, nPlane * nc, mode);
+    nAcc = 0;
+    accRow = 0;
+    curLoc = 0;
+    for (i = 0; i < p; i++) {
+        curPos[i] = offset[i];
+    }
+    while (1) {
+        newLoc = 0;
+        for (i = 0; i < p; i++) {
+            newLoc += curPos[i] * fileStride[i];
+        }
+        newLoc *= imelSize;
+        row = 0;
+        for (i = nPlaneDims - 1; i > 0; i--) {
+            row = row * out[i] + (curPos[i] - offset[i]) / bin[i];
+        }
+        row *= out[0] * nc;
+        if (curLoc < newLoc) {
+            error = IcsSkipIdsBlock(ics, newLoc - curLoc);
+            curLoc = newLoc;
+        }
+        if (!error) error = IcsReadIdsBlock(ics, buf, lineSize);
+        if (error != IcsErr_Ok) {
+            break; /* stop reading on error */
+        }
+        curLoc += lineSize;
+        if (useAcc) {
+            if ((nAcc > 0) &&
+                ((row != accRow) || (nAcc == ICS_BIN_FLOAT_LINES))) {
+                for (k = 0; k < size[0]; k++) {
+                    line[k] = (double)acc[k];
+                }
+                icsBinLine(plane + accRow, line, size[0], 1, bin[0], mode);
+                memset(acc, 0, size[0] * sizeof(float));
+                nAcc = 0;
+            }
+            if (dt == Ics_uint8) {
+                IcsGetKernels()->accumulateUint8(acc, (ics_t_uint8*)buf,
+                                                 size[0]);
+            } else {
+                IcsGetKernels()->accumulateUint16(acc, (ics_t_uint16*)buf,
+                                                  size[0]);
+            }
+            accRow = row;
+            nAcc++;
+        } else {
+            icsLineToDouble(line, buf, dt, size[0] * nc);
+            icsBinLine(plane + row, line, size[0], nc, bin[0], mode);
+        }
+        for (i = 1; i < p; i++) {
+            curPos[i]++;
+            if (curPos[i] < offset[i] + size[i]) {
+                break;
+            }
+            curPos[i] = offset[i];
+        }
+            /* Write the plane when the last line of a bin along the last
+               dimension has been read */
+        if ((i == p) || ((i == p - 1) &&
+                         ((curPos[i] - offset[i]) % bin[i] == 0))) {
+            if (nAcc > 0) {
+                for (k = 0; k < size[0]; k++) {
+                    line[k] = (double)acc[k];
+                }
+                icsBinLine(plane + accRow, line, size[0], 1, bin[0], mode);
+                memset(acc, 0, size[0] * sizeof(float));
+                nAcc = 0;
+            }
+            k = 0;
+            weight = 1.0;
+            if (p > 1) {
+                k = i == p ? out[p - 1] - 1
+                           : (curPos[p - 1] - offset[p - 1]) / bin[p - 1] - 1;
+                weight = (double)(size[p - 1] - k * bin[p - 1]);
+                if (weight > (double)bin[p - 1]) weight = (double)bin[p - 1];
+            }
+            icsStoreBins(dest + k * planeSize, plane, dt, nc, mode, nPlaneDims,
+                         size, bin, out, weight);
+            icsResetBins(plane, nPlane * nc, mode);
+        }
+        if (i == p) {
+            break; /* we're done reading */
+        }
+    }
+    if (error)
+        IcsCloseIds(ics);
+    else
+        error = IcsCloseIds(ics);
+    if ((error == IcsErr_Ok) && (n != outSize)) {
+        error = IcsErr_OutputNotFilled;
+    }
+
+  exit:
+    IcsReleaseScratch(ics, buf);
+    IcsReleaseScratch(ics, line);
+    IcsReleaseScratch(ics, plane);
+    IcsReleaseScratch(ics, acc);
+    return error;
+}
@@ -36,6 +36,10 @@
  *
  *   IcsReadIcs()
  *   IcsVersion()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsReadHistory()
  */
 
 
@@ -375,8 +379,8 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
     ICS_INIT_LOCALE;
     FILE            *fp;
     int              end        = 0, si, sj;
-    size_t           i, j;
-    char             seps[3], *ptr, *data;
+    size_t           i;
+    char             seps[3], *ptr;
     char             line[ICS_LINE_LENGTH];
     Ics_Token        cat, subCat, subSubCat;
     const char      *idx;
@@ -394,6 +398,9 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
     char             label[ICS_MAXDIM+1][ICS_STRLEN_TOKEN];
     char             unit[ICS_MAXDIM+1][ICS_STRLEN_TOKEN];
     Ics_SensorState  state      = IcsSensorState_default;
+    ics_t_sint64     lineStart;
+    ics_t_sint64     historyStart = -1, historyEnd = -1;
+    size_t           historyLen = strlen(ICS_HISTORY);
 #ifdef HAVE_STRTOK_R
     char *saveptr;
 #endif
@@ -424,8 +431,17 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
     if (!error) error = getIcsVersion(fp, seps, &(icsStruct->version));
     if (!error) error = getIcsFileName(fp, seps);
 
-    while (!end && !error
-           && (icsFGetStr(line, ICS_LINE_LENGTH, fp, seps[1]) != NULL)) {
+    while (!end && !error) {
+        lineStart = IcsFTell(fp);
+        if (icsFGetStr(line, ICS_LINE_LENGTH, fp, seps[1]) == NULL) break;
+            /* History lines are only read when they are asked for (see
+               IcsReadHistory()), here we just note where they are */
+        if ((strncmp(line, ICS_HISTORY, historyLen) == 0) &&
+            ((line[historyLen] == seps[0]) || (line[historyLen] == seps[1]))) {
+            if (historyStart < 0) historyStart = lineStart;
+            historyEnd = IcsFTell(fp);
+            continue;
+        }
         if (getIcsCat(line, seps, &cat, &subCat, &subSubCat, &idx) != IcsErr_Ok)
             continue;
         ptr = STRTOK(line, seps);
@@ -434,7 +450,7 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
             case ICSTOK_END:
                 end = 1;
                 if (icsStruct->srcFile[0] == '\0') {
-                    icsStruct->srcOffset =(size_t) ftell(fp);
+                    icsStruct->srcOffset = (size_t)IcsFTell(fp);
                     IcsStrCpy(icsStruct->srcFile, icsStruct->filename,
                               ICS_MAXPATHLEN);
                 }
@@ -451,6 +467,18 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
                             icsStruct->srcOffset = IcsStrToSize(ptr);
                         }
                         break;
+                    case ICSTOK_STORE:
+                        if (ptr != NULL) {
+                            IcsStrCpy(icsStruct->dedupStore, ptr,
+                                      ICS_MAXPATHLEN);
+                        }
+                        break;
+                    case ICSTOK_CHUNKS:
+                        if (ptr != NULL) {
+                            IcsStrCpy(icsStruct->chunkStore, ptr,
+                                      ICS_MAXPATHLEN);
+                        }
+                        break;
                     default:
                         break;
                 }
@@ -487,6 +515,12 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
                             icsStruct->imel.sigBits = IcsStrToSize(ptr);
                         }
                         break;
+                    case ICSTOK_CHUNKS:
+                        while (ptr!= NULL && i < ICS_MAXDIM) {
+                            icsStruct->chunkDims[i++] = IcsStrToSize(ptr);
+                            ptr = STRTOK(NULL, seps);
+                        }
+                        break;
                     default:
                         error = IcsErr_MissLayoutSubCat;
                 }
@@ -540,10 +574,34 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
                             case ICSTOK_COMPR_GZIP:
                                 icsStruct->compression = IcsCompr_gzip;
                                 break;
+                            case ICSTOK_COMPR_LOCO:
+                                icsStruct->compression = IcsCompr_loco;
+                                break;
+                            case ICSTOK_COMPR_FPRED:
+                                icsStruct->compression = IcsCompr_fpred;
+                                break;
                             default:
                                 error = IcsErr_UnknownCompression;
                         }
                         break;
+                    case ICSTOK_FILTER:
+                        if (getIcsToken(ptr, &G_Values) != ICSTOK_FILTER_DELTA) {
+                            error = IcsErr_UnknownCompression;
+                            break;
+                        }
+                        ptr = STRTOK(NULL, seps);
+                        if (ptr != NULL) {
+                            icsStruct->deltaDim = atoi(ptr);
+                            ptr = STRTOK(NULL, seps);
+                        }
+                        if (ptr != NULL) {
+                            icsStruct->deltaKeyInterval = IcsStrToSize(ptr);
+                        }
+                        if ((icsStruct->deltaDim < 0)
+                            || (icsStruct->deltaKeyInterval < 1)) {
+                            error = IcsErr_IllParameter;
+                        }
+                        break;
                     case ICSTOK_BYTEO:
                         while (ptr!= NULL && i < ICS_MAX_IMEL_SIZE) {
                             icsStruct->byteOrder[i++] = atoi(ptr);
@@ -586,29 +644,16 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
                 }
                 break;
             case ICSTOK_HISTORY:
-                if (ptr != NULL) {
-                    data = STRTOK(NULL, seps+1); /* This will get the rest of
-                                                    the line */
-                    if (data == NULL) { /* data is not allowed to be "", but ptr
-                                           is */
-                        data = ptr;
-                        ptr = "";
-                    }
-                        /* The next portion is to avoid having
-                           IcsInternAddHistory return IcsErr_LineOverflow. */
-                    i = strlen(ptr);
-                    if (i+1 > ICS_STRLEN_TOKEN) {
-                        ptr[ICS_STRLEN_TOKEN-1] = '\0';
-                        i = ICS_STRLEN_TOKEN-1;
-                    }
-                    j = strlen(ICS_HISTORY);
-                    if ((strlen(data) + i + j + 4) > ICS_LINE_LENGTH) {
-                        data[ICS_LINE_LENGTH - i - j - 4] = '\0';
-                    }
-                    error = IcsInternAddHistory(icsStruct, ptr, data, seps);
-                }
+                    /* A history line not caught above, because of leading
+                       separators */
+                if (historyStart < 0) historyStart = lineStart;
+                historyEnd = IcsFTell(fp);
                 break;
             case ICSTOK_SENSOR:
+                    /* Keep the sensor data when the header is written again
+                       (update mode, IcsCopyMetadata()) */
+                icsStruct->writeSensor = 1;
+                if (subCat == ICSTOK_SSTATES) icsStruct->writeSensorStates = 1;
                 switch (subCat) {
                     case ICSTOK_TYPE:
                         while (ptr != NULL && i < ICS_MAX_LAMBDA) {
@@ -913,6 +958,11 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
         }
     }
 
+    if (!error && (historyStart >= 0)) {
+        error = IcsInternSetHistoryRange(icsStruct, historyStart, historyEnd,
+                                         seps);
+    }
+
     if (forceLocale) {
         ICS_REVERT_LOCALE;
     }
@@ -925,6 +975,86 @@ Ics_Error IcsReadIcs(Ics_Header *icsStruct,
 }
 
 
+/* Add a history line, as returned by getIcsCat(), to the history. */
+static Ics_Error icsAddHistoryLine(Ics_Header *icsStruct,
+                                   char       *line,
+                                   const char *seps)
+{
+    ICSINIT;
+    char   *ptr, *data;
+    size_t  i, j;
+#ifdef HAVE_STRTOK_R
+    char *saveptr;
+#endif
+
+
+    ptr = STRTOK(line, seps);
+    if (ptr != NULL) {
+        data = STRTOK(NULL, seps+1); /* This will get the rest of the line */
+        if (data == NULL) { /* data is not allowed to be "", but ptr is */
+            data = ptr;
+            ptr = "";
+        }
+            /* The next portion is to avoid having IcsInternAddHistory return
+               IcsErr_LineOverflow. */
+        i = strlen(ptr);
+        if (i+1 > ICS_STRLEN_TOKEN) {
+            ptr[ICS_STRLEN_TOKEN-1] = '\0';
+            i = ICS_STRLEN_TOKEN-1;
+        }
+        j = strlen(ICS_HISTORY);
+        if ((strlen(data) + i + j + 4) > ICS_LINE_LENGTH) {
+            data[ICS_LINE_LENGTH - i - j - 4] = '\0';
+        }
+        error = IcsInternAddHistory(icsStruct, ptr, data, seps);
+    }
+
+    return error;
+}
+
+
+/* Read the history lines that IcsReadIcs() skipped, if they have not been read
+   yet. Called by all functions that use the history. */
+Ics_Error IcsReadHistory(Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_History *hist = (Ics_History*)icsStruct->history;
+    FILE        *fp;
+    char         line[ICS_LINE_LENGTH];
+    char         seps[3];
+    Ics_Token    cat, subCat, subSubCat;
+    const char  *idx;
+    ics_t_sint64 end;
+
+
+    if ((hist == NULL) || (hist->unreadStart >= hist->unreadEnd)) return error;
+
+        /* Mark the lines as read first, IcsInternAddHistory() appends to the
+           same history */
+    end = hist->unreadEnd;
+    memcpy(seps, hist->seps, 3);
+    fp = IcsFOpen(icsStruct->filename, "rb");
+    if (fp == NULL) return IcsErr_FOpenIcs;
+    if (IcsFSeek(fp, hist->unreadStart, SEEK_SET) != 0) error = IcsErr_FReadIcs;
+    hist->unreadStart = hist->unreadEnd = 0;
+    while (!error && (IcsFTell(fp) < end)) {
+        if (icsFGetStr(line, ICS_LINE_LENGTH, fp, seps[1]) == NULL) {
+            error = IcsErr_FReadIcs;
+            break;
+        }
+        if ((getIcsCat(line, seps, &cat, &subCat, &subSubCat, &idx)
+             == IcsErr_Ok) && (cat == ICSTOK_HISTORY)) {
+            error = icsAddHistoryLine(icsStruct, line, seps);
+        }
+    }
+
+    if (fclose(fp) == EOF) {
+        if (!error) error = IcsErr_FCloseIcs;
+    }
+    return error;
+}
+
+
 /* Read the first 3 lines of an ICS file to see which version it is. It returns
    0 if it is not an ICS file, or the version number if it is. */
 int IcsVersion(const char *filename,
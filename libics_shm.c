@@ -0,0 +1,405 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+
+/*
+ * FILE : libics_shm.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsPublishROIData()
+ *   IcsAttachShared()
+ *   IcsDetachShared()
+ *
+ * Publishing decoded image data in a named shared memory segment, so that
+ * several processes on the same machine can use one decoded copy of a
+ * (compressed) file. The segment starts with a small descriptor giving the
+ * layout, data type and strides of the data, followed by the data itself. The
+ * descriptor is marked as ready only after the data is complete. POSIX systems
+ * use shm_open(), Windows uses named file mappings backed by the paging file.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+#define ICS_SHM_MAGIC "ICSSHM1"
+#define ICS_SHM_ALIGN 64
+
+
+/* The descriptor at the start of a segment. Only fixed-size types are used,
+   as the processes sharing it can be compiled differently. */
+typedef struct {
+    char          magic[8];               /* ICS_SHM_MAGIC */
+    volatile int  ready;                  /* set once the data is complete */
+    int           dataType;               /* Ics_DataType of the data */
+    int           dimensions;             /* number of dimensions */
+    int           reserved;
+    ics_t_uint64  dims[ICS_MAXDIM];       /* size of the data */
+    ics_t_uint64  offset[ICS_MAXDIM];     /* position within the image */
+    ics_t_sint64  strides[ICS_MAXDIM];    /* in samples */
+    ics_t_uint64  dataOffset;             /* start of the data, in bytes */
+    ics_t_uint64  dataSize;               /* size of the data, in bytes */
+} Ics_SharedHeader;
+
+
+/* A mapped segment, allocated together with the view handed out. */
+typedef struct {
+    Ics_SharedData  view;
+    char           *base;                 /* start of the mapping */
+    size_t          length;               /* length of the mapping */
+    int             owner;                /* the segment was created here */
+    char            name[ICS_MAXPATHLEN]; /* name of the segment */
+#if defined(_WIN32)
+    HANDLE          map;
+#endif
+} Ics_SharedSegment;
+
+
+/* Copy name into the segment, POSIX names must start with a slash. */
+static Ics_Error icsSegmentName(Ics_SharedSegment *segment,
+                                const char        *name)
+{
+    ICSINIT;
+    size_t n = 0;
+
+
+    if ((name == NULL) || (name[0] == '\0')) return IcsErr_IllParameter;
+#if !defined(_WIN32)
+    if (name[0] != '/') segment->name[n++] = '/';
+#endif
+    if (n + strlen(name) >= ICS_MAXPATHLEN) return IcsErr_IllParameter;
+    IcsStrCpy(segment->name + n, name, (int)(ICS_MAXPATHLEN - n));
+
+    return error;
+}
+
+
+/* Create a new segment of the given length and map it for writing. */
+static Ics_Error icsCreateSegment(Ics_SharedSegment *segment,
+                                  size_t             length)
+{
+    ICSINIT;
+#if defined(_WIN32)
+    ics_t_uint64 size = length;
+
+
+    segment->map = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+                                      PAGE_READWRITE, (DWORD)(size >> 32),
+                                      (DWORD)size, segment->name);
+    if (segment->map == NULL) return IcsErr_FWriteIds;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(segment->map);
+        return IcsErr_DuplicateData;
+    }
+    segment->base = (char*)MapViewOfFile(segment->map, FILE_MAP_WRITE, 0, 0,
+                                         length);
+    if (segment->base == NULL) {
+        CloseHandle(segment->map);
+        return IcsErr_FWriteIds;
+    }
+#else
+    int fd;
+
+
+    if ((size_t)(off_t)length != length) return IcsErr_FWriteIds;
+        /* Only the owner can attach: the image data need not be public. */
+    fd = shm_open(segment->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return errno == EEXIST ? IcsErr_DuplicateData : IcsErr_FOpenIds;
+    }
+    if (ftruncate(fd, (off_t)length) != 0) {
+        error = IcsErr_FWriteIds;
+    } else {
+        segment->base = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, fd, 0);
+        if (segment->base == (char*)MAP_FAILED) error = IcsErr_FWriteIds;
+    }
+        /* The mapping stays valid after closing the segment */
+    close(fd);
+    if (error) {
+        shm_unlink(segment->name);
+        return error;
+    }
+#endif
+    segment->length = length;
+    segment->owner = 1;
+
+    return error;
+}
+
+
+/* Map an existing segment for reading. */
+static Ics_Error icsOpenSegment(Ics_SharedSegment *segment)
+{
+    ICSINIT;
+#if defined(_WIN32)
+    MEMORY_BASIC_INFORMATION info;
+
+
+    segment->map = OpenFileMappingA(FILE_MAP_READ, FALSE, segment->name);
+    if (segment->map == NULL) return IcsErr_FOpenIds;
+    segment->base = (char*)MapViewOfFile(segment->map, FILE_MAP_READ, 0, 0, 0);
+    if (segment->base == NULL) {
+        CloseHandle(segment->map);
+        return IcsErr_FReadIds;
+    }
+    if (VirtualQuery(segment->base, &info, sizeof(info)) == 0) {
+        info.RegionSize = 0;
+    }
+    segment->length = info.RegionSize;
+#else
+    int         fd;
+    struct stat info;
+
+
+    fd = shm_open(segment->name, O_RDONLY, 0);
+    if (fd < 0) return IcsErr_FOpenIds;
+    if (fstat(fd, &info) != 0) {
+        error = IcsErr_FReadIds;
+    } else if ((size_t)info.st_size < sizeof(Ics_SharedHeader)) {
+            /* Created, but not yet sized by the publisher */
+        error = IcsErr_MissingData;
+    } else {
+        segment->length = (size_t)info.st_size;
+        segment->base = (char*)mmap(NULL, segment->length, PROT_READ,
+                                    MAP_SHARED, fd, 0);
+        if (segment->base == (char*)MAP_FAILED) error = IcsErr_FReadIds;
+    }
+    close(fd);
+    if (error) return error;
+#endif
+    segment->owner = 0;
+
+    return error;
+}
+
+
+/* Unmap the segment, and remove its name if it was created here. */
+static Ics_Error icsCloseSegment(Ics_SharedSegment *segment)
+{
+    ICSINIT;
+
+
+#if defined(_WIN32)
+        /* The segment disappears with the last handle to it */
+    if (!UnmapViewOfFile(segment->base)) error = IcsErr_FCloseIds;
+    if (!CloseHandle(segment->map) && !error) error = IcsErr_FCloseIds;
+#else
+    if (munmap(segment->base, segment->length) != 0) error = IcsErr_FCloseIds;
+    if (segment->owner && (shm_unlink(segment->name) != 0) && !error) {
+        error = IcsErr_FCloseIds;
+    }
+#endif
+
+    return error;
+}
+
+
+/* Check the descriptor of a mapped segment and fill in the view from it. */
+static Ics_Error icsFillView(Ics_SharedSegment *segment)
+{
+    ICSINIT;
+    Ics_SharedHeader *header = (Ics_SharedHeader*)segment->base;
+    Ics_SharedData   *view   = &segment->view;
+    int               i;
+
+
+    if (segment->length < sizeof(Ics_SharedHeader)) return IcsErr_MissingData;
+    if (memcmp(header->magic, ICS_SHM_MAGIC, sizeof(header->magic)) != 0) {
+        return IcsErr_NotIcsFile;
+    }
+    if (!IcsAtomicGet(&header->ready)) return IcsErr_MissingData;
+    if ((header->dimensions < 1) || (header->dimensions > ICS_MAXDIM)) {
+        return IcsErr_TooManyDims;
+    }
+    if ((header->dataOffset > segment->length) ||
+        (header->dataSize > segment->length - header->dataOffset)) {
+        return IcsErr_CorruptedStream;
+    }
+
+    view->dataType = (Ics_DataType)header->dataType;
+    view->dimensions = header->dimensions;
+    for (i = 0; i < header->dimensions; i++) {
+        view->dims[i] = (size_t)header->dims[i];
+        view->offset[i] = (size_t)header->offset[i];
+        view->strides[i] = (ptrdiff_t)header->strides[i];
+    }
+    view->data = segment->base + header->dataOffset;
+    view->dataSize = (size_t)header->dataSize;
+    view->segment = segment;
+
+    return error;
+}
+
+
+/* Read a square region of the image into a new shared memory segment called
+   name. */
+Ics_Error IcsPublishROIData(ICS             *ics,
+                            const size_t    *offset,
+                            const size_t    *size,
+                            const char      *name,
+                            Ics_SharedData **shared)
+{
+    ICSINIT;
+    Ics_SharedSegment *segment;
+    Ics_SharedHeader  *header;
+    size_t             dataOffset, dataSize, o, s;
+    int                i;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+    if (shared == NULL) return IcsErr_IllParameter;
+    *shared = NULL;
+    if (ics->dimensions == 0) return IcsErr_NoLayout;
+
+    segment = (Ics_SharedSegment*)calloc(1, sizeof(Ics_SharedSegment));
+    if (segment == NULL) return IcsErr_Alloc;
+    error = icsSegmentName(segment, name);
+    if (error) goto exit;
+
+        /* The descriptor, padded such that the data is aligned */
+    dataOffset = (sizeof(Ics_SharedHeader) + ICS_SHM_ALIGN - 1) /
+        ICS_SHM_ALIGN * ICS_SHM_ALIGN;
+    dataSize = (size_t)IcsGetBytesPerSample(ics);
+    for (i = 0; i < ics->dimensions; i++) {
+        o = offset != NULL ? offset[i] : 0;
+        if (o > ics->dim[i].size) {
+            error = IcsErr_IllegalROI;
+            goto exit;
+        }
+        s = size != NULL ? size[i] : ics->dim[i].size - o;
+        if (o + s > ics->dim[i].size) {
+            error = IcsErr_IllegalROI;
+            goto exit;
+        }
+        dataSize *= s;
+    }
+
+    error = icsCreateSegment(segment, dataOffset + dataSize);
+    if (error) goto exit;
+    header = (Ics_SharedHeader*)segment->base;
+    header->dataType = (int)ics->imel.dataType;
+    header->dimensions = ics->dimensions;
+    for (i = 0; i < ics->dimensions; i++) {
+        o = offset != NULL ? offset[i] : 0;
+        s = size != NULL ? size[i] : ics->dim[i].size - o;
+        header->dims[i] = s;
+        header->offset[i] = o;
+        header->strides[i] = i == 0 ? 1 :
+            header->strides[i - 1] * (ics_t_sint64)header->dims[i - 1];
+    }
+    header->dataOffset = dataOffset;
+    header->dataSize = dataSize;
+    memcpy(header->magic, ICS_SHM_MAGIC, sizeof(header->magic));
+
+    error = IcsGetROIData(ics, offset, size, NULL, segment->base + dataOffset,
+                          dataSize);
+    if (!error) {
+            /* Consumers can attach from here on */
+        IcsAtomicSet(&header->ready, 1);
+        error = icsFillView(segment);
+    }
+    if (error) icsCloseSegment(segment);
+
+  exit:
+    if (error) {
+        free(segment);
+    } else {
+        *shared = &segment->view;
+    }
+
+    return error;
+}
+
+
+/* Map the shared memory segment called name for reading. */
+Ics_Error IcsAttachShared(const char      *name,
+                          Ics_SharedData **shared)
+{
+    ICSINIT;
+    Ics_SharedSegment *segment;
+
+
+    if (shared == NULL) return IcsErr_IllParameter;
+    *shared = NULL;
+
+    segment = (Ics_SharedSegment*)calloc(1, sizeof(Ics_SharedSegment));
+    if (segment == NULL) return IcsErr_Alloc;
+    error = icsSegmentName(segment, name);
+    if (!error) error = icsOpenSegment(segment);
+    if (!error) {
+        error = icsFillView(segment);
+        if (error) icsCloseSegment(segment);
+    }
+
+    if (error) {
+        free(segment);
+    } else {
+        *shared = &segment->view;
+    }
+
+    return error;
+}
+
+
+/* Unmap a segment, and remove it if it was published through this handle. */
+Ics_Error IcsDetachShared(Ics_SharedData *shared)
+{
+    ICSINIT;
+    Ics_SharedSegment *segment;
+
+
+    if ((shared == NULL) || (shared->segment == NULL))
+        return IcsErr_IllParameter;
+    segment = (Ics_SharedSegment*)shared->segment;
+    error = icsCloseSegment(segment);
+    free(segment);
+
+    return error;
+}
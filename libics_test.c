@@ -57,6 +57,10 @@ void IcsPrintIcs (ICS const* ics)
    printf ("Filename: %s\n", ics->filename);
    printf ("SrcFile: %s\n", ics->srcFile);
    printf ("SrcOffset: %ld\n", (long int)ics->srcOffset);
+   printf ("DedupStore: %s\n", ics->dedupStore);
+   printf ("ChunkStore: %s\n", ics->chunkStore);
+   printf ("DeltaDim: %d (key interval %lu)\n", ics->deltaDim,
+           (unsigned long)ics->deltaKeyInterval);
    printf ("Data: %p\n", ics->data);
    printf ("DataLength: %ld\n", (long int)ics->dataLength);
    printf ("Parameters: %d\n", ics->dimensions+1);
@@ -109,6 +113,12 @@ void IcsPrintIcs (ICS const* ics)
       case IcsCompr_gzip:
          s = "gzip";
          break;
+      case IcsCompr_loco:
+         s = "loco";
+         break;
+      case IcsCompr_fpred:
+         s = "fpred";
+         break;
       default:
          s = "unknown";
    }
@@ -161,6 +171,7 @@ void IcsPrintIcs (ICS const* ics)
    }
    printf ("\n");
    printf ("History Lines:\n");
+   IcsReadHistory((ICS*)ics);
    if (ics->history != NULL) {
       Ics_History* hist = (Ics_History*)ics->history;
       for (ii = 0; ii < hist->nStr; ii++) {
@@ -0,0 +1,737 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_thread.c
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsGetNumThreads()
+ *   IcsParallelFor()
+ *   IcsStartJob()
+ *   IcsStopJobs()
+ *   IcsLockJobs()
+ *   IcsUnlockJobs()
+ *   IcsWaitJobs()
+ *   IcsSignalJobs()
+ *   IcsLockMemory()
+ *   IcsUnlockMemory()
+ *   IcsAtomicAdd()
+ *   IcsAtomicGet()
+ *   IcsAtomicSet()
+ *   IcsAtomicCas()
+ *   IcsAtomicCasPtr()
+ *   IcsAtomicSwapPtr()
+ *
+ * A minimal parallel loop, used to code and decode tiles concurrently, and a
+ * pool of worker threads running background jobs, used by the asynchronous
+ * reads. Threads are only used if ICS_THREADS is defined (POSIX threads, or
+ * Windows threads when compiling for Windows); otherwise the loop runs
+ * sequentially and jobs run when they are started.
+ *
+ * Each context (see libics_context.c) has its own job queue, whose workers
+ * wait for new jobs until the context is freed. Jobs without a context go to
+ * a global queue, whose workers stop when the queue has been empty for
+ * ICS_JOB_IDLE milliseconds, so that a steady stream of jobs, such as the
+ * frames of a frame writer, does not start a thread for each job. A parallel
+ * loop is run by the calling thread together with the workers of the queue of
+ * its context, or of the global queue, instead of by new threads.
+ *
+ * The memory accounting and the scratch buffers of a context are protected by
+ * a lock of their own (see IcsLockMemory()), so that getting a buffer does not
+ * wait for the job queues, nor for the buffers of other contexts.
+ *
+ * The atomic operations are used for lock-free queues (see
+ * libics_frames.c). They use the GCC builtins, or the Interlocked functions
+ * on Windows; without threads they are plain operations.
+ */
+
+
+#include <stdlib.h>
+#include "libics_intern.h"
+
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#endif
+
+
+/* How long the workers of the global job queue wait for a new job, in ms. */
+#define ICS_JOB_IDLE 100
+
+
+#ifdef ICS_THREADS
+
+/* The job queue for jobs without a context. Its workers are started when
+   jobs are queued, up to IcsGetNumThreads(), and stop when the queue stays
+   empty for ICS_JOB_IDLE ms. The workers of a context wait for new jobs
+   instead, until the context is freed. The records of finished jobs are kept
+   for reuse. One lock and condition variable protect all queues, and are
+   also used to wait for jobs to finish. */
+static Ics_JobQueue icsJobs = {NULL, NULL, NULL, 0, 0, 0, 0};
+#if defined(_WIN32)
+static SRWLOCK            icsJobLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE icsJobDone = CONDITION_VARIABLE_INIT;
+#else
+static pthread_mutex_t    icsJobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     icsJobDone = PTHREAD_COND_INITIALIZER;
+#endif
+
+
+/* Shared state of a parallel loop. */
+typedef struct {
+    size_t           n;     /* number of iterations */
+    size_t           next;  /* next iteration to hand out */
+    Ics_Error        error; /* first error returned by func */
+    Ics_ParallelFunc func;
+    void            *data;
+    size_t           pending; /* jobs helping with the loop */
+#if defined(_WIN32)
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t  lock;
+#endif
+} Ics_ParallelLoop;
+
+
+static void icsLock(Ics_ParallelLoop *loop)
+{
+#if defined(_WIN32)
+    EnterCriticalSection(&loop->lock);
+#else
+    pthread_mutex_lock(&loop->lock);
+#endif
+}
+
+
+static void icsUnlock(Ics_ParallelLoop *loop)
+{
+#if defined(_WIN32)
+    LeaveCriticalSection(&loop->lock);
+#else
+    pthread_mutex_unlock(&loop->lock);
+#endif
+}
+
+
+/* Each thread takes the next iteration until all are done, or one failed. */
+static void icsParallelWorker(Ics_ParallelLoop *loop)
+{
+    Ics_Error error;
+    size_t    i;
+
+
+    for (;;) {
+        icsLock(loop);
+        if (loop->error || loop->next >= loop->n) {
+            icsUnlock(loop);
+            return;
+        }
+        i = loop->next++;
+        icsUnlock(loop);
+        error = loop->func(loop->data, i);
+        if (error) {
+            icsLock(loop);
+            if (!loop->error) loop->error = error;
+            icsUnlock(loop);
+        }
+    }
+}
+
+
+/* A job helping with a parallel loop. */
+static void icsParallelJob(void *arg)
+{
+    Ics_ParallelLoop *loop = (Ics_ParallelLoop*)arg;
+
+
+    icsParallelWorker(loop);
+    IcsLockJobs();
+    loop->pending--;
+    IcsSignalJobs();
+    IcsUnlockJobs();
+}
+
+
+/* Remove the jobs helping with loop that have not started yet from the queue
+   of a context, or from the global queue, and return how many were removed.
+   Must be called with the lock held. */
+static size_t icsCancelLoopJobs(Ics_Context      *context,
+                                Ics_ParallelLoop *loop)
+{
+    Ics_JobQueue *queue   = context != NULL ? &context->jobs : &icsJobs;
+    Ics_Job     **link    = &queue->first;
+    Ics_Job      *job;
+    size_t        removed = 0;
+
+
+    queue->last = NULL;
+    while (*link != NULL) {
+        job = *link;
+        if ((job->func == icsParallelJob) && (job->data == loop)) {
+            *link = job->next;
+            job->next = queue->spare;
+            queue->spare = job;
+            queue->nQueued--;
+            removed++;
+        } else {
+            queue->last = job;
+            link = &job->next;
+        }
+    }
+
+    return removed;
+}
+
+
+/* Run a parallel loop with the workers of a context, or of the global queue:
+   the calling thread works on the loop, helped by up to nThreads - 1 jobs.
+   Jobs that did not start before the loop finished are cancelled, so that a
+   loop started from a job of the same queue cannot wait for workers that are
+   all busy. */
+static Ics_Error icsJobParallelFor(Ics_Context      *context,
+                                   size_t            nThreads,
+                                   Ics_ParallelLoop *loop)
+{
+    size_t i;
+
+
+    for (i = 0; i < nThreads - 1; i++) {
+        IcsLockJobs();
+        loop->pending++;
+        IcsUnlockJobs();
+        if (IcsStartJob(context, icsParallelJob, loop) != IcsErr_Ok) {
+            IcsLockJobs();
+            loop->pending--;
+            IcsUnlockJobs();
+            break;
+        }
+    }
+    icsParallelWorker(loop);
+    IcsLockJobs();
+    loop->pending -= icsCancelLoopJobs(context, loop);
+    while (loop->pending > 0) {
+        IcsWaitJobs();
+    }
+    IcsUnlockJobs();
+
+    return loop->error;
+}
+
+
+#endif /* ICS_THREADS */
+
+
+/* The number of threads used for parallel loops: ICS_MAX_THREADS, or the
+   number of processors if that is 0. */
+int IcsGetNumThreads(void)
+{
+#ifdef ICS_THREADS
+    int n = ICS_MAX_THREADS;
+
+
+    if (n <= 0) {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        n = (int)info.dwNumberOfProcessors;
+#else
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    return n > 0 ? n : 1;
+#else
+    return 1;
+#endif
+}
+
+
+/* Call func(data, i) for i = 0 ... n-1, distributing the calls over threads:
+   those of the context, or those of the global job queue if context is NULL.
+   Returns the first error returned by func; once an error occurs, no further
+   calls are started. */
+Ics_Error IcsParallelFor(Ics_Context      *context,
+                         size_t            n,
+                         Ics_ParallelFunc  func,
+                         void             *data)
+{
+    ICSINIT;
+    size_t nThreads = (size_t)IcsGetContextThreads(context);
+    size_t i;
+
+
+    if (nThreads > n) nThreads = n;
+    if (nThreads <= 1) {
+        for (i = 0; !error && i < n; i++) {
+            error = func(data, i);
+        }
+        return error;
+    }
+
+#ifdef ICS_THREADS
+    {
+        Ics_ParallelLoop loop;
+
+
+        loop.n = n;
+        loop.next = 0;
+        loop.error = IcsErr_Ok;
+        loop.func = func;
+        loop.data = data;
+        loop.pending = 0;
+#if defined(_WIN32)
+        InitializeCriticalSection(&loop.lock);
+#else
+        if (pthread_mutex_init(&loop.lock, NULL) != 0) return IcsErr_Alloc;
+#endif
+        error = icsJobParallelFor(context, nThreads, &loop);
+#if defined(_WIN32)
+        DeleteCriticalSection(&loop.lock);
+#else
+        pthread_mutex_destroy(&loop.lock);
+#endif
+    }
+#endif
+
+    return error;
+}
+
+
+#ifdef ICS_THREADS
+
+/* The memory locks, see IcsLockMemory(). A context uses the one its address
+   selects. */
+#define ICS_MEMORY_LOCKS 8
+#if defined(_WIN32)
+static SRWLOCK            icsMemoryLocks[ICS_MEMORY_LOCKS] = {
+    SRWLOCK_INIT, SRWLOCK_INIT, SRWLOCK_INIT, SRWLOCK_INIT,
+    SRWLOCK_INIT, SRWLOCK_INIT, SRWLOCK_INIT, SRWLOCK_INIT
+};
+#else
+static pthread_mutex_t    icsMemoryLocks[ICS_MEMORY_LOCKS] = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER
+};
+#endif
+
+
+#if defined(_WIN32)
+static SRWLOCK *icsMemoryLock(const Ics_Context *context)
+#else
+static pthread_mutex_t *icsMemoryLock(const Ics_Context *context)
+#endif
+{
+        /* The low bits are the same for all allocations */
+    return icsMemoryLocks + ((size_t)context >> 6) % ICS_MEMORY_LOCKS;
+}
+
+
+/* Wait until IcsSignalJobs() is called, or for at most ms milliseconds.
+   Returns 1 if it timed out. Must be called with the lock held. */
+static int icsWaitJobsFor(unsigned long ms)
+{
+#if defined(_WIN32)
+    return !SleepConditionVariableSRW(&icsJobDone, &icsJobLock, (DWORD)ms, 0)
+           && (GetLastError() == ERROR_TIMEOUT);
+#else
+    struct timespec ts;
+
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += (time_t)(ms / 1000);
+    ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(&icsJobDone, &icsJobLock, &ts) == ETIMEDOUT;
+#endif
+}
+
+
+/* Run queued jobs until there are none left for a while, or, for a context,
+   until it is stopped. */
+static void icsJobWorker(Ics_Context *context)
+{
+    Ics_JobQueue *queue    = context != NULL ? &context->jobs : &icsJobs;
+    Ics_Job      *job;
+    int           timedOut = 0;
+
+
+    IcsLockJobs();
+    for (;;) {
+        if (queue->first != NULL) {
+            job = queue->first;
+            queue->first = job->next;
+            if (queue->first == NULL) queue->last = NULL;
+            queue->nQueued--;
+            IcsUnlockJobs();
+            job->func(job->data);
+            IcsLockJobs();
+            job->next = queue->spare;
+            queue->spare = job;
+            timedOut = 0;
+        } else if ((context != NULL) && !queue->stop) {
+            queue->nIdle++;
+            IcsWaitJobs();
+            queue->nIdle--;
+        } else if ((context == NULL) && !timedOut) {
+            queue->nIdle++;
+            timedOut = icsWaitJobsFor(ICS_JOB_IDLE);
+            queue->nIdle--;
+        } else {
+            break;
+        }
+    }
+    queue->nWorkers--;
+    if (context != NULL) IcsSignalJobs(); /* see IcsStopJobs() */
+    IcsUnlockJobs();
+}
+
+
+#if defined(_WIN32)
+static unsigned __stdcall icsJobThreadMain(void *arg)
+{
+    icsJobWorker((Ics_Context*)arg);
+    return 0;
+}
+#else
+static void *icsJobThreadMain(void *arg)
+{
+    icsJobWorker((Ics_Context*)arg);
+    return NULL;
+}
+#endif
+
+
+/* Start a detached worker thread. Returns 0 on failure. */
+static int icsStartWorker(Ics_Context *context)
+{
+#if defined(_WIN32)
+    HANDLE thread;
+
+
+    thread = (HANDLE)_beginthreadex(NULL, 0, icsJobThreadMain, context, 0,
+                                    NULL);
+    if (thread == 0) return 0;
+    CloseHandle(thread);
+    return 1;
+#else
+    pthread_t thread;
+
+
+    if (pthread_create(&thread, NULL, icsJobThreadMain, context) != 0)
+        return 0;
+    pthread_detach(thread);
+    return 1;
+#endif
+}
+
+#endif /* ICS_THREADS */
+
+
+/* Call func(data) in a worker thread of the context, or of the global queue
+   if context is NULL. Jobs are started in the order they are queued. Returns
+   IcsErr_NotValidAction if no worker thread can be started to run it. Without
+   threads, func is called before returning. */
+Ics_Error IcsStartJob(Ics_Context  *context,
+                      Ics_JobFunc   func,
+                      void         *data)
+{
+    ICSINIT;
+#ifdef ICS_THREADS
+    Ics_JobQueue *queue   = context != NULL ? &context->jobs : &icsJobs;
+    Ics_Job      *job;
+
+
+        /* Reuse the record of a finished job */
+    IcsLockJobs();
+    job = queue->spare;
+    if (job != NULL) queue->spare = job->next;
+    IcsUnlockJobs();
+    if (job == NULL) {
+        job = (Ics_Job*)IcsContextAlloc(context, sizeof(Ics_Job));
+        if (job == NULL) return IcsErr_Alloc;
+    }
+    job->func = func;
+    job->data = data;
+    job->next = NULL;
+    IcsLockJobs();
+    if (queue->last != NULL) {
+        queue->last->next = job;
+    } else {
+        queue->first = job;
+    }
+    queue->last = job;
+    queue->nQueued++;
+    if (queue->nIdle > 0) IcsSignalJobs();
+    if ((queue->nQueued > queue->nIdle)
+        && (queue->nWorkers < IcsGetContextThreads(context))) {
+        if (icsStartWorker(context)) {
+            queue->nWorkers++;
+        } else if (queue->nWorkers == 0) {
+                /* No worker to run it: the job is the only one queued */
+            queue->first = queue->last = NULL;
+            queue->nQueued = 0;
+            error = IcsErr_NotValidAction;
+        }
+    }
+    if (error) {
+        job->next = queue->spare;
+        queue->spare = job;
+    }
+    IcsUnlockJobs();
+#else
+    (void)context;
+    func(data);
+#endif
+
+    return error;
+}
+
+
+/* Stop the workers of a context, after they ran the queued jobs, and free the
+   records of finished jobs. */
+void IcsStopJobs(Ics_Context *context)
+{
+    Ics_Job *job;
+
+
+    IcsLockJobs();
+    context->jobs.stop = 1;
+    IcsSignalJobs();
+    while (context->jobs.nWorkers > 0) {
+        IcsWaitJobs();
+    }
+    IcsUnlockJobs();
+    while (context->jobs.spare != NULL) {
+        job = context->jobs.spare;
+        context->jobs.spare = job->next;
+        IcsContextFree(context, job);
+    }
+}
+
+
+void IcsLockJobs(void)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(&icsJobLock);
+#else
+    pthread_mutex_lock(&icsJobLock);
+#endif
+#endif
+}
+
+
+void IcsUnlockJobs(void)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    ReleaseSRWLockExclusive(&icsJobLock);
+#else
+    pthread_mutex_unlock(&icsJobLock);
+#endif
+#endif
+}
+
+
+/* Wait until IcsSignalJobs() is called. Must be called with the lock held. */
+void IcsWaitJobs(void)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    SleepConditionVariableSRW(&icsJobDone, &icsJobLock, INFINITE, 0);
+#else
+    pthread_cond_wait(&icsJobDone, &icsJobLock);
+#endif
+#endif
+}
+
+
+/* Wake up all threads in IcsWaitJobs(). */
+void IcsSignalJobs(void)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    WakeAllConditionVariable(&icsJobDone);
+#else
+    pthread_cond_broadcast(&icsJobDone);
+#endif
+#endif
+}
+
+
+/* Lock the memory accounting of the handles using context, and the memory and
+   scratch buffers of the context itself. Handles without a context share one
+   of the locks. Allocators are not called with this lock held. */
+void IcsLockMemory(const Ics_Context *context)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(icsMemoryLock(context));
+#else
+    pthread_mutex_lock(icsMemoryLock(context));
+#endif
+#else
+    (void)context;
+#endif
+}
+
+
+void IcsUnlockMemory(const Ics_Context *context)
+{
+#ifdef ICS_THREADS
+#if defined(_WIN32)
+    ReleaseSRWLockExclusive(icsMemoryLock(context));
+#else
+    pthread_mutex_unlock(icsMemoryLock(context));
+#endif
+#else
+    (void)context;
+#endif
+}
+
+
+/* Add to a counter and return the new value. */
+size_t IcsAtomicAdd(volatile size_t *value,
+                    size_t           add)
+{
+#if !defined(ICS_THREADS)
+    return *value += add;
+#elif defined(_WIN32)
+#if defined(_WIN64)
+    return (size_t)InterlockedExchangeAdd64((volatile LONG64*)value,
+                                            (LONG64)add) + add;
+#else
+    return (size_t)InterlockedExchangeAdd((volatile LONG*)value,
+                                          (LONG)add) + add;
+#endif
+#else
+    return __atomic_add_fetch(value, add, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+int IcsAtomicGet(volatile int *value)
+{
+#if !defined(ICS_THREADS)
+    return *value;
+#elif defined(_WIN32)
+    return (int)InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+void IcsAtomicSet(volatile int *value,
+                  int           newValue)
+{
+#if !defined(ICS_THREADS)
+    *value = newValue;
+#elif defined(_WIN32)
+    InterlockedExchange((volatile LONG*)value, (LONG)newValue);
+#else
+    __atomic_store_n(value, newValue, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+/* Set value to newValue if it equals expected. Returns 1 if it did. */
+int IcsAtomicCas(volatile int *value,
+                 int           expected,
+                 int           newValue)
+{
+#if !defined(ICS_THREADS)
+    if (*value != expected) return 0;
+    *value = newValue;
+    return 1;
+#elif defined(_WIN32)
+    return InterlockedCompareExchange((volatile LONG*)value, (LONG)newValue,
+                                      (LONG)expected) == (LONG)expected;
+#else
+    return __atomic_compare_exchange_n(value, &expected, newValue, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+/* Set *ptr to newValue if it equals *expected, and return 1. Otherwise set
+   *expected to the current value of *ptr, and return 0. */
+int IcsAtomicCasPtr(void *volatile *ptr,
+                    void          **expected,
+                    void           *newValue)
+{
+#if !defined(ICS_THREADS)
+    if (*ptr != *expected) {
+        *expected = *ptr;
+        return 0;
+    }
+    *ptr = newValue;
+    return 1;
+#elif defined(_WIN32)
+    void *old = InterlockedCompareExchangePointer(ptr, newValue, *expected);
+    if (old == *expected) return 1;
+    *expected = old;
+    return 0;
+#else
+    return __atomic_compare_exchange_n(ptr, expected, newValue, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+/* Set *ptr to newValue and return its old value. */
+void *IcsAtomicSwapPtr(void *volatile *ptr,
+                       void           *newValue)
+{
+#if !defined(ICS_THREADS)
+    void *old = *ptr;
+    *ptr = newValue;
+    return old;
+#elif defined(_WIN32)
+    return InterlockedExchangePointer(ptr, newValue);
+#else
+    return __atomic_exchange_n(ptr, newValue, __ATOMIC_SEQ_CST);
+#endif
+}
@@ -0,0 +1,693 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_tile.c
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsGetTileLayout()
+ *   IcsGetTileLines()
+ *   IcsIsTileCompression()
+ *   IcsTileCompressionName()
+ *   IcsTileSupports()
+ *   IcsEncodeTile()
+ *   IcsDecodeTile()
+ *   IcsWriteTiles()
+ *   IcsOpenTiles()
+ *   IcsCloseTiles()
+ *   IcsReadTileBlock()
+ *   IcsSetTileBlock()
+ *
+ * The image-specific codecs (see libics_loco.c and libics_fpred.c) compress the
+ * image in tiles, such that a block or region of the image can be read by
+ * decoding only the tiles it touches. A tile is a block of whole image lines
+ * within one 2D plane. The tiled data stream looks like:
+ *
+ *   tile 0, tile 1, ..., tile n-1,
+ *   n words with the length in bytes of each coded tile,
+ *   lines per tile, n, "ICSTILES"
+ *
+ * with the words stored as 64-bit little-endian values. The index is at the
+ * end so that the tiles can be written as they are coded; the stream extends to
+ * the end of the file. Each coded tile starts with a byte that indicates
+ * whether the tile is coded or stored: a tile that does not get smaller by
+ * coding is stored as-is.
+ *
+ * Tiles are coded and decoded in parallel (see IcsParallelFor()), in batches
+ * of ICS_TILE_BATCH tiles per thread, to limit the memory used.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "libics_intern.h"
+
+
+#define ICS_TILE_MAGIC  "ICSTILES"
+#define ICS_TILE_STORED 0
+#define ICS_TILE_CODED  1
+#define ICS_TILE_BATCH  4
+
+
+/* Codec interface. */
+typedef struct {
+    Ics_Compression   compression;
+    const char       *name;
+    int             (*supports)(Ics_DataType);
+    Ics_Error       (*encode)(const void*, Ics_DataType, size_t, size_t,
+                              unsigned char*, size_t, size_t*,
+                              const Ics_Header*);
+    Ics_Error       (*decode)(const unsigned char*, size_t, Ics_DataType,
+                              size_t, size_t, void*, const Ics_Header*);
+} Ics_TileCodec;
+
+
+static const Ics_TileCodec icsTileCodecs[] = {
+    {IcsCompr_loco, "loco", IcsLocoSupports, IcsLocoEncode, IcsLocoDecode},
+    {IcsCompr_fpred, "fpred", IcsFpredSupports, IcsFpredEncode, IcsFpredDecode}
+};
+#define ICS_N_TILE_CODECS (sizeof(icsTileCodecs) / sizeof(Ics_TileCodec))
+
+
+/* This is the struct behind the "void* tiles" in the Ics_BlockRead
+   structure: */
+typedef struct {
+    Ics_TileLayout  layout;
+    size_t         *offsets; /* file offset of each tile, and of the index */
+    size_t          pos;     /* current position in the image data */
+    size_t          current; /* tile in the buffer, nTiles if none */
+    char           *buffer;  /* holds the current tile */
+    unsigned char  *coded;   /* holds coded tiles */
+    size_t          codedSize;
+    size_t          batch;   /* maximum number of tiles decoded at once */
+} Ics_TileRead;
+
+
+/* A batch of tiles to be coded or decoded in parallel. */
+typedef struct {
+    const Ics_Header     *icsStruct;
+    const Ics_TileLayout *layout;
+    size_t                first;   /* first tile in the batch */
+    size_t                dim[ICS_MAXDIM];
+    char                 *raw;     /* tile data (one tile-sized slot per tile),
+                                      or NULL if not needed */
+    unsigned char        *coded;   /* coded tiles */
+    const size_t         *offsets; /* offset of each coded tile in coded */
+    size_t               *lengths; /* length of each coded tile */
+    char                 *out;     /* decoded image data */
+} Ics_TileBatch;
+
+
+static const Ics_TileCodec *icsGetTileCodec(Ics_Compression compression)
+{
+    size_t i;
+
+
+    for (i = 0; i < ICS_N_TILE_CODECS; i++) {
+        if (icsTileCodecs[i].compression == compression) {
+            return icsTileCodecs + i;
+        }
+    }
+    return NULL;
+}
+
+
+/* Divide the image in tiles. If linesPerTile is 0, tiles are made as large as
+   possible without exceeding maxBytes. */
+Ics_Error IcsGetTileLayout(const Ics_Header *icsStruct,
+                           size_t            linesPerTile,
+                           size_t            maxBytes,
+                           Ics_TileLayout   *layout)
+{
+    size_t nBytes = IcsGetDataTypeSize(icsStruct->imel.dataType);
+    int    i;
+
+
+    if ((icsStruct->dimensions < 1) || (nBytes == 0)) return IcsErr_NoLayout;
+    layout->lineBytes = icsStruct->dim[0].size * nBytes;
+    layout->linesPerPlane = icsStruct->dimensions > 1
+                          ? icsStruct->dim[1].size : 1;
+    layout->nPlanes = 1;
+    for (i = 2; i < icsStruct->dimensions; i++) {
+        layout->nPlanes *= icsStruct->dim[i].size;
+    }
+    if (linesPerTile == 0) {
+        linesPerTile = layout->lineBytes > 0 ? maxBytes / layout->lineBytes : 1;
+    }
+    if (linesPerTile < 1) linesPerTile = 1;
+    if (linesPerTile > layout->linesPerPlane) {
+        linesPerTile = layout->linesPerPlane;
+    }
+    layout->linesPerTile = linesPerTile;
+    layout->tilesPerPlane = linesPerTile > 0
+        ? (layout->linesPerPlane + linesPerTile - 1) / linesPerTile : 0;
+    layout->nTiles = layout->nPlanes * layout->tilesPerPlane;
+
+    return IcsErr_Ok;
+}
+
+
+/* Get the first image line and the number of lines of a tile. */
+void IcsGetTileLines(const Ics_TileLayout *layout,
+                     size_t                tile,
+                     size_t               *firstLine,
+                     size_t               *nLines)
+{
+    size_t plane = tile / layout->tilesPerPlane;
+    size_t line  = (tile % layout->tilesPerPlane) * layout->linesPerTile;
+
+
+    *firstLine = plane * layout->linesPerPlane + line;
+    *nLines = layout->linesPerPlane - line;
+    if (*nLines > layout->linesPerTile) *nLines = layout->linesPerTile;
+}
+
+
+/* Find the tile that contains position pos in the image data. */
+static size_t icsFindTile(const Ics_TileLayout *layout,
+                          size_t                pos)
+{
+    size_t line = pos / layout->lineBytes;
+
+
+    return (line / layout->linesPerPlane) * layout->tilesPerPlane
+        + (line % layout->linesPerPlane) / layout->linesPerTile;
+}
+
+
+/* Returns non-zero if the compression method codes data in tiles. */
+int IcsIsTileCompression(Ics_Compression compression)
+{
+    return icsGetTileCodec(compression) != NULL;
+}
+
+
+/* Returns the name of a tile compression method, used as file extension for
+   chunks in a chunk store. */
+const char *IcsTileCompressionName(Ics_Compression compression)
+{
+    const Ics_TileCodec *codec = icsGetTileCodec(compression);
+
+
+    return codec != NULL ? codec->name : "";
+}
+
+
+/* Returns non-zero if the tile compression method can code the data type. */
+int IcsTileSupports(Ics_Compression compression,
+                    Ics_DataType    dataType)
+{
+    const Ics_TileCodec *codec = icsGetTileCodec(compression);
+
+
+    return (codec != NULL) && codec->supports(dataType);
+}
+
+
+/* Code a tile of width x height imels. dest must have space for the tile data
+   plus one byte. The codec's buffers are scratch buffers of icsStruct. */
+Ics_Error IcsEncodeTile(Ics_Compression   compression,
+                        const void       *src,
+                        Ics_DataType      dataType,
+                        size_t            width,
+                        size_t            height,
+                        unsigned char    *dest,
+                        size_t           *length,
+                        const Ics_Header *icsStruct)
+{
+    ICSINIT;
+    const Ics_TileCodec *codec = icsGetTileCodec(compression);
+    size_t               n     = width * height
+                                 * IcsGetDataTypeSize(dataType);
+
+
+    if (codec == NULL) return IcsErr_UnknownCompression;
+    if (!codec->supports(dataType)) return IcsErr_IllParameter;
+
+    error = codec->encode(src, dataType, width, height, dest + 1, n, length,
+                          icsStruct);
+    if (error == IcsErr_BufferTooSmall) {
+            /* Coding doesn't pay off, store the tile as it is */
+        dest[0] = ICS_TILE_STORED;
+        memcpy(dest + 1, src, n);
+        *length = n + 1;
+        return IcsErr_Ok;
+    }
+    if (error) return error;
+    dest[0] = ICS_TILE_CODED;
+    (*length)++;
+
+    return error;
+}
+
+
+/* Decode a tile of width x height imels. */
+Ics_Error IcsDecodeTile(Ics_Compression      compression,
+                        const unsigned char *src,
+                        size_t               length,
+                        Ics_DataType         dataType,
+                        size_t               width,
+                        size_t               height,
+                        void                *dest,
+                        const Ics_Header    *icsStruct)
+{
+    const Ics_TileCodec *codec = icsGetTileCodec(compression);
+    size_t               n     = width * height
+                                 * IcsGetDataTypeSize(dataType);
+
+
+    if (codec == NULL) return IcsErr_UnknownCompression;
+    if (length < 1) return IcsErr_CorruptedStream;
+    switch (src[0]) {
+        case ICS_TILE_STORED:
+            if (length != n + 1) return IcsErr_CorruptedStream;
+            memcpy(dest, src + 1, n);
+            return IcsErr_Ok;
+        case ICS_TILE_CODED:
+            if (!codec->supports(dataType)) return IcsErr_IllParameter;
+            return codec->decode(src + 1, length - 1, dataType, width, height,
+                                 dest, icsStruct);
+        default:
+            return IcsErr_CorruptedStream;
+    }
+}
+
+
+/* Code one tile of a batch, into slot i of the coded buffer. */
+static Ics_Error icsEncodeBatchTile(void   *data,
+                                    size_t  i)
+{
+    Ics_TileBatch    *batch     = (Ics_TileBatch*)data;
+    const Ics_Header *icsStruct = batch->icsStruct;
+    size_t            tileBytes = batch->layout->linesPerTile
+                                  * batch->layout->lineBytes;
+    size_t            firstLine, nLines;
+    const char       *src;
+
+
+    IcsGetTileLines(batch->layout, batch->first + i, &firstLine, &nLines);
+    if (batch->raw != NULL) {
+        IcsGatherLines(icsStruct->data, batch->dim, icsStruct->dataStrides,
+                       icsStruct->dimensions,
+                       (int)IcsGetDataTypeSize(icsStruct->imel.dataType),
+                       firstLine, nLines, batch->raw + i * tileBytes);
+        src = batch->raw + i * tileBytes;
+    } else {
+        src = (const char*)icsStruct->data + firstLine * batch->layout->lineBytes;
+    }
+    return IcsEncodeTile(icsStruct->compression, src, icsStruct->imel.dataType,
+                         batch->dim[0], nLines,
+                         batch->coded + i * (tileBytes + 1), batch->lengths + i,
+                         icsStruct);
+}
+
+
+/* Write the image data as a tiled data stream. */
+Ics_Error IcsWriteTiles(const Ics_Header *icsStruct,
+                        FILE             *fp)
+{
+    ICSINIT;
+    Ics_Context   *context = (Ics_Context*)icsStruct->context;
+    Ics_TileLayout layout;
+    Ics_TileBatch  batch;
+    size_t         tileBytes, batchSize, tile, n, i;
+    ics_t_uint64  *lengths;
+    int            j;
+
+
+    error = IcsGetTileLayout(icsStruct, 0, ICS_TILE_SIZE, &layout);
+    if (error) return error;
+    if (!IcsTileSupports(icsStruct->compression, icsStruct->imel.dataType)) {
+        return IcsErr_IllParameter;
+    }
+    batch.icsStruct = icsStruct;
+    batch.layout = &layout;
+    for (j = 0; j < icsStruct->dimensions; j++) {
+        batch.dim[j] = icsStruct->dim[j].size;
+    }
+    tileBytes = layout.linesPerTile * layout.lineBytes;
+    batchSize = (size_t)IcsGetContextThreads(context) * ICS_TILE_BATCH;
+    if (batchSize > layout.nTiles) batchSize = layout.nTiles;
+    if (batchSize < 1) batchSize = 1;
+
+    batch.coded = NULL;
+    batch.lengths = NULL;
+    batch.raw = NULL;
+    lengths = (ics_t_uint64*)IcsGetScratch(icsStruct, (layout.nTiles + 1)
+                                           * sizeof(ics_t_uint64));
+    if (lengths == NULL) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+        /* Over the memory limit, code fewer tiles at a time */
+    for (;;) {
+        batch.coded = (unsigned char*)IcsGetScratch(icsStruct, batchSize
+                                                    * (tileBytes + 1));
+        batch.lengths = (size_t*)IcsGetScratch(icsStruct,
+                                               batchSize * sizeof(size_t));
+        if (icsStruct->dataStrides) {
+            batch.raw = (char*)IcsGetScratch(icsStruct, batchSize * tileBytes);
+        }
+        if ((batch.coded != NULL) && (batch.lengths != NULL)
+            && (!icsStruct->dataStrides || (batch.raw != NULL))) {
+            break;
+        }
+        IcsReleaseScratch(icsStruct, batch.coded);
+        IcsReleaseScratch(icsStruct, batch.lengths);
+        IcsReleaseScratch(icsStruct, batch.raw);
+        batch.coded = NULL;
+        batch.lengths = NULL;
+        batch.raw = NULL;
+        if (batchSize == 1) {
+            error = IcsErr_Alloc;
+            goto exit;
+        }
+        batchSize /= 2;
+    }
+
+        /* Code batches of tiles in parallel, and write them in order */
+    for (tile = 0; tile < layout.nTiles; tile += batchSize) {
+        n = layout.nTiles - tile;
+        if (n > batchSize) n = batchSize;
+        batch.first = tile;
+        error = IcsParallelFor(context, n, icsEncodeBatchTile, &batch);
+        if (error) goto exit;
+        for (i = 0; i < n; i++) {
+            if (fwrite(batch.coded + i * (tileBytes + 1), 1, batch.lengths[i],
+                       fp) != batch.lengths[i]) {
+                error = IcsErr_FWriteIds;
+                goto exit;
+            }
+            lengths[tile + i] = (ics_t_uint64)batch.lengths[i];
+        }
+    }
+
+        /* Write the index */
+    for (tile = 0; !error && tile < layout.nTiles; tile++) {
+        error = IcsPutWord(fp, lengths[tile]);
+    }
+    if (!error) error = IcsPutWord(fp, (ics_t_uint64)layout.linesPerTile);
+    if (!error) error = IcsPutWord(fp, (ics_t_uint64)layout.nTiles);
+    if (!error && fwrite(ICS_TILE_MAGIC, 1, 8, fp) != 8) {
+        error = IcsErr_FWriteIds;
+    }
+
+  exit:
+    IcsReleaseScratch(icsStruct, lengths);
+    IcsReleaseScratch(icsStruct, batch.coded);
+    IcsReleaseScratch(icsStruct, batch.lengths);
+    IcsReleaseScratch(icsStruct, batch.raw);
+    return error;
+}
+
+
+/* Read the tile index from the data file. */
+Ics_Error IcsOpenTiles(Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    FILE          *fp = br->dataFilePtr;
+    Ics_TileRead  *tr;
+    ics_t_uint64   linesPerTile, nTiles, length;
+    char           magic[8];
+    size_t         tile, start, maxLength = 0;
+    ics_t_sint64   end;
+
+
+    if (!IcsTileSupports(icsStruct->compression, icsStruct->imel.dataType)) {
+        return IcsErr_IllParameter;
+    }
+    start = (size_t)IcsFTell(fp);
+    if (IcsFSeek(fp, -24, SEEK_END) != 0) return IcsErr_CorruptedStream;
+    end = IcsFTell(fp);
+    if (end < 0) return IcsErr_FReadIds;
+    error = IcsGetWord(fp, &linesPerTile);
+    if (!error) error = IcsGetWord(fp, &nTiles);
+    if (error) return error;
+    if ((fread(magic, 1, 8, fp) != 8)
+        || (memcmp(magic, ICS_TILE_MAGIC, 8) != 0)) {
+        return IcsErr_CorruptedStream;
+    }
+
+    tr = (Ics_TileRead*)IcsGetScratch(icsStruct, sizeof(Ics_TileRead));
+    if (tr == NULL) return IcsErr_Alloc;
+    tr->offsets = NULL;
+    tr->buffer = NULL;
+    tr->coded = NULL;
+    tr->codedSize = 0;
+    tr->batch = (size_t)IcsGetContextThreads((Ics_Context*)icsStruct->context)
+                * ICS_TILE_BATCH;
+    tr->pos = 0;
+    error = IcsGetTileLayout(icsStruct, (size_t)linesPerTile, 0, &tr->layout);
+    if (!error && ((tr->layout.linesPerTile != (size_t)linesPerTile)
+                   || (tr->layout.nTiles != (size_t)nTiles)
+                   || ((ics_t_uint64)end < 8 * nTiles))) {
+        error = IcsErr_CorruptedStream;
+    }
+    tr->current = tr->layout.nTiles;
+
+        /* Read the tile lengths */
+    if (!error) {
+        tr->offsets = (size_t*)IcsGetScratch(icsStruct, (tr->layout.nTiles + 1)
+                                             * sizeof(size_t));
+        if (tr->offsets == NULL) error = IcsErr_Alloc;
+    }
+    if (!error && IcsFSeek(fp, end - 8 * (ics_t_sint64)nTiles, SEEK_SET) != 0) {
+        error = IcsErr_CorruptedStream;
+    }
+    if (!error) {
+        tr->offsets[0] = start;
+        for (tile = 0; tile < tr->layout.nTiles; tile++) {
+            error = IcsGetWord(fp, &length);
+            if (error) break;
+            tr->offsets[tile + 1] = tr->offsets[tile] + (size_t)length;
+            if ((size_t)length > maxLength) maxLength = (size_t)length;
+        }
+        if (!error && (tr->offsets[tr->layout.nTiles]
+                       != (size_t)end - 8 * (size_t)nTiles)) {
+            error = IcsErr_CorruptedStream;
+        }
+    }
+    if (!error) {
+        tr->buffer = (char*)IcsGetScratch(icsStruct, tr->layout.linesPerTile
+                                          * tr->layout.lineBytes + 1);
+        tr->codedSize = maxLength + 1;
+        tr->coded = (unsigned char*)IcsGetScratch(icsStruct, tr->codedSize);
+        if ((tr->buffer == NULL) || (tr->coded == NULL)) error = IcsErr_Alloc;
+    }
+    if (error) {
+        IcsReleaseScratch(icsStruct, tr->offsets);
+        IcsReleaseScratch(icsStruct, tr->buffer);
+        IcsReleaseScratch(icsStruct, tr->coded);
+        IcsReleaseScratch(icsStruct, tr);
+        return error;
+    }
+
+    br->tiles = tr;
+    return error;
+}
+
+
+/* Free the tile index. */
+Ics_Error IcsCloseTiles(Ics_Header *icsStruct)
+{
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_TileRead  *tr = (Ics_TileRead*)br->tiles;
+
+
+    IcsReleaseScratch(icsStruct, tr->offsets);
+    IcsReleaseScratch(icsStruct, tr->buffer);
+    IcsReleaseScratch(icsStruct, tr->coded);
+    IcsReleaseScratch(icsStruct, tr);
+    br->tiles = NULL;
+
+    return IcsErr_Ok;
+}
+
+
+/* Decode one tile of a batch. */
+static Ics_Error icsDecodeBatchTile(void   *data,
+                                    size_t  i)
+{
+    Ics_TileBatch    *batch     = (Ics_TileBatch*)data;
+    const Ics_Header *icsStruct = batch->icsStruct;
+    size_t            first, firstLine, nLines;
+
+
+    IcsGetTileLines(batch->layout, batch->first, &first, &nLines);
+    IcsGetTileLines(batch->layout, batch->first + i, &firstLine, &nLines);
+    return IcsDecodeTile(icsStruct->compression, batch->coded + batch->offsets[i],
+                         batch->offsets[i + 1] - batch->offsets[i],
+                         icsStruct->imel.dataType, icsStruct->dim[0].size,
+                         nLines,
+                         batch->out + (firstLine - first)
+                         * batch->layout->lineBytes, icsStruct);
+}
+
+
+/* Decode n consecutive whole tiles in parallel, directly into out. */
+static Ics_Error icsLoadTiles(Ics_Header *icsStruct,
+                              size_t      tile,
+                              size_t      n,
+                              char       *out)
+{
+    ICSINIT;
+    Ics_Context   *context = (Ics_Context*)icsStruct->context;
+    Ics_BlockRead *br      = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_TileRead  *tr      = (Ics_TileRead*)br->tiles;
+    Ics_TileBatch  batch;
+    size_t         length, i, half, first, firstLine, nLines;
+    size_t        *offsets;
+    unsigned char *coded;
+
+
+        /* The coded tiles are stored back-to-back, read them in one go */
+    length = tr->offsets[tile + n] - tr->offsets[tile];
+    if (length > tr->codedSize) {
+        coded = (unsigned char*)IcsGetScratch(icsStruct, length);
+        if (coded == NULL) {
+                /* Over the memory limit, decode the tiles in two halves; a
+                   single tile always fits */
+            if (n == 1) return IcsErr_Alloc;
+            half = n / 2;
+            IcsGetTileLines(&tr->layout, tile, &first, &nLines);
+            IcsGetTileLines(&tr->layout, tile + half, &firstLine, &nLines);
+            error = icsLoadTiles(icsStruct, tile, half, out);
+            if (error) return error;
+            return icsLoadTiles(icsStruct, tile + half, n - half,
+                                out + (firstLine - first)
+                                * tr->layout.lineBytes);
+        }
+        IcsReleaseScratch(icsStruct, tr->coded);
+        tr->coded = coded;
+        tr->codedSize = length;
+    }
+    if (IcsFSeek(br->dataFilePtr, (ics_t_sint64)tr->offsets[tile],
+                 SEEK_SET) != 0) {
+        return IcsErr_FReadIds;
+    }
+    if (fread(tr->coded, 1, length, br->dataFilePtr) != length) {
+        return ferror(br->dataFilePtr) ? IcsErr_FReadIds : IcsErr_EndOfStream;
+    }
+    offsets = (size_t*)IcsGetScratch(icsStruct, (n + 1) * sizeof(size_t));
+    if (offsets == NULL) return IcsErr_Alloc;
+    for (i = 0; i <= n; i++) {
+        offsets[i] = tr->offsets[tile + i] - tr->offsets[tile];
+    }
+
+    batch.icsStruct = icsStruct;
+    batch.layout = &tr->layout;
+    batch.first = tile;
+    batch.coded = tr->coded;
+    batch.offsets = offsets;
+    batch.out = out;
+    error = IcsParallelFor(context, n, icsDecodeBatchTile, &batch);
+    IcsReleaseScratch(icsStruct, offsets);
+
+    return error;
+}
+
+
+/* Read a data block from a tiled data stream. */
+Ics_Error IcsReadTileBlock(Ics_Header *icsStruct,
+                           void       *outBuf,
+                           size_t      len)
+{
+    ICSINIT;
+    Ics_BlockRead *br  = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_TileRead  *tr  = (Ics_TileRead*)br->tiles;
+    char          *out = (char*)outBuf;
+    size_t         tile, firstLine, nLines, start, inTile, n, nTiles;
+    size_t         total = tr->layout.nPlanes * tr->layout.linesPerPlane
+                           * tr->layout.lineBytes;
+
+
+    while (len > 0) {
+        if (tr->pos >= total) return IcsErr_EndOfStream;
+        tile = icsFindTile(&tr->layout, tr->pos);
+        IcsGetTileLines(&tr->layout, tile, &firstLine, &nLines);
+        start = firstLine * tr->layout.lineBytes;
+        inTile = tr->pos - start;
+        n = nLines * tr->layout.lineBytes - inTile;
+        if (n > len) n = len;
+        if ((tile != tr->current) && (n == nLines * tr->layout.lineBytes)) {
+                /* Whole tiles are requested, decode them in place */
+            nTiles = 1;
+            while ((nTiles < tr->batch) && (tile + nTiles < tr->layout.nTiles)) {
+                IcsGetTileLines(&tr->layout, tile + nTiles, &firstLine,
+                                &nLines);
+                if (n + nLines * tr->layout.lineBytes > len) break;
+                n += nLines * tr->layout.lineBytes;
+                nTiles++;
+            }
+            error = icsLoadTiles(icsStruct, tile, nTiles, out);
+            if (error) return error;
+        } else {
+            if (tile != tr->current) {
+                tr->current = tr->layout.nTiles;
+                error = icsLoadTiles(icsStruct, tile, 1, tr->buffer);
+                if (error) return error;
+                tr->current = tile;
+            }
+            memcpy(out, tr->buffer + inTile, n);
+        }
+        out += n;
+        len -= n;
+        tr->pos += n;
+    }
+
+    return error;
+}
+
+
+/* Set the read position in a tiled data stream. */
+Ics_Error IcsSetTileBlock(Ics_Header   *icsStruct,
+                          ics_t_sint64  offset,
+                          int           whence)
+{
+    Ics_BlockRead *br = (Ics_BlockRead*)icsStruct->blockRead;
+    Ics_TileRead  *tr = (Ics_TileRead*)br->tiles;
+    size_t         total = tr->layout.nPlanes * tr->layout.linesPerPlane
+                           * tr->layout.lineBytes;
+    size_t         base;
+
+
+    base = whence == SEEK_CUR ? tr->pos : 0;
+    if ((offset < 0) && ((size_t)(-offset) > base)) return IcsErr_IllParameter;
+    base = offset < 0 ? base - (size_t)(-offset) : base + (size_t)offset;
+    if (base > total) return IcsErr_EndOfStream;
+    tr->pos = base;
+
+    return IcsErr_Ok;
+}
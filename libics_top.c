@@ -45,11 +45,20 @@
  *   IcsGetDataBlock()
  *   IcsSkipDataBlock()
  *   IcsGetROIData()
+ *   IcsGetROIDataWithStrides()
  *   IcsGetDataWithStrides()
  *   IcsSetData()
  *   IcsSetDataWithStrides()
+ *   IcsSetDataSource()
+ *   IcsCopyMetadata()
  *   IcsSetSource()
+ *   IcsSetDedupStore()
+ *   IcsSetChunkStore()
  *   IcsSetCompression()
+ *   IcsSetTemporalDelta()
+ *   IcsSetZoneMap()
+ *   IcsSetZipIndex()
+ *   IcsSetDurability()
  *   IcsGetPosition()
  *   IcsGetPositionF()
  *   IcsSetPosition()
@@ -136,8 +145,15 @@ Ics_Error IcsOpen(ICS        **ics,
             *ics = NULL;
         } else {
             if (writing) {
-                    /* We're updating */
+                    /* We're updating. The history is read now, as the file is
+                       replaced when closing */
                 (*ics)->fileMode = IcsFileMode_update;
+                error = IcsReadHistory(*ics);
+                if (error) {
+                    IcsFreeHistory(*ics);
+                    free(*ics);
+                    *ics = NULL;
+                }
             } else {
                     /* We're just reading */
                 (*ics)->fileMode = IcsFileMode_read;
@@ -147,6 +163,7 @@ Ics_Error IcsOpen(ICS        **ics,
             /* We're writing */
         IcsInit(*ics);
         (*ics)->fileMode = IcsFileMode_write;
+        (*ics)->durability = IcsGetDefaultDurability();
         if (version) {
             (*ics)->version = version;
         }
@@ -170,13 +187,32 @@ Ics_Error IcsClose(ICS *ics)
     if (ics == NULL) return IcsErr_NotValidAction;
     if (ics->fileMode == IcsFileMode_read) {
             /* We're reading */
+        IcsDetachReads(ics);
         if (ics->blockRead != NULL) {
             error = IcsCloseIds(ics);
         }
     } else if (ics->fileMode == IcsFileMode_write) {
             /* We're writing */
-        error = IcsWriteIcs(ics, NULL);
-        if (!error) error = IcsWriteIds(ics);
+        if (ics->frameWriter != NULL) {
+                /* The header was written, wait for the last frames */
+            error = IcsFinishFrames(ics);
+        } else if (ics->dataMap != NULL) {
+                /* The header was written and the data is in the file */
+            if (ics->writeZoneMap) error = IcsWriteZoneMap(ics);
+            if (!error) {
+                error = IcsUnmapData(ics);
+            } else {
+                IcsUnmapData(ics);
+            }
+        } else {
+            error = IcsWriteIcs(ics, NULL);
+            if (!error) error = IcsWriteIds(ics);
+        }
+        if (!error && ics->writeZoneMap) error = IcsStampZoneMap(ics);
+        if (!error && !ics->writeZoneMap) IcsRemoveZoneMap(ics);
+        if (!error && !IcsWritesZipIndex(ics)) IcsRemoveZipIndex(ics);
+            /* Make the files durable before the ICS file appears */
+        error = IcsCommitOutput(ics, error);
     } else {
             /* We're updating */
         int needcopy = 0;
@@ -211,6 +247,7 @@ Ics_Error IcsClose(ICS *ics)
         }
     }
     IcsFreeHistory(ics);
+    free(ics->dataSource);
     free(ics);
 
     return error;
@@ -376,31 +413,75 @@ Ics_Error IcsSkipDataBlock(ICS    *ics,
 
 /* Read a square region of the image from an ICS file. */
 Ics_Error IcsGetROIData(ICS          *ics,
-                        const size_t *offsetPtr,
-                        const size_t *sizePtr,
-                        const size_t *samplingPtr,
-                        void         *destPtr,
+                        const size_t *offset,
+                        const size_t *size,
+                        const size_t *sampling,
+                        void         *dest,
                         size_t        n)
 {
     ICSINIT;
-    int           i, sizeConflict = 0, p;
-    size_t        j;
-    size_t        imelSize, roiSize, curLoc, newLoc, bufSize;
-    size_t        curPos[ICS_MAXDIM];
-    size_t        stride[ICS_MAXDIM];
-    size_t        bOffset[ICS_MAXDIM];
-    size_t        bSize[ICS_MAXDIM];
-    size_t        bSampling[ICS_MAXDIM];
-    const size_t *offset, *size, *sampling;
-    char         *buf;
-    char         *dest            = (char*)destPtr;
+    int    i;
+    size_t roiSize, o, s, d;
 
 
     if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
         return IcsErr_NotValidAction;
 
-    if ((n == 0) ||(dest == NULL)) return IcsErr_Ok;
+    if ((n == 0) || (dest == NULL)) return IcsErr_Ok;
+    roiSize = (size_t)IcsGetBytesPerSample(ics);
+    for (i = 0; i < ics->dimensions; i++) {
+        o = offset != NULL ? offset[i] : 0;
+        if (o > ics->dim[i].size) return IcsErr_IllegalROI;
+        s = size != NULL ? size[i] : ics->dim[i].size - o;
+        d = sampling != NULL ? sampling[i] : 1;
+        if (d < 1 || o + s > ics->dim[i].size) return IcsErr_IllegalROI;
+        roiSize *= (s + d - 1) / d;
+    }
+    if (n < roiSize) return IcsErr_BufferTooSmall;
+    error = IcsGetROIDataWithStrides(ics, offset, size, sampling, dest, NULL,
+                                     ics->dimensions);
+    if ((error == IcsErr_Ok) && (n != roiSize)) {
+        error = IcsErr_OutputNotFilled;
+    }
+
+    return error;
+}
+
+
+/* Read a square region of the image from an ICS file into a sub-block of a
+   memory block. The strides are given in samples, for the dimensions of the
+   (sub-sampled) region. */
+Ics_Error IcsGetROIDataWithStrides(ICS             *ics,
+                                   const size_t    *offsetPtr,
+                                   const size_t    *sizePtr,
+                                   const size_t    *samplingPtr,
+                                   void            *destPtr,
+                                   const ptrdiff_t *stridePtr,
+                                   int              nDims)
+{
+    ICSINIT;
+    int              i, p, direct;
+    size_t           j, count;
+    size_t           imelSize, curLoc, newLoc, bufSize;
+    size_t           curPos[ICS_MAXDIM];
+    size_t           fileStride[ICS_MAXDIM];
+    size_t           bOffset[ICS_MAXDIM];
+    size_t           bSize[ICS_MAXDIM];
+    size_t           bSampling[ICS_MAXDIM];
+    ptrdiff_t        bStride[ICS_MAXDIM];
+    const size_t    *offset, *size, *sampling;
+    const ptrdiff_t *stride;
+    char            *buf              = NULL;
+    char            *dest             = (char*)destPtr;
+    char            *out;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if (dest == NULL) return IcsErr_Ok;
     p = ics->dimensions;
+    if (nDims != p) return IcsErr_IllParameter;
     if (offsetPtr != NULL) {
         offset = offsetPtr;
     } else {
@@ -409,6 +490,9 @@ Ics_Error IcsGetROIData(ICS          *ics,
         }
         offset = bOffset;
     }
+    for (i = 0; i < p; i++) {
+        if (offset[i] > ics->dim[i].size) return IcsErr_IllegalROI;
+    }
     if (sizePtr != NULL) {
         size = sizePtr;
     } else {
@@ -429,213 +513,106 @@ Ics_Error IcsGetROIData(ICS          *ics,
         if (sampling[i] < 1 || offset[i] + size[i] > ics->dim[i].size)
             return IcsErr_IllegalROI;
     }
-    imelSize = (size_t)IcsGetBytesPerSample(ics);
-    roiSize = imelSize;
     for (i = 0; i < p; i++) {
-        roiSize *= (size[i] + sampling[i] - 1) / sampling[i];
+        if (size[i] == 0) return IcsErr_Ok;
     }
-    if (n != roiSize) {
-        sizeConflict = 1;
-        if (n < roiSize) return IcsErr_BufferTooSmall;
+    if (stridePtr != NULL) {
+        stride = stridePtr;
+    } else {
+        bStride[0] = 1;
+        for (i = 1; i < p; i++) {
+            bStride[i] = bStride[i - 1]
+                * (ptrdiff_t)((size[i - 1] + sampling[i - 1] - 1)
+                              / sampling[i - 1]);
+        }
+        stride = bStride;
     }
-        /* The stride array tells us how many imels to skip to go the next pixel
-           in each dimension */
-    stride[0] = 1;
+    imelSize = (size_t)IcsGetBytesPerSample(ics);
+        /* The file stride array tells us how many imels to skip to go the next
+           pixel in each dimension */
+    fileStride[0] = 1;
     for (i = 1; i < p; i++) {
-        stride[i] = stride[i - 1] * ics->dim[i - 1].size;
+        fileStride[i] = fileStride[i - 1] * ics->dim[i - 1].size;
     }
-    error = IcsOpenIds(ics);
-    if (error) return error;
-    bufSize = imelSize*size[0];
-    if (sampling[0] > 1) {
-            /* We read a line in a buffer, and then copy the needed imels to
-               dest */
-        buf =(char*)malloc(bufSize);
+    bufSize = imelSize * size[0];
+    count = (size[0] + sampling[0] - 1) / sampling[0];
+        /* Without subsampling or strides in dim[0] we read directly into dest,
+           otherwise we read a line in a buffer and copy the needed imels */
+    direct = (sampling[0] == 1) && (stride[0] == 1);
+    if (!direct) {
+        buf = (char*)IcsGetScratch(ics, bufSize);
         if (buf == NULL) return IcsErr_Alloc;
-        curLoc = 0;
+    }
+    error = IcsOpenIds(ics);
+    if (error) {
+        IcsReleaseScratch(ics, buf);
+        return error;
+    }
+    curLoc = 0;
+    for (i = 0; i < p; i++) {
+        curPos[i] = offset[i];
+    }
+    while (1) {
+        newLoc = 0;
+        out = dest;
         for (i = 0; i < p; i++) {
-            curPos[i] = offset[i];
+            newLoc += curPos[i] * fileStride[i];
+            out += (ptrdiff_t)((curPos[i] - offset[i]) / sampling[i])
+                * stride[i] * (ptrdiff_t)imelSize;
         }
-        while (1) {
-            newLoc = 0;
-            for (i = 0; i < p; i++) {
-                newLoc += curPos[i] * stride[i];
-            }
-            newLoc *= imelSize;
-            if (curLoc < newLoc) {
-                error = IcsSkipIdsBlock(ics, newLoc - curLoc);
-                curLoc = newLoc;
-            }
-            if (!error) error = IcsReadIdsBlock(ics, buf, bufSize);
-            if (error != IcsErr_Ok) {
-                break; /* stop reading on error */
-            }
-            curLoc += bufSize;
-            for (j=0; j < size[0]; j += sampling[0]) {
-                memcpy(dest, buf + (unsigned)i * imelSize, imelSize);
-                dest += imelSize;
-            }
-            for (i = 1; i < p; i++) {
-                curPos[i] += sampling[i];
-                if (curPos[i] < offset[i] + size[i]) {
-                    break;
-                }
-                curPos[i] = offset[i];
-            }
-            if (i==p) {
-                break; /* we're done reading */
-            }
+        newLoc *= imelSize;
+        if (curLoc < newLoc) {
+            error = IcsSkipIdsBlock(ics, newLoc - curLoc);
+            curLoc = newLoc;
         }
-        free(buf);
-    } else {
-            /* No subsampling in dim[0] required: read directly into dest */
-        curLoc = 0;
-        for (i = 0; i < p; i++) {
-            curPos[i] = offset[i];
+        if (!error) error = IcsReadIdsBlock(ics, direct ? out : buf, bufSize);
+        if (error != IcsErr_Ok) {
+            break; /* stop reading on error */
         }
-        while (1) {
-            newLoc = 0;
-            for (i = 0; i < p; i++) {
-                newLoc += curPos[i] * stride[i];
-            }
-            newLoc *= imelSize;
-            if (curLoc < newLoc) {
-                error = IcsSkipIdsBlock(ics, newLoc - curLoc);
-                curLoc = newLoc;
-            }
-            if (!error) error = IcsReadIdsBlock(ics, dest, bufSize);
-            if (error != IcsErr_Ok) {
-                break; /* stop reading on error */
-            }
-            curLoc += bufSize;
-            dest += bufSize;
-            for (i = 1; i < p; i++) {
-                curPos[i] += sampling[i];
-                if (curPos[i] < offset[i] + size[i]) {
-                    break;
-                }
-                curPos[i] = offset[i];
+        curLoc += bufSize;
+        if (!direct && stride[0] == 1) {
+            IcsGetKernels()->gather(out, buf,
+                                    (ptrdiff_t)(sampling[0] * imelSize),
+                                    count, imelSize);
+        } else if (!direct && sampling[0] == 1) {
+            IcsGetKernels()->scatter(out, stride[0] * (ptrdiff_t)imelSize, buf,
+                                     count, imelSize);
+        } else if (!direct) {
+            for (j = 0; j < count; j++) {
+                memcpy(out, buf + j * sampling[0] * imelSize, imelSize);
+                out += stride[0] * (ptrdiff_t)imelSize;
             }
-            if (i==p) {
-                break; /* we're done reading */
+        }
+        for (i = 1; i < p; i++) {
+            curPos[i] += sampling[i];
+            if (curPos[i] < offset[i] + size[i]) {
+                break;
             }
+            curPos[i] = offset[i];
+        }
+        if (i == p) {
+            break; /* we're done reading */
         }
     }
+    IcsReleaseScratch(ics, buf);
     if (error)
         IcsCloseIds(ics);
     else
         error = IcsCloseIds(ics);
 
-    if ((error == IcsErr_Ok) && sizeConflict) {
-        error = IcsErr_OutputNotFilled;
-    }
     return error;
 }
 
 
 /* Read the image data into a region of your buffer. */
 Ics_Error IcsGetDataWithStrides(ICS             *ics,
-                                void            *destPtr,
+                                void            *dest,
                                 size_t           n, /* ignored */
-                                const ptrdiff_t *stridePtr,
+                                const ptrdiff_t *stride,
                                 int              nDims)
 {
-    ICSINIT;
-    int              i, p;
-    size_t           j;
-    size_t           imelSize, bufSize;
-    size_t           curPos[ICS_MAXDIM];
-    ptrdiff_t        b_stride[ICS_MAXDIM];
-    ptrdiff_t const *stride;
-    char            *buf;
-    char            *dest = (char*)destPtr;
-    char            *out;
-
-
-    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
-        return IcsErr_NotValidAction;
-
-    if (dest == NULL) return IcsErr_Ok;
-    p = ics->dimensions;
-    if (nDims != p) return IcsErr_IllParameter;
-    if (stridePtr != NULL) {
-        stride = stridePtr;
-    } else {
-        b_stride[0] = 1;
-        for (i = 1; i < p; i++) {
-            b_stride[i] = b_stride[i - 1] * (ptrdiff_t)ics->dim[i - 1].size;
-        }
-        stride = b_stride;
-    }
-    imelSize = (size_t)IcsGetBytesPerSample(ics);
-
-    error = IcsOpenIds(ics);
-    if (error) return error;
-    bufSize = imelSize * ics->dim[0].size;
-    if (stride[0] != 1) {
-            /* We read a line in a buffer, and then copy the imels to dest */
-        buf = (char*)malloc(bufSize);
-        if (buf == NULL) return IcsErr_Alloc;
-        for (i = 0; i < p; i++) {
-            curPos[i] = 0;
-        }
-        while (1) {
-            out = dest;
-            for (i = 1; i < p; i++) {
-                out += (ptrdiff_t)curPos[i] * stride[i] * (ptrdiff_t)imelSize;
-            }
-            if (!error) error = IcsReadIdsBlock(ics, buf, bufSize);
-            if (error != IcsErr_Ok) {
-                break; /* stop reading on error */
-            }
-            for (j = 0; j < ics->dim[0].size; j++) {
-                memcpy(out, buf + j * imelSize, imelSize);
-                out += stride[0] * (ptrdiff_t)imelSize;
-            }
-            for (i = 1; i < p; i++) {
-                curPos[i]++;
-                if (curPos[i] < ics->dim[i].size) {
-                    break;
-                }
-                curPos[i] = 0;
-            }
-            if (i==p) {
-                break; /* we're done reading */
-            }
-        }
-        free(buf);
-    } else {
-            /* No subsampling in dim[0] required: read directly into dest */
-        for (i = 0; i < p; i++) {
-            curPos[i] = 0;
-        }
-        while (1) {
-            out = dest;
-            for (i = 1; i < p; i++) {
-                out += (ptrdiff_t)curPos[i] * stride[i] * (ptrdiff_t)imelSize;
-            }
-            if (!error) error = IcsReadIdsBlock(ics, out, bufSize);
-            if (error != IcsErr_Ok) {
-                break; /* stop reading on error */
-            }
-            for (i = 1; i < p; i++) {
-                curPos[i]++;
-                if (curPos[i] < ics->dim[i].size) {
-                    break;
-                }
-                curPos[i] = 0;
-            }
-            if (i==p) {
-                break; /* we're done reading */
-            }
-        }
-    }
-    if (error)
-        IcsCloseIds(ics);
-    else
-        error = IcsCloseIds(ics);
-
-    return error;
+    return IcsGetROIDataWithStrides(ics, NULL, NULL, NULL, dest, stride,
+                                    nDims);
 }
 
 
@@ -652,6 +629,8 @@ Ics_Error IcsSetData(ICS        *ics,
 
     if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
     if (ics->data != NULL) return IcsErr_DuplicateData;
+    if (ics->dataSource != NULL) return IcsErr_DuplicateData;
+    if (ics->frameWriter != NULL) return IcsErr_DuplicateData;
     if (ics->dimensions == 0) return IcsErr_NoLayout;
     if (n != IcsGetDataSize(ics)) {
         error = IcsErr_FSizeConflict;
@@ -683,6 +662,8 @@ Ics_Error IcsSetDataWithStrides(ICS             *ics,
 
     if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
     if (ics->data != NULL) return IcsErr_DuplicateData;
+    if (ics->dataSource != NULL) return IcsErr_DuplicateData;
+    if (ics->frameWriter != NULL) return IcsErr_DuplicateData;
     if (ics->dimensions == 0) return IcsErr_NoLayout;
     if (nDims != ics->dimensions) return IcsErr_IllParameter;
     ics->data = src;
@@ -693,6 +674,122 @@ Ics_Error IcsSetDataWithStrides(ICS             *ics,
 }
 
 
+/* Set a function that provides the image data. */
+Ics_Error IcsSetDataSource(ICS                *ics,
+                           Ics_DataSourceFunc  func,
+                           void               *userData)
+{
+    ICSINIT;
+    Ics_DataSource *source;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if (func == NULL) return IcsErr_IllParameter;
+    if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->data != NULL) return IcsErr_DuplicateData;
+    if (ics->dataSource != NULL) return IcsErr_DuplicateData;
+    if (ics->frameWriter != NULL) return IcsErr_DuplicateData;
+    if (ics->dimensions == 0) return IcsErr_NoLayout;
+    source = (Ics_DataSource*)malloc(sizeof(Ics_DataSource));
+    if (source == NULL) return IcsErr_Alloc;
+    source->func = func;
+    source->userData = userData;
+    ics->dataSource = source;
+
+    return error;
+}
+
+
+/* Copy the sensor parameters. */
+static void icsCopySensor(ICS       *dest,
+                          const ICS *src)
+{
+#define ICS_COPY(field) memcpy(&dest->field, &src->field, sizeof(dest->field))
+    ICS_COPY(writeSensor);
+    ICS_COPY(writeSensorStates);
+    ICS_COPY(type);
+    ICS_COPY(model);
+    ICS_COPY(sensorChannels);
+    ICS_COPY(imagingDirection); ICS_COPY(imagingDirectionState);
+    ICS_COPY(numAperture); ICS_COPY(numApertureState);
+    ICS_COPY(objectiveQuality); ICS_COPY(objectiveQualityState);
+    ICS_COPY(refrInxMedium); ICS_COPY(refrInxMediumState);
+    ICS_COPY(refrInxLensMedium); ICS_COPY(refrInxLensMediumState);
+    ICS_COPY(pinholeRadius); ICS_COPY(pinholeRadiusState);
+    ICS_COPY(illPinholeRadius); ICS_COPY(illPinholeRadiusState);
+    ICS_COPY(pinholeSpacing); ICS_COPY(pinholeSpacingState);
+    ICS_COPY(excitationBeamFill); ICS_COPY(excitationBeamFillState);
+    ICS_COPY(lambdaEx); ICS_COPY(lambdaExState);
+    ICS_COPY(lambdaEm); ICS_COPY(lambdaEmState);
+    ICS_COPY(exPhotonCnt); ICS_COPY(exPhotonCntState);
+    ICS_COPY(interfacePrimary); ICS_COPY(interfacePrimaryState);
+    ICS_COPY(interfaceSecondary); ICS_COPY(interfaceSecondaryState);
+    ICS_COPY(detectorMagn); ICS_COPY(detectorMagnState);
+    ICS_COPY(detectorPPU); ICS_COPY(detectorPPUState);
+    ICS_COPY(detectorBaseline); ICS_COPY(detectorBaselineState);
+    ICS_COPY(detectorLineAvgCnt); ICS_COPY(detectorLineAvgCntState);
+    ICS_COPY(stedDepletionMode); ICS_COPY(stedDepletionModeState);
+    ICS_COPY(stedLambda); ICS_COPY(stedLambdaState);
+    ICS_COPY(stedSatFactor); ICS_COPY(stedSatFactorState);
+    ICS_COPY(stedImmFraction); ICS_COPY(stedImmFractionState);
+    ICS_COPY(stedVPPM); ICS_COPY(stedVPPMState);
+    ICS_COPY(spimExcType); ICS_COPY(spimExcTypeState);
+    ICS_COPY(spimFillFactor); ICS_COPY(spimFillFactorState);
+    ICS_COPY(spimPlaneNA); ICS_COPY(spimPlaneNAState);
+    ICS_COPY(spimPlaneGaussWidth); ICS_COPY(spimPlaneGaussWidthState);
+    ICS_COPY(spimPlanePropDir); ICS_COPY(spimPlanePropDirState);
+    ICS_COPY(spimPlaneCenterOff); ICS_COPY(spimPlaneCenterOffState);
+    ICS_COPY(spimPlaneFocusOff); ICS_COPY(spimPlaneFocusOffState);
+    ICS_COPY(scatterModel); ICS_COPY(scatterModelState);
+    ICS_COPY(scatterFreePath); ICS_COPY(scatterFreePathState);
+    ICS_COPY(scatterRelContrib); ICS_COPY(scatterRelContribState);
+    ICS_COPY(scatterBlurring); ICS_COPY(scatterBlurringState);
+#undef ICS_COPY
+}
+
+
+/* Copy all the metadata from one ICS structure to another. */
+Ics_Error IcsCopyMetadata(ICS       *dest,
+                          const ICS *src)
+{
+    ICSINIT;
+    static char const  seps[3] = {ICS_FIELD_SEP, ICS_EOL, '\0'};
+    Ics_History       *hist;
+    int                i;
+
+
+    if ((dest == NULL) || (dest->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+    if ((src == NULL) || (src->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    dest->dimensions = src->dimensions;
+    for (i = 0; i < ICS_MAXDIM; i++) {
+        dest->dim[i] = src->dim[i];
+    }
+    dest->imel = src->imel;
+    IcsStrCpy(dest->coord, src->coord, ICS_STRLEN_TOKEN);
+    IcsStrCpy(dest->scilType, src->scilType, ICS_STRLEN_TOKEN);
+    icsCopySensor(dest, src);
+
+        /* History lines are copied as they are */
+    if (!error) error = IcsReadHistory((ICS*)src);
+    hist = (Ics_History*)src->history;
+    if (hist != NULL) {
+        for (i = 0; !error && i < hist->nStr; i++) {
+            if (hist->strings[i] != NULL) {
+                error = IcsInternAddHistory(dest, "", hist->strings[i],
+                                            seps);
+            }
+        }
+    }
+
+    return error;
+}
+
+
 /* Set the image data source file. */
 Ics_Error IcsSetSource(ICS        *ics,
                        const char *fname,
@@ -707,6 +804,11 @@ Ics_Error IcsSetSource(ICS        *ics,
     if (ics->version == 1) return IcsErr_NotValidAction;
     if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
     if (ics->data != NULL) return IcsErr_DuplicateData;
+    if (ics->dataSource != NULL) return IcsErr_DuplicateData;
+    if (ics->frameWriter != NULL) return IcsErr_DuplicateData;
+    if (ics->dedupStore[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->chunkStore[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->deltaDim >= 0) return IcsErr_DuplicateData;
     IcsStrCpy(ics->srcFile, fname, ICS_MAXPATHLEN);
     ics->srcOffset = offset;
 
@@ -714,6 +816,64 @@ Ics_Error IcsSetSource(ICS        *ics,
 }
 
 
+/* Set the directory of the deduplicating chunk store the image data is written
+   to. */
+Ics_Error IcsSetDedupStore(ICS        *ics,
+                           const char *storeDir,
+                           size_t      chunkSize)
+{
+    ICSINIT;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if (ics->version == 1) return IcsErr_NotValidAction;
+    if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->chunkStore[0] != '\0') return IcsErr_DuplicateData;
+    if ((storeDir == NULL) || (storeDir[0] == '\0'))
+        return IcsErr_IllParameter;
+    IcsStrCpy(ics->dedupStore, storeDir, ICS_MAXPATHLEN);
+    ics->dedupChunkSize = chunkSize;
+
+    return error;
+}
+
+
+/* Set the directory the image data is written to, one file per chunk. */
+Ics_Error IcsSetChunkStore(ICS          *ics,
+                           const char   *storeDir,
+                           const size_t *chunkDims)
+{
+    ICSINIT;
+    int i;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if (ics->version == 1) return IcsErr_NotValidAction;
+    if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->dedupStore[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->deltaDim >= 0) return IcsErr_DuplicateData;
+    if (ics->dataMap != NULL) return IcsErr_DuplicateData;
+    if (ics->frameWriter != NULL) return IcsErr_DuplicateData;
+    if (ics->dimensions == 0) return IcsErr_NoLayout;
+    if ((storeDir == NULL) || (storeDir[0] == '\0'))
+        return IcsErr_IllParameter;
+    IcsStrCpy(ics->chunkStore, storeDir, ICS_MAXPATHLEN);
+    for (i = 0; i < ics->dimensions; i++) {
+        if (chunkDims != NULL) {
+            ics->chunkDims[i] = chunkDims[i];
+        } else {
+            ics->chunkDims[i] = i < 3 ? ICS_CHUNK_EDGE : 1;
+        }
+    }
+
+    return error;
+}
+
+
 /* Set the compression method and compression parameter. */
 Ics_Error IcsSetCompression(ICS             *ics,
                             Ics_Compression  compression,
@@ -735,6 +895,99 @@ Ics_Error IcsSetCompression(ICS             *ics,
 }
 
 
+/* Delta code the frames along the time dimension. */
+Ics_Error IcsSetTemporalDelta(ICS    *ics,
+                              size_t  keyInterval)
+{
+    ICSINIT;
+    int i;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
+    if (ics->chunkStore[0] != '\0') return IcsErr_DuplicateData;
+    if (keyInterval == 0) {
+        ics->deltaDim = -1;
+        ics->deltaKeyInterval = 0;
+        return error;
+    }
+    if (ics->dimensions < 1) return IcsErr_NoLayout;
+    for (i = 0; i < ics->dimensions; i++) {
+        if ((strcmp(ics->dim[i].order, "t") == 0)
+            || (strcmp(ics->dim[i].order, "time") == 0)
+            || (strcmp(ics->dim[i].label, "t") == 0)
+            || (strcmp(ics->dim[i].label, "time") == 0)) break;
+    }
+    if (i == ics->dimensions) return IcsErr_IllParameter;
+    ics->deltaDim = i;
+    ics->deltaKeyInterval = keyInterval;
+
+    return error;
+}
+
+
+/* Write a zone map with the image data. */
+Ics_Error IcsSetZoneMap(ICS    *ics,
+                        size_t  chunkSize)
+{
+    ICSINIT;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
+    ics->writeZoneMap = 1;
+    ics->zoneChunkSize = chunkSize;
+
+    return error;
+}
+
+
+/* Write an index of the GZIP stream with the image data. */
+Ics_Error IcsSetZipIndex(ICS    *ics,
+                         size_t  planes)
+{
+    ICSINIT;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if (ics->srcFile[0] != '\0') return IcsErr_DuplicateData;
+    ics->writeZipIndex = 1;
+    ics->zipIndexPlanes = planes;
+
+    return error;
+}
+
+
+/* Set how the files written are made durable. */
+Ics_Error IcsSetDurability(ICS            *ics,
+                           Ics_Durability  durability)
+{
+    ICSINIT;
+
+
+    if ((ics == NULL) || (ics->fileMode != IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+        /* The header must not have been written yet */
+    if ((ics->dataMap != NULL) || (ics->frameWriter != NULL))
+        return IcsErr_NotValidAction;
+    if ((durability != IcsDurability_none) &&
+        (durability != IcsDurability_sync) &&
+        (durability != IcsDurability_group)) {
+        return IcsErr_IllParameter;
+    }
+    ics->durability = durability;
+
+    return error;
+}
+
+
 /* Get the position of the image in the real world: the origin of the first
    pixel, the distances between pixels and the units in which to measure. If you
    are not interested in one of the parameters, set the pointer to
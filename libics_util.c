@@ -44,24 +44,47 @@
  *
  * The following internal functions are contained in this file:
  *
+ *   IcsFOpen()
+ *   IcsFSeek()
+ *   IcsFTell()
+ *   IcsExistFile()
+ *   IcsMkDir()
  *   IcsStrCpy()
  *   IcsAppendChar()
  *   IcsGetFileName()
  *   IcsExtensionFind()
+ *   IcsGetSidecarName()
+ *   IcsPutWord()
+ *   IcsGetWord()
  *   IcsGetBytesPerSample()
  *   IcsOpenIcs()
  */
 
+    /* All files are opened and positioned in this file. Request 64-bit file
+       offsets on 32-bit POSIX systems, so that files larger than 2 GB can be
+       opened and all of them can be addressed. */
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+#if !defined(_WIN32) && !defined(_LARGEFILE_SOURCE)
+#define _LARGEFILE_SOURCE
+#endif
+
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include "libics_intern.h"
 
 #ifdef _WIN32
 #include <windows.h>
+#include <direct.h>
 #define strcasecmp _stricmp
 #else
 #include <strings.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #endif
+#include <errno.h>
 
 const char ICSEXT[] = ".ics";
 const char IDSEXT[] = ".ids";
@@ -98,6 +121,79 @@ FILE* IcsFOpen(const char *path,
 }
 
 
+/* fseek() with a 64-bit offset, also on systems where long has 32 bits. All
+   positioning within IDS files should go through this function. */
+int IcsFSeek(FILE         *fp,
+             ics_t_sint64  offset,
+             int           whence)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    return _fseeki64(fp, offset, whence);
+#elif defined(_WIN32)
+    if ((offset > LONG_MAX) || (offset < LONG_MIN)) return -1;
+    return fseek(fp, (long)offset, whence);
+#else
+    if ((ics_t_sint64)(off_t)offset != offset) return -1;
+    return fseeko(fp, (off_t)offset, whence);
+#endif
+}
+
+
+/* ftell() returning a 64-bit offset, or -1 on error. */
+ics_t_sint64 IcsFTell(FILE *fp)
+{
+#if defined(_MSC_VER) || defined(__MINGW32__)
+    return _ftelli64(fp);
+#elif defined(_WIN32)
+    return ftell(fp);
+#else
+    return ftello(fp);
+#endif
+}
+
+
+/* Check if a file exist. */
+int IcsExistFile(const char *filename)
+{
+    FILE *fp;
+
+
+    if ((fp = IcsFOpen(filename, "rb")) != NULL) {
+        fclose (fp);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+
+/* Create a directory. Returns 0 on success or if the directory already exists,
+   like IcsFOpen it supports UTF-8 paths on Windows. */
+int IcsMkDir(const char *path)
+{
+    int result;
+#ifdef _WIN32
+    wchar_t *wpath = NULL;
+    int      n     = MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, 0);
+
+    wpath =(wchar_t*)malloc(n * sizeof(wchar_t));
+    if (!wpath) return -1;
+    if (!MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, n)) {
+        free(wpath);
+        return -1;
+    }
+    result = _wmkdir(wpath);
+    free(wpath);
+#else
+    result = mkdir(path, 0777);
+#endif
+    if ((result != 0) && (errno == EEXIST)) {
+        result = 0;
+    }
+    return result;
+}
+
+
 /* This function can be used to check for the correct library version: if
   (strcmp (ICSLIB_VERSION, IcsGetLibVersion ()) != 0) return ERRORCODE; */
 const char *IcsGetLibVersion(void)
@@ -109,11 +205,11 @@ const char *IcsGetLibVersion(void)
 /* Parse a number string and return the value in a size_t. */
 size_t IcsStrToSize(const char *str)
 {
-    unsigned long ulsize;
-    size_t        size;
+    unsigned long long ulsize;
+    size_t             size;
 
 
-    ulsize = strtoul(str, NULL, 10);
+    ulsize = strtoull(str, NULL, 10);
     size =(size_t) ulsize;
 
     return size;
@@ -223,6 +319,61 @@ void IcsGetFileName(char       *dest,
 }
 
 
+/* Make the name of a file that goes with the ICS file, by replacing its
+   extension with ext. */
+char *IcsGetSidecarName(char       *dest,
+                        const char *src,
+                        const char *ext)
+{
+    char *end;
+
+
+    IcsStrCpy(dest, src, ICS_MAXPATHLEN);
+    end = IcsExtensionFind(dest);
+    if (end != NULL) *end = '\0';
+    if (strlen(dest) + strlen(ext) + 1 < ICS_MAXPATHLEN) {
+        strcat(dest, ext);
+    }
+    return dest;
+}
+
+
+/* Outputs a 64-bit word in LSB order to the given stream. */
+Ics_Error IcsPutWord(FILE         *file,
+                     ics_t_uint64  x)
+{
+    unsigned char buf[8];
+    int           i;
+
+
+    for (i = 0; i < 8; i++) {
+        buf[i] = (unsigned char)(x & 0xff);
+        x >>= 8;
+    }
+    if (fwrite(buf, 1, 8, file) != 8) return IcsErr_FWriteIds;
+    return IcsErr_Ok;
+}
+
+
+/* Reads a 64-bit word in LSB order from the given stream. */
+Ics_Error IcsGetWord(FILE         *file,
+                     ics_t_uint64 *x)
+{
+    unsigned char buf[8];
+    int           i;
+
+
+    if (fread(buf, 1, 8, file) != 8) {
+        return ferror(file) ? IcsErr_FReadIds : IcsErr_CorruptedStream;
+    }
+    *x = 0;
+    for (i = 7; i >= 0; i--) {
+        *x = (*x << 8) | buf[i];
+    }
+    return IcsErr_Ok;
+}
+
+
 /* Make a filename ending in '.ics' from the given filename.  If the filename
   ends in '.IDS' then make this '.ICS'.  Also accept filenames ending in
   '.ids.Z' and '.ids.gz', but strip the compression extension. */
@@ -350,6 +501,28 @@ void IcsInit(Ics_Header *icsStruct)
     icsStruct->blockRead = NULL;
     icsStruct->srcFile[0] = '\0';
     icsStruct->srcOffset = 0;
+    icsStruct->dedupStore[0] = '\0';
+    icsStruct->dedupChunkSize = 0;
+    icsStruct->chunkStore[0] = '\0';
+    for (i = 0; i < ICS_MAXDIM; i++) {
+        icsStruct->chunkDims[i] = 0;
+    }
+    icsStruct->deltaDim = -1;
+    icsStruct->deltaKeyInterval = 0;
+    icsStruct->writeZoneMap = 0;
+    icsStruct->zoneChunkSize = 0;
+    icsStruct->writeZipIndex = 0;
+    icsStruct->zipIndexPlanes = 0;
+    icsStruct->dataSource = NULL;
+    icsStruct->dataMap = NULL;
+    icsStruct->context = NULL;
+    icsStruct->frameWriter = NULL;
+    icsStruct->durability = IcsDurability_none;
+    icsStruct->memoryInUse = 0;
+    icsStruct->memoryPeak = 0;
+    icsStruct->memoryLimit = 0;
+    icsStruct->memoryOwner = NULL;
+    icsStruct->asyncReads = NULL;
     for (i = 0; i < ICS_MAX_IMEL_SIZE; i++) {
         icsStruct->byteOrder[i] = 0;
     }
@@ -241,6 +241,22 @@ static Ics_Error icsAddLastInt(char     *line,
 }
 
 
+static Ics_Error icsAddLastSize(char   *line,
+                                size_t  i)
+{
+    ICSINIT;
+    char intStr[ICS_STRLEN_OTHER];
+
+
+    sprintf(intStr, "%llu%c", (unsigned long long)i, ICS_EOL);
+    if (strlen(line) + strlen(intStr) + 1 > ICS_LINE_LENGTH)
+        return IcsErr_LineOverflow;
+    strcat(line, intStr);
+
+    return error;
+}
+
+
 static Ics_Error icsAddDouble(char   *line,
                               double  d)
 {
@@ -369,7 +385,25 @@ static Ics_Error writeIcsSource(Ics_Header *icsStruct,
             /* Now write the source file offset to the file */
         problem = icsFirstToken(line, ICSTOK_SOURCE);
         problem |= icsAddToken(line, ICSTOK_OFFSET);
-        problem |= icsAddLastInt(line,(long int)icsStruct->srcOffset);
+        problem |= icsAddLastSize(line, icsStruct->srcOffset);
+        if (problem) return IcsErr_FailWriteLine;
+        error = icsAddLine(line, fp);
+        if (error) return error;
+    }
+    if ((icsStruct->version >= 2) &&(icsStruct->dedupStore[0] != '\0')) {
+            /* Write the chunk store directory to the file */
+        problem = icsFirstToken(line, ICSTOK_SOURCE);
+        problem |= icsAddToken(line, ICSTOK_STORE);
+        problem |= icsAddLastText(line, icsStruct->dedupStore);
+        if (problem) return IcsErr_FailWriteLine;
+        error = icsAddLine(line, fp);
+        if (error) return error;
+    }
+    if ((icsStruct->version >= 2) && (icsStruct->chunkStore[0] != '\0')) {
+            /* Write the chunk directory to the file */
+        problem = icsFirstToken(line, ICSTOK_SOURCE);
+        problem |= icsAddToken(line, ICSTOK_CHUNKS);
+        problem |= icsAddLastText(line, icsStruct->chunkStore);
         if (problem) return IcsErr_FailWriteLine;
         error = icsAddLine(line, fp);
         if (error) return error;
@@ -387,6 +421,7 @@ static Ics_Error writeIcsLayout(Ics_Header *icsStruct,
     int    i;
     char   line[ICS_LINE_LENGTH];
     size_t size;
+    size_t chunkDims[ICS_MAXDIM];
 
 
         /* Write the number of parameters to the buffer: */
@@ -428,6 +463,20 @@ static Ics_Error writeIcsLayout(Ics_Header *icsStruct,
     error = icsAddLine(line, fp);
     if (error) return error;
 
+        /* Write the size of the chunks in the chunk directory: */
+    if ((icsStruct->version >= 2) && (icsStruct->chunkStore[0] != '\0')) {
+        IcsGetChunkDims(icsStruct, chunkDims, NULL);
+        problem = icsFirstToken(line, ICSTOK_LAYOUT);
+        problem |= icsAddToken(line, ICSTOK_CHUNKS);
+        for (i = 0; i < icsStruct->dimensions-1; i++) {
+            problem |= icsAddInt(line, (long int)chunkDims[i]);
+        }
+        problem |= icsAddLastInt(line, (long int)chunkDims[i]);
+        if (problem) return IcsErr_FailWriteLine;
+        error = icsAddLine(line, fp);
+        if (error) return error;
+    }
+
         /* Coordinates class. Video(default) means 0,0 corresponds with
            top-left. */
     if (*(icsStruct->coord) == '\0') {
@@ -518,6 +567,12 @@ static Ics_Error writeIcsRep(Ics_Header *icsStruct,
         case IcsCompr_gzip:
             problem |= icsAddLastToken(line, ICSTOK_COMPR_GZIP);
             break;
+        case IcsCompr_loco:
+            problem |= icsAddLastToken(line, ICSTOK_COMPR_LOCO);
+            break;
+        case IcsCompr_fpred:
+            problem |= icsAddLastToken(line, ICSTOK_COMPR_FPRED);
+            break;
         default:
             return IcsErr_UnknownCompression;
     }
@@ -525,6 +580,18 @@ static Ics_Error writeIcsRep(Ics_Header *icsStruct,
     error = icsAddLine(line, fp);
     if (error) return error;
 
+        /* Signal whether the frames along a dimension are delta coded: */
+    if (icsStruct->deltaDim >= 0) {
+        problem = icsFirstToken(line, ICSTOK_REPRES);
+        problem |= icsAddToken(line, ICSTOK_FILTER);
+        problem |= icsAddToken(line, ICSTOK_FILTER_DELTA);
+        problem |= icsAddInt(line, icsStruct->deltaDim);
+        problem |= icsAddLastInt(line, (long int)icsStruct->deltaKeyInterval);
+        if (problem) return IcsErr_FailWriteLine;
+        error = icsAddLine(line, fp);
+        if (error) return error;
+    }
+
         /* Define the byteorder. This is supposed to resolve little/big endian
            problems. If the calling function put something here, we'll keep
            it. Otherwise we fill in the machine's byte order. */
@@ -953,6 +1020,10 @@ Ics_Error IcsWriteIcs(Ics_Header *icsStruct,
     FILE *fp;
 
 
+        /* Read any history lines still in the file we might overwrite */
+    error = IcsReadHistory(icsStruct);
+    if (error) return error;
+
     if ((filename != NULL) &&(filename[0] != '\0')) {
         IcsGetIcsName(icsStruct->filename, filename, 0);
     } else if (icsStruct->filename[0] != '\0') {
@@ -962,7 +1033,9 @@ Ics_Error IcsWriteIcs(Ics_Header *icsStruct,
         return IcsErr_FOpenIcs;
     }
 
-    fp = IcsFOpen(icsStruct->filename, "wb");
+    error = IcsGetOutputName(buf, icsStruct);
+    if (error) return error;
+    fp = IcsFOpen(buf, "wb");
     if (fp == NULL) return IcsErr_FOpenIcs;
 
     ICS_SET_LOCALE;
@@ -0,0 +1,340 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_zipindex.c
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsWritesZipIndex()
+ *   IcsNewZipIndex()
+ *   IcsAddToZipIndex()
+ *   IcsFinishZipIndex()
+ *   IcsReadZipIndex()
+ *   IcsFindZipIndex()
+ *   IcsFreeZipIndex()
+ *   IcsRemoveZipIndex()
+ *
+ * A GZIP index records points in the compressed image data where
+ * decompression can start afresh: the writer ends the deflate stream in a
+ * full flush there, so that nothing after it refers back to the data before
+ * it. With every plane (or every so many planes) starting at such a point,
+ * reaching plane t means inflating only that plane, not all planes before
+ * it. The index is written next to the ICS file, in a file with the extension
+ * ".izx":
+ *
+ *   "ICSZINDX", version, size of the image data, number of entries,
+ *   for each entry: offset in the image data, offset in the GZIP stream,
+ *   CRC of the image data before that point
+ *
+ * with each item stored as a 64-bit little-endian word. Offsets in the GZIP
+ * stream are counted from its header. The last entry marks the end of the
+ * compressed data; it must match the CRC and size in the GZIP trailer,
+ * otherwise the index is taken to be for other data and is ignored.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics_intern.h"
+
+
+#define ICS_ZINDEX_MAGIC   "ICSZINDX"
+#define ICS_ZINDEX_VERSION 1
+
+
+/* Does the image data of this ICS structure go into a single GZIP stream
+   written with an index? */
+int IcsWritesZipIndex(const Ics_Header *icsStruct)
+{
+    return icsStruct->writeZipIndex
+        && (icsStruct->compression == IcsCompr_gzip)
+        && (icsStruct->srcFile[0] == '\0')
+        && (icsStruct->dedupStore[0] == '\0')
+        && (icsStruct->chunkStore[0] == '\0');
+}
+
+
+/* Start an index for the GZIP stream of the image data, with an entry every
+   zipIndexPlanes planes. The writer passes the restart points to
+   IcsAddToZipIndex() as it goes. */
+Ics_Error IcsNewZipIndex(const Ics_Header  *icsStruct,
+                         Ics_ZipIndex     **index)
+{
+    Ics_ZipIndex *zi;
+    size_t        size, planes, nPlanes;
+    int           i;
+
+
+    size = IcsGetDataSize(icsStruct);
+    nPlanes = 1;
+    for (i = 2; i < icsStruct->dimensions; i++) {
+        nPlanes *= icsStruct->dim[i].size;
+    }
+    if ((size == 0) || (nPlanes == 0)) return IcsErr_NoLayout;
+    planes = icsStruct->zipIndexPlanes > 0 ? icsStruct->zipIndexPlanes : 1;
+    if (planes > nPlanes) planes = nPlanes;
+
+    zi = (Ics_ZipIndex*)IcsGetScratch(icsStruct, sizeof(Ics_ZipIndex));
+    if (zi == NULL) return IcsErr_Alloc;
+    zi->size = size;
+    zi->interval = (size / nPlanes) * planes;
+    zi->next = zi->interval;
+    zi->nEntries = 0;
+        /* One entry per interval, and the end of the stream */
+    zi->maxEntries = (nPlanes + planes - 1) / planes + 1;
+    zi->entries = (Ics_ZipIndexEntry*)IcsGetScratch(icsStruct, zi->maxEntries
+                                                    * sizeof(Ics_ZipIndexEntry));
+    if (zi->entries == NULL) {
+        IcsReleaseScratch(icsStruct, zi);
+        return IcsErr_Alloc;
+    }
+    *index = zi;
+
+    return IcsErr_Ok;
+}
+
+
+/* Record a restart point: dataPos bytes of image data, ending at filePos in
+   the GZIP stream, with CRC crc. It is kept if it is the first one at or past
+   the next multiple of the interval, or the end of the data. */
+void IcsAddToZipIndex(Ics_ZipIndex  *index,
+                      ics_t_uint64   dataPos,
+                      ics_t_uint64   filePos,
+                      unsigned long  crc)
+{
+    Ics_ZipIndexEntry *entry;
+
+
+    if ((index == NULL) || (index->nEntries >= index->maxEntries)) return;
+    if ((dataPos < index->next) && (dataPos != index->size)) return;
+    entry = index->entries + index->nEntries++;
+    entry->dataPos = dataPos;
+    entry->filePos = filePos;
+    entry->crc = crc;
+    index->next = (size_t)(dataPos / index->interval + 1) * index->interval;
+}
+
+
+/* Write the index next to the ICS file, and free it. If error is set, or the
+   writer did not get to the end of the data, the index is only freed. */
+Ics_Error IcsFinishZipIndex(const Ics_Header *icsStruct,
+                            Ics_ZipIndex     *index,
+                            Ics_Error         error)
+{
+    FILE   *fp;
+    char    filename[ICS_MAXPATHLEN];
+    size_t  i;
+
+
+    if (!error && (index->nEntries > 0)
+        && (index->entries[index->nEntries - 1].dataPos == index->size)) {
+        IcsGetSidecarName(filename, icsStruct->filename, ICS_ZINDEX_EXT);
+        fp = IcsFOpen(filename, "wb");
+        if (fp == NULL) {
+            error = IcsErr_FOpenIds;
+        } else {
+            if (fwrite(ICS_ZINDEX_MAGIC, 1, 8, fp) != 8) {
+                error = IcsErr_FWriteIds;
+            }
+            if (!error) error = IcsPutWord(fp, ICS_ZINDEX_VERSION);
+            if (!error) error = IcsPutWord(fp, (ics_t_uint64)index->size);
+            if (!error) {
+                error = IcsPutWord(fp, (ics_t_uint64)index->nEntries);
+            }
+            for (i = 0; !error && i < index->nEntries; i++) {
+                error = IcsPutWord(fp, index->entries[i].dataPos);
+                if (!error) error = IcsPutWord(fp, index->entries[i].filePos);
+                if (!error) {
+                    error = IcsPutWord(fp, (ics_t_uint64)index->entries[i].crc);
+                }
+            }
+            if (fclose(fp) == EOF) {
+                if (!error) error = IcsErr_FCloseIds;
+            }
+            if (error) remove(filename);
+        }
+    }
+    IcsFreeZipIndex(icsStruct, index);
+
+    return error;
+}
+
+
+/* Does the GZIP trailer at filePos in the data file hold crc and size? The
+   position in the file is kept. */
+static int icsCheckZipTrailer(const Ics_Header *icsStruct,
+                              ics_t_uint64      filePos,
+                              unsigned long     crc,
+                              size_t            size)
+{
+    Ics_BlockRead *br  = (Ics_BlockRead*)icsStruct->blockRead;
+    FILE          *fp  = br->dataFilePtr;
+    unsigned char  buf[8];
+    ics_t_sint64   pos;
+    unsigned long  trailerCrc, trailerSize;
+    int            i, match;
+
+
+    pos = IcsFTell(fp);
+    if (pos < 0) return 0;
+    match = (IcsFSeek(fp, (ics_t_sint64)(br->dataOffset + filePos), SEEK_SET)
+             == 0) && (fread(buf, 1, 8, fp) == 8);
+    if (IcsFSeek(fp, pos, SEEK_SET) != 0) return 0;
+    if (!match) return 0;
+    trailerCrc = trailerSize = 0;
+    for (i = 3; i >= 0; i--) {
+        trailerCrc = (trailerCrc << 8) | buf[i];
+        trailerSize = (trailerSize << 8) | buf[4 + i];
+    }
+    return (trailerCrc == crc) && (trailerSize == (size & 0xFFFFFFFF));
+}
+
+
+/* Read the index of the GZIP stream being read. If there is none, or it does
+   not match the data, index is set to NULL. */
+Ics_Error IcsReadZipIndex(const Ics_Header  *icsStruct,
+                          Ics_ZipIndex     **index)
+{
+    ICSINIT;
+    FILE              *fp;
+    Ics_ZipIndex      *zi  = NULL;
+    Ics_ZipIndexEntry *entry;
+    char               filename[ICS_MAXPATHLEN];
+    char               magic[8];
+    ics_t_uint64       version, size, n, crc;
+    size_t             i;
+
+
+    *index = NULL;
+    IcsGetSidecarName(filename, icsStruct->filename, ICS_ZINDEX_EXT);
+    fp = IcsFOpen(filename, "rb");
+    if (fp == NULL) return IcsErr_Ok;
+
+        /* An index that cannot be read, or was written for other data, is
+           ignored */
+    if ((fread(magic, 1, 8, fp) != 8)
+        || (memcmp(magic, ICS_ZINDEX_MAGIC, 8) != 0)
+        || IcsGetWord(fp, &version) || (version != ICS_ZINDEX_VERSION)
+        || IcsGetWord(fp, &size)
+        || (size != (ics_t_uint64)IcsGetDataSize(icsStruct))
+        || IcsGetWord(fp, &n) || (n == 0)
+        || (n > size + 1)) {
+        goto exit;
+    }
+    zi = (Ics_ZipIndex*)IcsGetScratch(icsStruct, sizeof(Ics_ZipIndex));
+    if (zi == NULL) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+    zi->entries = (Ics_ZipIndexEntry*)IcsGetScratch(icsStruct, (size_t)n
+                                                    * sizeof(Ics_ZipIndexEntry));
+    if (zi->entries == NULL) {
+        IcsReleaseScratch(icsStruct, zi);
+        zi = NULL;
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+    zi->size = (size_t)size;
+    zi->interval = 0;
+    zi->next = 0;
+    zi->nEntries = zi->maxEntries = (size_t)n;
+    for (i = 0; i < zi->nEntries; i++) {
+        entry = zi->entries + i;
+        if (IcsGetWord(fp, &entry->dataPos) || IcsGetWord(fp, &entry->filePos)
+            || IcsGetWord(fp, &crc)
+            || ((i > 0) && ((entry->dataPos <= entry[-1].dataPos)
+                            || (entry->filePos <= entry[-1].filePos)))) {
+            break;
+        }
+        entry->crc = (unsigned long)crc;
+    }
+    entry = zi->entries + zi->nEntries - 1;
+    if ((i < zi->nEntries) || (entry->dataPos != size)
+        || !icsCheckZipTrailer(icsStruct, entry->filePos, entry->crc,
+                               zi->size)) {
+        IcsFreeZipIndex(icsStruct, zi);
+        zi = NULL;
+    }
+    *index = zi;
+
+  exit:
+    fclose(fp);
+    return error;
+}
+
+
+/* The last restart point at or before dataPos, or NULL if there is none. */
+const Ics_ZipIndexEntry *IcsFindZipIndex(const Ics_ZipIndex *index,
+                                         ics_t_uint64        dataPos)
+{
+    size_t low, high, mid;
+
+
+    if ((index == NULL) || (index->nEntries < 2)) return NULL;
+        /* Binary search, leaving out the end of the stream */
+    low = 0;
+    high = index->nEntries - 1;
+    if (index->entries[0].dataPos > dataPos) return NULL;
+    while (high - low > 1) {
+        mid = low + (high - low) / 2;
+        if (index->entries[mid].dataPos <= dataPos) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return index->entries + low;
+}
+
+
+/* Free an index. */
+void IcsFreeZipIndex(const Ics_Header *icsStruct,
+                     Ics_ZipIndex     *index)
+{
+    if (index == NULL) return;
+    IcsReleaseScratch(icsStruct, index->entries);
+    IcsReleaseScratch(icsStruct, index);
+}
+
+
+/* Remove the GZIP index of an ICS file, if there is one. */
+void IcsRemoveZipIndex(const Ics_Header *icsStruct)
+{
+    char filename[ICS_MAXPATHLEN];
+
+
+    IcsGetSidecarName(filename, icsStruct->filename, ICS_ZINDEX_EXT);
+    if (IcsExistFile(filename)) remove(filename);
+}
@@ -0,0 +1,739 @@
+/*
+ * libics: Image Cytometry Standard file reading and writing.
+ *
+ * Copyright 2015-2017:
+ *   Scientific Volume Imaging Holding B.V.
+ *   Laapersveld 63, 1213 VB Hilversum, The Netherlands
+ *   https://www.svi.nl
+ *
+ * Contact: libics@svi.nl
+ *
+ * Copyright (C) 2000-2013 Cris Luengo and others
+ *
+ * Large chunks of this library written by
+ *    Bert Gijsbers
+ *    Dr. Hans T.M. van der Voort
+ * And also Damir Sudar, Geert van Kempen, Jan Jitze Krol,
+ * Chiel Baarslag and Fons Laan.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * FILE : libics_zone.c
+ *
+ * The following library functions are contained in this file:
+ *
+ *   IcsForEachZone()
+ *   IcsGetBoundingBox()
+ *
+ * The following internal functions are contained in this file:
+ *
+ *   IcsNewZoneMap()
+ *   IcsAddToZoneMap()
+ *   IcsFinishZoneMap()
+ *   IcsWriteZoneMap()
+ *   IcsStampZoneMap()
+ *   IcsRemoveZoneMap()
+ *
+ * A zone map records, for each chunk of the image data, the smallest and
+ * largest value and the number of non-zero samples. The chunks are made of
+ * whole image lines and never span more than one 2D plane, as the tiles of
+ * the tile codecs; with those codecs, and with a chunk store, the chunks are
+ * the tiles or the stored chunks. The map is written next to the ICS file, in
+ * a file with the extension ".izm":
+ *
+ *   "ICSZONES", version, data type, lines per chunk, number of chunks,
+ *   size and modification time of the data file,
+ *   for each chunk: minimum, maximum, number of non-zero samples
+ *
+ * with each item stored as a 64-bit little-endian word; the minimum and
+ * maximum are IEEE doubles. Complex samples are represented by their
+ * magnitude, NaN values are ignored. The data file is the IDS file, the ICS
+ * file of a version 2.0 file, or the ICS file if the data is in a chunk
+ * store. Its size and time are recorded when the file is closed, after the
+ * data is written; the modification time is in nanoseconds where the system
+ * provides them.
+ *
+ * The queries read only the chunks whose value range intersects the requested
+ * one, skipping the other ones. Files without a zone map (or with one that
+ * does not match the image, or whose data file has changed since) are queried
+ * by reading all chunks.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "libics_intern.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+
+#define ICS_ZONE_MAGIC   "ICSZONES"
+#define ICS_ZONE_VERSION 2
+
+/* Position of the size and time of the data file in the zone map */
+#define ICS_ZONE_STAMP   40
+
+/* Number of samples converted to double at once */
+#define ICS_ZONE_BLOCK   1024
+
+
+/* The statistics of one chunk. */
+typedef struct {
+    double       min;
+    double       max;
+    ics_t_uint64 nonZero;
+} Ics_ZoneStats;
+
+
+/* A zone map being computed, the struct behind the void* used by the
+   internal functions. */
+typedef struct {
+    Ics_TileLayout  layout;
+    Ics_DataType    dataType;
+    size_t          sampleSize; /* bytes per sample */
+    size_t          chunk;      /* chunk being filled */
+    size_t          fill;       /* bytes of that chunk seen so far */
+    Ics_ZoneStats  *zones;
+} Ics_ZoneMap;
+
+
+static ics_t_uint64 icsDoubleBits(double x)
+{
+    ics_t_uint64 bits;
+
+
+    memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+
+static double icsBitsDouble(ics_t_uint64 bits)
+{
+    double x;
+
+
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+
+/* Convert n samples to double; complex samples give their magnitude. */
+static void icsGetValues(double       *dest,
+                         const void   *src,
+                         Ics_DataType  dataType,
+                         size_t        n)
+{
+    size_t i;
+
+
+    switch (dataType) {
+        case Ics_uint8:
+        {
+            const ics_t_uint8 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_sint8:
+        {
+            const ics_t_sint8 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_uint16:
+        {
+            const ics_t_uint16 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_sint16:
+        {
+            const ics_t_sint16 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_uint32:
+        {
+            const ics_t_uint32 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_sint32:
+        {
+            const ics_t_sint32 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_real32:
+        {
+            const ics_t_real32 *in = src;
+            for (i = 0; i < n; i++) dest[i] = (double)in[i];
+        }
+        break;
+        case Ics_real64:
+            memcpy(dest, src, n * sizeof(double));
+            break;
+        case Ics_complex32:
+        {
+            const ics_t_real32 *in = src;
+            for (i = 0; i < n; i++, in += 2) {
+                dest[i] = sqrt((double)in[0] * in[0] + (double)in[1] * in[1]);
+            }
+        }
+        break;
+        case Ics_complex64:
+        {
+            const ics_t_real64 *in = src;
+            for (i = 0; i < n; i++, in += 2) {
+                dest[i] = sqrt(in[0] * in[0] + in[1] * in[1]);
+            }
+        }
+        break;
+        default:
+            memset(dest, 0, n * sizeof(double));
+            break;
+    }
+}
+
+
+/* Add n samples to the statistics of a chunk. */
+static void icsAddToZone(Ics_ZoneStats *zone,
+                         const void    *src,
+                         Ics_DataType   dataType,
+                         size_t         sampleSize,
+                         size_t         n)
+{
+    double values[ICS_ZONE_BLOCK];
+    size_t i, m;
+
+
+    while (n > 0) {
+        m = n < ICS_ZONE_BLOCK ? n : ICS_ZONE_BLOCK;
+        icsGetValues(values, src, dataType, m);
+        for (i = 0; i < m; i++) {
+            if (values[i] != 0.0) zone->nonZero++;
+            if (values[i] < zone->min) zone->min = values[i];
+            if (values[i] > zone->max) zone->max = values[i];
+        }
+        src = (const char*)src + m * sampleSize;
+        n -= m;
+    }
+}
+
+
+/* The size of the chunks of a zone map written for this ICS structure. */
+static size_t icsZoneChunkSize(const Ics_Header *icsStruct)
+{
+    if (icsStruct->zoneChunkSize > 0) return icsStruct->zoneChunkSize;
+    if (icsStruct->dedupStore[0] != '\0') {
+        return icsStruct->dedupChunkSize > 0 ? icsStruct->dedupChunkSize
+                                             : ICS_DEDUP_CHUNK_SIZE;
+    }
+    if (IcsIsTileCompression(icsStruct->compression)) return ICS_TILE_SIZE;
+    return ICS_ZONE_CHUNK_SIZE;
+}
+
+
+/* Start computing the zone map of the image data. The data are then passed
+   in order to IcsAddToZoneMap(). */
+Ics_Error IcsNewZoneMap(const Ics_Header  *icsStruct,
+                        void             **zoneMap)
+{
+    ICSINIT;
+    Ics_ZoneMap *zm;
+    size_t       i;
+
+
+    zm = (Ics_ZoneMap*)IcsGetScratch(icsStruct, sizeof(Ics_ZoneMap));
+    if (zm == NULL) return IcsErr_Alloc;
+    error = IcsGetTileLayout(icsStruct, 0, icsZoneChunkSize(icsStruct),
+                             &zm->layout);
+    if (error) {
+        IcsReleaseScratch(icsStruct, zm);
+        return error;
+    }
+    zm->dataType = icsStruct->imel.dataType;
+    zm->sampleSize = IcsGetDataTypeSize(zm->dataType);
+    zm->chunk = 0;
+    zm->fill = 0;
+    zm->zones = (Ics_ZoneStats*)IcsGetScratch(icsStruct, zm->layout.nTiles
+                                              * sizeof(Ics_ZoneStats));
+    if (zm->zones == NULL) {
+        IcsReleaseScratch(icsStruct, zm);
+        return IcsErr_Alloc;
+    }
+    for (i = 0; i < zm->layout.nTiles; i++) {
+        zm->zones[i].min = HUGE_VAL;
+        zm->zones[i].max = -HUGE_VAL;
+        zm->zones[i].nonZero = 0;
+    }
+    *zoneMap = zm;
+
+    return error;
+}
+
+
+/* Add the next n bytes of the image data to the zone map. n must be a
+   multiple of the sample size. */
+void IcsAddToZoneMap(void       *zoneMap,
+                     const void *src,
+                     size_t      n)
+{
+    Ics_ZoneMap *zm = (Ics_ZoneMap*)zoneMap;
+    size_t       firstLine, nLines, chunkBytes, m;
+
+
+    while ((n > 0) && (zm->chunk < zm->layout.nTiles)) {
+        IcsGetTileLines(&zm->layout, zm->chunk, &firstLine, &nLines);
+        chunkBytes = nLines * zm->layout.lineBytes;
+        m = chunkBytes - zm->fill;
+        if (m > n) m = n;
+        icsAddToZone(zm->zones + zm->chunk, src, zm->dataType, zm->sampleSize,
+                     m / zm->sampleSize);
+        zm->fill += m;
+        if (zm->fill == chunkBytes) {
+            zm->chunk++;
+            zm->fill = 0;
+        }
+        src = (const char*)src + m;
+        n -= m;
+    }
+}
+
+
+/* Write the zone map next to the ICS file, and free it. If error is set, the
+   zone map is only freed. */
+Ics_Error IcsFinishZoneMap(const Ics_Header *icsStruct,
+                           void             *zoneMap,
+                           Ics_Error         error)
+{
+    Ics_ZoneMap *zm = (Ics_ZoneMap*)zoneMap;
+    FILE        *fp;
+    char         filename[ICS_MAXPATHLEN];
+    size_t       i;
+
+
+    if (!error) {
+        IcsGetSidecarName(filename, icsStruct->filename, ICS_ZONE_EXT);
+        fp = IcsFOpen(filename, "wb");
+        if (fp == NULL) {
+            error = IcsErr_FOpenIds;
+        } else {
+            if (fwrite(ICS_ZONE_MAGIC, 1, 8, fp) != 8) error = IcsErr_FWriteIds;
+            if (!error) error = IcsPutWord(fp, ICS_ZONE_VERSION);
+            if (!error) error = IcsPutWord(fp, (ics_t_uint64)zm->dataType);
+            if (!error) {
+                error = IcsPutWord(fp, (ics_t_uint64)zm->layout.linesPerTile);
+            }
+            if (!error) error = IcsPutWord(fp, (ics_t_uint64)zm->layout.nTiles);
+                /* The data file is stamped by IcsStampZoneMap() */
+            if (!error) error = IcsPutWord(fp, 0);
+            if (!error) error = IcsPutWord(fp, 0);
+            for (i = 0; !error && i < zm->layout.nTiles; i++) {
+                error = IcsPutWord(fp, icsDoubleBits(zm->zones[i].min));
+                if (!error) {
+                    error = IcsPutWord(fp, icsDoubleBits(zm->zones[i].max));
+                }
+                if (!error) error = IcsPutWord(fp, zm->zones[i].nonZero);
+            }
+            if (fclose(fp) == EOF) {
+                if (!error) error = IcsErr_FCloseIds;
+            }
+            if (error) remove(filename);
+        }
+    }
+    IcsReleaseScratch(icsStruct, zm->zones);
+    IcsReleaseScratch(icsStruct, zm);
+
+    return error;
+}
+
+
+/* Compute the zone map of the image data in memory, and write it. */
+Ics_Error IcsWriteZoneMap(const Ics_Header *icsStruct)
+{
+    ICSINIT;
+    Ics_ZoneMap *zm;
+    void        *zoneMap;
+    size_t       dim[ICS_MAXDIM];
+    size_t       chunk, firstLine, nLines, len;
+    char        *buf = NULL;
+    int          i;
+
+
+    error = IcsNewZoneMap(icsStruct, &zoneMap);
+    if (error) return error;
+    zm = (Ics_ZoneMap*)zoneMap;
+    if (icsStruct->dataStrides == NULL) {
+        len = zm->layout.nTiles > 0 ? IcsGetDataSize(icsStruct) : 0;
+        if (len > icsStruct->dataLength) len = icsStruct->dataLength;
+        IcsAddToZoneMap(zoneMap, icsStruct->data, len);
+    } else {
+            /* Gather each chunk in a buffer */
+        for (i = 0; i < icsStruct->dimensions; i++) {
+            dim[i] = icsStruct->dim[i].size;
+        }
+        buf = (char*)IcsGetScratch(icsStruct, zm->layout.linesPerTile
+                                   * zm->layout.lineBytes);
+        if (buf == NULL) error = IcsErr_Alloc;
+        for (chunk = 0; !error && chunk < zm->layout.nTiles; chunk++) {
+            IcsGetTileLines(&zm->layout, chunk, &firstLine, &nLines);
+            IcsGatherLines(icsStruct->data, dim, icsStruct->dataStrides,
+                           icsStruct->dimensions, (int)zm->sampleSize,
+                           firstLine, nLines, buf);
+            IcsAddToZoneMap(zoneMap, buf, nLines * zm->layout.lineBytes);
+        }
+        IcsReleaseScratch(icsStruct, buf);
+    }
+
+    return IcsFinishZoneMap(icsStruct, zoneMap, error);
+}
+
+
+/* The name of the file that holds the data of an ICS file, see above. */
+static Ics_Error icsZoneDataName(char             *dest,
+                                 const Ics_Header *icsStruct)
+{
+    if ((icsStruct->chunkStore[0] == '\0')
+        && (icsStruct->dedupStore[0] == '\0')) {
+        if (icsStruct->version == 1) {
+            IcsGetIdsName(dest, icsStruct->filename);
+            return IcsErr_Ok;
+        }
+        if (icsStruct->srcFile[0] != '\0') {
+            IcsStrCpy(dest, icsStruct->srcFile, ICS_MAXPATHLEN);
+            return IcsErr_Ok;
+        }
+    }
+        /* While writing, the ICS file can have a temporary name */
+    return IcsGetOutputName(dest, icsStruct);
+}
+
+
+/* Get the size and modification time of a file. Returns 0 if the file cannot
+   be inspected. */
+static int icsFileStamp(const char   *filename,
+                        ics_t_uint64 *size,
+                        ics_t_uint64 *mtime)
+{
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA info;
+
+
+    if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &info)) {
+        return 0;
+    }
+    *size = ((ics_t_uint64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    *mtime = ((ics_t_uint64)info.ftLastWriteTime.dwHighDateTime << 32)
+            | info.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat info;
+
+
+    if (stat(filename, &info) != 0) return 0;
+    *size = (ics_t_uint64)info.st_size;
+#if defined(__APPLE__)
+    *mtime = (ics_t_uint64)info.st_mtimespec.tv_sec * 1000000000u
+            + (ics_t_uint64)info.st_mtimespec.tv_nsec;
+#else
+    *mtime = (ics_t_uint64)info.st_mtim.tv_sec * 1000000000u
+            + (ics_t_uint64)info.st_mtim.tv_nsec;
+#endif
+#endif
+    return 1;
+}
+
+
+/* Record the size and time of the data file in the zone map written for it,
+   once the data is written. */
+Ics_Error IcsStampZoneMap(const Ics_Header *icsStruct)
+{
+    ICSINIT;
+    FILE         *fp;
+    char          filename[ICS_MAXPATHLEN];
+    ics_t_uint64  size, mtime;
+
+
+    error = icsZoneDataName(filename, icsStruct);
+    if (error) return error;
+    if (!icsFileStamp(filename, &size, &mtime)) return IcsErr_FOpenIds;
+    IcsGetSidecarName(filename, icsStruct->filename, ICS_ZONE_EXT);
+    fp = IcsFOpen(filename, "r+b");
+    if (fp == NULL) return IcsErr_FOpenIds;
+    if (fseek(fp, ICS_ZONE_STAMP, SEEK_SET) != 0) error = IcsErr_FWriteIds;
+    if (!error) error = IcsPutWord(fp, size);
+    if (!error) error = IcsPutWord(fp, mtime);
+    if (fclose(fp) == EOF) {
+        if (!error) error = IcsErr_FCloseIds;
+    }
+    if (error) remove(filename);
+
+    return error;
+}
+
+
+/* Remove the zone map of an ICS file, if there is one. */
+void IcsRemoveZoneMap(const Ics_Header *icsStruct)
+{
+    char filename[ICS_MAXPATHLEN];
+
+
+    IcsGetSidecarName(filename, icsStruct->filename, ICS_ZONE_EXT);
+    if (IcsExistFile(filename)) remove(filename);
+}
+
+
+/* Read the zone map of an ICS file. If there is none, or it does not match
+   the image, zones is set to NULL and layout to the default chunks. */
+static Ics_Error icsReadZoneMap(const Ics_Header  *icsStruct,
+                                Ics_TileLayout    *layout,
+                                Ics_ZoneStats    **zones)
+{
+    ICSINIT;
+    FILE          *fp;
+    Ics_ZoneStats *zs = NULL;
+    char           filename[ICS_MAXPATHLEN];
+    char           magic[8];
+    ics_t_uint64   version, dataType, linesPerChunk, n, min, max;
+    ics_t_uint64   dataSize, dataTime, size, mtime;
+    size_t         i;
+
+
+    *zones = NULL;
+    error = IcsGetTileLayout(icsStruct, 0, ICS_ZONE_CHUNK_SIZE, layout);
+    if (error) return error;
+    IcsGetSidecarName(filename, icsStruct->filename, ICS_ZONE_EXT);
+    fp = IcsFOpen(filename, "rb");
+    if (fp == NULL) return IcsErr_Ok;
+
+        /* A zone map that cannot be read, or was written for other data, is
+           ignored */
+    error = icsZoneDataName(filename, icsStruct);
+    if (error || !icsFileStamp(filename, &size, &mtime)) {
+        error = IcsErr_Ok;
+        goto exit;
+    }
+    if ((fread(magic, 1, 8, fp) != 8)
+        || (memcmp(magic, ICS_ZONE_MAGIC, 8) != 0)
+        || IcsGetWord(fp, &version) || (version != ICS_ZONE_VERSION)
+        || IcsGetWord(fp, &dataType)
+        || (dataType != (ics_t_uint64)icsStruct->imel.dataType)
+        || IcsGetWord(fp, &linesPerChunk) || (linesPerChunk == 0)
+        || IcsGetWord(fp, &n)
+        || IcsGetWord(fp, &dataSize) || (dataSize != size)
+        || IcsGetWord(fp, &dataTime) || (dataTime != mtime)) {
+        goto exit;
+    }
+    error = IcsGetTileLayout(icsStruct, (size_t)linesPerChunk, 0, layout);
+    if (error || (layout->linesPerTile != linesPerChunk)
+        || (layout->nTiles != n)) {
+        error = IcsGetTileLayout(icsStruct, 0, ICS_ZONE_CHUNK_SIZE, layout);
+        goto exit;
+    }
+    zs = (Ics_ZoneStats*)IcsGetScratch(icsStruct,
+                                       (size_t)n * sizeof(Ics_ZoneStats));
+    if (zs == NULL) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+    for (i = 0; i < (size_t)n; i++) {
+        if (IcsGetWord(fp, &min) || IcsGetWord(fp, &max)
+            || IcsGetWord(fp, &zs[i].nonZero)) {
+            IcsReleaseScratch(icsStruct, zs);
+            zs = NULL;
+            error = IcsGetTileLayout(icsStruct, 0, ICS_ZONE_CHUNK_SIZE, layout);
+            goto exit;
+        }
+        zs[i].min = icsBitsDouble(min);
+        zs[i].max = icsBitsDouble(max);
+    }
+    *zones = zs;
+
+  exit:
+    fclose(fp);
+    return error;
+}
+
+
+/* Call func for each chunk of the image data that has values in the range
+   [low, high]. */
+Ics_Error IcsForEachZone(ICS          *ics,
+                         double        low,
+                         double        high,
+                         Ics_ZoneFunc  func,
+                         void         *userData)
+{
+    ICSINIT;
+    Ics_TileLayout  layout;
+    Ics_ZoneStats  *zones = NULL;
+    size_t          offset[ICS_MAXDIM], size[ICS_MAXDIM];
+    size_t          chunk, firstLine, nLines, plane, pos, curLoc;
+    char           *buf   = NULL;
+    int             i, open = 0;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if (func == NULL) return IcsErr_IllParameter;
+    if ((ics->imel.dataType == Ics_unknown) ||
+        (ics->imel.dataType > Ics_complex64))
+        return IcsErr_UnknownDataType;
+    error = icsReadZoneMap(ics, &layout, &zones);
+    if (error) return error;
+    buf = (char*)IcsGetScratch(ics, layout.linesPerTile * layout.lineBytes + 1);
+    if (buf == NULL) {
+        error = IcsErr_Alloc;
+        goto exit;
+    }
+    if (ics->blockRead != NULL) {
+        error = IcsCloseIds(ics);
+        if (error) goto exit;
+    }
+    error = IcsOpenIds(ics);
+    if (error) goto exit;
+    open = 1;
+
+    curLoc = 0;
+    for (chunk = 0; chunk < layout.nTiles; chunk++) {
+        if ((zones != NULL) &&
+            ((zones[chunk].max < low) || (zones[chunk].min > high)))
+            continue;
+        IcsGetTileLines(&layout, chunk, &firstLine, &nLines);
+        pos = firstLine * layout.lineBytes;
+        if (curLoc < pos) {
+            error = IcsSkipIdsBlock(ics, pos - curLoc);
+            curLoc = pos;
+        }
+        if (!error) {
+            error = IcsReadIdsBlock(ics, buf, nLines * layout.lineBytes);
+        }
+        if (error) break;
+        curLoc += nLines * layout.lineBytes;
+
+            /* The chunk is a range of lines within one plane */
+        offset[0] = 0;
+        size[0] = ics->dim[0].size;
+        plane = firstLine / layout.linesPerPlane;
+        if (ics->dimensions > 1) {
+            offset[1] = firstLine % layout.linesPerPlane;
+            size[1] = nLines;
+        }
+        for (i = 2; i < ics->dimensions; i++) {
+            offset[i] = plane % ics->dim[i].size;
+            size[i] = 1;
+            plane /= ics->dim[i].size;
+        }
+        error = func(userData, offset, size, buf);
+        if (error) break;
+    }
+
+  exit:
+    if (open) {
+        if (error)
+            IcsCloseIds(ics);
+        else
+            error = IcsCloseIds(ics);
+    }
+    IcsReleaseScratch(ics, buf);
+    IcsReleaseScratch(ics, zones);
+    return error;
+}
+
+
+/* State for IcsGetBoundingBox(). */
+typedef struct {
+    ICS    *ics;
+    double  threshold;
+    size_t  first[ICS_MAXDIM];
+    size_t  last[ICS_MAXDIM];
+    int     found;
+} Ics_BoundingBox;
+
+
+/* Extend the bounding box with the samples above the threshold in a chunk. */
+static Ics_Error icsExtendBoundingBox(void         *userData,
+                                      const size_t *offset,
+                                      const size_t *size,
+                                      const void   *data)
+{
+    Ics_BoundingBox *bb = (Ics_BoundingBox*)userData;
+    ICS             *ics = bb->ics;
+    double          *values;
+    size_t           lineBytes, y, x, x0, x1;
+    int              i, nDims = ics->dimensions;
+
+
+    values = (double*)IcsGetScratch(ics, size[0] * sizeof(double));
+    if (values == NULL) return IcsErr_Alloc;
+    lineBytes = size[0] * IcsGetDataTypeSize(ics->imel.dataType);
+    for (y = 0; y < (nDims > 1 ? size[1] : 1); y++) {
+        icsGetValues(values, (const char*)data + y * lineBytes,
+                     ics->imel.dataType, size[0]);
+        for (x0 = 0; x0 < size[0] && !(values[x0] > bb->threshold); x0++);
+        if (x0 == size[0]) continue;
+        for (x1 = size[0] - 1; !(values[x1] > bb->threshold); x1--);
+        for (i = 0; i < nDims; i++) {
+            x = offset[i] + (i == 1 ? y : 0);
+            if (!bb->found || (bb->first[i] > (i == 0 ? x0 : x))) {
+                bb->first[i] = i == 0 ? x0 : x;
+            }
+            if (!bb->found || (bb->last[i] < (i == 0 ? x1 : x))) {
+                bb->last[i] = i == 0 ? x1 : x;
+            }
+        }
+        bb->found = 1;
+    }
+    IcsReleaseScratch(ics, values);
+
+    return IcsErr_Ok;
+}
+
+
+/* Find the bounding box of the samples with a value above threshold. */
+Ics_Error IcsGetBoundingBox(ICS    *ics,
+                            double  threshold,
+                            size_t *offset,
+                            size_t *size)
+{
+    ICSINIT;
+    Ics_BoundingBox bb;
+    int             i;
+
+
+    if ((ics == NULL) || (ics->fileMode == IcsFileMode_write))
+        return IcsErr_NotValidAction;
+
+    if ((offset == NULL) || (size == NULL)) return IcsErr_IllParameter;
+    bb.ics = ics;
+    bb.threshold = threshold;
+    bb.found = 0;
+    error = IcsForEachZone(ics, threshold, HUGE_VAL, icsExtendBoundingBox,
+                           &bb);
+    if (error) return error;
+    for (i = 0; i < ics->dimensions; i++) {
+        offset[i] = bb.found ? bb.first[i] : 0;
+        size[i] = bb.found ? bb.last[i] - bb.first[i] + 1 : 0;
+    }
+
+    return error;
+}
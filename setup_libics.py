@@ -1,17 +1,51 @@
 # setup_libics.py
+import os
+import sys
 from distutils.core import setup, Extension
 
+# With zlib and threads, like the CMake build; shared memory needs rt on Linux
+libraries = ['z']
+macros = [('ICS_ZLIB', None), ('ICS_THREADS', None)]
+swig_opts = []
+if sys.platform != 'win32':
+    libraries += ['pthread', 'm']
+if sys.platform.startswith('linux'):
+    libraries += ['rt']
+
+# config.h is made by configure, and optional
+if os.path.exists('config.h'):
+    macros.append(('HAVE_CONFIG_H', None))
+    swig_opts.append('-DHAVE_CONFIG_H')
+
 libics_module = Extension('_libics', sources=['libics_read.c',
 'libics_util.c',
 'libics_write.c',
 'libics_compress.c',
 'libics_data.c',
+'libics_dedup.c',
+'libics_tile.c',
+'libics_loco.c',
+'libics_fpred.c',
+'libics_thread.c',
+'libics_cpu.c',
+'libics_filter.c',
+'libics_zone.c',
+'libics_zipindex.c',
 'libics_test.c',
 'libics_history.c',
 'libics_top.c',
 'libics_sensor.c',
 'libics_binary.c',
 'libics_gzip.c',
-'libics_preview.c', 'libics.i'], libraries=['z'])
+'libics_map.c',
+'libics_async.c',
+'libics_context.c',
+'libics_frames.c',
+'libics_chunks.c',
+'libics_numa.c',
+'libics_shm.c',
+'libics_durable.c',
+'libics_preview.c', 'libics.i'], libraries=libraries,
+                          define_macros=macros, swig_opts=swig_opts)
 
 setup(name='libics', ext_modules=[libics_module], py_modules=["libics"])
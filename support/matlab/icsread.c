@@ -1,9 +1,21 @@
 /* ICSREAD   Reads a numeric array from an ICS file.
- *     A = ICSWRITE(FILENAME) reads the numeric data in
+ *     A = ICSREAD(FILENAME) reads the numeric data in
  *     an ICS image file named FILENAME into A.
  *
- *     Known limitations:
- *        - Complex data is not read.
+ *     A = ICSREAD(FILENAME,OFFSET,SIZE,SAMPLING) reads only the
+ *     region given by OFFSET (0-based), SIZE and SAMPLING. These
+ *     are vectors with one value per dimension, in the order of the
+ *     dimensions in the file. Pass [] to use the default (the whole
+ *     image, no subsampling).
+ *
+ *     [A,ORDER] = ICSREAD(...) also returns a cell array with the
+ *     names of the dimensions of A.
+ *
+ *     The dimensions of A are reordered by name: "x", "y", "z" and
+ *     "t" (or "time") come first, in that order, and "probe" comes
+ *     last. As usual in MATLAB, the first two dimensions are swapped,
+ *     so that the image rows are along y. The data is read directly
+ *     into A, also for complex data.
  *
  * Copyright (C) 2000-2007 Cris Luengo and others
  * email: clluengo@users.sourceforge.net
@@ -14,35 +26,177 @@
 typedef int mwSize;
 
 #include "mex.h"
+#include <stdlib.h>
 #include <string.h>
 #include "libics.h"
 
+/* Finds the first unused dimension named name or alt (which can be NULL). */
+static int find_dim (ICS* ip, int ndims, const char* name, const char* alt,
+                     const int* used) {
+   const char* order;
+   const char* label;
+   int ii;
+
+   for (ii=0;ii<ndims;ii++) {
+      if (used[ii] || IcsGetOrderF (ip, ii, &order, &label) != IcsErr_Ok)
+         continue;
+      if (!strcmp (order, name) || !strcmp (label, name))
+         return ii;
+      if (alt && (!strcmp (order, alt) || !strcmp (label, alt)))
+         return ii;
+   }
+   return -1;
+}
+
+/* Fills perm with the dimension in the file for each dimension of A. */
+static void sort_dims (ICS* ip, int ndims, int* perm) {
+   static const char* first[4] = {"x", "y", "z", "t"};
+   int used[ICS_MAXDIM];
+   int probe[ICS_MAXDIM];
+   int n = 0, nprobe = 0, ii, d, tmp;
+
+   for (ii=0;ii<ndims;ii++)
+      used[ii] = 0;
+   for (ii=0;ii<4;ii++) {
+      d = find_dim (ip, ndims, first[ii], ii==3 ? "time" : NULL, used);
+      if (d >= 0) {
+         perm[n++] = d;
+         used[d] = 1;
+      }
+   }
+   while ((d = find_dim (ip, ndims, "probe", NULL, used)) >= 0) {
+      probe[nprobe++] = d;
+      used[d] = 1;
+   }
+   for (ii=0;ii<ndims;ii++)
+      if (!used[ii])
+         perm[n++] = ii;
+   for (ii=0;ii<nprobe;ii++)
+      perm[n++] = probe[ii];
+   if (ndims>1) {
+      /* This is to swap the first two dimensions; MATLAB does y-x-z indexing. */
+      tmp = perm[0];
+      perm[0] = perm[1];
+      perm[1] = tmp;
+   }
+}
+
+/* Reads a vector argument with one value per dimension. */
+static int get_vector (const mxArray* arg, int ndims, size_t* dest,
+                       const char* name) {
+   char errormessage[256];
+   double* data;
+   int ii;
+
+   if (mxIsEmpty (arg))
+      return 0;
+   if (!mxIsDouble (arg) || mxIsComplex (arg) ||
+       (int)mxGetNumberOfElements (arg) != ndims) {
+      sprintf (errormessage, "%s should be a vector with one value per dimension.", name);
+      mexErrMsgTxt (errormessage);
+   }
+   data = mxGetPr (arg);
+   for (ii=0;ii<ndims;ii++) {
+      if (data[ii] < 0)
+         mexErrMsgTxt ("Negative values in OFFSET, SIZE or SAMPLING.");
+      dest[ii] = (size_t)data[ii];
+   }
+   return 1;
+}
+
+/* Reads a region of complex data into the separate real and imaginary arrays,
+   a line at a time. */
+static Ics_Error read_split_complex (ICS* ip, int ndims, const size_t* dims,
+                                     const size_t* offset, const size_t* size,
+                                     const size_t* sampling,
+                                     const ptrdiff_t* strides, size_t elemsize,
+                                     char* re, char* im) {
+   size_t pos[ICS_MAXDIM];
+   size_t filestride[ICS_MAXDIM];
+   size_t curloc = 0, newloc, linesize, count, jj;
+   ptrdiff_t out;
+   char* line;
+   char* src;
+   Ics_Error retval = IcsErr_Ok;
+   int ii;
+
+   for (ii=0;ii<ndims;ii++)
+      if (size[ii] == 0)
+         return IcsErr_Ok;
+   filestride[0] = 2*elemsize;
+   for (ii=1;ii<ndims;ii++)
+      filestride[ii] = filestride[ii-1]*dims[ii-1];
+   linesize = size[0]*2*elemsize;
+   count = (size[0]+sampling[0]-1)/sampling[0];
+   line = (char*)mxMalloc (linesize);
+   for (ii=0;ii<ndims;ii++)
+      pos[ii] = offset[ii];
+   while (1) {
+      newloc = 0;
+      out = 0;
+      for (ii=0;ii<ndims;ii++) {
+         newloc += pos[ii]*filestride[ii];
+         out += (ptrdiff_t)((pos[ii]-offset[ii])/sampling[ii])*strides[ii];
+      }
+      if (curloc < newloc)
+         retval = IcsSkipDataBlock (ip, newloc-curloc);
+      if (retval == IcsErr_Ok)
+         retval = IcsGetDataBlock (ip, line, linesize);
+      if (retval != IcsErr_Ok)
+         break;
+      curloc = newloc+linesize;
+      src = line;
+      for (jj=0;jj<count;jj++) {
+         memcpy (re+out*(ptrdiff_t)elemsize, src, elemsize);
+         memcpy (im+out*(ptrdiff_t)elemsize, src+elemsize, elemsize);
+         src += sampling[0]*2*elemsize;
+         out += strides[0];
+      }
+      for (ii=1;ii<ndims;ii++) {
+         pos[ii] += sampling[ii];
+         if (pos[ii] < offset[ii]+size[ii])
+            break;
+         pos[ii] = offset[ii];
+      }
+      if (ii==ndims)
+         break;
+   }
+   mxFree (line);
+   return retval;
+}
+
 void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
    ICS* ip;
    Ics_DataType dt;
    mwSize mx_dims[ICS_MAXDIM];
    int ndims;
+   int perm[ICS_MAXDIM];
    size_t dims[ICS_MAXDIM];
-   size_t strides[ICS_MAXDIM];
-   size_t bufsize;
+   size_t offset[ICS_MAXDIM];
+   size_t size[ICS_MAXDIM];
+   size_t sampling[ICS_MAXDIM];
+   ptrdiff_t strides[ICS_MAXDIM];
+   ptrdiff_t stride;
    void* buf;
    Ics_Error retval;
    mxClassID class;
+   mxComplexity complexity = mxREAL;
    char filename[ICS_MAXPATHLEN];
-   int elemsize;
+   const char* order;
+   const char* label;
+   size_t elemsize;
    int ii;
-   size_t tmp;
    char errormessage[2048];
 
    if (strcmp (ICSLIB_VERSION, IcsGetLibVersion ()))
       mexErrMsgTxt ("Linking against the wrong version of the library.");
 
-   /* There should be one output argument. */
-   if (nlhs > 1)
+   /* There should be one or two output arguments. */
+   if (nlhs > 2)
       mexErrMsgTxt ("Too many output arguments.");
 
-   /* There should be one input argument. */
-   if (nrhs > 1)
+   /* There should be one to four input arguments. */
+   if (nrhs > 4)
       mexErrMsgTxt ("Too many input arguments.");
    if (nrhs < 1)
       mexErrMsgTxt ("Not enough input arguments.");
@@ -109,33 +263,84 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
          elemsize = 4;
          break;
       case Ics_complex64:
+         class = mxDOUBLE_CLASS;
+         complexity = mxCOMPLEX;
+         elemsize = 8;
+         break;
       case Ics_complex32:
-         mexErrMsgTxt ("Cannot read complex data (I'm too lazy).");
+         class = mxSINGLE_CLASS;
+         complexity = mxCOMPLEX;
+         elemsize = 4;
          break;
       default:
+         IcsClose (ip);
          mexErrMsgTxt ("Unknown data type in ICS file.");
    }
-   strides[0] = 1;
-   for (ii=1;ii<ndims;ii++)
-      strides[ii] = strides[ii-1]*dims[ii-1];
-   if (ndims>1) {
-      /* This is to swap the first two dimensions; MATLAB does y-x-z indexing. */
-      strides[0] = dims[1];
-      strides[1] = 1;
-      tmp = dims[0];
-      dims[0] = dims[1];
-      dims[1] = tmp;
+
+   /* Region arguments. */
+   for (ii=0;ii<ndims;ii++) {
+      offset[ii] = 0;
+      sampling[ii] = 1;
    }
-   for (ii=0;ii<ndims;ii++)
-      mx_dims[ii] = (mwSize)(dims[ii]);
-   plhs[0] = mxCreateNumericArray ((mwSize)ndims, mx_dims, class, mxREAL);
+   if (nrhs > 1)
+      get_vector (prhs[1], ndims, offset, "OFFSET");
+   for (ii=0;ii<ndims;ii++) {
+      if (offset[ii] > dims[ii]) {
+         IcsClose (ip);
+         mexErrMsgTxt ("OFFSET is outside of the image.");
+      }
+      size[ii] = dims[ii]-offset[ii];
+   }
+   if (nrhs > 2)
+      get_vector (prhs[2], ndims, size, "SIZE");
+   if (nrhs > 3)
+      get_vector (prhs[3], ndims, sampling, "SAMPLING");
+   for (ii=0;ii<ndims;ii++) {
+      if (sampling[ii] < 1 || offset[ii]+size[ii] > dims[ii]) {
+         IcsClose (ip);
+         mexErrMsgTxt ("The region is outside of the image.");
+      }
+   }
+
+   /* The output array has the dimensions in a different order; the strides
+      make the library put each sample in its place. */
+   sort_dims (ip, ndims, perm);
+   stride = 1;
+   for (ii=0;ii<ndims;ii++) {
+      mx_dims[ii] = (mwSize)((size[perm[ii]]+sampling[perm[ii]]-1)/sampling[perm[ii]]);
+      strides[perm[ii]] = stride;
+      stride *= (ptrdiff_t)mx_dims[ii];
+   }
+   plhs[0] = mxCreateNumericArray ((mwSize)ndims, mx_dims, class, complexity);
    buf = mxGetData (plhs[0]);
-   bufsize = mxGetNumberOfElements (plhs[0]) * elemsize;
-   retval = IcsGetDataWithStrides (ip, buf, bufsize, strides, ndims);
+#if !defined(MX_HAS_INTERLEAVED_COMPLEX) || !MX_HAS_INTERLEAVED_COMPLEX
+   if (complexity == mxCOMPLEX) {
+      /* MATLAB stores the real and imaginary parts in separate arrays. */
+      retval = read_split_complex (ip, ndims, dims, offset, size, sampling,
+                                   strides, elemsize, (char*)buf,
+                                   (char*)mxGetImagData (plhs[0]));
+   }
+   else
+#endif
+   {
+      retval = IcsGetROIDataWithStrides (ip, offset, size, sampling, buf,
+                                         strides, ndims);
+   }
    if (retval != IcsErr_Ok) {
+      IcsClose (ip);
       sprintf (errormessage, "Couldn't read the image data: %s", IcsGetErrorText (retval));
       mexErrMsgTxt (errormessage);
    }
+
+   /* Second output argument. */
+   if (nlhs > 1) {
+      plhs[1] = mxCreateCellMatrix (1, (mwSize)ndims);
+      for (ii=0;ii<ndims;ii++) {
+         IcsGetOrderF (ip, perm[ii], &order, &label);
+         mxSetCell (plhs[1], (mwSize)ii, mxCreateString (order));
+      }
+   }
+
    retval = IcsClose (ip);
    if (retval != IcsErr_Ok) {
       sprintf (errormessage, "Couldn't close the file pointer: %s", IcsGetErrorText (retval));
@@ -3,8 +3,10 @@
  *     in A to an ICS image file named FILENAME. If COMPRESS
  *     is non-zero the data will be written compressed.
  *
- *     Known limitations:
- *        - Complex data is not written.
+ *     Complex data is written as complex32 or complex64. With
+ *     MATLAB's interleaved complex storage the data is written
+ *     without making a copy; with separate storage it is first
+ *     interleaved into a temporary copy.
  *
  * Copyright (C) 2000-2007 Cris Luengo and others
  * email: clluengo@users.sourceforge.net
@@ -24,9 +26,11 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
    int ndims;
    const mwSize* mx_dims;
    size_t dims[ICS_MAXDIM];
-   size_t strides[ICS_MAXDIM];
+   ptrdiff_t strides[ICS_MAXDIM];
    size_t bufsize;
    void* buf;
+   void* copy = NULL;
+   int complex;
    Ics_Error retval;
    mxClassID class;
    char filename[ICS_MAXPATHLEN];
@@ -86,8 +90,16 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
       default:
          mexErrMsgTxt ("Input array should be numeric.");
    }
-   if (mxIsComplex (prhs[0]))
-      mexErrMsgTxt ("Cannot write complex data (I'm too lazy).");
+   complex = mxIsComplex (prhs[0]);
+   if (complex) {
+      if (dt == Ics_real64)
+         dt = Ics_complex64;
+      else if (dt == Ics_real32)
+         dt = Ics_complex32;
+      else
+         mexErrMsgTxt ("Complex data should be single or double.");
+      elemsize *= 2;
+   }
    buf = mxGetData (prhs[0]);
    ndims = (int)mxGetNumberOfDimensions (prhs[0]);
    mx_dims = mxGetDimensions (prhs[0]);
@@ -95,16 +107,34 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
       dims[ii] = (size_t)(mx_dims[ii]);
    strides[0] = 1;
    for (ii=1;ii<ndims;ii++)
-      strides[ii] = strides[ii-1]*dims[ii-1];
+      strides[ii] = strides[ii-1]*(ptrdiff_t)dims[ii-1];
    if (ndims>1) {
       /* This is to swap the first two dimensions; MATLAB does y-x-z indexing. */
       tmp = dims[0];
       dims[0] = dims[1];
       dims[1] = tmp;
-      strides[0] = dims[1];
+      strides[0] = (ptrdiff_t)dims[1];
       strides[1] = 1;
    }
    bufsize = mxGetNumberOfElements (prhs[0]) * elemsize;
+#if !defined(MX_HAS_INTERLEAVED_COMPLEX) || !MX_HAS_INTERLEAVED_COMPLEX
+   if (complex) {
+      /* MATLAB stores the real and imaginary parts in separate arrays. */
+      size_t n = mxGetNumberOfElements (prhs[0]);
+      size_t half = elemsize / 2;
+      char* re = (char*)mxGetData (prhs[0]);
+      char* im = (char*)mxGetImagData (prhs[0]);
+      char* out;
+      copy = mxMalloc (bufsize);
+      out = (char*)copy;
+      for (tmp=0;tmp<n;tmp++) {
+         memcpy (out, re+tmp*half, half);
+         memcpy (out+half, im+tmp*half, half);
+         out += elemsize;
+      }
+      buf = copy;
+   }
+#endif
 
    /* Second input argument. */
    filename[0] = '\0';
@@ -140,6 +170,8 @@ void mexFunction (int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
       IcsSetCompression (ip, IcsCompr_gzip, 0);
    IcsAddHistory (ip, "software", "ICSWRITE under MATLAB with libics");
    retval = IcsClose (ip);
+   if (copy)
+      mxFree (copy);
    if (retval != IcsErr_Ok) {
       sprintf (errormessage, "Failed to create the ICS file: %s", IcsGetErrorText (retval));
       mexErrMsgTxt (errormessage);
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "libics_ll.h"
+#include "test_util.h"
+
+#define NREADS 16
+
+typedef struct {
+   int       done;
+   Ics_Error error;
+} Result;
+
+static void on_read(void *userData, Ics_Error error) {
+   Result *r = userData;
+   r->error = error;
+   r->done = 1;
+}
+
+/* A region for read number i */
+static void region(int i, const size_t *dims, size_t *offset, size_t *size) {
+   int j;
+   for(j = 0; j < 3; j++) {
+      offset[j] = (size_t)(i * (j + 3)) % ((dims[j] + 1) / 2);
+      size[j] = (dims[j] - offset[j] + 1) / 2;
+      if(i % 2) size[j] = dims[j] - offset[j];
+   }
+}
+
+/* Read NREADS regions asynchronously and compare them to blocking reads */
+static void compare(const char *name, int callbacks) {
+   ICS*            ip;
+   Ics_DataType    dt;
+   int             ndims, i, j, done;
+   size_t          dims[ICS_MAXDIM], offset[3], size[3], n[NREADS];
+   char            *bufs[NREADS], *ref;
+   Ics_ReadRequest *requests[NREADS];
+   Result          results[NREADS];
+
+   check(IcsOpen(&ip, name, "r"), "open file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   for(i = 0; i < NREADS; i++) {
+      region(i, dims, offset, size);
+      n[i] = IcsGetDataTypeSize(dt);
+      for(j = 0; j < 3; j++) n[i] *= size[j];
+      bufs[i] = malloc(n[i]);
+      results[i].done = 0;
+      check(IcsSubmitROIRead(ip, offset, size, NULL, bufs[i], n[i],
+                             callbacks ? on_read : NULL, results + i,
+                             requests + i), "submit read");
+   }
+   /* Reads continue with their own copy of the ICS structure */
+   check(IcsClose(ip), "close file");
+   for(i = 0; i < NREADS; i++) {
+      if(i % 2) {
+         do {
+            check(IcsPollRead(requests[i], &done), "poll read");
+         } while(!done);
+      }
+      check(IcsWaitRead(requests[i]), "read region");
+      /* The callback has been called before the request was done */
+      if(callbacks && (!results[i].done || results[i].error != IcsErr_Ok)) {
+         fprintf(stderr, "Callback of read %d not called.\n", i);
+         exit(-1);
+      }
+   }
+
+   check(IcsOpen(&ip, name, "r"), "open file");
+   for(i = 0; i < NREADS; i++) {
+      region(i, dims, offset, size);
+      ref = malloc(n[i]);
+      check(IcsGetROIData(ip, offset, size, NULL, ref, n[i]), "read region");
+      if(memcmp(ref, bufs[i], n[i]) != 0) {
+         fprintf(stderr, "Asynchronous read %d of %s differs.\n", i, name);
+         exit(-1);
+      }
+      free(ref);
+      free(bufs[i]);
+   }
+   check(IcsClose(ip), "close file");
+}
+
+typedef struct {
+   int order[NREADS];
+   int count;
+} Log;
+
+typedef struct {
+   Log *log;
+   int index;
+} Entry;
+
+/* The first callback takes long, so that later reads would overtake it */
+static void on_ordered_read(void *userData, Ics_Error error) {
+   Entry          *e = userData;
+   volatile long  spin;
+   check(error, "read region");
+   if(e->index == 0) {
+      for(spin = 0; spin < 50000000; spin++);
+   }
+   e->log->order[e->log->count++] = e->index;
+}
+
+/* Reads on one handle finish in the order they were submitted, even if a
+   later one is much smaller and there are workers to spare */
+static void ordered(const char *name) {
+   ICS*            ip;
+   Ics_Context     *ctx;
+   Ics_DataType    dt;
+   int             ndims, i;
+   size_t          dims[ICS_MAXDIM], size[3], n;
+   char            *bufs[NREADS];
+   Ics_ReadRequest *requests[NREADS];
+   Entry           entries[NREADS];
+   Log             log;
+
+   log.count = 0;
+   check(IcsNewContext(&ctx, 4), "create context");
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsSetContext(ip, ctx), "set context");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   for(i = 0; i < NREADS; i++) {
+      size[0] = i % 4 ? 1 : dims[0];
+      size[1] = i % 4 ? 1 : dims[1];
+      size[2] = i % 4 ? 1 : dims[2];
+      n = IcsGetDataTypeSize(dt) * size[0] * size[1] * size[2];
+      bufs[i] = malloc(n);
+      entries[i].log = &log;
+      entries[i].index = i;
+      check(IcsSubmitROIRead(ip, NULL, size, NULL, bufs[i], n,
+                             on_ordered_read, entries + i, requests + i),
+            "submit read");
+   }
+   for(i = 0; i < NREADS; i++) {
+      check(IcsWaitRead(requests[i]), "read region");
+      free(bufs[i]);
+   }
+   check(IcsClose(ip), "close file");
+   check(IcsFreeContext(ctx), "free context");
+   for(i = 0; i < NREADS; i++) {
+      if(log.order[i] != i) {
+         fprintf(stderr, "Read %d of %s finished out of order.\n",
+                 log.order[i], name);
+         exit(-1);
+      }
+   }
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*            ip;
+   ICS*            op;
+   Ics_DataType    dt;
+   int             ndims;
+   size_t          dims[ICS_MAXDIM];
+   size_t          bufsize;
+   void            *buf;
+   Ics_ReadRequest *request;
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* A compressed copy of the image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   bufsize = IcsGetDataSize(ip);
+   buf = malloc(bufsize);
+   check(IcsGetData(ip, buf, bufsize), "read input image data");
+   check(IcsClose(ip), "close input file");
+   check(IcsOpen(&op, argv[2], "w2"), "open output file");
+   IcsSetLayout(op, dt, ndims, dims);
+   IcsSetData(op, buf, bufsize);
+   IcsSetCompression(op, IcsCompr_gzip, 6);
+   check(IcsClose(op), "write output file");
+
+   compare(argv[1], 0);
+   compare(argv[1], 1);
+   compare(argv[2], 0);
+   compare(argv[2], 1);
+   ordered(argv[1]);
+   ordered(argv[2]);
+
+   /* Errors are reported when the read has finished */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   dims[0]++;
+   check(IcsSubmitROIRead(ip, NULL, dims, NULL, buf, bufsize, NULL, NULL,
+                          &request), "submit read");
+   if(IcsWaitRead(request) != IcsErr_IllegalROI) {
+      fprintf(stderr, "Illegal region not detected.\n");
+      exit(-1);
+   }
+   if(IcsSubmitROIRead(ip, NULL, NULL, NULL, buf, bufsize, NULL, NULL, NULL)
+      != IcsErr_IllParameter) {
+      fprintf(stderr, "Missing callback and request handle not detected.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close input file");
+
+   free(buf);
+   exit(0);
+}
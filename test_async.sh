@@ -0,0 +1 @@
+./test_async $srcdir/test/testim.ics result_async.ics
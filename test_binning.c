@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "libics.h"
+#include "test_util.h"
+
+/* Binned 3D region of the image in img, computed directly */
+static void reference(const double *img, const size_t *dims,
+                      const size_t *offset, const size_t *size,
+                      const size_t *bin, Ics_BinMode mode, double *dest) {
+   size_t out[3], x, y, z, i, j, k, cnt;
+   double v, r;
+
+   for(i = 0; i < 3; i++) out[i] = (size[i] + bin[i] - 1) / bin[i];
+   for(z = 0; z < out[2]; z++) {
+      for(y = 0; y < out[1]; y++) {
+         for(x = 0; x < out[0]; x++) {
+            r = mode == IcsBin_max ? -HUGE_VAL : mode == IcsBin_min ? HUGE_VAL : 0;
+            cnt = 0;
+            for(k = z * bin[2]; k < (z + 1) * bin[2] && k < size[2]; k++) {
+               for(j = y * bin[1]; j < (y + 1) * bin[1] && j < size[1]; j++) {
+                  for(i = x * bin[0]; i < (x + 1) * bin[0] && i < size[0]; i++) {
+                     v = img[((k + offset[2]) * dims[1] + j + offset[1]) * dims[0]
+                             + i + offset[0]];
+                     if(mode == IcsBin_mean) r += v;
+                     else if(mode == IcsBin_max) { if(r < v) r = v; }
+                     else if(r > v) r = v;
+                     cnt++;
+                  }
+               }
+            }
+            if(mode == IcsBin_mean) r /= (double)cnt;
+            *dest++ = r;
+         }
+      }
+   }
+}
+
+static void compare(const char *name, Ics_DataType dt, const double *img,
+                    const size_t *dims, const size_t *offset,
+                    const size_t *size, const size_t *bin) {
+   ICS*          ip;
+   Ics_BinMode   mode;
+   size_t        n = 1, i;
+   double        *expected;
+   void          *buf;
+   double        v;
+
+   for(i = 0; i < 3; i++) n *= (size[i] + bin[i] - 1) / bin[i];
+   expected = malloc(n * sizeof(double));
+   buf = malloc(n * sizeof(float));
+   for(mode = IcsBin_mean; mode <= IcsBin_min; mode++) {
+      reference(img, dims, offset, size, bin, mode, expected);
+      check(IcsOpen(&ip, name, "r"), "open file");
+      check(IcsGetBinnedROIData(ip, offset, size, bin, mode, buf,
+                                n * (dt == Ics_real32 ? 4 : 2)),
+            "read binned data");
+      check(IcsClose(ip), "close file");
+      for(i = 0; i < n; i++) {
+         if(dt == Ics_real32) {
+            v = ((float*)buf)[i];
+            if(fabs(v - expected[i]) > 1e-6 * fabs(expected[i])) break;
+         } else {
+            if(((unsigned short*)buf)[i] != (unsigned short)floor(expected[i] + 0.5))
+               break;
+         }
+      }
+      if(i != n) {
+         fprintf(stderr, "Binned data of %s differ from the expected data"
+                 " (mode %d, bin %d).\n", name, (int)mode, (int)i);
+         exit(-1);
+      }
+   }
+   free(expected);
+   free(buf);
+}
+
+static void write_file(const char *name, Ics_DataType dt, size_t *dims,
+                       void *buf, size_t bufsize, Ics_Compression compr) {
+   ICS* ip;
+   check(IcsOpen(&ip, name, "w2"), "open output file");
+   IcsSetLayout(ip, dt, 3, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, compr, 6);
+   check(IcsClose(ip), "write output file");
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         n, i;
+   unsigned short *buf16;
+   float          *buf32;
+   double         *img;
+   char           namez[1024], name32[1024];
+   size_t         all[3] = {0, 0, 0};
+   size_t         offset[3] = {3, 5, 1};
+   size_t         size[3] = {170, 97, 1};
+   size_t         bin1[3] = {4, 3, 2};
+   size_t         bin2[3] = {8, 8, 1};
+   size_t         bin3[3] = {1, 1, 1};
+   unsigned short small[4];
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16 || ndims != 3) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   n = IcsGetImageSize(ip);
+   buf16 = malloc(n * 2);
+   buf32 = malloc(n * sizeof(float));
+   img = malloc(n * sizeof(double));
+   check(IcsGetData(ip, buf16, n * 2), "read input image data");
+   check(IcsClose(ip), "close input file");
+   for(i = 0; i < n; i++) {
+      buf32[i] = (float)buf16[i] * 0.3f - 100.0f;
+      img[i] = buf16[i];
+   }
+   test_name(namez, argv[2], "_z.ics");
+   write_file(namez, Ics_uint16, dims, buf16, n * 2, IcsCompr_gzip);
+   test_name(name32, argv[2], "_f.ics");
+   write_file(name32, Ics_real32, dims, buf32, n * sizeof(float),
+              IcsCompr_uncompressed);
+
+   /* Whole image with bins that do not divide the sizes, and a region */
+   compare(argv[1], Ics_uint16, img, dims, all, dims, bin1);
+   compare(argv[1], Ics_uint16, img, dims, offset, size, bin2);
+   compare(argv[1], Ics_uint16, img, dims, offset, size, bin3);
+   compare(namez, Ics_uint16, img, dims, all, dims, bin1);
+   compare(namez, Ics_uint16, img, dims, offset, size, bin2);
+   for(i = 0; i < n; i++) img[i] = buf32[i];
+   compare(name32, Ics_real32, img, dims, all, dims, bin1);
+   compare(name32, Ics_real32, img, dims, offset, size, bin2);
+
+   /* Errors */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   if(IcsGetBinnedROIData(ip, NULL, NULL, bin1, IcsBin_mean, small, 4)
+      != IcsErr_BufferTooSmall) {
+      fprintf(stderr, "Small buffer not detected.\n");
+      exit(-1);
+   }
+   bin3[0] = 0;
+   if(IcsGetBinnedROIData(ip, NULL, NULL, bin3, IcsBin_mean, buf16, n * 2)
+      != IcsErr_IllegalROI) {
+      fprintf(stderr, "Zero bin size not detected.\n");
+      exit(-1);
+   }
+   IcsClose(ip);
+
+   free(buf16);
+   free(buf32);
+   free(img);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_binning $srcdir/test/testim.ics result_binning.ics && ICS_CPU_LEVEL=generic ./test_binning $srcdir/test/testim.ics result_binning_generic.ics
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+static int exists(const char *name) {
+   FILE *fp = fopen(name, "rb");
+   if(fp == NULL) return 0;
+   fclose(fp);
+   return 1;
+}
+
+/* Copy a 3D region out of an image */
+static void extract(const unsigned short *img, const size_t *dims,
+                    const size_t *offset, const size_t *size,
+                    unsigned short *dest) {
+   size_t y, z;
+   for(z = 0; z < size[2]; z++) {
+      for(y = 0; y < size[1]; y++) {
+         memcpy(dest, img + ((z + offset[2]) * dims[1] + y + offset[1]) * dims[0]
+                + offset[0], size[0] * 2);
+         dest += size[0];
+      }
+   }
+}
+
+static void write_chunks(const char *name, const char *dir, size_t *dims,
+                         size_t *chunks, Ics_Compression compr,
+                         unsigned short *buf) {
+   ICS* ip;
+   check(IcsOpen(&ip, name, "w2"), "open output file");
+   IcsSetLayout(ip, Ics_uint16, 3, dims);
+   if(buf != NULL) {
+      IcsSetData(ip, buf, dims[0] * dims[1] * dims[2] * 2);
+   }
+   IcsSetCompression(ip, compr, 6);
+   check(IcsSetChunkStore(ip, dir, chunks), "set the chunk directory");
+   check(IcsClose(ip), "write output file");
+}
+
+/* Compare a region read through ip with the same region of img */
+static void compare(ICS *ip, const unsigned short *img, size_t *dims,
+                    const size_t *offset, const size_t *size,
+                    const char *what) {
+   size_t         n = size[0] * size[1] * size[2];
+   unsigned short *roi = malloc(n * 2);
+   unsigned short *expected = malloc(n * 2);
+   check(IcsGetROIData(ip, offset, size, NULL, roi, n * 2), "read region");
+   extract(img, dims, offset, size, expected);
+   if(memcmp(roi, expected, n * 2) != 0) {
+      fprintf(stderr, "Data read %s differ from the data written.\n", what);
+      exit(-1);
+   }
+   free(roi);
+   free(expected);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims, ii;
+   size_t         dims[ICS_MAXDIM];
+   size_t         n;
+   unsigned short *buf, *zeros, *region;
+   char           name[1024], dir[1024], chunk[1100];
+   size_t         chunks[3] = {40, 32, 1};
+   size_t         thick[3] = {40, 32, 2};
+   size_t         all[3] = {0, 0, 0};
+   size_t         offset[3] = {7, 9, 0};
+   size_t         size[3] = {101, 60, 2};
+   size_t         offset2[3] = {40, 32, 0};
+   size_t         size2[3] = {40, 32, 1};
+   size_t         offset3[3] = {0, 0, 1};
+   size_t         plane[3];
+   Ics_Compression compr[3] = {IcsCompr_uncompressed, IcsCompr_gzip,
+                               IcsCompr_loco};
+   const char*    ext[3] = {"", ".gz", ".loco"};
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16 || ndims != 3 || dims[0] < 80 || dims[1] < 64) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   n = IcsGetImageSize(ip);
+   buf = malloc(n * 2);
+   zeros = calloc(n, 2);
+   plane[0] = dims[0];
+   plane[1] = dims[1];
+   plane[2] = 1;
+   check(IcsGetData(ip, buf, n * 2), "read input image data");
+   if(IcsPutROIData(ip, NULL, NULL, buf, n * 2) != IcsErr_NotValidAction) {
+      fprintf(stderr, "Writing to a file without chunk directory allowed.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close input file");
+
+   /* Chunks that don't divide the image, with each compression method */
+   test_name(name, argv[2], "_c.ics");
+   test_name(dir, argv[2], "_c.chunks");
+   for(ii = 0; ii < 3; ii++) {
+      write_chunks(name, dir, dims, chunks, compr[ii], buf);
+      sprintf(chunk, "%s/4.1.0%s", dir, ext[ii]);
+      if(!exists(chunk)) {
+         fprintf(stderr, "Chunk file %s not written.\n", chunk);
+         exit(-1);
+      }
+      check(IcsOpen(&ip, name, "r"), "open chunked file");
+      compare(ip, buf, dims, all, dims, "from the chunk directory");
+      compare(ip, buf, dims, offset, size, "from the chunk directory");
+      check(IcsClose(ip), "close chunked file");
+   }
+
+   /* Reading plane by plane decodes each chunk once: the second plane comes
+      from the chunks decoded for the first one, even if the directory is
+      gone */
+   write_chunks(name, dir, dims, thick, IcsCompr_gzip, buf);
+   sprintf(chunk, "%s.moved", dir);
+   check(IcsOpen(&ip, name, "r"), "open chunked file");
+   region = malloc(n * 2);
+   check(IcsGetDataBlock(ip, region, dims[0] * dims[1] * 2), "read plane");
+   if(rename(dir, chunk) != 0) {
+      fprintf(stderr, "Could not move the chunk directory.\n");
+      exit(-1);
+   }
+   check(IcsGetDataBlock(ip, region + dims[0] * dims[1],
+                         (n - dims[0] * dims[1]) * 2), "read other planes");
+   rename(chunk, dir);
+   if(memcmp(region, buf, n * 2) != 0) {
+      fprintf(stderr, "Chunks decoded again for each plane.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close chunked file");
+   free(region);
+
+   /* An empty chunk directory, filled region by region */
+   write_chunks(name, dir, dims, chunks, IcsCompr_uncompressed, NULL);
+   sprintf(chunk, "%s/1.1.0", dir);
+   remove(chunk);
+   check(IcsOpen(&ip, name, "r"), "open chunked file");
+   compare(ip, zeros, dims, offset2, size2, "from a missing chunk");
+   region = malloc(n * 2);
+   extract(buf, dims, offset, size, region);
+   check(IcsPutROIData(ip, offset, size, region, n * 2), "write region");
+   if(!exists(chunk)) {
+      fprintf(stderr, "Chunk file %s not written.\n", chunk);
+      exit(-1);
+   }
+   compare(ip, buf, dims, offset, size, "after writing a region");
+
+   /* Then the whole image, one plane at a time */
+   check(IcsPutROIData(ip, all, plane, buf, n * 2), "write first plane");
+   check(IcsPutROIData(ip, offset3, plane, buf + dims[0] * dims[1],
+                       dims[0] * dims[1] * 2), "write second plane");
+   compare(ip, buf, dims, all, dims, "after writing the whole image");
+   check(IcsClose(ip), "close chunked file");
+
+   free(buf);
+   free(zeros);
+   free(region);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_chunks $srcdir/test/testim.ics result_chunks.ics
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "libics_ll.h"
+#include "test_util.h"
+
+#define NREADS 8
+
+typedef struct {
+   size_t allocs;
+   size_t frees;
+} Counter;
+
+static void *count_alloc(void *userData, size_t size) {
+   ((Counter*)userData)->allocs++;
+   return malloc(size);
+}
+
+static void count_free(void *userData, void *ptr) {
+   ((Counter*)userData)->frees++;
+   free(ptr);
+}
+
+static void write_file(const char *name, Ics_Context *ctx, Ics_DataType dt,
+                       int ndims, const size_t *dims, const void *buf,
+                       size_t bufsize, Ics_Compression compr) {
+   ICS* ip;
+   check(IcsOpen(&ip, name, "w2"), "open output file");
+   check(IcsSetContext(ip, ctx), "set context");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, compr, 6);
+   check(IcsClose(ip), "write output file");
+}
+
+/* Read every other pixel, which goes through a line buffer */
+static void read_sampled(const char *name, Ics_Context *ctx, void *dest,
+                         size_t n) {
+   ICS*   ip;
+   size_t sampling[3] = {2, 2, 1};
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsSetContext(ip, ctx), "set context");
+   check(IcsGetROIData(ip, NULL, NULL, sampling, dest, n), "read region");
+   check(IcsClose(ip), "close file");
+}
+
+static void compare(const void *a, const void *b, size_t n, const char *what) {
+   if(memcmp(a, b, n) != 0) {
+      fprintf(stderr, "Data differ: %s.\n", what);
+      exit(-1);
+   }
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*            ip;
+   Ics_DataType    dt;
+   int             ndims, ii, jj;
+   size_t          dims[ICS_MAXDIM];
+   size_t          bufsize, n, allocs = 0;
+   void            *buf, *ref, *out, *bufs[NREADS];
+   char            namez[1024], namel[1024];
+   Ics_Context     *ctx;
+   Ics_ReadRequest *requests[NREADS];
+   Counter         counter = {0, 0};
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   bufsize = IcsGetDataSize(ip);
+   buf = malloc(bufsize);
+   check(IcsGetData(ip, buf, bufsize), "read input image data");
+   check(IcsClose(ip), "close input file");
+   n = IcsGetDataTypeSize(dt) * ((dims[0] + 1) / 2) * ((dims[1] + 1) / 2);
+   for(jj = 2; jj < ndims; jj++) n *= dims[jj];
+   ref = malloc(n);
+   out = malloc(n);
+   read_sampled(argv[1], NULL, ref, n);
+   test_name(namez, argv[2], "_z.ics");
+   test_name(namel, argv[2], "_l.ics");
+
+   /* With a single thread, repeated writes and reads reuse the buffers of the
+      first round */
+   check(IcsNewContextWithAllocator(&ctx, 1, count_alloc, count_free,
+                                    &counter), "create context");
+   for(ii = 0; ii < 4; ii++) {
+      write_file(namez, ctx, dt, ndims, dims, buf, bufsize, IcsCompr_gzip);
+      write_file(namel, ctx, dt, ndims, dims, buf, bufsize, IcsCompr_loco);
+      read_sampled(namez, ctx, out, n);
+      compare(ref, out, n, "gzip with context");
+      read_sampled(namel, ctx, out, n);
+      compare(ref, out, n, "loco with context");
+      if(ii == 0) {
+         allocs = counter.allocs;
+      }
+   }
+   if(allocs == 0 || counter.allocs != allocs) {
+      fprintf(stderr, "Buffers not reused (%d, then %d allocations).\n",
+              (int)allocs, (int)counter.allocs);
+      exit(-1);
+   }
+   check(IcsFreeContext(ctx), "free context");
+   if(counter.frees != counter.allocs) {
+      fprintf(stderr, "Context memory not freed.\n");
+      exit(-1);
+   }
+
+   /* Several threads shared by asynchronous reads, which decode tiles in
+      parallel themselves */
+   check(IcsNewContextWithAllocator(&ctx, 4, count_alloc, count_free,
+                                    &counter), "create context");
+   check(IcsOpen(&ip, namel, "r"), "open file");
+   check(IcsSetContext(ip, ctx), "set context");
+   for(ii = 0; ii < NREADS; ii++) {
+      bufs[ii] = malloc(bufsize);
+      check(IcsSubmitROIRead(ip, NULL, NULL, NULL, bufs[ii], bufsize, NULL,
+                             NULL, requests + ii), "submit read");
+   }
+   for(ii = 0; ii < NREADS; ii++) {
+      check(IcsWaitRead(requests[ii]), "read data");
+      compare(buf, bufs[ii], bufsize, "asynchronous read with context");
+      free(bufs[ii]);
+   }
+   check(IcsClose(ip), "close file");
+   read_sampled(namez, ctx, out, n);
+   compare(ref, out, n, "gzip with context");
+   check(IcsFreeContext(ctx), "free context");
+   if(counter.frees != counter.allocs) {
+      fprintf(stderr, "Context memory not freed.\n");
+      exit(-1);
+   }
+
+   /* Errors */
+   if(IcsNewContextWithAllocator(&ctx, 1, count_alloc, NULL, NULL)
+      != IcsErr_IllParameter) {
+      fprintf(stderr, "Missing free function not detected.\n");
+      exit(-1);
+   }
+
+   free(buf);
+   free(ref);
+   free(out);
+   exit(0);
+}
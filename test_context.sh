@@ -0,0 +1 @@
+./test_context $srcdir/test/testim.ics result_context.ics
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "libics_sensor.h"
+#include "test_util.h"
+
+static Ics_Error read_block(void *data, void *dest, size_t n) {
+   return IcsGetDataBlock((ICS*)data, dest, n);
+}
+
+/* Convert src to dest through a data source, then check data and metadata */
+static void convert(const char *src, const char *dest, const char *mode,
+                    Ics_Compression compression, void *buf, size_t bufsize) {
+   ICS*             in;
+   ICS*             out;
+   void*            buf2;
+   int              nhist;
+   char             line[ICS_LINE_LENGTH];
+   Ics_HistoryIterator it;
+   double           origin, scale;
+   char             units[ICS_STRLEN_TOKEN];
+
+   check(IcsOpen(&in, src, "r"), "open input file");
+   check(IcsOpen(&out, dest, mode), "open output file");
+   check(IcsCopyMetadata(out, in), "copy metadata");
+   check(IcsSetCompression(out, compression, 6), "set compression");
+   check(IcsSetDataSource(out, read_block, in), "set data source");
+   if(IcsSetData(out, buf, bufsize) != IcsErr_DuplicateData) {
+      fprintf(stderr, "IcsSetData after IcsSetDataSource not refused.\n");
+      exit(-1);
+   }
+   check(IcsClose(out), "write output file");
+   check(IcsClose(in), "close input file");
+
+   check(IcsOpen(&in, dest, "r"), "open output file for reading");
+   if(bufsize != IcsGetDataSize(in)) {
+      fprintf(stderr, "Data in output file not same size as written.\n");
+      exit(-1);
+   }
+   buf2 = malloc(bufsize);
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   check(IcsGetData(in, buf2, bufsize), "read output image data");
+   if(memcmp(buf, buf2, bufsize) != 0) {
+      fprintf(stderr, "Data in output file does not match data in input.\n");
+      exit(-1);
+   }
+   free(buf2);
+   check(IcsGetNumHistoryStrings(in, &nhist), "count history");
+   check(IcsNewHistoryIterator(in, &it, "test"), "iterate history");
+   check(IcsGetHistoryStringI(in, &it, line), "read history");
+   if(nhist != 2 || strcmp(line, "test\tsecond\tfield") != 0) {
+      fprintf(stderr, "History not copied correctly.\n");
+      exit(-1);
+   }
+   check(IcsGetPosition(in, 1, &origin, &scale, units), "read position");
+   if(origin != -653 || scale != 0.014 || strcmp(units, "milimeter") != 0) {
+      fprintf(stderr, "Position not copied correctly.\n");
+      exit(-1);
+   }
+   if(IcsGetSensorNumAperture(in) != 1.4) {
+      fprintf(stderr, "Sensor parameters not copied correctly.\n");
+      exit(-1);
+   }
+   check(IcsClose(in), "close output file");
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*         ip;
+   Ics_DataType dt;
+   int          ndims;
+   size_t       dims[ICS_MAXDIM];
+   size_t       bufsize;
+   void*        buf;
+   char         src[1024];
+   char         name[1024], suffix[16];
+   const char*  modes[4] = {"w2", "w1", "w2", "w1"};
+   Ics_Compression compr[4] = {IcsCompr_gzip, IcsCompr_uncompressed,
+                               IcsCompr_loco, IcsCompr_gzip};
+   int          ii;
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   bufsize = IcsGetDataSize(ip);
+   buf = malloc(bufsize);
+   if(buf == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   check(IcsGetData(ip, buf, bufsize), "read input image data");
+   check(IcsClose(ip), "close input file");
+
+   /* Write a source file with some metadata */
+   test_name(src, argv[2], "_src.ics");
+   check(IcsOpen(&ip, src, "w2"), "open source file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetPosition(ip, 1, -653, 0.014, "milimeter");
+   IcsAddHistory(ip, "test", "second\tfield");
+   IcsAddHistory(ip, "other", "line");
+   IcsEnableWriteSensor(ip, 1);
+   IcsSetSensorNumAperture(ip, 1.4);
+   check(IcsClose(ip), "write source file");
+
+   /* Convert it in several ways */
+   for(ii = 0; ii < 4; ii++) {
+      sprintf(suffix, "_%d.ics", ii);
+      test_name(name, argv[2], suffix);
+      convert(src, name, modes[ii], compr[ii], buf, bufsize);
+   }
+
+   free(buf);
+   exit(0);
+}
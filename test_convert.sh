@@ -0,0 +1 @@
+./test_convert $srcdir/test/testim.ics result_conv.ics && ./icsconvert -q -c gzip $srcdir/test/testim.ics result_icsconvert.ics
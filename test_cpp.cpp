@@ -0,0 +1,139 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "libics.hpp"
+
+static void fail(const char *msg) {
+   std::fprintf(stderr, "%s\n", msg);
+   std::exit(-1);
+}
+
+int main(int argc, const char* argv[]) {
+   if(argc != 3) {
+      fail("Two file names required: in out");
+   }
+
+   try {
+      /* Read image with the C++ interface */
+      ics::file in(argv[1], "r");
+      ics::layout l = in.layout();
+      if(l.type != Ics_uint16 || l.ndims != 3) {
+         fail("Expected a 3D uint16 input image.");
+      }
+      ics::buffer<std::uint16_t> img = in.read<std::uint16_t>();
+
+      /* Compare to the C interface */
+      {
+         ICS*   ip;
+         size_t bufsize;
+         void*  buf;
+         if(IcsOpen(&ip, argv[1], "r") != IcsErr_Ok) {
+            fail("Could not open input file.");
+         }
+         bufsize = IcsGetDataSize(ip);
+         buf = std::malloc(bufsize);
+         IcsGetData(ip, buf, bufsize);
+         if(std::memcmp(buf, img.data(), bufsize) != 0) {
+            fail("C++ read does not match C read.");
+         }
+         std::free(buf);
+         IcsClose(ip);
+      }
+
+      /* Reading with the wrong type must throw */
+      try {
+         in.read<float>();
+         fail("Type mismatch not detected.");
+      } catch(const ics::error &e) {
+         if(e.code() != IcsErr_IllParameter) {
+            fail("Unexpected error code for type mismatch.");
+         }
+      }
+
+      /* Conversion */
+      ics::buffer<float> imgf = in.read_as<float>();
+      auto vu = std::as_const(img).get_view();
+      auto vf = std::as_const(imgf).get_view();
+      auto mmu = ics::kernel::minmax(vu);
+      auto mmf = ics::kernel::minmax(vf);
+      if((float)mmu.first != mmf.first || (float)mmu.second != mmf.second) {
+         fail("Converted data has a different range.");
+      }
+      if(ics::kernel::sum(vu) != ics::kernel::sum(vf)) {
+         fail("Converted data has a different sum.");
+      }
+
+      /* Transposed, subsampled region through a strided view */
+      const size_t off[3] = {10, 20, 1};
+      const size_t smp[3] = {2, 3, 1};
+      size_t rdims[3] = {30, 20, 1};
+      ptrdiff_t rstrides[3] = {20, 1, 600};
+      size_t rsize[1] = {600};
+      ics::buffer<std::uint16_t> roi(rsize);
+      ics::view<std::uint16_t> rv(roi.data(), rdims, rstrides);
+      in.read_roi(rv, off, smp);
+      for(size_t y = 0; y < rdims[1]; y++) {
+         for(size_t x = 0; x < rdims[0]; x++) {
+            if(rv(x, y, 0) != img.get_view()(off[0] + x * smp[0],
+                                             off[1] + y * smp[1], off[2])) {
+               fail("Region read does not match data in input.");
+            }
+            if(roi.data()[x * 20 + y] != rv(x, y, 0)) {
+               fail("Strided view does not index the buffer correctly.");
+            }
+         }
+      }
+
+      /* Preview equals the C function */
+      {
+         ics::buffer<std::uint8_t> prev = in.preview(1);
+         ICS*   ip;
+         std::uint8_t* buf = (std::uint8_t*)std::malloc(l.dims[0] * l.dims[1]);
+         IcsOpen(&ip, argv[1], "r");
+         IcsGetPreviewData(ip, buf, l.dims[0] * l.dims[1], 1);
+         IcsClose(ip);
+         if(std::memcmp(buf, prev.data(), l.dims[0] * l.dims[1]) != 0) {
+            fail("Preview does not match IcsGetPreviewData.");
+         }
+         std::free(buf);
+      }
+      in.close();
+
+      /* Write the image mirrored along y, read it back and compare */
+      {
+         ics::view<const std::uint16_t> src = std::as_const(img).get_view();
+         ptrdiff_t mstrides[3] = {src.stride(0), -src.stride(1), src.stride(2)};
+         ics::view<const std::uint16_t> mirrored(
+            &src(0, l.dims[1] - 1, 0), l.shape(), mstrides);
+         ics::file out(argv[2], "w2");
+         out.write(mirrored, IcsCompr_gzip, 6);
+         out.close();
+
+         ics::file back(argv[2], "r");
+         ics::buffer<std::uint16_t> img2 = back.read<std::uint16_t>();
+         ics::view<std::uint16_t> v2 = img2.get_view();
+         for(size_t z = 0; z < l.dims[2]; z++) {
+            for(size_t y = 0; y < l.dims[1]; y++) {
+               for(size_t x = 0; x < l.dims[0]; x++) {
+                  if(v2(x, y, z) != mirrored(x, y, z)) {
+                     fail("Data in output file does not match data in input.");
+                  }
+               }
+            }
+         }
+      }
+
+      /* Move-only handles */
+      ics::file a(argv[2], "r");
+      ics::file b(std::move(a));
+      if(a || !b) {
+         fail("Moving a file handle failed.");
+      }
+   } catch(const ics::error &e) {
+      std::fprintf(stderr, "Unexpected error: %s\n", e.what());
+      std::exit(-1);
+   }
+
+   std::exit(0);
+}
@@ -0,0 +1 @@
+./test_cpp $srcdir/test/testim.ics result_cpp.ics
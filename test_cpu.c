@@ -0,0 +1,394 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+/* Writes a version 1 file with the samples stored in the opposite byte order,
+   in groups of 'group' bytes. */
+static void write_swapped(const char *name, Ics_DataType dt, int ndims,
+                          size_t *dims, void *buf, size_t bufsize,
+                          size_t group) {
+   ICS*      ip;
+   Ics_Error retval;
+   char      idsname[1024];
+   char      header[4096];
+   char      order[64];
+   char*     line;
+   char*     end;
+   char*     data;
+   FILE*     fp;
+   size_t    len, bytes, i, j;
+
+   retval = IcsOpen(&ip, name, "w1");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, bufsize);
+   bytes = bufsize / IcsGetImageSize(ip);
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not write output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+
+   /* Swap the data */
+   test_name(idsname, name, ".ids");
+   data = malloc(bufsize);
+   if(data == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   for(i = 0; i < bufsize; i += group) {
+      for(j = 0; j < group; j++) {
+         data[i + j] = ((char*)buf)[i + group - 1 - j];
+      }
+   }
+   fp = fopen(idsname, "wb");
+   if(fp == NULL || fwrite(data, 1, bufsize, fp) != bufsize) {
+      fprintf(stderr, "Could not rewrite the IDS file.\n");
+      exit(-1);
+   }
+   fclose(fp);
+   free(data);
+
+   /* Change the byte order in the header */
+   fp = fopen(name, "rb");
+   if(fp == NULL) {
+      fprintf(stderr, "Could not read the ICS file.\n");
+      exit(-1);
+   }
+   len = fread(header, 1, sizeof(header) - 1, fp);
+   fclose(fp);
+   header[len] = '\0';
+   line = strstr(header, "byte_order");
+   if(line == NULL) {
+      fprintf(stderr, "No byte order in the ICS file.\n");
+      exit(-1);
+   }
+   end = strchr(line, '\n');
+   order[0] = '\0';
+   for(i = 0; i < bytes; i++) {
+      sprintf(order + strlen(order), "\t%d",
+              (int)((i / group) * group + group - i % group));
+   }
+   fp = fopen(name, "wb");
+   if(fp == NULL) {
+      fprintf(stderr, "Could not rewrite the ICS file.\n");
+      exit(-1);
+   }
+   fprintf(fp, "%.*sbyte_order%s%s", (int)(line - header), header, order,
+           end);
+   fclose(fp);
+}
+
+static void read_compare(const char *name, void *buf, size_t bufsize) {
+   ICS*      ip;
+   Ics_Error retval;
+   void*     buf2;
+
+   retval = IcsOpen(&ip, name, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(bufsize != IcsGetDataSize(ip)) {
+      fprintf(stderr, "Data in output file not same size as written.\n");
+      exit(-1);
+   }
+   buf2 = malloc(bufsize);
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf2, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read output image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(memcmp(buf, buf2, bufsize) != 0) {
+      fprintf(stderr, "Data in output file does not match data in input.\n");
+      exit(-1);
+   }
+   free(buf2);
+}
+
+/* Reads the image into every other sample of a buffer twice the size. */
+static void read_strided(const char *name, void *buf, size_t bufsize,
+                         size_t bytes) {
+   ICS*      ip;
+   Ics_DataType dt;
+   int       ndims, ii;
+   size_t    dims[ICS_MAXDIM];
+   ptrdiff_t strides[ICS_MAXDIM];
+   char*     buf2;
+   size_t    i;
+   Ics_Error retval;
+
+   retval = IcsOpen(&ip, name, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   strides[0] = 2;
+   for(ii = 1; ii < ndims; ii++) {
+      strides[ii] = strides[ii-1] * (ptrdiff_t)dims[ii-1];
+   }
+   buf2 = calloc(2, bufsize);
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetDataWithStrides(ip, buf2, 0, strides, ndims);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read output image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsClose(ip);
+   for(i = 0; i < bufsize / bytes; i++) {
+      if(memcmp(buf2 + 2 * i * bytes, (char*)buf + i * bytes, bytes) != 0) {
+         fprintf(stderr, "Strided read does not match data in input.\n");
+         exit(-1);
+      }
+   }
+   free(buf2);
+}
+
+/* Writes the image from every other sample of a buffer twice the size. */
+static void write_strided(const char *name, Ics_DataType dt, int ndims,
+                          size_t *dims, void *buf, size_t bufsize,
+                          size_t bytes, Ics_Compression compression) {
+   ICS*      ip;
+   ptrdiff_t strides[ICS_MAXDIM];
+   char*     buf2;
+   size_t    i;
+   int       ii;
+   Ics_Error retval;
+
+   buf2 = calloc(2, bufsize);
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   for(i = 0; i < bufsize / bytes; i++) {
+      memcpy(buf2 + 2 * i * bytes, (char*)buf + i * bytes, bytes);
+   }
+   strides[0] = 2;
+   for(ii = 1; ii < ndims; ii++) {
+      strides[ii] = strides[ii-1] * (ptrdiff_t)dims[ii-1];
+   }
+   retval = IcsOpen(&ip, name, "w2");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetDataWithStrides(ip, buf2, 2 * bufsize, strides, ndims);
+   IcsSetCompression(ip, compression, 6);
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not write output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   free(buf2);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         offset[3] = {1, 3, 0};
+   size_t         size[3] = {170, 100, 2};
+   size_t         sampling[3] = {3, 2, 1};
+   size_t         bufsize, planesize, n, i, x, y, z;
+   unsigned short *buf1;
+   unsigned char  *buf8, *preview, *roi;
+   float          *buf32;
+   double         *buf64;
+   char           name[1024];
+   unsigned short min, max;
+   Ics_Error      retval;
+
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+   printf("CPU level: %s\n", IcsGetCpuLevel());
+
+   /* Read image */
+   retval = IcsOpen(&ip, argv[1], "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16 || ndims != 3) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   bufsize = IcsGetDataSize(ip);
+   n = bufsize / 2;
+   planesize = dims[0] * dims[1];
+   buf1 = malloc(bufsize);
+   buf8 = malloc(n);
+   buf32 = malloc(n * sizeof(float));
+   buf64 = malloc(n * sizeof(double));
+   preview = malloc(planesize);
+   roi = malloc(bufsize);
+   if(buf1 == NULL || buf8 == NULL || buf32 == NULL || buf64 == NULL ||
+      preview == NULL || roi == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf1, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read input image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   for(i = 0; i < n; i++) {
+      buf8[i] = (unsigned char)(buf1[i] >> 4);
+      buf32[i] = (float)buf1[i] * 0.25f;
+      buf64[i] = (double)buf1[i] * -0.5;
+   }
+
+   /* Byte swapping while reading */
+   write_swapped(argv[2], Ics_uint16, ndims, dims, buf1, bufsize, 2);
+   read_compare(argv[2], buf1, bufsize);
+   read_strided(argv[2], buf1, bufsize, 2);
+   sprintf(name, "%s_f.ics", argv[2]);
+   write_swapped(name, Ics_real32, ndims, dims, buf32, n * sizeof(float), 4);
+   read_compare(name, buf32, n * sizeof(float));
+   read_strided(name, buf32, n * sizeof(float), 4);
+   sprintf(name, "%s_d.ics", argv[2]);
+   write_swapped(name, Ics_real64, ndims, dims, buf64, n * sizeof(double), 8);
+   read_compare(name, buf64, n * sizeof(double));
+   read_strided(name, buf64, n * sizeof(double), 8);
+   sprintf(name, "%s_c.ics", argv[2]);
+   write_swapped(name, Ics_complex32, ndims, dims, buf64, n * sizeof(double),
+                 4);
+   read_compare(name, buf64, n * sizeof(double));
+
+   /* Writing from strided buffers */
+   sprintf(name, "%s_s.ics", argv[2]);
+   write_strided(name, Ics_uint16, ndims, dims, buf1, bufsize, 2,
+                 IcsCompr_uncompressed);
+   read_compare(name, buf1, bufsize);
+   write_strided(name, Ics_real32, ndims, dims, buf32, n * sizeof(float), 4,
+                 IcsCompr_gzip);
+   read_compare(name, buf32, n * sizeof(float));
+   write_strided(name, Ics_real64, ndims, dims, buf64, n * sizeof(double), 8,
+                 IcsCompr_uncompressed);
+   read_compare(name, buf64, n * sizeof(double));
+
+   /* Preview of a uint16 image */
+   retval = IcsOpen(&ip, argv[2], "r");
+   if(retval == IcsErr_Ok) {
+      retval = IcsGetPreviewData(ip, preview, planesize, 1);
+      IcsClose(ip);
+   }
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read preview: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   min = max = buf1[planesize];
+   for(i = planesize; i < 2 * planesize; i++) {
+      if(min > buf1[i]) min = buf1[i];
+      if(max < buf1[i]) max = buf1[i];
+   }
+   for(i = 0; i < planesize; i++) {
+      if(preview[i] != (unsigned char)((buf1[planesize + i] - min)
+                                       * (255.0 / (max - min)))) {
+         fprintf(stderr, "Preview does not match data in input.\n");
+         exit(-1);
+      }
+   }
+
+   /* Preview of a uint8 image */
+   sprintf(name, "%s_8.ics", argv[2]);
+   write_strided(name, Ics_uint8, ndims, dims, buf8, n, 1,
+                 IcsCompr_uncompressed);
+   retval = IcsOpen(&ip, name, "r");
+   if(retval == IcsErr_Ok) {
+      retval = IcsGetPreviewData(ip, preview, planesize, 0);
+      IcsClose(ip);
+   }
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read preview: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   min = max = buf8[0];
+   for(i = 0; i < planesize; i++) {
+      if(min > buf8[i]) min = buf8[i];
+      if(max < buf8[i]) max = buf8[i];
+   }
+   for(i = 0; i < planesize; i++) {
+      if(preview[i] != (unsigned char)((buf8[i] - min)
+                                       * (255.0 / (max - min)))) {
+         fprintf(stderr, "Preview does not match data in input.\n");
+         exit(-1);
+      }
+   }
+
+   /* Subsampled region */
+   retval = IcsOpen(&ip, argv[2], "r");
+   if(retval == IcsErr_Ok) {
+      retval = IcsGetROIData(ip, offset, size, sampling, roi,
+                             57 * 50 * 2 * 2);
+      IcsClose(ip);
+   }
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read region: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   i = 0;
+   for(z = 0; z < size[2]; z += sampling[2]) {
+      for(y = 0; y < size[1]; y += sampling[1]) {
+         for(x = 0; x < size[0]; x += sampling[0], i++) {
+            if(((unsigned short*)roi)[i] !=
+               buf1[(z + offset[2]) * planesize + (y + offset[1]) * dims[0]
+                    + x + offset[0]]) {
+               fprintf(stderr, "Region read does not match data in input.\n");
+               exit(-1);
+            }
+         }
+      }
+   }
+
+   free(buf1);
+   free(buf8);
+   free(buf32);
+   free(buf64);
+   free(preview);
+   free(roi);
+   exit(0);
+}
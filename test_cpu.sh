@@ -0,0 +1 @@
+./test_cpu $srcdir/test/testim.ics result_cpu.ics && ICS_CPU_LEVEL=generic ./test_cpu $srcdir/test/testim.ics result_cpu_generic.ics
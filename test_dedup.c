@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+/* Count the uncompressed chunk files (those without extension) in the store,
+   which has one sub-directory level; returns -1 where directories cannot be
+   listed */
+static long count_chunks(const char *store) {
+#ifdef _WIN32
+   (void)store;
+   return -1;
+#else
+   DIR           *dir, *sub;
+   struct dirent *entry, *chunk;
+   char          path[2048];
+   long          n = 0;
+
+   dir = opendir(store);
+   if(dir == NULL) {
+      fprintf(stderr, "Could not list the chunk store.\n");
+      exit(-1);
+   }
+   while((entry = readdir(dir)) != NULL) {
+      if(entry->d_name[0] == '.') {
+         continue;
+      }
+      sprintf(path, "%s/%s", store, entry->d_name);
+      sub = opendir(path);
+      if(sub == NULL) {
+         continue;
+      }
+      while((chunk = readdir(sub)) != NULL) {
+         if(strchr(chunk->d_name, '.') == NULL) {
+            n++;
+         }
+      }
+      closedir(sub);
+   }
+   closedir(dir);
+   return n;
+#endif
+}
+
+static void write_dedup(const char *name, const char *store, Ics_DataType dt,
+                        int ndims, size_t *dims, void *buf, size_t bufsize,
+                        Ics_Compression compression, int strided) {
+   ICS*      ip;
+   Ics_Error retval;
+   ptrdiff_t strides[ICS_MAXDIM];
+   int       ii;
+
+   retval = IcsOpen(&ip, name, "w2");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsSetLayout(ip, dt, ndims, dims);
+   if(strided) {
+      strides[0] = 1;
+      for(ii = 1; ii < ndims; ii++) {
+         strides[ii] = strides[ii-1] * (ptrdiff_t)dims[ii-1];
+      }
+      IcsSetDataWithStrides(ip, buf, bufsize, strides, ndims);
+   } else {
+      IcsSetData(ip, buf, bufsize);
+   }
+   IcsSetCompression(ip, compression, 6);
+   retval = IcsSetDedupStore(ip, store, 4096);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not set the chunk store: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not write output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+}
+
+static void read_compare(const char *name, void *buf, size_t bufsize) {
+   ICS*      ip;
+   Ics_Error retval;
+   void*     buf2;
+
+   retval = IcsOpen(&ip, name, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(bufsize != IcsGetDataSize(ip)) {
+      fprintf(stderr, "Data in output file not same size as written.\n");
+      exit(-1);
+   }
+   buf2 = malloc(bufsize);
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf2, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read output image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(memcmp(buf, buf2, bufsize) != 0) {
+      fprintf(stderr, "Data in output file does not match data in input.\n");
+      exit(-1);
+   }
+   free(buf2);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         offset[3] = {10, 20, 0};
+   size_t         size[3] = {100, 50, 2};
+   size_t         bufsize, planesize, x, y, z, linesPerChunk;
+   long           nChunks;
+   unsigned short *buf1, *buf2, *roi;
+   char           name2[1024], name3[1024];
+   char           store[1024];
+   Ics_Error      retval;
+
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+   sprintf(store, "%s.store", argv[2]);
+   sprintf(name2, "%s_b.ics", argv[2]);
+   sprintf(name3, "%s_c.ics", argv[2]);
+
+   /* Read image */
+   retval = IcsOpen(&ip, argv[1], "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16 || ndims != 3) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   bufsize = IcsGetDataSize(ip);
+   planesize = dims[0] * dims[1];
+   buf1 = malloc(bufsize);
+   buf2 = malloc(bufsize);
+   roi = malloc(bufsize);
+   if(buf1 == NULL || buf2 == NULL || roi == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf1, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read input image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+
+   /* First image: both planes equal, written uncompressed */
+   memcpy(buf2, buf1, planesize * 2);
+   memcpy(buf2 + planesize, buf1, planesize * 2);
+   write_dedup(argv[2], store, dt, ndims, dims, buf2, bufsize,
+               IcsCompr_uncompressed, 0);
+
+   /* The second plane is stored as references to the chunks of the first
+      one, which are made of whole lines of at most 4096 bytes */
+   linesPerChunk = 4096 / (dims[0] * 2);
+   nChunks = count_chunks(store);
+   if(nChunks == 0
+      || nChunks > (long)((dims[1] + linesPerChunk - 1) / linesPerChunk)) {
+      fprintf(stderr, "Equal planes not stored once: %ld chunk files.\n",
+              nChunks);
+      exit(-1);
+   }
+
+   /* Writing the same data again adds no chunks */
+   write_dedup(name3, store, dt, ndims, dims, buf2, bufsize,
+               IcsCompr_uncompressed, 0);
+   if(count_chunks(store) != nChunks) {
+      fprintf(stderr, "Equal images not stored once.\n");
+      exit(-1);
+   }
+
+   /* Second image: the original, written with strides and compression into
+      the same store; the first plane shares its chunks with the first
+      image */
+   write_dedup(name2, store, dt, ndims, dims, buf1, bufsize,
+               IcsCompr_gzip, 1);
+
+   /* Read both images back */
+   read_compare(argv[2], buf2, bufsize);
+   read_compare(name2, buf1, bufsize);
+
+   /* Read a region from the second image */
+   retval = IcsOpen(&ip, name2, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsGetROIData(ip, offset, size, NULL, roi,
+                          size[0] * size[1] * size[2] * 2);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read region from output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   for(z = 0; z < size[2]; z++) {
+      for(y = 0; y < size[1]; y++) {
+         for(x = 0; x < size[0]; x++) {
+            if(roi[(z * size[1] + y) * size[0] + x] !=
+               buf1[(z + offset[2]) * planesize + (y + offset[1]) * dims[0]
+                    + x + offset[0]]) {
+               fprintf(stderr, "Region read does not match data in input.\n");
+               exit(-1);
+            }
+         }
+      }
+   }
+
+   free(buf1);
+   free(buf2);
+   free(roi);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_dedup $srcdir/test/testim.ics result_dedup.ics
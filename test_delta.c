@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+
+static void write_delta(const char *name, Ics_DataType dt, int ndims,
+                        size_t *dims, const char *order[], void *buf,
+                        size_t bufsize, Ics_Compression compression,
+                        size_t keyInterval) {
+   ICS*      ip;
+   Ics_Error retval;
+   int       ii;
+
+   retval = IcsOpen(&ip, name, "w2");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsSetLayout(ip, dt, ndims, dims);
+   for(ii = 0; ii < ndims; ii++) {
+      IcsSetOrder(ip, ii, order[ii], order[ii]);
+   }
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, compression, 6);
+   retval = IcsSetTemporalDelta(ip, keyInterval);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not set delta coding: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not write output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+}
+
+static void read_compare(const char *name, void *buf, size_t bufsize,
+                         size_t blocksize) {
+   ICS*      ip;
+   Ics_Error retval;
+   char*     buf2;
+   size_t    pos, n;
+
+   retval = IcsOpen(&ip, name, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(bufsize != IcsGetDataSize(ip)) {
+      fprintf(stderr, "Data in output file not same size as written.\n");
+      exit(-1);
+   }
+   buf2 = malloc(bufsize);
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   for(pos = 0; pos < bufsize; pos += n) {
+      n = bufsize - pos < blocksize ? bufsize - pos : blocksize;
+      retval = IcsGetDataBlock(ip, buf2 + pos, n);
+      if(retval != IcsErr_Ok) {
+         fprintf(stderr, "Could not read output image data: %s\n",
+                 IcsGetErrorText(retval));
+         exit(-1);
+      }
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(memcmp(buf, buf2, bufsize) != 0) {
+      fprintf(stderr, "Data in output file does not match data in input.\n");
+      exit(-1);
+   }
+   free(buf2);
+}
+
+static void read_roi(const char *name, size_t *offset, size_t *size,
+                     void *roi, size_t roisize) {
+   ICS*      ip;
+   Ics_Error retval;
+
+   retval = IcsOpen(&ip, name, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsGetROIData(ip, offset, size, NULL, roi, roisize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read region from output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+}
+
+static long file_size(const char *name) {
+   FILE* fp;
+   long  size;
+
+   fp = fopen(name, "rb");
+   if(fp == NULL) {
+      return -1;
+   }
+   fseek(fp, 0, SEEK_END);
+   size = ftell(fp);
+   fclose(fp);
+   return size;
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         dims2[3];
+   size_t         dims3[3] = {40, 12, 30};
+   size_t         offset[3] = {20, 10, 5};
+   size_t         size[3] = {100, 60, 3};
+   size_t         offset3[3] = {5, 6, 3};
+   size_t         size3[3] = {30, 5, 20};
+   const char*    order2[3] = {"x", "y", "t"};
+   const char*    order3[3] = {"x", "time", "y"};
+   size_t         bufsize, planesize, x, y, z;
+   unsigned short *buf1, *buf2, *roi;
+   float          *buf3, *roi3;
+   char           name2[1024];
+   char           name3[1024];
+   Ics_Error      retval;
+
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+   sprintf(name2, "%s_c.ics", argv[2]);
+   sprintf(name3, "%s_f.ics", argv[2]);
+
+   /* Read image */
+   retval = IcsOpen(&ip, argv[1], "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16 || ndims != 3) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   planesize = dims[0] * dims[1];
+   bufsize = IcsGetDataSize(ip);
+   buf1 = malloc(bufsize);
+   if(buf1 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf1, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read input image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+
+   /* A time series: the first plane, with a small object moving around */
+   dims2[0] = dims[0];
+   dims2[1] = dims[1];
+   dims2[2] = 10;
+   bufsize = planesize * dims2[2] * sizeof(unsigned short);
+   buf2 = malloc(bufsize);
+   roi = malloc(size[0] * size[1] * size[2] * sizeof(unsigned short));
+   if(buf2 == NULL || roi == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   for(z = 0; z < dims2[2]; z++) {
+      memcpy(buf2 + z * planesize, buf1, planesize * sizeof(unsigned short));
+      for(y = 0; y < 10; y++) {
+         for(x = 0; x < 10; x++) {
+            buf2[z * planesize + (y + 5 * z) * dims2[0] + x + 10 * z] = 0;
+         }
+      }
+   }
+   write_delta(argv[2], Ics_uint16, 3, dims2, order2, buf2, bufsize,
+               IcsCompr_gzip, 4);
+   read_compare(argv[2], buf2, bufsize, bufsize);
+   read_compare(argv[2], buf2, bufsize, 1000);
+   write_delta(name2, Ics_uint16, 3, dims2, order2, buf2, bufsize,
+               IcsCompr_gzip, 0);
+   read_compare(name2, buf2, bufsize, bufsize);
+   printf("delta: %ld bytes, no delta: %ld bytes\n",
+          file_size(argv[2]), file_size(name2));
+
+   /* Random access */
+   read_roi(argv[2], offset, size, roi,
+            size[0] * size[1] * size[2] * sizeof(unsigned short));
+   for(z = 0; z < size[2]; z++) {
+      for(y = 0; y < size[1]; y++) {
+         for(x = 0; x < size[0]; x++) {
+            if(roi[(z * size[1] + y) * size[0] + x] !=
+               buf2[(z + offset[2]) * planesize + (y + offset[1]) * dims2[0]
+                    + x + offset[0]]) {
+               fprintf(stderr, "Region read does not match data in input.\n");
+               exit(-1);
+            }
+         }
+      }
+   }
+
+   /* Floating-point data, with time not the last dimension */
+   bufsize = dims3[0] * dims3[1] * dims3[2] * sizeof(float);
+   buf3 = malloc(bufsize);
+   roi3 = malloc(size3[0] * size3[1] * size3[2] * sizeof(float));
+   if(buf3 == NULL || roi3 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   for(z = 0; z < dims3[2]; z++) {
+      for(y = 0; y < dims3[1]; y++) {
+         for(x = 0; x < dims3[0]; x++) {
+            buf3[(z * dims3[1] + y) * dims3[0] + x] =
+               (float)x * 0.5f - (float)z + (float)y * 0.001f;
+         }
+      }
+   }
+   write_delta(name3, Ics_real32, 3, dims3, order3, buf3, bufsize,
+               IcsCompr_uncompressed, 5);
+   read_compare(name3, buf3, bufsize, 52);
+   read_roi(name3, offset3, size3, roi3,
+            size3[0] * size3[1] * size3[2] * sizeof(float));
+   for(z = 0; z < size3[2]; z++) {
+      for(y = 0; y < size3[1]; y++) {
+         for(x = 0; x < size3[0]; x++) {
+            if(roi3[(z * size3[1] + y) * size3[0] + x] !=
+               buf3[((z + offset3[2]) * dims3[1] + y + offset3[1]) * dims3[0]
+                    + x + offset3[0]]) {
+               fprintf(stderr, "Region read does not match data in input.\n");
+               exit(-1);
+            }
+         }
+      }
+   }
+
+   free(buf1);
+   free(buf2);
+   free(buf3);
+   free(roi);
+   free(roi3);
+   exit(0);
+}
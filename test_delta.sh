@@ -0,0 +1 @@
+./test_delta $srcdir/test/testim.ics result_delta.ics
@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+static int exists(const char *name) {
+   FILE *fp = fopen(name, "rb");
+   if(fp == NULL) return 0;
+   fclose(fp);
+   return 1;
+}
+
+/* Check that name exists, without temporary file, and holds buf */
+static void compare(const char *name, const void *buf, size_t n) {
+   ICS*  ip;
+   char  tmp[1100];
+   void  *data;
+
+   sprintf(tmp, "%s.tmp", name);
+   if(!exists(name) || exists(tmp)) {
+      fprintf(stderr, "File %s not committed.\n", name);
+      exit(-1);
+   }
+   data = malloc(n);
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsGetData(ip, data, n), "read data");
+   check(IcsClose(ip), "close file");
+   if(memcmp(data, buf, n) != 0) {
+      fprintf(stderr, "Data in %s differ.\n", name);
+      exit(-1);
+   }
+   free(data);
+}
+
+static void write_file(const char *name, const char *mode, Ics_DataType dt,
+                       int ndims, size_t *dims, void *buf, size_t n,
+                       Ics_Compression compr, int zones,
+                       Ics_Durability durability) {
+   ICS* ip;
+   remove(name);
+   check(IcsOpen(&ip, name, mode), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, n);
+   IcsSetCompression(ip, compr, 6);
+   if(zones) {
+      check(IcsSetZoneMap(ip, 0), "set zone map");
+   }
+   if(durability != IcsDurability_none) {
+      check(IcsSetDurability(ip, durability), "set durability");
+   }
+   check(IcsClose(ip), "write output file");
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims, ii;
+   size_t         dims[ICS_MAXDIM];
+   size_t         n;
+   char           *buf;
+   char           names[3][1024], tmp[1100], suffix[16], cmd[4096];
+   const char*    modes[3] = {"w2", "w1", "w2"};
+   Ics_Compression compr[3] = {IcsCompr_uncompressed, IcsCompr_gzip,
+                               IcsCompr_uncompressed};
+
+   if(argc == 4 && strcmp(argv[3], "exit") == 0) {
+      /* Write a file with the group policy and exit right away */
+      check(IcsOpen(&ip, argv[1], "r"), "open input file");
+      IcsGetLayout(ip, &dt, &ndims, dims);
+      n = IcsGetDataSize(ip);
+      buf = malloc(n);
+      check(IcsGetData(ip, buf, n), "read input image data");
+      check(IcsClose(ip), "close input file");
+      check(IcsSetDefaultDurability(IcsDurability_group, 60000),
+            "set default durability");
+      write_file(argv[2], "w2", dt, ndims, dims, buf, n,
+                 IcsCompr_uncompressed, 0, IcsDurability_none);
+      exit(0);
+   }
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   n = IcsGetDataSize(ip);
+   buf = malloc(n);
+   check(IcsGetData(ip, buf, n), "read input image data");
+   if(IcsSetDurability(ip, IcsDurability_sync) != IcsErr_NotValidAction) {
+      fprintf(stderr, "Durability set on a file opened for reading.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close input file");
+   for(ii = 0; ii < 3; ii++) {
+      sprintf(suffix, "_%d.ics", ii);
+      test_name(names[ii], argv[2], suffix);
+   }
+
+   /* Each file flushed when closed */
+   for(ii = 0; ii < 3; ii++) {
+      write_file(names[ii], modes[ii], dt, ndims, dims, buf, n, compr[ii],
+                 ii == 2, IcsDurability_sync);
+      compare(names[ii], buf, n);
+   }
+
+   /* A failed write leaves nothing behind */
+   remove(names[0]);
+   check(IcsOpen(&ip, names[0], "w2"), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   check(IcsSetDurability(ip, IcsDurability_sync), "set durability");
+   if(IcsClose(ip) != IcsErr_MissingData) {
+      fprintf(stderr, "File without data written.\n");
+      exit(-1);
+   }
+   sprintf(tmp, "%s.tmp", names[0]);
+   if(exists(names[0]) || exists(tmp)) {
+      fprintf(stderr, "Failed write left a file behind.\n");
+      exit(-1);
+   }
+
+   /* Files flushed as a group, after a long window or when asked to */
+   check(IcsSetDefaultDurability(IcsDurability_group, 60000),
+         "set default durability");
+   for(ii = 0; ii < 3; ii++) {
+      write_file(names[ii], modes[ii], dt, ndims, dims, buf, n, compr[ii],
+                 ii == 2, IcsDurability_none);
+      if(exists(names[ii])) {
+         fprintf(stderr, "File %s visible before it was flushed.\n",
+                 names[ii]);
+         exit(-1);
+      }
+   }
+   check(IcsFlushDurable(), "flush files");
+   for(ii = 0; ii < 3; ii++) {
+      compare(names[ii], buf, n);
+   }
+
+   /* Files still queued when the program exits are flushed */
+   remove(names[0]);
+   sprintf(cmd, "\"%s\" \"%s\" \"%s\" exit", argv[0], argv[1], names[0]);
+   if(system(cmd) != 0) {
+      fprintf(stderr, "Writing and exiting failed.\n");
+      exit(-1);
+   }
+   compare(names[0], buf, n);
+
+   /* Back to the default */
+   check(IcsSetDefaultDurability(IcsDurability_none, 0),
+         "set default durability");
+   write_file(names[0], "w2", dt, ndims, dims, buf, n, IcsCompr_uncompressed,
+              0, IcsDurability_none);
+   compare(names[0], buf, n);
+
+   free(buf);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_durable $srcdir/test/testim.ics result_v2durable.ics
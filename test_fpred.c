@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+
+static void write_image(const char *name, Ics_DataType dt, int ndims,
+                        size_t *dims, void *buf, size_t bufsize,
+                        Ics_Compression compression) {
+   ICS*      ip;
+   Ics_Error retval;
+
+   retval = IcsOpen(&ip, name, "w2");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, compression, 6);
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not write output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+}
+
+static void read_compare(const char *name, void *buf, size_t bufsize) {
+   ICS*      ip;
+   Ics_Error retval;
+   void*     buf2;
+
+   retval = IcsOpen(&ip, name, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(bufsize != IcsGetDataSize(ip)) {
+      fprintf(stderr, "Data in output file not same size as written.\n");
+      exit(-1);
+   }
+   buf2 = malloc(bufsize);
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf2, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read output image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(memcmp(buf, buf2, bufsize) != 0) {
+      fprintf(stderr, "Data in output file does not match data in input.\n");
+      exit(-1);
+   }
+   free(buf2);
+}
+
+static long file_size(const char *name) {
+   FILE* fp;
+   long  size;
+
+   fp = fopen(name, "rb");
+   if(fp == NULL) {
+      fprintf(stderr, "Could not open %s.\n", name);
+      exit(-1);
+   }
+   fseek(fp, 0, SEEK_END);
+   size = ftell(fp);
+   fclose(fp);
+   return size;
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         dims2[3] = {700, 400, 3};
+   size_t         dims3[2] = {64, 50};
+   size_t         offset[3] = {50, 100, 1};
+   size_t         size[3] = {300, 250, 2};
+   size_t         bufsize, n, ii, x, y, z;
+   unsigned short* buf1;
+   float*         buf2;
+   double*        buf3;
+   float*         roi;
+   char           name2[1024];
+   char           name3[1024];
+   Ics_Error      retval;
+
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+   sprintf(name2, "%s_gz.ics", argv[2]);
+   sprintf(name3, "%s_b.ics", argv[2]);
+
+   /* Read image */
+   retval = IcsOpen(&ip, argv[1], "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16) {
+      fprintf(stderr, "Expected a uint16 input image.\n");
+      exit(-1);
+   }
+   bufsize = IcsGetDataSize(ip);
+   buf1 = malloc(bufsize);
+   if(buf1 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf1, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read input image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+
+   /* The input image as real64 */
+   n = bufsize / sizeof(unsigned short);
+   buf3 = malloc(n * sizeof(double));
+   if(buf3 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   for(ii = 0; ii < n; ii++) {
+      buf3[ii] = buf1[ii] / 3.0 - 1000.0;
+   }
+   write_image(argv[2], Ics_real64, ndims, dims, buf3, n * sizeof(double),
+               IcsCompr_fpred);
+   read_compare(argv[2], buf3, n * sizeof(double));
+
+   /* A small complex image, with special values */
+   buf2 = malloc(dims3[0] * dims3[1] * 2 * sizeof(float));
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   for(ii = 0; ii < dims3[0] * dims3[1] * 2; ii++) {
+      buf2[ii] = (float)((double)ii * (ii % 2 ? -0.25 : 1.5));
+   }
+   buf2[3] = -0.0f;
+   buf2[5] = 1e38f * 10.0f;
+   buf2[7] = 1e-42f;
+   write_image(name3, Ics_complex32, 2, dims3, buf2,
+               dims3[0] * dims3[1] * 2 * sizeof(float), IcsCompr_fpred);
+   read_compare(name3, buf2, dims3[0] * dims3[1] * 2 * sizeof(float));
+   free(buf2);
+
+   /* A real32 image that spans several tiles per plane */
+   bufsize = dims2[0] * dims2[1] * dims2[2] * sizeof(float);
+   buf2 = malloc(bufsize);
+   roi = malloc(size[0] * size[1] * size[2] * sizeof(float));
+   if(buf2 == NULL || roi == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   srand(1);
+   for(z = 0; z < dims2[2]; z++) {
+      for(y = 0; y < dims2[1]; y++) {
+         for(x = 0; x < dims2[0]; x++) {
+            buf2[(z * dims2[1] + y) * dims2[0] + x] =
+               (float)x * 0.01f - (float)y * 0.02f + (float)z
+               + (float)(rand() % 100) * 1e-4f;
+         }
+      }
+   }
+   write_image(name3, Ics_real32, 3, dims2, buf2, bufsize, IcsCompr_fpred);
+   read_compare(name3, buf2, bufsize);
+   write_image(name2, Ics_real32, 3, dims2, buf2, bufsize, IcsCompr_gzip);
+   printf("fpred: %ld bytes, gzip: %ld bytes\n", file_size(name3),
+          file_size(name2));
+
+   /* Read a region that crosses tile boundaries */
+   retval = IcsOpen(&ip, name3, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsGetROIData(ip, offset, size, NULL, roi,
+                          size[0] * size[1] * size[2] * sizeof(float));
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read region from output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   for(z = 0; z < size[2]; z++) {
+      for(y = 0; y < size[1]; y++) {
+         for(x = 0; x < size[0]; x++) {
+            if(memcmp(&roi[(z * size[1] + y) * size[0] + x],
+                      &buf2[((z + offset[2]) * dims2[1] + y + offset[1])
+                            * dims2[0] + x + offset[0]], sizeof(float)) != 0) {
+               fprintf(stderr, "Region read does not match data in input.\n");
+               exit(-1);
+            }
+         }
+      }
+   }
+
+   free(buf1);
+   free(buf2);
+   free(buf3);
+   free(roi);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_fpred $srcdir/test/testim.ics result_fpred.ics
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+#define DEPTH 4
+
+typedef struct {
+   size_t released;
+   size_t next;
+   int    wrong;
+} Released;
+
+/* Frames are written, and therefore released, in order */
+static void release(void *userData, size_t index, const void *frame) {
+   Released *r = userData;
+   if(index != r->next) r->wrong = 1;
+   r->next = index + 1;
+   r->released++;
+   (void)frame;
+}
+
+/* Write the image frame by frame, pushing each group of DEPTH frames in
+   reverse order; skip one frame if missing is not negative */
+static Ics_Error write_frames(const char *name, const char *mode,
+                              Ics_Compression compr, Ics_DataType dt,
+                              int ndims, const size_t *dims, const char *buf,
+                              long missing, Released *r) {
+   ICS             *ip;
+   Ics_FrameWriter *writer;
+   Ics_Error       error;
+   size_t          frameSize, i, j, n, first;
+
+   check(IcsOpen(&ip, name, mode), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetCompression(ip, compr, 6);
+   error = IcsStartFrameWriter(ip, DEPTH, &writer);
+   if(error == IcsErr_NotValidAction) {
+      /* Built without threads, there is no frame writer */
+      IcsClose(ip);
+      exit(0);
+   }
+   check(error, "start frame writer");
+   n = dims[ndims - 1];
+   frameSize = IcsGetDataSize(ip) / n;
+   r->released = 0;
+   r->next = 0;
+   r->wrong = 0;
+   for(first = 0; first < n; first += DEPTH) {
+      for(j = DEPTH; j > 0; j--) {
+         i = first + j - 1;
+         if(i >= n || (long)i == missing) continue;
+         check(IcsPushFrame(writer, i, buf + i * frameSize, release, r),
+               "push frame");
+      }
+   }
+   if(missing < 0 && IcsPushFrame(writer, 0, buf, release, r)
+      != IcsErr_DuplicateData) {
+      fprintf(stderr, "Duplicate frame not detected.\n");
+      exit(-1);
+   }
+   return IcsClose(ip);
+}
+
+static void compare(const char *name, const void *buf, size_t bufsize) {
+   ICS  *ip;
+   void *out = malloc(bufsize);
+   check(IcsOpen(&ip, name, "r"), "open file");
+   if(IcsGetDataSize(ip) != bufsize) {
+      fprintf(stderr, "Wrong data size in %s.\n", name);
+      exit(-1);
+   }
+   check(IcsGetData(ip, out, bufsize), "read data");
+   check(IcsClose(ip), "close file");
+   if(memcmp(buf, out, bufsize) != 0) {
+      fprintf(stderr, "Frames in %s differ from the image.\n", name);
+      exit(-1);
+   }
+   free(out);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS             *ip;
+   Ics_DataType    dt;
+   int             ndims, ii;
+   size_t          dims[ICS_MAXDIM];
+   size_t          bufsize;
+   char            *buf;
+   char            name[1024], suffix[16];
+   Released        r;
+   const char*     modes[3] = {"w2", "w1", "w1"};
+   Ics_Compression compr[3] = {IcsCompr_gzip, IcsCompr_gzip,
+                               IcsCompr_uncompressed};
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   bufsize = IcsGetDataSize(ip);
+   buf = malloc(bufsize);
+   check(IcsGetData(ip, buf, bufsize), "read input image data");
+   check(IcsClose(ip), "close input file");
+
+   for(ii = 0; ii < 3; ii++) {
+      sprintf(suffix, "_%d.ics", ii);
+      test_name(name, argv[2], suffix);
+      check(write_frames(name, modes[ii], compr[ii], dt, ndims, dims, buf, -1,
+                         &r), "write frames");
+      if(r.wrong || r.released != dims[ndims - 1]) {
+         fprintf(stderr, "Frames not released in order.\n");
+         exit(-1);
+      }
+      compare(name, buf, bufsize);
+   }
+
+   /* A missing frame is reported, and the frames waiting for it released */
+   if(write_frames(name, "w2", IcsCompr_gzip, dt, ndims, dims, buf, 1, &r)
+      != IcsErr_MissingData) {
+      fprintf(stderr, "Missing frame not detected.\n");
+      exit(-1);
+   }
+   if(r.released != dims[ndims - 1] - 1) {
+      fprintf(stderr, "Frames not released.\n");
+      exit(-1);
+   }
+
+   free(buf);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_frames $srcdir/test/testim.ics result_frames.ics
@@ -2,6 +2,32 @@
 #include <stdio.h>
 #include <string.h>
 #include "libics.h"
+#include "libics_ll.h"
+
+/* Position with SEEK_SET in the data of name, which must be equal to data,
+   and read a line there */
+static void seek_set(const char *name, const char *data, size_t bufsize) {
+   ICS*      ip;
+   char      line[64];
+   size_t    pos = bufsize / 2;
+   Ics_Error retval;
+
+   retval = IcsOpen(&ip, name, "r");
+   if (retval == IcsErr_Ok) retval = IcsGetDataBlock(ip, line, sizeof(line));
+   if (retval == IcsErr_Ok) retval = IcsSetIdsBlock(ip, (long)pos, SEEK_SET);
+   if (retval == IcsErr_Ok) retval = IcsGetDataBlock(ip, line, sizeof(line));
+   if (retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not position in %s: %s\n", name,
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if (memcmp(line, data + pos, sizeof(line)) != 0) {
+      fprintf(stderr, "Data at SEEK_SET position in %s do not match.\n",
+              name);
+      exit(-1);
+   }
+   IcsClose(ip);
+}
 
 int main(int argc, const char* argv[]) {
    ICS*         ip;
@@ -96,6 +122,12 @@ int main(int argc, const char* argv[]) {
       exit(-1);
    }
 
+   /* SEEK_SET is relative to the start of the data: in the IDS file of the
+      input that is the start of the file, as it always was, in the output it
+      is the end of the header */
+   seek_set(argv[1], buf1, bufsize);
+   seek_set(argv[2], buf1, bufsize);
+
    free(buf1);
    free(buf2);
    exit(0);
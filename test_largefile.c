@@ -0,0 +1,228 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+#include "libics.h"
+#include "libics_ll.h"
+#include "test_util.h"
+
+#define TWO_31   ((int64_t)1 << 31)
+#define TWO_32   ((int64_t)1 << 32)
+#define MIB      ((size_t)1 << 20)
+
+/* Raw data: 65536 x 65540 uint8, just over 4 GB, starting 3 GB into the file */
+#define RAW_X    65536
+#define RAW_Y    65540
+#define RAW_OFFSET (3 * ((int64_t)1 << 30))
+#define RAW_SIZE ((int64_t)RAW_X * RAW_Y)
+
+/* Compressed data: 4097 lines of 1 MB; all zero except the last line */
+#define GZ_LINES 4097
+
+static void seek64(FILE *fp, int64_t offset) {
+#if defined(_WIN32)
+   if(_fseeki64(fp, offset, SEEK_SET) == 0) return;
+#else
+   if(fseeko(fp, (off_t)offset, SEEK_SET) == 0) return;
+#endif
+   fprintf(stderr, "Could not seek in the data file.\n");
+   exit(-1);
+}
+
+static void marker(unsigned char *buf, int k) {
+   int j;
+   for(j = 0; j < 8; j++) {
+      buf[j] = (unsigned char)(k * 8 + j + 1);
+   }
+}
+
+static void write_header(const char *name, const char *source, size_t *dims,
+                         size_t offset, Ics_Compression compression) {
+   ICS* ip;
+   check(IcsOpen(&ip, name, "w2"), "open output file");
+   check(IcsSetLayout(ip, Ics_uint8, 2, dims), "set layout");
+   check(IcsSetSource(ip, source, offset), "set source");
+   check(IcsSetCompression(ip, compression, 6), "set compression");
+   check(IcsClose(ip), "write output file");
+}
+
+/* Read 8 bytes at pos through skipping, and compare to marker k */
+static void read_marker(const char *name, int64_t pos, int k) {
+   ICS*          ip;
+   unsigned char buf[8], expected[8];
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsSkipDataBlock(ip, (size_t)pos), "skip data");
+   check(IcsGetDataBlock(ip, buf, 8), "read data");
+   marker(expected, k);
+   if(memcmp(buf, expected, 8) != 0) {
+      fprintf(stderr, "Wrong data at offset %.0f.\n", (double)pos);
+      exit(-1);
+   }
+   check(IcsClose(ip), "close file");
+}
+
+/* A sparse file with uncompressed data beyond 2^31 and 2^32 bytes */
+static void test_raw(const char *name, const char *source) {
+   int64_t       pos[4] = {0, TWO_31 - 4, TWO_32 - 4, RAW_SIZE - 8};
+   size_t        dims[2] = {RAW_X, RAW_Y};
+   size_t        offset[2] = {RAW_X - 8, RAW_Y - 1};
+   size_t        size[2] = {8, 1};
+   unsigned char buf[8], expected[8];
+   FILE*         fp;
+   ICS*          ip;
+   int           k;
+
+   fp = fopen(source, "wb");
+   if(fp == NULL) {
+      fprintf(stderr, "Could not create the data file.\n");
+      exit(-1);
+   }
+   for(k = 0; k < 4; k++) {
+      marker(buf, k);
+      seek64(fp, RAW_OFFSET + pos[k]);
+      if(fwrite(buf, 1, 8, fp) != 8) {
+         fprintf(stderr, "Could not write the data file.\n");
+         exit(-1);
+      }
+   }
+   fclose(fp);
+   write_header(name, source, dims, (size_t)RAW_OFFSET, IcsCompr_uncompressed);
+
+   for(k = 0; k < 4; k++) {
+      read_marker(name, pos[k], k);
+   }
+
+   /* The last 8 pixels as a region */
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsGetROIData(ip, offset, size, NULL, buf, 8), "read region");
+   marker(expected, 3);
+   if(memcmp(buf, expected, 8) != 0) {
+      fprintf(stderr, "Region read beyond 4 GB is wrong.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close file");
+
+   /* Seeking back over more than 4 GB with the low-level interface */
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsOpenIds(ip), "open data");
+   check(IcsSetIdsBlock(ip, pos[3], SEEK_SET), "seek");
+   check(IcsReadIdsBlock(ip, buf, 8), "read data");
+   check(IcsSetIdsBlock(ip, -(pos[3] - pos[1] + 8), SEEK_CUR), "seek back");
+   check(IcsReadIdsBlock(ip, buf, 8), "read data");
+   marker(expected, 1);
+   if(memcmp(buf, expected, 8) != 0) {
+      fprintf(stderr, "Seeking back over 4 GB is wrong.\n");
+      exit(-1);
+   }
+   check(IcsCloseIds(ip), "close data");
+   check(IcsClose(ip), "close file");
+}
+
+/* A gzip stream of more than 4 GB. The zero lines compress to identical
+   blocks, so the stream is put together from one compressed line. */
+static void test_gzip(const char *name, const char *source) {
+   size_t        dims[2] = {MIB, GZ_LINES};
+   unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+   unsigned char *line, *zline, *last, *zlast, trailer[8];
+   size_t        zlen, zlastlen, j;
+   uLong         crc, crcZero, crcLast;
+   z_stream      s;
+   FILE*         fp;
+   ICS*          ip;
+   int           k;
+
+   line = calloc(MIB, 1);
+   last = malloc(MIB);
+   zline = malloc(2 * MIB);
+   zlast = malloc(2 * MIB);
+   for(j = 0; j < MIB; j++) {
+      last[j] = (unsigned char)(j * 7 + 1);
+   }
+   memset(&s, 0, sizeof(s));
+   if(deflateInit2(&s, 1, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+      fprintf(stderr, "Could not initialize zlib.\n");
+      exit(-1);
+   }
+   s.next_in = line;
+   s.avail_in = (uInt)MIB;
+   s.next_out = zline;
+   s.avail_out = (uInt)(2 * MIB);
+   deflate(&s, Z_FULL_FLUSH);
+   zlen = 2 * MIB - s.avail_out;
+   s.next_in = last;
+   s.avail_in = (uInt)MIB;
+   s.next_out = zlast;
+   s.avail_out = (uInt)(2 * MIB);
+   if(deflate(&s, Z_FINISH) != Z_STREAM_END) {
+      fprintf(stderr, "Could not compress.\n");
+      exit(-1);
+   }
+   zlastlen = 2 * MIB - s.avail_out;
+   deflateEnd(&s);
+
+   crcZero = crc32(0L, line, (uInt)MIB);
+   crcLast = crc32(0L, last, (uInt)MIB);
+   crc = crc32(0L, Z_NULL, 0);
+   for(k = 0; k < GZ_LINES - 1; k++) {
+      crc = crc32_combine(crc, crcZero, (z_off_t)MIB);
+   }
+   crc = crc32_combine(crc, crcLast, (z_off_t)MIB);
+   for(k = 0; k < 4; k++) {
+      trailer[k] = (unsigned char)(crc >> (8 * k));
+      trailer[4 + k] = (unsigned char)((GZ_LINES * MIB) >> (8 * k));
+   }
+
+   fp = fopen(source, "wb");
+   if(fp == NULL) {
+      fprintf(stderr, "Could not create the data file.\n");
+      exit(-1);
+   }
+   seek64(fp, RAW_OFFSET);
+   fwrite(header, 1, 10, fp);
+   for(k = 0; k < GZ_LINES - 1; k++) {
+      fwrite(zline, 1, zlen, fp);
+   }
+   fwrite(zlast, 1, zlastlen, fp);
+   if(fwrite(trailer, 1, 8, fp) != 8 || fclose(fp) != 0) {
+      fprintf(stderr, "Could not write the data file.\n");
+      exit(-1);
+   }
+   write_header(name, source, dims, (size_t)RAW_OFFSET, IcsCompr_gzip);
+
+   /* Skip to the last line and read it; this checks the trailer */
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsSkipDataBlock(ip, (GZ_LINES - 1) * MIB), "skip data");
+   check(IcsGetDataBlock(ip, line, MIB), "read data");
+   if(memcmp(line, last, MIB) != 0) {
+      fprintf(stderr, "Data beyond 4 GB in gzip stream is wrong.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close file");
+
+   free(line);
+   free(last);
+   free(zline);
+   free(zlast);
+}
+
+int main(int argc, const char* argv[]) {
+   char name[1024], source[1024];
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   test_name(source, argv[2], ".raw");
+   test_raw(argv[2], source);
+   remove(source);
+
+   test_name(name, argv[2], "_z.ics");
+   test_name(source, argv[2], "_z.raw");
+   test_gzip(name, source);
+   remove(source);
+
+   exit(0);
+}
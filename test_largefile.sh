@@ -0,0 +1 @@
+./test_largefile $srcdir/test/testim.ics result_large.ics
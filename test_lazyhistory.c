@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+#define NLINES 20000
+
+/* Check the number of history lines, and the first and last ones */
+static void check_history(const char *name, int nExpected) {
+   ICS*  ip;
+   int   n, i;
+   char  key[ICS_STRLEN_TOKEN], value[ICS_LINE_LENGTH], expected[64];
+   Ics_HistoryIterator it;
+
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsGetNumHistoryStrings(ip, &n), "count history lines");
+   if(n != nExpected) {
+      fprintf(stderr, "Wrong number of history lines in %s (%d).\n", name, n);
+      exit(-1);
+   }
+   check(IcsNewHistoryIterator(ip, &it, "step"), "make history iterator");
+   for(i = 0; i < NLINES; i++) {
+      check(IcsGetHistoryKeyValueI(ip, &it, key, value), "read history line");
+      sprintf(expected, "line %d of the provenance", i);
+      if(strcmp(key, "step") != 0 || strcmp(value, expected) != 0) {
+         fprintf(stderr, "History line %d of %s does not match.\n", i, name);
+         exit(-1);
+      }
+   }
+   check(IcsClose(ip), "close file");
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   ICS*           op;
+   Ics_DataType   dt;
+   int            ndims, i;
+   size_t         dims[ICS_MAXDIM];
+   size_t         bufsize;
+   void           *buf;
+   char           value[ICS_LINE_LENGTH];
+   char           name2[1024];
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Write a copy of the image with many history lines */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   bufsize = IcsGetDataSize(ip);
+   buf = malloc(bufsize);
+   check(IcsGetData(ip, buf, bufsize), "read input image data");
+   check(IcsOpen(&op, argv[2], "w2"), "open output file");
+   IcsSetLayout(op, dt, ndims, dims);
+   IcsSetData(op, buf, bufsize);
+   for(i = 0; i < NLINES; i++) {
+      sprintf(value, "line %d of the provenance", i);
+      check(IcsAddHistory(op, "step", value), "add history line");
+   }
+   check(IcsClose(op), "write output file");
+   check(IcsClose(ip), "close input file");
+
+   /* The data can be read without the history */
+   check(IcsOpen(&ip, argv[2], "r"), "open output file");
+   check(IcsGetData(ip, buf, bufsize), "read output data");
+   check(IcsClose(ip), "close output file");
+   check_history(argv[2], NLINES);
+
+   /* Copied and updated files keep the history */
+   test_name(name2, argv[2], "_copy.ics");
+   check(IcsOpen(&ip, argv[2], "r"), "open output file");
+   check(IcsOpen(&op, name2, "w1"), "open copy");
+   check(IcsCopyMetadata(op, ip), "copy metadata");
+   IcsSetData(op, buf, bufsize);
+   check(IcsClose(op), "write copy");
+   check(IcsClose(ip), "close output file");
+   check_history(name2, NLINES);
+   check(IcsOpen(&ip, argv[2], "rw"), "open output file for update");
+   check(IcsAddHistory(ip, "extra", "added"), "add history line");
+   check(IcsClose(ip), "update output file");
+   check_history(argv[2], NLINES + 1);
+   check(IcsOpen(&ip, argv[2], "r"), "open output file");
+   check(IcsGetData(ip, buf, bufsize), "read updated data");
+   check(IcsClose(ip), "close output file");
+
+   free(buf);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_lazyhistory $srcdir/test/testim.ics result_lazyhist.ics
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+
+static void write_image(const char *name, Ics_DataType dt, int ndims,
+                        size_t *dims, void *buf, size_t bufsize,
+                        Ics_Compression compression) {
+   ICS*      ip;
+   Ics_Error retval;
+
+   retval = IcsOpen(&ip, name, "w2");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, compression, 6);
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not write output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+}
+
+static void read_compare(const char *name, void *buf, size_t bufsize) {
+   ICS*      ip;
+   Ics_Error retval;
+   void*     buf2;
+
+   retval = IcsOpen(&ip, name, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(bufsize != IcsGetDataSize(ip)) {
+      fprintf(stderr, "Data in output file not same size as written.\n");
+      exit(-1);
+   }
+   buf2 = malloc(bufsize);
+   if(buf2 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf2, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read output image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   if(memcmp(buf, buf2, bufsize) != 0) {
+      fprintf(stderr, "Data in output file does not match data in input.\n");
+      exit(-1);
+   }
+   free(buf2);
+}
+
+static long file_size(const char *name) {
+   FILE* fp;
+   long  size;
+
+   fp = fopen(name, "rb");
+   if(fp == NULL) {
+      fprintf(stderr, "Could not open %s.\n", name);
+      exit(-1);
+   }
+   fseek(fp, 0, SEEK_END);
+   size = ftell(fp);
+   fclose(fp);
+   return size;
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         dims2[3] = {600, 500, 3};
+   size_t         offset[3] = {50, 150, 1};
+   size_t         size[3] = {300, 300, 2};
+   size_t         bufsize, x, y, z;
+   void*          buf1;
+   short*         buf2;
+   short*         roi;
+   char           name2[1024];
+   char           name3[1024];
+   Ics_Error      retval;
+
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+   sprintf(name2, "%s_gz.ics", argv[2]);
+   sprintf(name3, "%s_b.ics", argv[2]);
+
+   /* Read image */
+   retval = IcsOpen(&ip, argv[1], "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   bufsize = IcsGetDataSize(ip);
+   buf1 = malloc(bufsize);
+   if(buf1 == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf1, bufsize);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read input image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+
+   /* Write and read back the image, compare to gzip */
+   write_image(argv[2], dt, ndims, dims, buf1, bufsize, IcsCompr_loco);
+   read_compare(argv[2], buf1, bufsize);
+   write_image(name2, dt, ndims, dims, buf1, bufsize, IcsCompr_gzip);
+   printf("loco: %ld bytes, gzip: %ld bytes\n", file_size(argv[2]),
+          file_size(name2));
+
+   /* A signed image that spans several tiles per plane */
+   bufsize = dims2[0] * dims2[1] * dims2[2] * sizeof(short);
+   buf2 = malloc(bufsize);
+   roi = malloc(size[0] * size[1] * size[2] * sizeof(short));
+   if(buf2 == NULL || roi == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   srand(1);
+   for(z = 0; z < dims2[2]; z++) {
+      for(y = 0; y < dims2[1]; y++) {
+         for(x = 0; x < dims2[0]; x++) {
+            buf2[(z * dims2[1] + y) * dims2[0] + x] =
+               (short)((int)(x * 40) - (int)(y * 30) + (int)(z * 1000)
+                       + rand() % 64 - 32);
+         }
+      }
+   }
+   buf2[0] = -32768;
+   buf2[1] = 32767;
+   write_image(name3, Ics_sint16, 3, dims2, buf2, bufsize, IcsCompr_loco);
+   read_compare(name3, buf2, bufsize);
+
+   /* Read a region that crosses tile boundaries */
+   retval = IcsOpen(&ip, name3, "r");
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open output file for reading: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsGetROIData(ip, offset, size, NULL, roi,
+                          size[0] * size[1] * size[2] * sizeof(short));
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read region from output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close output file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   for(z = 0; z < size[2]; z++) {
+      for(y = 0; y < size[1]; y++) {
+         for(x = 0; x < size[0]; x++) {
+            if(roi[(z * size[1] + y) * size[0] + x] !=
+               buf2[((z + offset[2]) * dims2[1] + y + offset[1]) * dims2[0]
+                    + x + offset[0]]) {
+               fprintf(stderr, "Region read does not match data in input.\n");
+               exit(-1);
+            }
+         }
+      }
+   }
+
+   free(buf1);
+   free(buf2);
+   free(roi);
+   exit(0);
+}
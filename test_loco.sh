@@ -0,0 +1 @@
+./test_loco $srcdir/test/testim.ics result_loco.ics
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+#define NREADS 4
+
+static void compare(const void *a, const void *b, size_t n, const char *what) {
+   if(memcmp(a, b, n) != 0) {
+      fprintf(stderr, "Data differ: %s.\n", what);
+      exit(-1);
+   }
+}
+
+/* Check that the buffers of a handle are all given back, and that they never
+   took more than limit bytes (if not 0) */
+static void check_usage(ICS *ip, size_t limit, const char *what) {
+   size_t inUse, peak;
+   check(IcsGetMemoryUsage(ip, &inUse, &peak), "get memory usage");
+   if(inUse != 0 || peak == 0 || (limit > 0 && peak > limit)) {
+      fprintf(stderr, "Wrong memory usage %s: %d in use, peak %d.\n", what,
+              (int)inUse, (int)peak);
+      exit(-1);
+   }
+}
+
+/* Read all of ip several times at once with asynchronous reads */
+static void async_reads(ICS *ip, const void *buf, size_t bufsize) {
+   Ics_ReadRequest *requests[NREADS];
+   void            *out[NREADS];
+   int              i;
+
+   for(i = 0; i < NREADS; i++) {
+      out[i] = malloc(bufsize);
+      check(IcsSubmitROIRead(ip, NULL, NULL, NULL, out[i], bufsize, NULL, NULL,
+                             &requests[i]), "submit read");
+   }
+   for(i = 0; i < NREADS; i++) {
+      check(IcsWaitRead(requests[i]), "read asynchronously");
+      compare(buf, out[i], bufsize, "asynchronous read");
+      free(out[i]);
+   }
+}
+
+/* Make a preview and a thumbnail of plane 1 of name, with a memory limit */
+static void previews(const char *name, size_t limit, unsigned char *preview,
+                     unsigned char *thumb, size_t n) {
+   ICS* ip;
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsSetMemoryLimit(ip, limit), "set memory limit");
+   check(IcsGetPreviewData(ip, preview, n, 1), "read preview");
+   check(IcsGetThumbnailData(ip, thumb, 64, 64, 1), "read thumbnail");
+   check_usage(ip, limit, "for previews");
+   check(IcsClose(ip), "close file");
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         bufsize, plane, inUse, peak;
+   void           *buf, *out;
+   unsigned char  *preview, *preview2, thumb[64 * 64], thumb2[64 * 64];
+   char           namez[1024];
+   Ics_Context    *ctx;
+   Ics_ReadRequest *requests[NREADS];
+   int            i;
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16 || ndims != 3) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   bufsize = IcsGetDataSize(ip);
+   buf = malloc(bufsize);
+   out = malloc(bufsize);
+   check(IcsGetData(ip, buf, bufsize), "read input image data");
+   check(IcsClose(ip), "close input file");
+   test_name(namez, argv[2], "_z.ics");
+   check(IcsOpen(&ip, namez, "w2"), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsClose(ip), "write output file");
+
+   /* zlib memory is accounted to the handle */
+   check(IcsOpen(&ip, namez, "r"), "open gzip file");
+   check(IcsGetData(ip, out, bufsize), "read gzip data");
+   compare(buf, out, bufsize, "gzip");
+   check_usage(ip, 0, "reading gzip data");
+   check(IcsClose(ip), "close gzip file");
+
+   /* Under a limit smaller than a plane, previews are made line by line */
+   plane = dims[0] * dims[1];
+   preview = malloc(plane);
+   preview2 = malloc(plane);
+   previews(argv[1], 0, preview, thumb, plane);
+   previews(argv[1], plane, preview2, thumb2, plane);
+   compare(preview, preview2, plane, "preview under a memory limit");
+   compare(thumb, thumb2, sizeof(thumb), "thumbnail under a memory limit");
+
+   /* A limit too small for the zlib state */
+   check(IcsOpen(&ip, namez, "r"), "open gzip file");
+   check(IcsSetMemoryLimit(ip, 1024), "set memory limit");
+   if(IcsGetData(ip, out, bufsize) != IcsErr_Alloc) {
+      fprintf(stderr, "Memory limit of the handle not respected.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close gzip file");
+
+   /* Asynchronous reads are accounted to the handle they were submitted on,
+      also when they run at the same time */
+   check(IcsOpen(&ip, namez, "r"), "open gzip file");
+   async_reads(ip, buf, bufsize);
+   check_usage(ip, 0, "in asynchronous reads");
+   check(IcsSetMemoryLimit(ip, 1024), "set memory limit");
+   for(i = 0; i < NREADS; i++) {
+      check(IcsSubmitROIRead(ip, NULL, NULL, NULL, out, bufsize, NULL, NULL,
+                             &requests[i]), "submit read");
+   }
+   for(i = 0; i < NREADS; i++) {
+      if(IcsWaitRead(requests[i]) != IcsErr_Alloc) {
+         fprintf(stderr, "Memory limit not respected by asynchronous read.\n");
+         exit(-1);
+      }
+   }
+   check(IcsClose(ip), "close gzip file");
+
+   /* The handle can be closed while reads are in flight */
+   check(IcsOpen(&ip, namez, "r"), "open gzip file");
+   for(i = 0; i < NREADS; i++) {
+      check(IcsSubmitROIRead(ip, NULL, NULL, NULL, out, bufsize, NULL, NULL,
+                             &requests[i]), "submit read");
+   }
+   check(IcsClose(ip), "close gzip file");
+   for(i = 0; i < NREADS; i++) {
+      check(IcsWaitRead(requests[i]), "read after closing");
+   }
+   compare(buf, out, bufsize, "read after closing");
+
+   /* A context holds on to its free buffers, until they are needed under its
+      limit */
+   check(IcsNewContext(&ctx, 1), "create context");
+   check(IcsOpen(&ip, namez, "r"), "open gzip file");
+   check(IcsSetContext(ip, ctx), "set context");
+   check(IcsGetData(ip, out, bufsize), "read gzip data with context");
+   compare(buf, out, bufsize, "gzip with context");
+   check_usage(ip, 0, "reading gzip data with context");
+   check(IcsGetContextMemoryUsage(ctx, &inUse, &peak), "get memory usage");
+   if(inUse == 0 || peak < inUse) {
+      fprintf(stderr, "Wrong memory usage of the context.\n");
+      exit(-1);
+   }
+   check(IcsSetContextMemoryLimit(ctx, 1024), "set memory limit");
+   if(IcsGetData(ip, out, bufsize) != IcsErr_Alloc) {
+      fprintf(stderr, "Memory limit of the context not respected.\n");
+      exit(-1);
+   }
+   check(IcsGetContextMemoryUsage(ctx, &inUse, NULL), "get memory usage");
+   if(inUse != 0) {
+      fprintf(stderr, "Free buffers of the context not released.\n");
+      exit(-1);
+   }
+   check(IcsSetContextMemoryLimit(ctx, 0), "remove memory limit");
+   check(IcsGetData(ip, out, bufsize), "read gzip data with context");
+   compare(buf, out, bufsize, "gzip with context");
+   check(IcsClose(ip), "close gzip file");
+   check(IcsFreeContext(ctx), "free context");
+
+   free(buf);
+   free(out);
+   free(preview);
+   free(preview2);
+   exit(0);
+}
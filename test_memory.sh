@@ -0,0 +1 @@
+./test_memory $srcdir/test/testim.ics result_v2memory.ics
@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "libics.h"
+#include "libics_ll.h"
+#include "test_util.h"
+
+/* Write the image by filling in the memory-mapped file, line by line in
+   reverse order, using the strides */
+static void write_mapped(const char *name, const char *mode, Ics_DataType dt,
+                         int ndims, size_t *dims, const char *image) {
+   ICS*           ip;
+   void           *data;
+   ptrdiff_t      strides[ICS_MAXDIM];
+   size_t         nlines = 1, line, rest, pos;
+   size_t         bps = IcsGetDataTypeSize(dt);
+   int            i;
+
+   check(IcsOpen(&ip, name, mode), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsAddHistory(ip, "test", "mapped output");
+   check(IcsSetZoneMap(ip, 0), "set zone map");
+   check(IcsMapData(ip, &data, strides), "map output file");
+   if(IcsSetData(ip, image, IcsGetDataSize(ip)) != IcsErr_DuplicateData) {
+      fprintf(stderr, "Data set twice.\n");
+      exit(-1);
+   }
+   for(i = 1; i < ndims; i++) nlines *= dims[i];
+   for(line = nlines; line-- > 0; ) {
+      rest = line;
+      pos = 0;
+      for(i = 1; i < ndims; i++) {
+         pos += (rest % dims[i]) * (size_t)strides[i];
+         rest /= dims[i];
+      }
+      memcpy((char*)data + pos * bps, image + line * dims[0] * bps,
+             dims[0] * bps);
+   }
+   check(IcsClose(ip), "write output file");
+}
+
+/* Compare the file with the image */
+static void compare(const char *name, const char *image, size_t n) {
+   ICS*  ip;
+   void  *buf;
+   char  value[ICS_LINE_LENGTH];
+
+   check(IcsOpen(&ip, name, "r"), "open output file");
+   if(IcsGetDataSize(ip) != n) {
+      fprintf(stderr, "Wrong image size in %s.\n", name);
+      exit(-1);
+   }
+   check(IcsGetHistoryString(ip, value, IcsWhich_First), "read history");
+   buf = malloc(n);
+   check(IcsGetData(ip, buf, n), "read output data");
+   check(IcsClose(ip), "close output file");
+   if(memcmp(image, buf, n) != 0) {
+      fprintf(stderr, "Data in %s differ from the image.\n", name);
+      exit(-1);
+   }
+   free(buf);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*          ip;
+   Ics_DataType  dt;
+   int           ndims;
+   size_t        dims[ICS_MAXDIM];
+   size_t        n;
+   char          *image;
+   void          *data;
+   char          name1[1024], name2[1024], zname[1024];
+   FILE          *fp;
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   n = IcsGetDataSize(ip);
+   image = malloc(n);
+   check(IcsGetData(ip, image, n), "read input image data");
+   check(IcsClose(ip), "close input file");
+
+   /* Version 1.0 (separate IDS file) and 2.0 (data after the header) */
+   test_name(name1, argv[2], "_1.ics");
+   test_name(name2, argv[2], "_2.ics");
+   write_mapped(name1, "w1", dt, ndims, dims, image);
+   write_mapped(name2, "w2", dt, ndims, dims, image);
+   compare(name1, image, n);
+   compare(name2, image, n);
+   test_name(zname, argv[2], "_2.izm");
+   fp = fopen(zname, "rb");
+   if(fp == NULL) {
+      fprintf(stderr, "Zone map %s not written.\n", zname);
+      exit(-1);
+   }
+   fclose(fp);
+
+   /* Compressed data cannot be mapped */
+   check(IcsOpen(&ip, name2, "w2"), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   if(IcsMapData(ip, &data, NULL) != IcsErr_NotValidAction) {
+      fprintf(stderr, "Compressed data mapped.\n");
+      exit(-1);
+   }
+   check(IcsSetData(ip, image, n), "set image data");
+   check(IcsClose(ip), "write output file");
+
+   free(image);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_mmap $srcdir/test/testim.ics result_mmap.ics
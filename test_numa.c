@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+/* Read name in partitions, and compare with the data in buf */
+static void compare(const char *name, const void *buf, size_t n,
+                    const size_t *partSizes, size_t nParts, int bind) {
+   ICS* ip;
+   char *data = malloc(n);
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsGetDataPartitioned(ip, data, n, partSizes, nParts, bind),
+         "read partitioned data");
+   check(IcsClose(ip), "close file");
+   if(memcmp(data, buf, n) != 0) {
+      fprintf(stderr, "Partitioned data of %s differ (%d partitions).\n",
+              name, (int)nParts);
+      exit(-1);
+   }
+   free(data);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         n, planes[3], wrong[2];
+   char           *buf;
+   char           namez[1024];
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   n = IcsGetDataSize(ip);
+   buf = malloc(n);
+   check(IcsGetData(ip, buf, n), "read input image data");
+   check(IcsClose(ip), "close input file");
+   if(IcsGetNumaNodes() < 1) {
+      fprintf(stderr, "Wrong number of NUMA nodes.\n");
+      exit(-1);
+   }
+
+   /* A gzip copy is read sequentially after placing the pages */
+   test_name(namez, argv[2], "_z.ics");
+   check(IcsOpen(&ip, namez, "w2"), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, n);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsClose(ip), "write output file");
+
+   /* One partition per node, an even split, and one per plane plus an empty
+      one */
+   planes[0] = n / dims[ndims - 1];
+   planes[1] = n - planes[0];
+   planes[2] = 0;
+   compare(argv[1], buf, n, NULL, 0, 1);
+   compare(argv[1], buf, n, NULL, 5, 0);
+   compare(argv[1], buf, n, planes, 3, 1);
+   compare(namez, buf, n, NULL, 4, 1);
+   compare(namez, buf, n, planes, 3, 0);
+
+   /* Partitions that don't add up */
+   wrong[0] = n / 2;
+   wrong[1] = n / 4;
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   if(IcsGetDataPartitioned(ip, buf, n, wrong, 2, 0) != IcsErr_IllParameter) {
+      fprintf(stderr, "Wrong partition sizes not detected.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close input file");
+
+   free(buf);
+   exit(0);
+}
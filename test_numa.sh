@@ -0,0 +1 @@
+./test_numa $srcdir/test/testim.ics result_numa.ics
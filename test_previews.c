@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+#define XS 50
+#define YS 40
+#define ZS 5
+
+/* Compare the previews of all planes of name, in a montage of the given
+   width, with those of IcsGetPreviewData() */
+static void compare(const char *name, size_t columns) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims, i;
+   size_t         dims[ICS_MAXDIM];
+   size_t         nPlanes = 1, rows, width, k, y;
+   unsigned char  *all, *plane, *cell;
+
+   check(IcsOpen(&ip, name, "r"), "open file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   for(i = 2; i < ndims; i++) {
+      nPlanes *= dims[i];
+   }
+   rows = (nPlanes + columns - 1) / columns;
+   width = columns * dims[0];
+   all = malloc(width * rows * dims[1]);
+   plane = malloc(dims[0] * dims[1]);
+   check(IcsGetPreviewPlanes(ip, all, width * rows * dims[1], 1, columns, 0),
+         "read previews");
+   for(k = 0; k < rows * columns; k++) {
+      if(k < nPlanes) {
+         check(IcsGetPreviewData(ip, plane, dims[0] * dims[1], k),
+               "read preview");
+      } else {
+         memset(plane, 0, dims[0] * dims[1]);
+      }
+      cell = all + (k / columns) * dims[1] * width + (k % columns) * dims[0];
+      for(y = 0; y < dims[1]; y++) {
+         if(memcmp(cell + y * width, plane + y * dims[0], dims[0]) != 0) {
+            fprintf(stderr, "Preview %d of %s differs.\n", (int)k, name);
+            exit(-1);
+         }
+      }
+   }
+   check(IcsClose(ip), "close file");
+   free(all);
+   free(plane);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         n, x, y, z;
+   size_t         sdims[3] = {XS, YS, ZS};
+   char           *buf;
+   char           namez[1024];
+   unsigned short *stack;
+   unsigned char  *previews;
+   int            expected, diff;
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image, and write a gzip copy */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   n = IcsGetDataSize(ip);
+   buf = malloc(n);
+   check(IcsGetData(ip, buf, n), "read input image data");
+   check(IcsClose(ip), "close input file");
+   test_name(namez, argv[2], "_z.ics");
+   check(IcsOpen(&ip, namez, "w2"), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, n);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsClose(ip), "write output file");
+   free(buf);
+
+   /* Each plane scaled to its own range, one after the other and in a
+      montage with an empty cell */
+   compare(argv[1], 1);
+   compare(namez, 1);
+   compare(namez, 3);
+
+   /* A stack whose planes have different ranges, scaled together */
+   stack = malloc(XS * YS * ZS * 2);
+   for(z = 0; z < ZS; z++) {
+      for(y = 0; y < YS; y++) {
+         for(x = 0; x < XS; x++) {
+            stack[(z * YS + y) * XS + x] = (unsigned short)((x + y) * (z + 1));
+         }
+      }
+   }
+   check(IcsOpen(&ip, argv[2], "w2"), "open output file");
+   IcsSetLayout(ip, Ics_uint16, 3, sdims);
+   IcsSetData(ip, stack, XS * YS * ZS * 2);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsClose(ip), "write output file");
+
+   /* Planes 0, 2 and 4 */
+   previews = malloc(XS * YS * 3);
+   check(IcsOpen(&ip, argv[2], "r"), "open output file");
+   check(IcsGetPreviewPlanes(ip, previews, XS * YS * 3, 2, 1, 1),
+         "read previews");
+   if(IcsGetPreviewPlanes(ip, previews, XS * YS * 2, 2, 1, 1) !=
+      IcsErr_BufferTooSmall) {
+      fprintf(stderr, "Too small buffer not detected.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close output file");
+   for(z = 0; z < 3; z++) {
+      for(y = 0; y < YS; y++) {
+         for(x = 0; x < XS; x++) {
+            expected = (int)((x + y) * (2 * z + 1) * 255 /
+                             ((XS + YS - 2) * ZS));
+            diff = previews[(z * YS + y) * XS + x] - expected;
+            if(diff < -1 || diff > 1) {
+               fprintf(stderr, "Wrong globally scaled preview of plane %d.\n",
+                       (int)(2 * z));
+               exit(-1);
+            }
+         }
+      }
+   }
+
+   free(stack);
+   free(previews);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_previews $srcdir/test/testim.ics result_v2previews.ics
@@ -0,0 +1,66 @@
+# Round-trips a NumPy array through the Python bindings.
+# Usage: test_python.py in.ics out.ics
+import sys
+import numpy
+import libics
+
+
+def fail(what):
+    sys.stderr.write(what + "\n")
+    sys.exit(-1)
+
+
+def open_ics(name, mode):
+    error, ip = libics.IcsOpen(name, mode)
+    if error != libics.IcsErr_Ok:
+        fail("Could not open %s: %s" % (name, libics.IcsGetErrorText(error)))
+    return ip
+
+
+if len(sys.argv) != 3:
+    fail("Two file names required: in out")
+
+# Read image
+ip = open_ics(sys.argv[1], "r")
+data = libics.get_data(ip)
+libics.close(ip)
+if data.dtype != numpy.uint16 or data.ndim != 3:
+    fail("Expected a 3D uint16 input image.")
+
+# Write it from a strided view into a larger array
+big = numpy.zeros(data.shape[:-1] + (data.shape[-1] * 2,), data.dtype)
+big[..., ::2] = data
+view = big[..., ::2]
+refs = sys.getrefcount(view)
+ip = open_ics(sys.argv[2], "w2")
+libics.set_data(ip, view)
+if sys.getrefcount(view) != refs + 1:
+    fail("Buffer not held while writing.")
+libics.IcsSetCompression(ip, libics.IcsCompr_gzip, 6)
+libics.IcsClose(ip)
+
+# Plain IcsClose releases the buffer as well
+if sys.getrefcount(view) != refs:
+    fail("Buffer not released by IcsClose.")
+
+# Read it back whole, into a strided view, and as a region
+ip = open_ics(sys.argv[2], "r")
+if not numpy.array_equal(libics.get_data(ip), data):
+    fail("Data in output file does not match data in input.")
+out = numpy.zeros(big.shape, data.dtype)
+libics.get_data(ip, out[..., 1::2])
+if not numpy.array_equal(out[..., 1::2], data):
+    fail("Data read into a strided array do not match.")
+roi = libics.get_roi_data(ip, offset=[10, 20, 0], size=[30, 40, 2])
+if not numpy.array_equal(roi, data[0:2, 20:60, 10:40]):
+    fail("Region read does not match data in input.")
+libics.close(ip)
+
+# A mismatched type is an error
+ip = open_ics(sys.argv[2], "r")
+try:
+    libics.get_data(ip, numpy.zeros(data.shape, numpy.float32))
+    fail("Wrong data type accepted.")
+except libics.IcsError:
+    pass
+libics.close(ip)
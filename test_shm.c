@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "libics.h"
+#include "test_util.h"
+
+/* Attach to name, and compare the view with the region read through ip */
+static void compare(ICS *ip, const char *name, const size_t *offset,
+                    const size_t *size) {
+   Ics_SharedData *view;
+   Ics_DataType   dt;
+   int            ndims, i;
+   size_t         dims[ICS_MAXDIM];
+   size_t         n = 2;
+   ptrdiff_t      stride = 1;
+   char           *roi;
+
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   for(i = 0; i < ndims; i++) {
+      n *= size[i];
+   }
+   roi = malloc(n);
+   check(IcsGetROIData(ip, offset, size, NULL, roi, n), "read region");
+   check(IcsAttachShared(name, &view), "attach to shared data");
+   if(view->dataType != dt || view->dimensions != ndims || view->dataSize != n) {
+      fprintf(stderr, "Wrong layout of shared data %s.\n", name);
+      exit(-1);
+   }
+   for(i = 0; i < ndims; i++) {
+      if(view->dims[i] != size[i] || view->offset[i] != offset[i] ||
+         view->strides[i] != stride) {
+         fprintf(stderr, "Wrong dimension %d of shared data %s.\n", i, name);
+         exit(-1);
+      }
+      stride *= (ptrdiff_t)size[i];
+   }
+   if(memcmp(view->data, roi, n) != 0) {
+      fprintf(stderr, "Shared data %s differ from the file.\n", name);
+      exit(-1);
+   }
+   check(IcsDetachShared(view), "detach from shared data");
+   free(roi);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         n;
+   char           *buf;
+   char           namez[1024], name1[64], name2[64];
+   size_t         all[3] = {0, 0, 0};
+   size_t         offset[3] = {7, 9, 1};
+   size_t         size[3] = {101, 60, 1};
+   Ics_SharedData *shared1, *shared2, *view;
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image, and write a gzip copy */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   n = IcsGetDataSize(ip);
+   buf = malloc(n);
+   check(IcsGetData(ip, buf, n), "read input image data");
+   check(IcsClose(ip), "close input file");
+   test_name(namez, argv[2], "_z.ics");
+   check(IcsOpen(&ip, namez, "w2"), "open output file");
+   IcsSetLayout(ip, dt, ndims, dims);
+   IcsSetData(ip, buf, n);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsClose(ip), "write output file");
+
+   /* Publish the whole image and a region of the compressed copy */
+   sprintf(name1, "libics_test_%ld_1", (long)time(NULL));
+   sprintf(name2, "libics_test_%ld_2", (long)time(NULL));
+   check(IcsOpen(&ip, namez, "r"), "open compressed file");
+   check(IcsPublishROIData(ip, NULL, NULL, name1, &shared1),
+         "publish the image");
+   check(IcsPublishROIData(ip, offset, size, name2, &shared2),
+         "publish a region");
+   if(IcsPublishROIData(ip, NULL, NULL, name1, &view) != IcsErr_DuplicateData) {
+      fprintf(stderr, "Publishing under an existing name allowed.\n");
+      exit(-1);
+   }
+   compare(ip, name1, all, dims);
+   compare(ip, name2, offset, size);
+   if(memcmp(shared1->data, buf, n) != 0) {
+      fprintf(stderr, "Published data differ from the file.\n");
+      exit(-1);
+   }
+   check(IcsClose(ip), "close compressed file");
+
+   /* A view remains valid after the data is withdrawn */
+   check(IcsAttachShared(name1, &view), "attach to shared data");
+   check(IcsDetachShared(shared1), "withdraw shared data");
+   if(memcmp(view->data, buf, n) != 0) {
+      fprintf(stderr, "Attached data changed after withdrawing.\n");
+      exit(-1);
+   }
+   check(IcsDetachShared(view), "detach from shared data");
+   if(IcsAttachShared(name1, &view) != IcsErr_FOpenIds) {
+      fprintf(stderr, "Withdrawn shared data still found.\n");
+      exit(-1);
+   }
+   check(IcsDetachShared(shared2), "withdraw shared data");
+
+   free(buf);
+   exit(0);
+}
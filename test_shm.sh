@@ -0,0 +1 @@
+./test_shm $srcdir/test/testim.ics result_v2shm.ics
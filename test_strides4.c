@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+
+/* Reads a region into a buffer with the given strides, and compares it with
+   the full image. */
+static void read_compare(const char *name, unsigned short *full, size_t *dims,
+                         size_t *offset, size_t *size, size_t *sampling,
+                         ptrdiff_t *strides, ptrdiff_t origin) {
+   ICS*            ip;
+   Ics_Error       retval;
+   unsigned short* buf;
+   size_t          n[3], x, y, z;
+
+   for (x = 0; x < 3; x++) {
+      n[x] = (size[x] + sampling[x] - 1) / sampling[x];
+   }
+   buf = malloc(n[0] * n[1] * n[2] * sizeof(unsigned short));
+   if (buf == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsOpen(&ip, name, "r");
+   if (retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsGetROIDataWithStrides(ip, offset, size, sampling, buf + origin,
+                                     strides, 3);
+   if (retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read region using strides: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if (retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   for (z = 0; z < n[2]; z++) {
+      for (y = 0; y < n[1]; y++) {
+         for (x = 0; x < n[0]; x++) {
+            if (buf[origin + (ptrdiff_t)x * strides[0]
+                    + (ptrdiff_t)y * strides[1] + (ptrdiff_t)z * strides[2]] !=
+                full[((z * sampling[2] + offset[2]) * dims[1]
+                      + y * sampling[1] + offset[1]) * dims[0]
+                     + x * sampling[0] + offset[0]]) {
+               fprintf(stderr, "Region read does not match data in input.\n");
+               exit(-1);
+            }
+         }
+      }
+   }
+   free(buf);
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims;
+   size_t         dims[ICS_MAXDIM];
+   size_t         offset[3] = {3, 5, 0};
+   size_t         size[3] = {150, 90, 2};
+   size_t         sampling[3] = {2, 3, 1};
+   size_t         nosampling[3] = {1, 1, 1};
+   ptrdiff_t      strides[3];
+   size_t         bufsize;
+   unsigned short *buf;
+   Ics_Error      retval;
+
+
+   if (argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   retval = IcsOpen(&ip, argv[1], "r");
+   if (retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not open input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if (dt != Ics_uint16 || ndims != 3) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   bufsize = IcsGetDataSize(ip);
+   buf = malloc(bufsize);
+   if (buf == NULL) {
+      fprintf(stderr, "Could not allocate memory.\n");
+      exit(-1);
+   }
+   retval = IcsGetData(ip, buf, bufsize);
+   if (retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not read input image data: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+   retval = IcsClose(ip);
+   if (retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not close input file: %s\n",
+              IcsGetErrorText(retval));
+      exit(-1);
+   }
+
+   /* Subsampled region with the first two dimensions swapped */
+   strides[0] = 30;
+   strides[1] = 1;
+   strides[2] = 75 * 30;
+   read_compare(argv[1], buf, dims, offset, size, sampling, strides, 0);
+
+   /* Region with the first two dimensions swapped, no subsampling */
+   strides[0] = 90;
+   strides[1] = 1;
+   strides[2] = 150 * 90;
+   read_compare(argv[1], buf, dims, offset, size, nosampling, strides, 0);
+
+   /* Subsampled region, mirrored along the last dimension */
+   strides[0] = 1;
+   strides[1] = 75;
+   strides[2] = -75 * 30;
+   read_compare(argv[1], buf, dims, offset, size, sampling, strides, 75 * 30);
+
+   free(buf);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_strides4 $srcdir/test/testim.ics result_s4.ics
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+#define NFILES 3
+
+typedef struct {
+   Ics_Error     error[NFILES];
+   unsigned char *thumb[NFILES];
+   size_t        size;
+} Batch;
+
+/* Thumbnail of a plane, computed the same way as the library does */
+static void reference(const double *plane, size_t xs, size_t ys, size_t w,
+                      size_t h, unsigned char *dest) {
+   double  scale, sum, min = 0, max = 0, gain, *t;
+   size_t  tw, th, step, nlines, x, y, r, r0, r1, x0, x1, i;
+
+   scale = (double)xs / (double)w;
+   if(scale < (double)ys / (double)h) scale = (double)ys / (double)h;
+   tw = (size_t)((double)xs / scale + 0.5);
+   th = (size_t)((double)ys / scale + 0.5);
+   step = ys / (2 * th);
+   if(step < 1) step = 1;
+   nlines = (ys + step - 1) / step;
+   t = malloc(tw * th * sizeof(double));
+   for(y = 0; y < th; y++) {
+      r0 = y * nlines / th;
+      r1 = (y + 1) * nlines / th;
+      if(r1 <= r0) r1 = r0 + 1;
+      for(x = 0; x < tw; x++) {
+         x0 = x * xs / tw;
+         x1 = (x + 1) * xs / tw;
+         if(x1 <= x0) x1 = x0 + 1;
+         sum = 0;
+         for(r = r0; r < r1; r++) {
+            for(i = x0; i < x1; i++) {
+               sum += plane[r * step * xs + i];
+            }
+         }
+         t[y * tw + x] = sum / (double)((x1 - x0) * (r1 - r0));
+         if(x + y == 0 || min > t[y * tw + x]) min = t[y * tw + x];
+         if(x + y == 0 || max < t[y * tw + x]) max = t[y * tw + x];
+      }
+   }
+   gain = max > min ? 255.0 / (max - min) : 0.0;
+   memset(dest, 0, w * h);
+   for(y = 0; y < th; y++) {
+      for(x = 0; x < tw; x++) {
+         dest[((h - th) / 2 + y) * w + (w - tw) / 2 + x] =
+            (unsigned char)((t[y * tw + x] - min) * gain + 0.5);
+      }
+   }
+   free(t);
+}
+
+static void compare(const unsigned char *a, const unsigned char *b, size_t n,
+                    const char *what) {
+   size_t i;
+   for(i = 0; i < n; i++) {
+      if(abs((int)a[i] - (int)b[i]) > 1) {
+         fprintf(stderr, "%s does not match the expected thumbnail.\n", what);
+         exit(-1);
+      }
+   }
+}
+
+static void thumbnail(const char *name, size_t w, size_t h, size_t plane,
+                      unsigned char *dest) {
+   ICS* ip;
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsGetThumbnailData(ip, dest, w, h, plane), "make thumbnail");
+   check(IcsClose(ip), "close file");
+}
+
+static void write_file(const char *name, Ics_DataType dt, size_t *dims,
+                       void *buf, size_t bufsize) {
+   ICS* ip;
+   check(IcsOpen(&ip, name, "w2"), "open output file");
+   IcsSetLayout(ip, dt, 3, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, IcsCompr_uncompressed, 0);
+   check(IcsClose(ip), "write output file");
+}
+
+static Ics_Error collect(void *userData, size_t index, Ics_Error error,
+                         const unsigned char *thumb) {
+   Batch *b = userData;
+   b->error[index] = error;
+   if(thumb != NULL) {
+      b->thumb[index] = malloc(b->size);
+      memcpy(b->thumb[index], thumb, b->size);
+   }
+   return IcsErr_Ok;
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*           ip;
+   Ics_DataType   dt;
+   int            ndims, ii;
+   size_t         dims[ICS_MAXDIM];
+   size_t         sizes[3][2] = {{64, 48}, {20, 20}, {300, 200}};
+   size_t         n, planesize, i, w, h;
+   unsigned short *buf16;
+   unsigned char  *buf8;
+   float          *buf32;
+   double         *plane;
+   unsigned char  *thumb, *expected;
+   char           name8[1024], name32[1024];
+   const char*    files[NFILES];
+   Batch          batch;
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16 || ndims != 3) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   n = IcsGetImageSize(ip);
+   planesize = dims[0] * dims[1];
+   buf16 = malloc(n * 2);
+   buf8 = malloc(n);
+   buf32 = malloc(n * sizeof(float));
+   plane = malloc(planesize * sizeof(double));
+   thumb = malloc(300 * 200);
+   expected = malloc(300 * 200);
+   check(IcsGetData(ip, buf16, n * 2), "read input image data");
+   check(IcsClose(ip), "close input file");
+   for(i = 0; i < n; i++) {
+      buf8[i] = (unsigned char)(buf16[i] >> 4);
+      buf32[i] = (float)buf16[i] * 0.25f;
+   }
+   test_name(name8, argv[2], "_8.ics");
+   write_file(name8, Ics_uint8, dims, buf8, n);
+   test_name(name32, argv[2], "_f.ics");
+   write_file(name32, Ics_real32, dims, buf32, n * sizeof(float));
+
+   /* Single thumbnails: shrinking with and without skipping lines, and
+      enlarging */
+   for(ii = 0; ii < 3; ii++) {
+      w = sizes[ii][0];
+      h = sizes[ii][1];
+      for(i = 0; i < planesize; i++) plane[i] = buf16[planesize + i];
+      reference(plane, dims[0], dims[1], w, h, expected);
+      thumbnail(argv[1], w, h, 1, thumb);
+      compare(thumb, expected, w * h, "uint16 thumbnail");
+      thumbnail(name32, w, h, 1, thumb);
+      compare(thumb, expected, w * h, "real32 thumbnail");
+      for(i = 0; i < planesize; i++) plane[i] = buf8[i];
+      reference(plane, dims[0], dims[1], w, h, expected);
+      thumbnail(name8, w, h, 0, thumb);
+      compare(thumb, expected, w * h, "uint8 thumbnail");
+   }
+
+   /* Non-existent plane */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   if(IcsGetThumbnailData(ip, thumb, 64, 48, 2) != IcsErr_IllegalROI) {
+      fprintf(stderr, "Non-existent plane not detected.\n");
+      exit(-1);
+   }
+   IcsClose(ip);
+
+   /* Batch, with a file that does not exist */
+   files[0] = argv[1];
+   files[1] = "nonexistent_file.ics";
+   files[2] = name32;
+   memset(&batch, 0, sizeof(batch));
+   batch.size = 64 * 48;
+   check(IcsLoadThumbnails(files, NFILES, 1, 64, 48, collect, &batch),
+         "make thumbnails");
+   if(batch.error[1] == IcsErr_Ok || batch.thumb[1] != NULL) {
+      fprintf(stderr, "Missing file not reported.\n");
+      exit(-1);
+   }
+   for(ii = 0; ii < NFILES; ii += 2) {
+      check(batch.error[ii], "make thumbnail in batch");
+      thumbnail(files[ii], 64, 48, 1, thumb);
+      if(batch.thumb[ii] == NULL ||
+         memcmp(batch.thumb[ii], thumb, 64 * 48) != 0) {
+         fprintf(stderr, "Batch thumbnail does not match single one.\n");
+         exit(-1);
+      }
+      free(batch.thumb[ii]);
+   }
+
+   free(buf16);
+   free(buf8);
+   free(buf32);
+   free(plane);
+   free(thumb);
+   free(expected);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_thumbnail $srcdir/test/testim.ics result_thumb.ics && ICS_CPU_LEVEL=generic ./test_thumbnail $srcdir/test/testim.ics result_thumb_generic.ics
@@ -0,0 +1,39 @@
+/*
+ * FILE : test_util.h
+ *
+ * Helpers shared by the test programs.
+ */
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+
+
+/* Exits the test program with a message if retval is an error. */
+static inline void check(Ics_Error  retval,
+                         const char *what)
+{
+   if(retval != IcsErr_Ok) {
+      fprintf(stderr, "Could not %s: %s\n", what, IcsGetErrorText(retval));
+      exit(-1);
+   }
+}
+
+
+/* Writes into dest the name of the .ics file base with its extension
+   replaced by suffix, e.g. "out.ics" and "_z.ics" give "out_z.ics". */
+static inline char *test_name(char       *dest,
+                              const char *base,
+                              const char *suffix)
+{
+   sprintf(dest, "%.*s%s", (int)strlen(base) - 4, base, suffix);
+   return dest;
+}
+
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+#define PLANES 16
+#define PAD 3
+
+static int exists(const char *name) {
+   FILE *fp = fopen(name, "rb");
+   if(fp == NULL) {
+      return 0;
+   }
+   fclose(fp);
+   return 1;
+}
+
+static void copy_file(const char *from, const char *to) {
+   char buf[4096];
+   size_t n;
+   FILE *in = fopen(from, "rb");
+   FILE *out = fopen(to, "wb");
+   if(in == NULL || out == NULL) {
+      fprintf(stderr, "Could not copy %s.\n", from);
+      exit(-1);
+   }
+   while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+      fwrite(buf, 1, n, out);
+   }
+   fclose(in);
+   fclose(out);
+}
+
+/* Read planes of name in a jumbled order, as regions and as blocks, and
+   compare them with the planes in buf */
+static void compare(const char *name, const unsigned short *buf,
+                    const size_t *dims) {
+   static const size_t order[] = {13, 2, 15, 7, 0, 8};
+   ICS* ip;
+   size_t plane = dims[0] * dims[1];
+   size_t offset[3] = {0, 0, 0}, size[3];
+   size_t i, t, pos;
+   unsigned short *data = malloc(plane * sizeof(unsigned short));
+
+   size[0] = dims[0];
+   size[1] = dims[1];
+   size[2] = 1;
+   check(IcsOpen(&ip, name, "r"), "open file");
+   for(i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+      t = order[i];
+      offset[2] = t;
+      check(IcsGetROIData(ip, offset, size, NULL, data,
+                          plane * sizeof(unsigned short)), "read plane");
+      if(memcmp(data, buf + t * plane, plane * sizeof(unsigned short))) {
+         fprintf(stderr, "Plane %d of %s differs.\n", (int)t, name);
+         exit(-1);
+      }
+   }
+   check(IcsClose(ip), "close file");
+
+   /* Skip over planes with the block interface, then read a line */
+   check(IcsOpen(&ip, name, "r"), "open file");
+   pos = 0;
+   for(t = 3; t < PLANES; t += 5) {
+      check(IcsSkipDataBlock(ip, (t * plane + 7 - pos) * sizeof(short)),
+            "skip data");
+      check(IcsGetDataBlock(ip, data, dims[0] * sizeof(short)), "read data");
+      pos = t * plane + 7 + dims[0];
+      if(memcmp(data, buf + t * plane + 7, dims[0] * sizeof(short))) {
+         fprintf(stderr, "Block in plane %d of %s differs.\n", (int)t, name);
+         exit(-1);
+      }
+   }
+   check(IcsClose(ip), "close file");
+   free(data);
+}
+
+static void release(void *userData, size_t index, const void *frame) {
+   (void)userData;
+   (void)index;
+   (void)frame;
+}
+
+int main(int argc, const char* argv[]) {
+   ICS*            ip;
+   Ics_DataType    dt;
+   Ics_FrameWriter *writer;
+   Ics_Error       error;
+   int             ndims;
+   size_t          dims[ICS_MAXDIM];
+   size_t          n, plane, bufsize, i, t;
+   ptrdiff_t       strides[3];
+   unsigned short  *in, *buf, *padded;
+   unsigned char   *preview, *preview2;
+   char            namez[1024], namep[1024], nameidx[1024], nameidx2[1024];
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* Read image */
+   check(IcsOpen(&ip, argv[1], "r"), "open input file");
+   IcsGetLayout(ip, &dt, &ndims, dims);
+   if(dt != Ics_uint16 || ndims != 3) {
+      fprintf(stderr, "Expected a 3D uint16 input image.\n");
+      exit(-1);
+   }
+   n = IcsGetDataSize(ip);
+   in = malloc(n);
+   check(IcsGetData(ip, in, n), "read input image data");
+   check(IcsClose(ip), "close input file");
+
+   /* Make an image with more planes, each one different */
+   plane = dims[0] * dims[1];
+   dims[2] = PLANES;
+   bufsize = plane * PLANES * sizeof(unsigned short);
+   buf = malloc(bufsize);
+   for(t = 0; t < PLANES; t++) {
+      for(i = 0; i < plane; i++) {
+         buf[t * plane + i] = (unsigned short)(in[(t % 2) * plane + i] + t);
+      }
+   }
+
+   /* Write it with an index, and without one */
+   test_name(namez, argv[2], "_z.ics");
+   test_name(namep, argv[2], "_p.ics");
+   test_name(nameidx, namez, ".izx");
+   test_name(nameidx2, namep, ".izx");
+   check(IcsOpen(&ip, namez, "w2"), "open output file");
+   IcsSetLayout(ip, dt, 3, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsSetZipIndex(ip, 0), "set GZIP index");
+   check(IcsClose(ip), "write output file");
+   if(!exists(nameidx)) {
+      fprintf(stderr, "GZIP index not written.\n");
+      exit(-1);
+   }
+   compare(namez, buf, dims);
+   check(IcsOpen(&ip, namep, "w2"), "open output file");
+   IcsSetLayout(ip, dt, 3, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsClose(ip), "write output file");
+   if(exists(nameidx2)) {
+      fprintf(stderr, "GZIP index written without asking.\n");
+      exit(-1);
+   }
+
+   /* Previews jump to the plane */
+   preview = malloc(plane);
+   preview2 = malloc(plane);
+   check(IcsOpen(&ip, namez, "r"), "open file");
+   check(IcsGetPreviewData(ip, preview, plane, 14), "read preview");
+   check(IcsClose(ip), "close file");
+   check(IcsOpen(&ip, namep, "r"), "open file");
+   check(IcsGetPreviewData(ip, preview2, plane, 14), "read preview");
+   check(IcsClose(ip), "close file");
+   if(memcmp(preview, preview2, plane)) {
+      fprintf(stderr, "Preview with GZIP index differs.\n");
+      exit(-1);
+   }
+
+   /* An index that belongs to other data is ignored */
+   buf[0]++;
+   check(IcsOpen(&ip, namep, "w2"), "open output file");
+   IcsSetLayout(ip, dt, 3, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, IcsCompr_gzip, 9);
+   check(IcsClose(ip), "write output file");
+   copy_file(nameidx, nameidx2);
+   compare(namep, buf, dims);
+
+   /* Strided data, an entry every 4 planes */
+   padded = malloc((dims[0] + PAD) * dims[1] * PLANES * sizeof(short));
+   for(i = 0; i < dims[1] * PLANES; i++) {
+      memcpy(padded + i * (dims[0] + PAD), buf + i * dims[0],
+             dims[0] * sizeof(short));
+   }
+   strides[0] = 1;
+   strides[1] = (ptrdiff_t)(dims[0] + PAD);
+   strides[2] = strides[1] * (ptrdiff_t)dims[1];
+   check(IcsOpen(&ip, namez, "w2"), "open output file");
+   IcsSetLayout(ip, dt, 3, dims);
+   IcsSetDataWithStrides(ip, padded, bufsize, strides, 3);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsSetZipIndex(ip, 4), "set GZIP index");
+   check(IcsClose(ip), "write output file");
+   compare(namez, buf, dims);
+
+   /* Frames written as they come */
+   check(IcsOpen(&ip, namez, "w2"), "open output file");
+   IcsSetLayout(ip, dt, 3, dims);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsSetZipIndex(ip, 0), "set GZIP index");
+   error = IcsStartFrameWriter(ip, 4, &writer);
+   if(error == IcsErr_NotValidAction) {
+      /* Built without threads, there is no frame writer */
+      IcsClose(ip);
+   } else {
+      check(error, "start frame writer");
+      for(t = 0; t < PLANES; t++) {
+         check(IcsPushFrame(writer, t, buf + t * plane, release, NULL),
+               "push frame");
+      }
+      check(IcsClose(ip), "write output file");
+      compare(namez, buf, dims);
+   }
+
+   /* Writing without an index removes the old one */
+   check(IcsOpen(&ip, namez, "w2"), "open output file");
+   IcsSetLayout(ip, dt, 3, dims);
+   IcsSetData(ip, buf, bufsize);
+   IcsSetCompression(ip, IcsCompr_gzip, 6);
+   check(IcsClose(ip), "write output file");
+   if(exists(nameidx)) {
+      fprintf(stderr, "Old GZIP index not removed.\n");
+      exit(-1);
+   }
+
+   free(in);
+   free(buf);
+   free(padded);
+   free(preview);
+   free(preview2);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_zipindex $srcdir/test/testim.ics result_v2zipindex.ics
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "libics.h"
+#include "test_util.h"
+
+#define XS 64
+#define YS 48
+#define ZS 10
+#define CHUNK_LINES 8
+
+typedef struct {
+   const unsigned short *image;
+   size_t               pos;
+   int                  nChunks;
+   int                  wrong;
+} Visit;
+
+static Ics_Error read_source(void *data, void *dest, size_t n) {
+   Visit *v = data;
+   memcpy(dest, (const char*)v->image + v->pos, n);
+   v->pos += n;
+   return IcsErr_Ok;
+}
+
+/* Count the chunks, and compare them to the image */
+static Ics_Error visit(void *userData, const size_t *offset,
+                       const size_t *size, const void *data) {
+   Visit  *v = userData;
+   size_t start = (offset[2] * YS + offset[1]) * XS;
+   if(offset[0] != 0 || size[0] != XS || size[2] != 1 ||
+      memcmp(v->image + start, data, size[1] * XS * 2) != 0) {
+      v->wrong = 1;
+   }
+   v->nChunks++;
+   return IcsErr_Ok;
+}
+
+static int exists(const char *name) {
+   FILE *fp = fopen(name, "rb");
+   if(fp == NULL) return 0;
+   fclose(fp);
+   return 1;
+}
+
+static char *read_file(const char *name, size_t *size) {
+   FILE *fp = fopen(name, "rb");
+   char *buf = malloc(1 << 16);
+   if(fp == NULL || buf == NULL) {
+      fprintf(stderr, "Could not read %s.\n", name);
+      exit(-1);
+   }
+   *size = fread(buf, 1, 1 << 16, fp);
+   fclose(fp);
+   return buf;
+}
+
+static void write_file(const char *name, const char *mode,
+                       Ics_Compression compr, int zones, int source,
+                       unsigned short *image) {
+   ICS*   ip;
+   size_t dims[3] = {XS, YS, ZS};
+   Visit  v;
+   check(IcsOpen(&ip, name, mode), "open output file");
+   IcsSetLayout(ip, Ics_uint16, 3, dims);
+   if(source) {
+      v.image = image;
+      v.pos = 0;
+      check(IcsSetDataSource(ip, read_source, &v), "set data source");
+   } else {
+      IcsSetData(ip, image, XS * YS * ZS * 2);
+   }
+   IcsSetCompression(ip, compr, 6);
+   if(zones) {
+      check(IcsSetZoneMap(ip, CHUNK_LINES * XS * 2), "set zone map");
+   }
+   check(IcsClose(ip), "write output file");
+}
+
+/* Check the bounding boxes and the chunks visited for a range */
+static void query(const char *name, unsigned short *image, int nExpected) {
+   ICS*   ip;
+   size_t offset[3], size[3];
+   size_t box1[6] = {10, 30, 3, 11, 11, 3};
+   size_t box2[6] = {0, 0, 3, 21, 41, 6};
+   Visit  v;
+
+   check(IcsOpen(&ip, name, "r"), "open file");
+   check(IcsGetBoundingBox(ip, 500, offset, size), "find bounding box");
+   if(memcmp(offset, box1, 3 * sizeof(size_t)) != 0 ||
+      memcmp(size, box1 + 3, 3 * sizeof(size_t)) != 0) {
+      fprintf(stderr, "Wrong bounding box in %s.\n", name);
+      exit(-1);
+   }
+   check(IcsGetBoundingBox(ip, 10, offset, size), "find bounding box");
+   if(memcmp(offset, box2, 3 * sizeof(size_t)) != 0 ||
+      memcmp(size, box2 + 3, 3 * sizeof(size_t)) != 0) {
+      fprintf(stderr, "Wrong bounding box in %s.\n", name);
+      exit(-1);
+   }
+   check(IcsGetBoundingBox(ip, 2000, offset, size), "find bounding box");
+   if(size[0] != 0 || size[1] != 0 || size[2] != 0) {
+      fprintf(stderr, "Empty bounding box not found in %s.\n", name);
+      exit(-1);
+   }
+   v.image = image;
+   v.nChunks = 0;
+   v.wrong = 0;
+   check(IcsForEachZone(ip, 900, 2000, visit, &v), "iterate chunks");
+   if(v.wrong || v.nChunks != nExpected) {
+      fprintf(stderr, "Wrong chunks visited in %s (%d).\n", name, v.nChunks);
+      exit(-1);
+   }
+   check(IcsClose(ip), "close file");
+}
+
+int main(int argc, const char* argv[]) {
+   unsigned short *image;
+   size_t         x, y, z;
+   char           name[1024], zname[1024], suffix[16];
+   const char*    modes[4] = {"w2", "w1", "w2", "w2"};
+   Ics_Compression compr[4] = {IcsCompr_uncompressed, IcsCompr_gzip,
+                               IcsCompr_loco, IcsCompr_gzip};
+   int            ii;
+   char           *zmap;
+   size_t         zsize;
+   FILE           *fp;
+
+   if(argc != 3) {
+      fprintf(stderr, "Two file names required: in out\n");
+      exit(-1);
+   }
+
+   /* A mostly empty volume with a block and a single bright pixel */
+   image = calloc(XS * YS * ZS, 2);
+   for(z = 3; z < 6; z++) {
+      for(y = 30; y <= 40; y++) {
+         for(x = 10; x <= 20; x++) {
+            image[(z * YS + y) * XS + x] = 1000;
+         }
+      }
+   }
+   image[8 * YS * XS] = 50;
+
+   /* Written in several ways; the last one through a data source */
+   for(ii = 0; ii < 4; ii++) {
+      sprintf(suffix, "_%d.ics", ii);
+      test_name(name, argv[2], suffix);
+      sprintf(suffix, "_%d.izm", ii);
+      test_name(zname, argv[2], suffix);
+      write_file(name, modes[ii], compr[ii], 1, ii == 3, image);
+      if(!exists(zname)) {
+         fprintf(stderr, "Zone map %s not written.\n", zname);
+         exit(-1);
+      }
+      /* Lines 24 to 47 of planes 3 to 5 */
+      query(name, image, 9);
+   }
+
+   /* Without zone map all chunks (one per plane) are visited, and a stale
+      one is removed */
+   zmap = read_file(zname, &zsize);
+   write_file(name, "w2", IcsCompr_uncompressed, 0, 0, image);
+   if(exists(zname)) {
+      fprintf(stderr, "Stale zone map %s not removed.\n", zname);
+      exit(-1);
+   }
+   query(name, image, ZS);
+
+   /* A zone map written for an earlier version of the data is ignored */
+   fp = fopen(zname, "wb");
+   if(fp == NULL || fwrite(zmap, 1, zsize, fp) != zsize || fclose(fp) != 0) {
+      fprintf(stderr, "Could not restore zone map %s.\n", zname);
+      exit(-1);
+   }
+   query(name, image, ZS);
+   free(zmap);
+
+   free(image);
+   exit(0);
+}
@@ -0,0 +1 @@
+./test_zonemap $srcdir/test/testim.ics result_zone.ics